@@ -112,22 +112,22 @@ Description:
 
 #include "usb_config.h"             // Must be defined by the application
 
-#include "usb/usb_common.h"         // Common USB library definitions
-#include "usb/usb_ch9.h"            // USB device framework definitions
+#include "USB/usb_common.h"         // Common USB library definitions
+#include "USB/usb_ch9.h"            // USB device framework definitions
 
 #if defined( USB_SUPPORT_DEVICE )
-    #include "usb/usb_device.h"     // USB Device abstraction layer interface
+    #include "USB/usb_device.h"     // USB Device abstraction layer interface
 #endif
 
 #if defined( USB_SUPPORT_HOST )
-    #include "usb/usb_host.h"       // USB Host abstraction layer interface
+    #include "USB/usb_host.h"       // USB Host abstraction layer interface
 #endif
 
 #if defined ( USB_SUPPORT_OTG )
-    #include "usb/usb_otg.h" 
+    #include "USB/usb_otg.h" 
 #endif
 
-#include "usb/usb_hal.h"            // Hardware Abstraction Layer interface
+#include "USB/usb_hal.h"            // Hardware Abstraction Layer interface
 
 // *****************************************************************************
 // *****************************************************************************
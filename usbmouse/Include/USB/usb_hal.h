@@ -89,11 +89,11 @@ Description:
 //DOM-IGNORE-END
 
 #if defined(__18CXX)
-    #include "USB\usb_hal_pic18.h"
+    #include "USB/usb_hal_pic18.h"
 #elif defined(__C30__)
-    #include "USB\usb_hal_pic24.h"
+    #include "USB/usb_hal_pic24.h"
 #elif defined(__PIC32MX__)
-    #include "USB\usb_hal_pic32.h"
+    #include "USB/usb_hal_pic32.h"
 #else
     #error "Silicon Platform not defined"
 #endif
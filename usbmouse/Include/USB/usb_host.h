@@ -107,6 +107,34 @@ Change History
 #endif
 
 
+#ifndef USB_ENDPOINT_LATENCY_BINS
+    #define USB_ENDPOINT_LATENCY_BINS   8   // Define how many bins the transfer latency
+                                            // histogram of each endpoint has, if
+                                            // USB_ENABLE_ENDPOINT_STATISTICS is defined.
+#endif
+
+
+#ifndef USB_CAPTURE_RECORDS
+    #define USB_CAPTURE_RECORDS         64  // Define how many records the traffic capture
+                                            // ring holds, if USB_ENABLE_TRAFFIC_CAPTURE
+                                            // is defined.  Must be a power of two.
+#endif
+
+#ifndef USB_CAPTURE_DATA_SIZE
+    #define USB_CAPTURE_DATA_SIZE       8   // Define how many bytes of each packet are
+                                            // captured.  Keep it a multiple of 4.
+#endif
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE ) && !defined( USB_CAPTURE_TIMESTAMP )
+    #if defined( __PIC32MX__ )
+        #define USB_CAPTURE_TIMESTAMP()         ReadCoreTimer()         // Time stamp of each capture record.
+        #define USB_CAPTURE_TICKS_PER_SECOND    (GetSystemClock() / 2)  // Rate of USB_CAPTURE_TIMESTAMP().
+    #else
+        #error Define USB_CAPTURE_TIMESTAMP() and USB_CAPTURE_TICKS_PER_SECOND to use USB_ENABLE_TRAFFIC_CAPTURE.
+    #endif
+#endif
+
+
 #ifndef USB_INITIAL_VBUS_CURRENT
     #error The application must define USB_INITIAL_VBUS_CURRENT as 100 mA for Host or 8-100 mA for OTG.
 #endif
@@ -273,6 +301,121 @@ typedef struct _USB_TPL
     } flags;                                    //
 } USB_TPL;
 
+
+// *****************************************************************************
+/* Timing Profile
+
+This structure holds the waits the host makes while it brings up a newly
+attached device.  Each value is a count of 1 ms timer ticks.  The first tick
+comes at an arbitrary point in the first millisecond, so a count of (n+1)
+waits at least n ms.  The defaults are USB_INSERT_TIME, USB_RESET_TIME and
+USB_RESET_RECOVERY_TIME.  See USBHostSetTimingProfile().
+*/
+
+typedef struct _USB_TIMING_PROFILE
+{
+    WORD    insertTime;                 // Insertion debounce before the first reset (USB 2.0 minimum 100 ms).
+    WORD    resetTime;                  // Length of the bus reset (USB 2.0 root port minimum 50 ms).
+    WORD    resetRecoveryTime;          // Wait after the reset before the first SETUP (USB 2.0 minimum 10 ms).
+} USB_TIMING_PROFILE;
+
+
+// *****************************************************************************
+/* Enumeration Telemetry
+
+This structure records when each phase of the most recent enumeration
+finished, in milliseconds since the device attached.  A value of 0 means the
+phase has not been reached yet.  The time base counts 1 ms timer ticks
+during the insertion and reset waits and SOFs after that, so it has a
+resolution of 1 ms.  It is available only if USB_ENABLE_ENUMERATION_TELEMETRY
+is defined.  See USBHostEnumerationTelemetry().
+*/
+
+typedef struct _USB_ENUMERATION_TELEMETRY
+{
+    WORD    settled;                    // Insertion debounce finished.
+    WORD    reset;                      // Bus reset and reset recovery finished.
+    WORD    deviceDescriptor;           // Device Descriptor read.
+    WORD    addressed;                  // SET_ADDRESS finished.
+    WORD    configDescriptors;          // Configuration Descriptors read, or restored from the enumeration cache.
+    WORD    configured;                 // SET_CONFIGURATION finished.
+    WORD    running;                    // Client drivers initialized.
+    WORD    firstData;                  // First data received from a non-control endpoint.
+    BYTE    resets;                     // Bus resets issued, including enumeration retries.
+} USB_ENUMERATION_TELEMETRY;
+
+
+// *****************************************************************************
+/* Event Queue Statistics
+
+This structure holds the counters of the queue that passes transfer events
+from the USB interrupt to USBHostTasks().  It is available only if
+USB_ENABLE_TRANSFER_EVENT is defined.  See USBHostEventQueueStatistics().
+*/
+
+typedef struct _USB_EVENT_QUEUE_STATISTICS
+{
+    WORD    deferred;                   // Completions held back because the queue was full.
+    WORD    dropped;                    // Isochronous events lost because the queue was full.
+    BYTE    highWater;                  // Most events ever waiting in the queue.
+} USB_EVENT_QUEUE_STATISTICS;
+
+
+// *****************************************************************************
+/* Endpoint Statistics
+
+This structure holds the transfer statistics of one endpoint.  Transactions
+and bytes count the packets that moved data.  NAKs, STALLs and errors count
+the handshakes and bus errors of every transaction attempt.  The latency
+histogram counts finished transfers (except isochronous) by the number of
+SOFs between the submission of the transfer and its completion: bin 0 is
+the same frame, bin n is 2^(n-1) to 2^n - 1 frames, and the last bin also
+holds anything longer.  The structure is kept only if
+USB_ENABLE_ENDPOINT_STATISTICS is defined.  See USBHostEndpointStatistics().
+*/
+
+typedef struct _USB_ENDPOINT_STATISTICS
+{
+    DWORD   transfers;                  // Transfers finished, with or without an error.
+    DWORD   transactions;               // Transactions that were ACKed or returned data.
+    DWORD   bytes;                      // Bytes moved by those transactions.
+    DWORD   naks;                       // NAK handshakes.
+    WORD    stalls;                     // STALL handshakes.
+    WORD    errors;                     // Bus errors: timeouts, CRC, bit stuffing, bad PID or data toggle.
+    WORD    maxLatency;                 // Longest transfer, in frames.
+    WORD    latency[USB_ENDPOINT_LATENCY_BINS]; // Transfers by latency in frames (see above).
+} USB_ENDPOINT_STATISTICS;
+
+
+// *****************************************************************************
+/* Traffic Capture Record
+
+The host can keep a ring of the last USB_CAPTURE_RECORDS transactions, as a
+flight recorder for problems in the field, if USB_ENABLE_TRAFFIC_CAPTURE is
+defined.  Each transaction makes two records: a USB_CAPTURE_TOKEN record
+when the token is given to the SIE, and a USB_CAPTURE_RESULT record when it
+finishes.  The data of SETUP and OUT packets is in the token record, and the
+data of IN packets is in the result record.  The Tools/usb_capture_pcap.c
+program converts a dump of the records into a usbmon pcap file for
+Wireshark.  See USBHostCaptureRecord().
+*/
+
+#define USB_CAPTURE_TOKEN               'S'     // Token handed to the SIE.
+#define USB_CAPTURE_RESULT              'C'     // Token finished, with a handshake, data or a bus error.
+
+typedef struct _USB_CAPTURE_RECORD
+{
+    DWORD   time;                       // USB_CAPTURE_TIMESTAMP() when the record was made.
+    BYTE    event;                      // USB_CAPTURE_TOKEN or USB_CAPTURE_RESULT.
+    BYTE    transferType;               // USB_TRANSFER_TYPE_... of the endpoint.
+    BYTE    address;                    // Device address.
+    BYTE    endpoint;                   // Endpoint number, with bit 7 set for an IN token.
+    BYTE    pid;                        // Token: USB_TOKEN_SETUP, _IN or _OUT.  Result: PID from the BDT, 0 for a bus error.
+    BYTE    error;                      // Result of a bus error: U1EIR.  Otherwise 0.
+    WORD    length;                     // Bytes in the packet.
+    BYTE    data[USB_CAPTURE_DATA_SIZE];    // The first bytes of the packet.
+} USB_CAPTURE_RECORD;
+
 // Section: TPL Initializers
 #define INIT_VID_PID(v,p)   {((v)|((p)<<16))}           // Set VID/PID support in the TPL.
 #define INIT_CL_SC_P(c,s,p) {((c)|((s)<<8)|((p)<<16))}  // Set class support in the TPL (non-OTG only).
@@ -455,6 +598,134 @@ extern CLIENT_DRIVER_TABLE  usbClientDrvTable[];                // Application's
 // *****************************************************************************
 // *****************************************************************************
 
+/****************************************************************************
+  Function:
+    WORD USBHostArenaHighWater( void )
+
+  Summary:
+    This function returns the most enumeration arena space ever used.
+
+  Description:
+    This function returns the largest number of bytes that have been in use
+    in the enumeration arena at one time since power up.  It can be used to
+    tune USB_HOST_ARENA_SIZE for the devices that will be attached.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Arena high-water mark, in bytes
+
+  Remarks:
+    This function is available only if USB_HOST_ARENA_SIZE is defined.
+  ***************************************************************************/
+
+#if defined( USB_HOST_ARENA_SIZE )
+WORD    USBHostArenaHighWater( void );
+#endif
+
+
+/****************************************************************************
+  Function:
+    DWORD USBHostCaptureCount( void )
+
+  Summary:
+    This function returns the number of traffic capture records made.
+
+  Description:
+    This function returns the number of records that have been added to the
+    traffic capture ring since the host was initialized.  The ring holds the
+    last USB_CAPTURE_RECORDS of them, so the records that can still be read
+    with USBHostCaptureRecord() are those from
+    count - USB_CAPTURE_RECORDS (or 0) up to count - 1.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Number of records made
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRAFFIC_CAPTURE is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+DWORD   USBHostCaptureCount( void );
+#endif
+
+
+/****************************************************************************
+  Function:
+    void USBHostCaptureEnable( BOOL enable )
+
+  Summary:
+    This function starts or stops the traffic capture.
+
+  Description:
+    This function starts or stops adding records to the traffic capture
+    ring.  Capture is on after USBHostInit().  The application should stop
+    it while it reads the ring, so that the records it is reading are not
+    overwritten, and start it again afterwards.
+
+  Precondition:
+    None
+
+  Parameters:
+    BOOL enable - TRUE to capture, FALSE to stop
+
+  Returns:
+    None
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRAFFIC_CAPTURE is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+void    USBHostCaptureEnable( BOOL enable );
+#endif
+
+
+/****************************************************************************
+  Function:
+    BOOL USBHostCaptureRecord( DWORD sequence, USB_CAPTURE_RECORD *pRecord )
+
+  Summary:
+    This function copies a record from the traffic capture ring.
+
+  Description:
+    This function copies the record with the given sequence number from the
+    traffic capture ring.  Records are numbered from 0 in the order they
+    were made.  See USBHostCaptureCount().
+
+  Precondition:
+    None
+
+  Parameters:
+    DWORD sequence              - Sequence number of the record
+    USB_CAPTURE_RECORD *pRecord - Copy of the record
+
+  Return Values:
+    TRUE    - The record was copied.
+    FALSE   - The record has not been made yet, or has been overwritten.
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRAFFIC_CAPTURE is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+BOOL    USBHostCaptureRecord( DWORD sequence, USB_CAPTURE_RECORD *pRecord );
+#endif
+
+
 /****************************************************************************
   Function:
     BYTE USBHostClearEndpointErrors( BYTE deviceAddress, BYTE endpoint )
@@ -576,6 +847,119 @@ BOOL    USBHostDeviceSpecificClientDriver( BYTE deviceAddress );
 BYTE    USBHostDeviceStatus( BYTE deviceAddress );
 
 
+/****************************************************************************
+  Function:
+    BYTE USBHostEndpointStatistics( BYTE deviceAddress, BYTE endpoint,
+                USB_ENDPOINT_STATISTICS *pStatistics, BOOL clear )
+
+  Summary:
+    This function returns the transfer statistics of an endpoint.
+
+  Description:
+    This function copies the transfer statistics of an endpoint of an
+    attached device, and optionally clears them.  The counts separate time
+    spent waiting on the device (NAKs), on the bus (errors and retries) and
+    in the host's own scheduling (latency with few NAKs), which helps find
+    the cause of a slow or jerky device.
+
+  Precondition:
+    None
+
+  Parameters:
+    BYTE deviceAddress                  - Device address
+    BYTE endpoint                       - Endpoint address, or 0 for EP0
+    USB_ENDPOINT_STATISTICS *pStatistics - Copy of the statistics.  May be
+                                            NULL if only clearing.
+    BOOL clear                          - Clear the statistics after the
+                                            copy is taken
+
+  Return Values:
+    USB_SUCCESS             - The statistics were returned
+    USB_UNKNOWN_DEVICE      - Device not found
+    USB_ENDPOINT_NOT_FOUND  - Invalid endpoint
+
+  Remarks:
+    This function is available only if USB_ENABLE_ENDPOINT_STATISTICS is
+    defined.  The statistics start from zero each time the device
+    enumerates.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+BYTE    USBHostEndpointStatistics( BYTE deviceAddress, BYTE endpoint, USB_ENDPOINT_STATISTICS *pStatistics, BOOL clear );
+#endif
+
+
+/****************************************************************************
+  Function:
+    const USB_ENUMERATION_TELEMETRY * USBHostEnumerationTelemetry( void )
+
+  Summary:
+    This function returns the phase timestamps of the most recent
+    enumeration.
+
+  Description:
+    This function returns a pointer to the telemetry of the most recent
+    enumeration.  Each field is the time, in milliseconds since the device
+    attached, that a phase of the enumeration finished.  The record is
+    cleared when a device attaches, and fields are filled in as the phases
+    finish.  The application can use it to see where enumeration time goes
+    before shortening the waits with USBHostSetTimingProfile().
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Pointer to the enumeration telemetry
+
+  Remarks:
+    This function is available only if USB_ENABLE_ENUMERATION_TELEMETRY is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+const USB_ENUMERATION_TELEMETRY * USBHostEnumerationTelemetry( void );
+#endif
+
+
+/****************************************************************************
+  Function:
+    const USB_EVENT_QUEUE_STATISTICS * USBHostEventQueueStatistics( void )
+
+  Summary:
+    This function returns the counters of the transfer event queue.
+
+  Description:
+    This function returns a pointer to the counters of the queue that passes
+    transfer events from the USB interrupt to USBHostTasks().  If the queue
+    is full when a control, interrupt or bulk transfer finishes, the host
+    holds the completion and reports it on a later pass; these are counted
+    as deferred.  Isochronous events that find the queue full are dropped.
+    A high water mark that reaches USB_EVENT_QUEUE_DEPTH, or a growing
+    deferred count, means that USBHostTasks() is not called often enough
+    for the load, or that the queue should be deeper.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Pointer to the event queue statistics
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRANSFER_EVENT is
+    defined.  The counters saturate at their maximum values.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRANSFER_EVENT )
+const USB_EVENT_QUEUE_STATISTICS * USBHostEventQueueStatistics( void );
+#endif
+
+
 /****************************************************************************
   Function:
     BYTE * USBHostGetCurrentConfigurationDescriptor( BYTE deviceAddress )
@@ -884,6 +1268,69 @@ BYTE    USBHostIssueDeviceRequest( BYTE deviceAddress, BYTE bmRequestType, BYTE
              BYTE clientDriverID );
 
 
+/****************************************************************************
+  Function:
+    BYTE USBHostIssueStreamedDeviceRequest( BYTE deviceAddress,
+                    BYTE bmRequestType, BYTE bRequest, WORD wValue,
+                    WORD wIndex, WORD wLength, BYTE *window, WORD windowSize,
+                    BYTE clientDriverID )
+
+  Summary:
+    This function sends a device request that reads its data through a
+    small window instead of into a buffer the size of the data.
+
+  Description:
+    This function sends a device request that gets wLength bytes from the
+    device, like USBHostIssueDeviceRequest() with USB_DEVICE_REQUEST_GET.
+    The data is written round the window as it arrives.  The caller reads
+    it with USBHostStreamPeek() and frees the space with
+    USBHostStreamConsume() while the transfer runs.  The host does not ask
+    the device for the next packet until the window has room for it, so no
+    data is lost if the caller falls behind.
+
+    The transfer completes the same way as one started with
+    USBHostIssueDeviceRequest().  Data still in the window when it completes
+    can be read until the next request on EP0 is issued.
+
+  Precondition:
+    The host state machine should be in the running state, and no reads or
+    writes to EP0 should be in progress.
+
+  Parameters:
+    BYTE deviceAddress  - Device address
+    BYTE bmRequestType  - The request type as defined by the USB
+                            specification.
+    BYTE bRequest       - The request as defined by the USB specification.
+    WORD wValue         - The value for the request as defined by the USB
+                            specification.
+    WORD wIndex         - The index for the request as defined by the USB
+                            specification.
+    WORD wLength        - The data length for the request as defined by the
+                            USB specification.
+    BYTE *window        - Buffer the data passes through
+    WORD windowSize     - Size of the window.  Must be a multiple of the
+                            maximum packet size of EP0.
+    BYTE clientDriverID - Client driver to send the event to.
+
+  Return Values:
+    USB_SUCCESS                 - Request processing started
+    USB_UNKNOWN_DEVICE          - Device not found
+    USB_ILLEGAL_REQUEST         - The window size is not a multiple of the
+                                    maximum packet size of EP0
+    Others                      - See USBHostIssueDeviceRequest()
+
+  Remarks:
+    This function is available only if USB_ENABLE_CONTROL_READ_STREAM is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+BYTE    USBHostIssueStreamedDeviceRequest( BYTE deviceAddress, BYTE bmRequestType, BYTE bRequest,
+             WORD wValue, WORD wIndex, WORD wLength, BYTE *window, WORD windowSize,
+             BYTE clientDriverID );
+#endif
+
+
 /****************************************************************************
   Function:
     BYTE USBHostRead( BYTE deviceAddress, BYTE endpoint, BYTE *pData,
@@ -1147,6 +1594,38 @@ BYTE USBHostSetDeviceConfiguration( BYTE deviceAddress, BYTE configuration );
 BYTE USBHostSetNAKTimeout( BYTE deviceAddress, BYTE endpoint, WORD flags, WORD timeoutCount );
 
 
+/****************************************************************************
+  Function:
+    BYTE USBHostSetTimingProfile( const USB_TIMING_PROFILE *pProfile )
+
+  Summary:
+    This function sets the insertion, reset and reset recovery waits.
+
+  Description:
+    This function sets the waits the host makes after a device attaches.
+    Applications whose devices are known to settle quickly can shorten the
+    waits to bring the device up sooner.  Values below the USB 2.0 minimums
+    are rejected.  Passing NULL restores the defaults.
+
+  Precondition:
+    None
+
+  Parameters:
+    const USB_TIMING_PROFILE *pProfile - New waits, or NULL for the defaults
+
+  Return Values:
+    USB_SUCCESS         - The profile will be used from the next attach
+    USB_ILLEGAL_REQUEST - A value is below its USB 2.0 minimum; the profile
+                            is unchanged
+
+  Remarks:
+    The profile is not used for the enumeration in progress, if any.  Use
+    USBHostEnumerationTelemetry() to measure the effect of a new profile.
+  ***************************************************************************/
+
+BYTE USBHostSetTimingProfile( const USB_TIMING_PROFILE *pProfile );
+
+
 /****************************************************************************
   Function:
     void USBHostShutdown( void )
@@ -1175,6 +1654,75 @@ BYTE USBHostSetNAKTimeout( BYTE deviceAddress, BYTE endpoint, WORD flags, WORD t
 void    USBHostShutdown( void );
 
 
+/****************************************************************************
+  Function:
+    void USBHostStreamConsume( BYTE deviceAddress, WORD length )
+
+  Summary:
+    This function frees data of a streamed device request that the caller
+    has read.
+
+  Description:
+    This function frees the first length bytes returned by
+    USBHostStreamPeek(), so that the window has room for more data from the
+    device.
+
+  Precondition:
+    USBHostIssueStreamedDeviceRequest() has been called.
+
+  Parameters:
+    BYTE deviceAddress  - Device address
+    WORD length         - Number of bytes read.  Must not be more than
+                            USBHostStreamPeek() returned.
+
+  Returns:
+    None
+
+  Remarks:
+    This function is available only if USB_ENABLE_CONTROL_READ_STREAM is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+void    USBHostStreamConsume( BYTE deviceAddress, WORD length );
+#endif
+
+
+/****************************************************************************
+  Function:
+    WORD USBHostStreamPeek( BYTE deviceAddress, BYTE **ppData )
+
+  Summary:
+    This function returns the data of a streamed device request that has
+    arrived and not been read yet.
+
+  Description:
+    This function returns the data of a streamed device request that has
+    arrived and has not been freed with USBHostStreamConsume().  The data is
+    returned in one piece up to the end of the window; the rest is returned
+    by the next call, once this piece has been consumed.
+
+  Precondition:
+    USBHostIssueStreamedDeviceRequest() has been called.
+
+  Parameters:
+    BYTE deviceAddress  - Device address
+    BYTE **ppData       - Set to the first unread byte
+
+  Returns:
+    The number of bytes at *ppData.  0 if there are none, or if the last
+    request on EP0 was not streamed.
+
+  Remarks:
+    This function is available only if USB_ENABLE_CONTROL_READ_STREAM is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+WORD    USBHostStreamPeek( BYTE deviceAddress, BYTE **ppData );
+#endif
+
+
 /****************************************************************************
   Function:
     BYTE USBHostSuspendDevice( BYTE deviceAddress )
@@ -44,6 +44,17 @@ extra RAM.
 Since HID transfers are performed with interrupt taransfers, 
 USB_SUPPORT_INTERRUPT_TRANSFERS must be defined.
 
+If USB_HID_ENABLE_REPORT_PIPELINE is defined (which requires
+USB_ENABLE_TRANSFER_EVENT), the driver keeps a read permanently armed on the
+interrupt IN endpoint of the first interface once the device is running.
+Each completed report is queued in a small per-device ring
+(USB_HID_PIPELINE_DEPTH entries) and announced with EVENT_HID_RPT_RECEIVED,
+and the read is re-armed from the same transfer event.  The application
+collects reports with USBHostHIDPipelineGetReport() instead of issuing
+USBHostHIDRead() for every report.  If the ring is full the read is left
+unarmed until a report is removed, so the device NAKs instead of reports
+being dropped.
+
 Summary:
     This is the header file for a USB Embedded Host that is Human Interface
     Device Class .
@@ -176,6 +187,10 @@ Change History:
     // An error occurred while trying to do a HID reset.  The returned data pointer 
     // is NULL.
 #define EVENT_HID_RESET_ERROR               EVENT_HID_BASE + EVENT_HID_OFFSET + 10   
+    // A report was received on the pipelined interrupt IN endpoint and queued
+    // (USB_HID_ENABLE_REPORT_PIPELINE only).  The returned data pointer points
+    // to the queued HID_PIPELINE_REPORT.
+#define EVENT_HID_RPT_RECEIVED              EVENT_HID_BASE + EVENT_HID_OFFSET + 11   
 
 
 
@@ -222,6 +237,113 @@ This defines the data type required to hold the maximum field size data.
 #endif
 
 
+// *****************************************************************************
+/* HID Import Program
+
+USBHostHID_ApiCompileImport() turns a set of HID_DATA_DETAILS into this
+program when USB_HID_ENABLE_IMPORT_PROGRAM is defined, normally while the
+application handles EVENT_HID_RPT_DESC_PARSED.  Each operation extracts one
+field: it loads the bytes the field spans, shifts the field down to bit 0,
+masks it, and sign extends it.  USBHostHID_ApiImportReport() then runs the
+whole program over each report in a single pass, without recomputing the
+field positions.  USB_HID_IMPORT_MAX_FIELDS limits the number of fields
+(the sum of the counts of the data details) in one program.
+*/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+    #ifndef USB_HID_IMPORT_MAX_FIELDS
+        #define USB_HID_IMPORT_MAX_FIELDS       16      // Fields extracted per report
+    #endif
+
+    typedef struct _HID_IMPORT_OP
+    {
+        WORD                byteOffset;         // First byte of the field in the report.
+        BYTE                byteCount;          // Number of bytes the field spans (1-5).
+        BYTE                shift;              // Bit position of the field in its first byte.
+        DWORD               mask;               // Mask of the field after the shift.
+        DWORD               signBit;            // Sign bit of the field, or 0 if not sign extended.
+    } HID_IMPORT_OP;
+
+    typedef struct _HID_IMPORT_PROGRAM
+    {
+        WORD                reportLength;       // Expected length of the report.
+        WORD                reportID;           // Report ID - the first byte of the report, or 0.
+        BYTE                fields;             // Number of operations in the program.
+        HID_IMPORT_OP       op[USB_HID_IMPORT_MAX_FIELDS];
+    } HID_IMPORT_PROGRAM;
+#endif
+
+
+// *****************************************************************************
+/* HID Report Routing Table
+
+USBHostHID_ApiBuildRoutes() builds this table from the parsed report
+descriptor when USB_HID_ENABLE_REPORT_ROUTING is defined.  A route connects
+the input fields of one report ID that belong to one top level (application)
+collection, such as the mouse or the keyboard of a wireless receiver, to the
+handler the application registered for that collection's usage.  The fields
+of each route are compiled into import operations, so
+USBHostHID_ApiRouteReport() finds the routes of a report by indexing
+firstRoute[] with its report ID, decodes all their fields in one pass, and
+calls each handler with the fields and their usages.
+
+Report IDs above USB_HID_ROUTE_MAX_REPORT_ID are not routed.  The table holds
+at most USB_HID_MAX_ROUTES routes and USB_HID_ROUTE_MAX_FIELDS fields.
+*/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+    #ifndef USB_HID_ENABLE_IMPORT_PROGRAM
+        #error "USB_HID_ENABLE_REPORT_ROUTING requires USB_HID_ENABLE_IMPORT_PROGRAM"
+    #endif
+    #ifndef USB_HID_ROUTE_MAX_REPORT_ID
+        #define USB_HID_ROUTE_MAX_REPORT_ID     15      // Highest report ID routed
+    #endif
+    #ifndef USB_HID_MAX_ROUTES
+        #define USB_HID_MAX_ROUTES              4       // Report ID and collection pairs
+    #endif
+    #ifndef USB_HID_ROUTE_MAX_FIELDS
+        #define USB_HID_ROUTE_MAX_FIELDS        32      // Fields of all routes
+    #endif
+
+    #define USB_HID_NO_ROUTE                    0xFF    // firstRoute[] entry of an unrouted report ID
+
+    typedef struct _HID_ROUTE_FIELD
+    {
+        WORD                usagePage;          // Usage page of the field.
+        WORD                usage;              // Usage of a variable field, or the first usage of an array field.
+        BYTE                dataModes;          // Main item data bits (HIDData_Variable, HIDData_Relative...).
+    } HID_ROUTE_FIELD;
+
+    typedef void (*HID_ROUTE_HANDLER)( BYTE reportID, const HID_ROUTE_FIELD *pFields,
+                                       const HID_USER_DATA_SIZE *pValues, BYTE count );
+
+    typedef struct _HID_ROUTE_APPLICATION
+    {
+        WORD                usagePage;          // Usage page of the application collection.
+        WORD                usage;              // Usage of the application collection.
+        HID_ROUTE_HANDLER   handler;            // Called with the collection's fields of each report.
+    } HID_ROUTE_APPLICATION;
+
+    typedef struct _HID_ROUTE
+    {
+        HID_ROUTE_HANDLER   handler;            // Handler of the collection.
+        WORD                reportLength;       // Length of the report, including the report ID.
+        BYTE                reportID;           // Report ID, or 0 if the device does not use them.
+        BYTE                firstField;         // Index of the first field of the route.
+        BYTE                fields;             // Number of fields of the route.
+    } HID_ROUTE;
+
+    typedef struct _HID_ROUTE_TABLE
+    {
+        BYTE                firstRoute[USB_HID_ROUTE_MAX_REPORT_ID + 1];    // Routes of a report ID are consecutive.
+        BOOL                reportIDs;          // Reports start with a report ID.
+        BYTE                routes;             // Number of routes.
+        BYTE                fields;             // Number of fields.
+        HID_ROUTE           route[USB_HID_MAX_ROUTES];
+        HID_ROUTE_FIELD     field[USB_HID_ROUTE_MAX_FIELDS];
+        HID_IMPORT_OP       op[USB_HID_ROUTE_MAX_FIELDS];
+    } HID_ROUTE_TABLE;
+#endif
+
+
 // *****************************************************************************
 /* HID Device ID Information
 
@@ -250,6 +372,72 @@ typedef struct _HID_TRANSFER_DATA
 } HID_TRANSFER_DATA;
 
 
+// *****************************************************************************
+/* HID Pipelined Report
+
+This structure holds one report received on the pipelined interrupt IN
+endpoint when USB_HID_ENABLE_REPORT_PIPELINE is defined.  The SIE writes the
+report directly into the queue entry.  USB_HID_PIPELINE_REPORT_SIZE must be at
+least the largest input report of the supported devices.
+*/
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+    #ifndef USB_HID_PIPELINE_DEPTH
+        #define USB_HID_PIPELINE_DEPTH          4       // Reports queued per device
+    #endif
+    #ifndef USB_HID_PIPELINE_REPORT_SIZE
+        #define USB_HID_PIPELINE_REPORT_SIZE    8       // Boot protocol report size
+    #endif
+
+    typedef struct _HID_PIPELINE_REPORT
+    {
+        BYTE                interfaceNum;       // Interface the report was read from.
+        BYTE                length;             // Count of bytes received.
+        BYTE                data[USB_HID_PIPELINE_REPORT_SIZE];
+    } HID_PIPELINE_REPORT;
+#endif
+
+
+// *****************************************************************************
+/* HID Streamed Report Descriptor
+
+When USB_HID_STREAM_REPORT_DESCRIPTOR is defined the report descriptor is not
+read into a buffer of its full size.  The host reads it into a window of
+USB_HID_REPORT_DESCRIPTOR_WINDOW bytes (a multiple of the endpoint 0 packet
+size) and the driver feeds the parser from the window while the transfer is
+still running, so descriptors of any length are parsed with no heap.  This
+requires USB_ENABLE_CONTROL_READ_STREAM in the host layer.
+*/
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+    #ifndef USB_ENABLE_CONTROL_READ_STREAM
+        #error "USB_HID_STREAM_REPORT_DESCRIPTOR requires USB_ENABLE_CONTROL_READ_STREAM"
+    #endif
+    #ifndef USB_HID_REPORT_DESCRIPTOR_WINDOW
+        #define USB_HID_REPORT_DESCRIPTOR_WINDOW    64      // Bytes of descriptor buffered
+    #endif
+#endif
+
+
+// *****************************************************************************
+/* HID Report Descriptor Cache
+
+If USB_HID_REPORT_CACHE_ENTRIES is defined, the driver keeps the parsed report
+descriptor of the last few interfaces, keyed by the VID, PID and bcdDevice of
+the device and the number and report descriptor length of the interface.
+When an interface with a matching key is initialized, the parse is restored
+and EVENT_HID_RPT_DESC_PARSED is sent without reading or parsing the report
+descriptor again, so the application rebuilds its HID_DATA_DETAILS from the
+same parser output.  Parses longer than USB_HID_REPORT_CACHE_SIZE bytes are
+not cached.  An entry is removed when it is used and stored again when the
+application accepts the parse, so an interface whose cached parse is
+rejected is read and parsed in full on the next attempt.
+*/
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+    #ifndef USB_HID_REPORT_CACHE_SIZE
+        #define USB_HID_REPORT_CACHE_SIZE           512     // Largest parse that is cached
+    #endif
+#endif
+
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: Function Prototypes 
@@ -311,6 +499,38 @@ BOOL USBHostHIDDeviceDetect( BYTE deviceAddress );
 *******************************************************************************/
 BYTE    USBHostHIDDeviceStatus( BYTE deviceAddress );
 
+/*******************************************************************************
+  Function:
+    BOOL USBHostHIDPipelineGetReport( BYTE deviceAddress,
+                HID_PIPELINE_REPORT *report )
+
+  Summary:
+    This function removes the oldest pipelined report from the queue.
+
+  Description:
+    This function copies the oldest report received on the pipelined interrupt
+    IN endpoint into the caller's buffer and removes it from the queue.
+
+  Precondition:
+    USB_HID_ENABLE_REPORT_PIPELINE is defined.
+
+  Parameters:
+    BYTE deviceAddress          - Device address
+    HID_PIPELINE_REPORT *report - Buffer to receive the report
+
+  Return Values:
+    TRUE    - A report was copied to the buffer
+    FALSE   - No device with specified address, or no report is queued
+
+  Remarks:
+    While the pipeline is armed, USBHostHIDRead() on the same interface
+    returns USB_ENDPOINT_BUSY.  Reports are queued from the transfer event,
+    so USBTasks() must be called for the queue to fill.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+    BOOL USBHostHIDPipelineGetReport( BYTE deviceAddress, HID_PIPELINE_REPORT *report );
+#endif
+
 /*******************************************************************************
   Function:
     BYTE USBHostHIDRead( BYTE deviceAddress,BYTE reportid, BYTE interface, 
@@ -524,6 +744,78 @@ BOOL    USBHostHIDTransferIsComplete( BYTE deviceAddress, BYTE *errorCode, BYTE
 #define USBHostHIDWrite( address,reportid,interface,size,data) \
                USBHostHIDTransfer( address,0,interface,reportid,size,data)
 
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiBuildRoutes(HID_ROUTE_TABLE *pTable,
+                const HID_ROUTE_APPLICATION *pApplications, BYTE applications)
+
+  Description:
+    This function builds a report routing table from the report descriptor
+    that has just been parsed.  Each input report is split by the top level
+    collection its fields belong to, and every part whose collection usage
+    is in pApplications becomes a route to that collection's handler.
+    Constant (padding) fields are left out.  The table is normally built
+    while handling EVENT_HID_RPT_DESC_PARSED.
+
+  Precondition:
+    The report descriptor has been parsed.
+
+  Parameters:
+    HID_ROUTE_TABLE *pTable                     - Table to build
+    const HID_ROUTE_APPLICATION *pApplications  - Collections the application
+                                                  handles
+    BYTE applications                           - Number of collections
+
+  Return Values:
+    TRUE    - At least one route was built
+    FALSE   - The device has none of the collections, or the routes do not
+              fit the table.
+
+  Remarks:
+    This function is available only if USB_HID_ENABLE_REPORT_ROUTING is
+    defined.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+BOOL USBHostHID_ApiBuildRoutes(HID_ROUTE_TABLE *pTable, const HID_ROUTE_APPLICATION *pApplications, BYTE applications);
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiCompileImport(HID_IMPORT_PROGRAM *pProgram,
+                          HID_DATA_DETAILS **ppDataDetails, BYTE detailCount)
+
+  Description:
+    This function compiles a set of data details into an import program for
+    USBHostHID_ApiImportReport().  The fields of the data details are
+    extracted in the order given, so the fields of ppDataDetails[0] are at
+    the start of the buffer, followed by those of ppDataDetails[1], and so
+    on.  The program is normally compiled while handling
+    EVENT_HID_RPT_DESC_PARSED, once the data details have been filled in.
+
+  Precondition:
+    None
+
+  Parameters:
+    HID_IMPORT_PROGRAM *pProgram    - Program to compile
+    HID_DATA_DETAILS **ppDataDetails- Data details of the fields to extract
+    BYTE detailCount                - Number of data details
+
+  Return Values:
+    TRUE    - The program was compiled
+    FALSE   - The data details are for different reports, a field lies
+              outside the report or is wider than 32 bits, or there are
+              more than USB_HID_IMPORT_MAX_FIELDS fields.
+
+  Remarks:
+    This function is available only if USB_HID_ENABLE_IMPORT_PROGRAM is
+    defined.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+BOOL USBHostHID_ApiCompileImport(HID_IMPORT_PROGRAM *pProgram, HID_DATA_DETAILS **ppDataDetails, BYTE detailCount);
+#endif
+
+
 /*******************************************************************************
   Function:
     BOOL USBHostHID_ApiFindBit(WORD usagePage,WORD usage,HIDReportTypeEnum type,
@@ -704,6 +996,71 @@ BYTE USBHostHID_ApiGetCurrentInterfaceNum(void);
 BOOL USBHostHID_ApiImportData(BYTE *report,WORD reportLength,HID_USER_DATA_SIZE *buffer, HID_DATA_DETAILS *pDataDetails);;
 
 
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiImportReport(BYTE *report, WORD reportLength,
+                     HID_USER_DATA_SIZE *buffer, HID_IMPORT_PROGRAM *pProgram)
+  Description:
+    This function extracts all the fields of an import program from an input
+    report in one pass.  It gives the same values as calling
+    USBHostHID_ApiImportData() for each of the data details the program was
+    compiled from, with the results placed one after another in the buffer.
+
+  Precondition:
+    USBHostHID_ApiCompileImport() has compiled the program.
+
+  Parameters:
+    BYTE *report                    - Input report received from device
+    WORD reportLength               - Length of input report
+    HID_USER_DATA_SIZE *buffer      - Buffer into which data needs to be
+                                      populated, pProgram->fields entries
+    HID_IMPORT_PROGRAM *pProgram    - Compiled import program
+
+  Return Values:
+    TRUE    - If the data is retrieved from the report
+    FALSE   - If the report is not the one the program was compiled for.
+
+  Remarks:
+    This function is available only if USB_HID_ENABLE_IMPORT_PROGRAM is
+    defined.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+BOOL USBHostHID_ApiImportReport(BYTE *report, WORD reportLength, HID_USER_DATA_SIZE *buffer, HID_IMPORT_PROGRAM *pProgram);
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiRouteReport(HID_ROUTE_TABLE *pTable, BYTE *report,
+                     WORD reportLength)
+  Description:
+    This function passes an input report to the handlers of its routes.
+    The routes are found by indexing the table with the report ID, so the
+    cost does not grow with the number of reports the device has.  All the
+    fields of the routes are decoded in one pass before the handlers are
+    called.
+
+  Precondition:
+    USBHostHID_ApiBuildRoutes() has built the table.
+
+  Parameters:
+    HID_ROUTE_TABLE *pTable         - Routing table
+    BYTE *report                    - Input report received from device
+    WORD reportLength               - Length of input report
+
+  Return Values:
+    TRUE    - The report was passed to its handlers
+    FALSE   - The report has no routes, or is not the expected length.
+
+  Remarks:
+    This function is available only if USB_HID_ENABLE_REPORT_ROUTING is
+    defined.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+BOOL USBHostHID_ApiRouteReport(HID_ROUTE_TABLE *pTable, BYTE *report, WORD reportLength);
+#endif
+
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: USB Host Callback Function Prototypes
@@ -793,5 +1150,8 @@ BOOL USBHostHIDEventHandler( BYTE address, USB_EVENT event, void *data, DWORD si
     // This macro provides legacy support for an older API function.
 #define USBHostHID_ApiTransferIsComplete( e, c )    USBHostHIDTransferIsComplete( 1, e, c )
 
+    // This macro provides the pipelined report queue in the same style.
+#define USBHostHID_ApiGetPipelinedReport( r )       USBHostHIDPipelineGetReport( 1, r )
+
 
 #endif
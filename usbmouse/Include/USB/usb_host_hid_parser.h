@@ -189,6 +189,45 @@ Change History:
 #define HIDCollection_Physical     0x00
 #define HIDCollection_Application  0x01
 
+//------------------------------------------------------------------------------
+//
+// Parser Limits
+//
+// The parser keeps the parsed report descriptor in fixed pools of these sizes.
+// A descriptor that needs more is rejected with HID_ERR_NotEnoughMemory.
+//
+//------------------------------------------------------------------------------
+
+#ifndef USB_HID_MAX_COLLECTIONS
+    #define USB_HID_MAX_COLLECTIONS         8       // Collections, plus one for the virtual top level collection
+#endif
+#ifndef USB_HID_MAX_REPORT_ITEMS
+    #define USB_HID_MAX_REPORT_ITEMS        24      // Input, Output and Feature items
+#endif
+#ifndef USB_HID_MAX_REPORTS
+    #define USB_HID_MAX_REPORTS             8       // Report IDs, plus one for the report without an ID
+#endif
+#ifndef USB_HID_MAX_USAGE_ITEMS
+    #define USB_HID_MAX_USAGE_ITEMS         32      // Usages; a Usage Minimum/Maximum pair counts as one
+#endif
+#ifndef USB_HID_MAX_STRING_ITEMS
+    #define USB_HID_MAX_STRING_ITEMS        4       // String indexes and ranges
+#endif
+#ifndef USB_HID_MAX_DESIGNATOR_ITEMS
+    #define USB_HID_MAX_DESIGNATOR_ITEMS    4       // Designator indexes and ranges
+#endif
+#ifndef USB_HID_MAX_COLLECTION_NESTING
+    #define USB_HID_MAX_COLLECTION_NESTING  4       // Depth of nested collections
+#endif
+#ifndef USB_HID_MAX_GLOBALS_NESTING
+    #define USB_HID_MAX_GLOBALS_NESTING     2       // Depth of Push items
+#endif
+
+#if (USB_HID_MAX_COLLECTIONS > 255) || (USB_HID_MAX_REPORT_ITEMS > 255) || (USB_HID_MAX_USAGE_ITEMS > 255) || \
+    (USB_HID_MAX_STRING_ITEMS > 255) || (USB_HID_MAX_DESIGNATOR_ITEMS > 255) || (USB_HID_MAX_REPORTS > 255)
+    #error The parsed report descriptor indexes its pools with a BYTE.
+#endif
+
 
 typedef enum {
     hidReportInput,
@@ -409,7 +448,7 @@ typedef struct _USB_HID_ITEM_LIST
 */
 typedef enum {
     HID_ERR = 0,                        // No error
-    HID_ERR_NotEnoughMemory,            // If not enough Heap can be allocated, make sure sufficient dynamic memory is aloocated for the parser
+    HID_ERR_NotEnoughMemory,            // One of the parser's pools is full, see the USB_HID_MAX_... limits
     HID_ERR_NullPointer,                // Pointer to report descriptor is NULL
     HID_ERR_UnexpectedEndCollection,    // End of collection not expected
     HID_ERR_UnexpectedPop,              // POP not expected
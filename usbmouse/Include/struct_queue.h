@@ -335,6 +335,41 @@
                                      &(q)->buffer[0]              )
 
 
+/* StructQueuePeekHead
+ *************************************************************************
+ * Precondition:    The queue must have been initialized and must not
+ *                  currently be full.
+ *
+ * Input:           q   Pointer to the queue data structure
+ *
+ *                  N   Number of elements in the queue data buffer array
+ *
+ * Output:          None
+ *
+ * Returns:         The item that the next "StructQueueAdd" will return.
+ *
+ * Side Effects:    None
+ *
+ * Overview:        This routine provides access to the free item after
+ *                  the head index position without adding it to the
+ *                  queue, handling buffer wrap correctly.  It allows the
+ *                  item to be filled in place (for example, by DMA)
+ *                  before it is committed with "StructQueueAdd".
+ *
+ * Notes:           The caller must first ensure that the queue is not
+ *                  full by calling one or more of the other operations
+ *                  (such as "StructQueueIsNotFull") before performing this
+ *                  operation.
+ *
+ *                  This operation is implemented with a macro that
+ *                  supports queues of any type of data items.
+ *************************************************************************/
+
+#define StructQueuePeekHead(q,N) ( ((q)->head < (N-1))         ?  \
+                                     &(q)->buffer[(q)->head+1] :  \
+                                     &(q)->buffer[0]              )
+
+
 /* StructQueueIsFull
  *************************************************************************
  * Precondition:    The queue must be initialized.
@@ -58,11 +58,13 @@ CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
 #include "GenericTypeDefs.h"
 #include "HardwareProfile.h"
 #include "usb_config.h"
-#include "USB\usb.h"
-#include "USB\usb_host_hid_parser.h"
-#include "USB\usb_host_hid.h"
+#include "USB/usb.h"
+#include "USB/usb_host_hid_parser.h"
+#include "USB/usb_host_hid.h"
+#include "spi_link.h"
+#include "uart2.h"
 #include <plib.h>
-#include <P32xxxx.h>
+#include <p32xxxx.h>
 
 
 // *****************************************************************************
@@ -81,15 +83,51 @@ typedef enum _APP_STATE
     ERROR_REPORTED 
 } APP_STATE;
 
+// Largest input report the application accepts.  The report size itself is
+// taken from the parsed report descriptor.
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+    #define APPL_MAX_REPORT_SIZE    USB_HID_PIPELINE_REPORT_SIZE
+#else
+    #define APPL_MAX_REPORT_SIZE    64      // Largest full speed interrupt packet
+#endif
+
+// Sign extended axis value as a LONG, for any HID_MAX_DATA_FIELD_SIZE.
+#if (HID_MAX_DATA_FIELD_SIZE <= 8)
+    #define APPL_AXIS_VALUE(d)      ((LONG)(signed char)(d))
+#elif (HID_MAX_DATA_FIELD_SIZE <= 16)
+    #define APPL_AXIS_VALUE(d)      ((LONG)(SHORT)(d))
+#else
+    #define APPL_AXIS_VALUE(d)      ((LONG)(d))
+#endif
+
 typedef struct _HID_REPORT_BUFFER
 {
     WORD  Report_ID;
     WORD  ReportSize;
 //    BYTE* ReportData;
-    BYTE  ReportData[4];
+    BYTE  ReportData[APPL_MAX_REPORT_SIZE];
+    WORD  ReportLength;     // Length of the report in ReportData
     WORD  ReportPollRate;
 }   HID_REPORT_BUFFER;
 
+// Movement decoded from one report by App_MouseReportHandler()
+typedef struct _APP_MOUSE_REPORT
+{
+    LONG  xMvmt;
+    LONG  yMvmt;
+    LONG  wheel;
+    BYTE  buttons;
+    BOOL  updated;
+}   APP_MOUSE_REPORT;
+
+// With report routing a device may send reports of several lengths, each
+// starting with its report ID; ReportSize is then the longest of them.
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+    #define APPL_REPORT_LENGTH_OK(n)    (((n) > 0) && ((n) <= Appl_raw_report_buffer.ReportSize))
+#else
+    #define APPL_REPORT_LENGTH_OK(n)    ((n) == Appl_raw_report_buffer.ReportSize)
+#endif
+
 // *****************************************************************************
 // *****************************************************************************
 // Internal Function Prototypes
@@ -101,9 +139,14 @@ BOOL AppGetParsedReportDetails(void);
 void App_Detect_Device(void);
 BOOL USB_HID_DataCollectionHandler(void);
 
-void App_ProcessInputReport(short *xLoc, short *yLoc);
-void initspi(void);
-long spi_send_receive(long send);
+void App_ProcessInputReport(LONG *xLoc, LONG *yLoc, BYTE *buttons, BYTE *wheel);
+void App_DrawLabels(void);
+void App_ConsoleTasks(void);
+void App_DumpEndpointStatistics(void);
+void App_DumpCapture(void);
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+void App_MouseReportHandler(BYTE reportID, const HID_ROUTE_FIELD *pFields, const HID_USER_DATA_SIZE *pValues, BYTE count);
+#endif
 
 // *****************************************************************************
 // *****************************************************************************
@@ -116,10 +159,26 @@ long spi_send_receive(long send);
 #define USAGE_PAGE_BUTTONS              (0x09)
 
 #define USAGE_PAGE_GEN_DESKTOP          (0x01)
+#define USAGE_MOUSE                     (0x02)
+#define USAGE_X                         (0x30)
+#define USAGE_Y                         (0x31)
+#define USAGE_WHEEL                     (0x38)
 
 
 #define MAX_ERROR_COUNTER               (10)
 
+// Keyboard geometry, must match videoGen/keyLookup in vga.sv.  The keyboard
+// has as many white keys as fit across the screen.
+#define KEYBOARD_LEFT                   (20)          // Pixels
+#define KEYBOARD_PITCH                  (27)          // Pixels from one white key to the next
+#define KEYBOARD_WHITE_KEYS(width)      (((width) - 2 * KEYBOARD_LEFT) / KEYBOARD_PITCH)
+
+// Labels on the FPGA's text screen (8 x 8 pixel tiles)
+#define LABEL_TITLE_ROW                 (2)           // Centered across the screen
+#define LABEL_TITLE_COLOR               (15)          // White
+#define LABEL_NOTE_ROW                  (41)          // Just below the white keys
+#define LABEL_NOTE_COLOR                (7)           // Light grey
+
 
 // *****************************************************************************
 // *****************************************************************************
@@ -133,9 +192,24 @@ HID_DATA_DETAILS Appl_Mouse_Buttons_Details;
 HID_DATA_DETAILS Appl_XY_Axis_Details;
 
 HID_REPORT_BUFFER  Appl_raw_report_buffer;
-
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+HID_PIPELINE_REPORT Appl_pipeline_report;
+#endif
+
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+// Reports of the device's mouse collection go to App_MouseReportHandler();
+// any other collection on the interface (such as the keyboard of a wireless
+// receiver) is ignored.
+const HID_ROUTE_APPLICATION Appl_route_applications[] =
+{
+    { USAGE_PAGE_GEN_DESKTOP, USAGE_MOUSE, App_MouseReportHandler }
+};
+HID_ROUTE_TABLE Appl_route_table;
+APP_MOUSE_REPORT Appl_mouse_report;
+#else
 HID_USER_DATA_SIZE Appl_Button_report_buffer[3];
 HID_USER_DATA_SIZE Appl_XY_report_buffer[3];
+#endif
 
 BYTE ErrorDriver;
 BYTE ErrorCounter;
@@ -161,12 +235,16 @@ int main (void)
     	BYTE i;
         int  value;
 
-		short xPosition = 0; // To store x location
-		short yPosition = 0; // To store y location
-		
-		long toSend =0;
+		LONG  xPosition = 0; // To store x location
+		LONG  yPosition = 0; // To store y location
+		BYTE  buttons = 0;   // Button bitmap, bit 0 is the left button
+		BYTE  wheel = 0;     // Running total of wheel movement
 
-		initspi();
+		SPILinkInitialize();
+#if defined(USB_ENABLE_ENDPOINT_STATISTICS) || defined(USB_ENABLE_TRAFFIC_CAPTURE)
+		UART2Init();
+#endif
+		App_DrawLabels();
         value = SYSTEMConfigWaitStatesAndPB( GetSystemClock() );
     
         // Enable the cache for the best performance
@@ -183,9 +261,37 @@ int main (void)
         PORTD = 0x5;
         // Initialize USB layers
         USBInitialize( 0 );
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+        // The HID driver keeps the interrupt IN endpoint armed and queues each
+        // report as it arrives, so there is no per-report state machine here.
+        while(1)
+        {
+            USBTasks();
+            SPILinkTasks();
+            App_ConsoleTasks();
+
+            while(USBHostHID_ApiGetPipelinedReport(&Appl_pipeline_report))
+            {
+                if(!APPL_REPORT_LENGTH_OK(Appl_pipeline_report.length))
+                {
+                    ErrorCounter++ ;
+                    continue;
+                }
+                ErrorCounter = 0;
+                Appl_raw_report_buffer.ReportLength = Appl_pipeline_report.length;
+                memcpy(Appl_raw_report_buffer.ReportData, Appl_pipeline_report.data, Appl_raw_report_buffer.ReportLength);
+
+                App_ProcessInputReport( &xPosition, &yPosition, &buttons, &wheel);
+                //Now we want to send the values to the FPGA by magic/SPI
+                SPILinkSendCursor((WORD)xPosition, (WORD)yPosition, buttons, wheel);
+            }
+        }
+#else
         while(1)
         {
             USBTasks();
+            SPILinkTasks();
+            App_ConsoleTasks();
             App_Detect_Device();
             
             switch(App_State_Mouse)
@@ -227,7 +333,7 @@ int main (void)
                 case INPUT_REPORT_PENDING:
                            if(USBHostHID_ApiTransferIsComplete(&ErrorDriver,&NumOfBytesRcvd))
                             {
-                                if(ErrorDriver ||(NumOfBytesRcvd != Appl_raw_report_buffer.ReportSize ))
+                                if(ErrorDriver || !APPL_REPORT_LENGTH_OK(NumOfBytesRcvd))
                                 {
                                   ErrorCounter++ ; 
                                   if(MAX_ERROR_COUNTER <= ErrorDriver)
@@ -239,12 +345,12 @@ int main (void)
                                 {
                                   ErrorCounter = 0; 
                                   ReportBufferUpdated = TRUE;
+                                  Appl_raw_report_buffer.ReportLength = NumOfBytesRcvd;
                                   App_State_Mouse = READY_TO_TX_RX_REPORT;
 
-                                  App_ProcessInputReport( &xPosition, &yPosition);
+                                  App_ProcessInputReport( &xPosition, &yPosition, &buttons, &wheel);
   								  //Now we want to send the values to the FPGA by magic/SPI
-								  toSend = ((((long) xPosition) << 16) | ((long) yPosition));
-								  spi_send_receive(toSend);
+								  SPILinkSendCursor((WORD)xPosition, (WORD)yPosition, buttons, wheel);
                                 }
                             }
                     break;
@@ -258,69 +364,393 @@ int main (void)
 
 
         }
+#endif
 }
 
 
-void App_ProcessInputReport(short *xLoc, short *yLoc)
+void App_ProcessInputReport(LONG *xLoc, LONG *yLoc, BYTE *buttons, BYTE *wheel)
 {
+    const SPI_LINK_SCREEN *screen = SPILinkGetScreen();
     BYTE  data;
-	short xMvmt, yMvmt;
+	LONG  xMvmt, yMvmt;
+#ifndef USB_HID_ENABLE_REPORT_ROUTING
+    BYTE  i;
+#endif
    /* process input report received from device */
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+    // The report goes to the handler of the collection it belongs to; only
+    // mouse reports move the cursor.
+    Appl_mouse_report.updated = FALSE;
+    USBHostHID_ApiRouteReport(&Appl_route_table, Appl_raw_report_buffer.ReportData, Appl_raw_report_buffer.ReportLength);
+    if(!Appl_mouse_report.updated)
+    {
+        return;
+    }
+    xMvmt = Appl_mouse_report.xMvmt;
+    yMvmt = Appl_mouse_report.yMvmt;
+    *wheel += (BYTE) Appl_mouse_report.wheel;
+    *buttons = Appl_mouse_report.buttons;
+#else
     USBHostHID_ApiImportData(Appl_raw_report_buffer.ReportData, Appl_raw_report_buffer.ReportSize
                           ,Appl_Button_report_buffer, &Appl_Mouse_Buttons_Details);
     USBHostHID_ApiImportData(Appl_raw_report_buffer.ReportData, Appl_raw_report_buffer.ReportSize
                           ,Appl_XY_report_buffer, &Appl_XY_Axis_Details);
 
     
-    xMvmt = (signed char) Appl_XY_report_buffer[0];	// Get X-axis movement from report
+    // The axes are sign extended as they are extracted, so 12 and 16 bit
+    // axes keep their full range.
+    xMvmt = APPL_AXIS_VALUE(Appl_XY_report_buffer[0]);	// Get X-axis movement from report
 	//PORTD = *xLoc;	// Write to LEDs to show mouse is working
-    yMvmt = (signed char) Appl_XY_report_buffer[1];	// Get Y-axis movement from report
+    yMvmt = APPL_AXIS_VALUE(Appl_XY_report_buffer[1]);	// Get Y-axis movement from report
+    if(Appl_XY_Axis_Details.count > 2)
+    {
+        *wheel += (signed char) Appl_XY_report_buffer[2];	// Wheel, if the mouse has one
+    }
+
+    *buttons = 0;
+    for(i = 0; (i < Appl_Mouse_Buttons_Details.count) && (i < 3); i++)
+    {
+        if(Appl_Button_report_buffer[i])
+        {
+            *buttons |= 1 << i;
+        }
+    }
+#endif
     
 	*xLoc = *xLoc + xMvmt; //Adjust the current column value
 	*yLoc = *yLoc + yMvmt; //Adjust the curent row value
 	
+	// Keep the cursor on the screen the FPGA reported
 	if(*xLoc < 0)
 	{
 		*xLoc = 0;
 	}
-	else if(*xLoc > 640)
+	else if(*xLoc >= (LONG)screen->width)
 	{
-		*xLoc = 640;
+		*xLoc = screen->width - 1;
 	}
 	if(*yLoc < 0)
 	{
 		*yLoc = 0;
 	}
-	else if(*yLoc > 480)
+	else if(*yLoc >= (LONG)screen->height)
 	{
-		*yLoc = 480;
+		*yLoc = screen->height - 1;
 	}
 }
 
-//******************************************************************************
-//******************************************************************************
-// SPI Support Functions
-//******************************************************************************
-//******************************************************************************
+/****************************************************************************
+  Function:
+    void App_DrawLabels(void)
+
+  Description:
+    Writes the title and a note name under each white key to the FPGA's
+    text screen, laid out for the resolution the FPGA reported.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Waits for room in the SPI link for each tile, so only call this before
+    the USB stack is running.
+  ***************************************************************************/
+void App_DrawLabels(void)
+{
+    static const char title[] = "USB PIANO";
+    static const char notes[] = "CDEFGAB";
+    const SPI_LINK_SCREEN *screen = SPILinkGetScreen();
+    BYTE column = (screen->width / 8 - (sizeof(title) - 1)) / 2;
+    BYTE i;
+
+    for(i = 0; title[i]; i++)
+    {
+        while(!SPILinkWriteTile(column + i, LABEL_TITLE_ROW, title[i], LABEL_TITLE_COLOR))
+        {
+            SPILinkTasks();
+        }
+    }
+    for(i = 0; i < KEYBOARD_WHITE_KEYS(screen->width); i++)
+    {
+        while(!SPILinkWriteTile((KEYBOARD_LEFT + i * KEYBOARD_PITCH + KEYBOARD_PITCH / 2) / 8, LABEL_NOTE_ROW,
+                                notes[i % 7], LABEL_NOTE_COLOR))
+        {
+            SPILinkTasks();
+        }
+    }
+}
+
+/****************************************************************************
+  Function:
+    void App_ConsoleTasks(void)
+
+  Description:
+    This function polls UART2 for console commands.  Typing 's' dumps the
+    transfer statistics of the mouse's endpoints, 'c' dumps and then
+    clears them, and 'p' dumps the USB traffic capture.
+
+  Precondition:
+    UART2Init() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Does nothing unless USB_ENABLE_ENDPOINT_STATISTICS or
+    USB_ENABLE_TRAFFIC_CAPTURE is defined.
+  ***************************************************************************/
+void App_ConsoleTasks(void)
+{
+#if defined(USB_ENABLE_ENDPOINT_STATISTICS) || defined(USB_ENABLE_TRAFFIC_CAPTURE)
+    char command;
+
+    if(!UART2IsPressed())
+    {
+        return;
+    }
+
+    command = UART2GetChar();
+#if defined(USB_ENABLE_TRAFFIC_CAPTURE)
+    if(command == 'p')
+    {
+        App_DumpCapture();
+    }
+#endif
+#if defined(USB_ENABLE_ENDPOINT_STATISTICS)
+    if((command == 's') || (command == 'c'))
+    {
+        App_DumpEndpointStatistics();
+        if(command == 'c')
+        {
+            BYTE endpoint;
+
+            USBHostEndpointStatistics(1, 0, NULL, TRUE);
+            for(endpoint = 1; endpoint < 16; endpoint++)
+            {
+                USBHostEndpointStatistics(1, endpoint, NULL, TRUE);
+                USBHostEndpointStatistics(1, endpoint | 0x80, NULL, TRUE);
+            }
+        }
+    }
+#endif
+#endif
+}
+
+/****************************************************************************
+  Function:
+    void App_DumpCapture(void)
 
-void initspi(void) {
-	char junk;
-
-	SPI2CONbits.ON = 0; // disable SPI to reset any previous state
-	junk = SPI2BUF; // read SPI buffer to clear the receive buffer
-	SPI2BRG = 7; //set BAUD rate to 1.25MHz, with Pclk at 20MHz 
-	SPI2CONbits.MSTEN = 1; // enable master mode
-	SPI2CONbits.CKE = 1; // set clock-to-data timing (data centered on rising SCK edge) 
-	SPI2CONbits.MODE32 = 1; // Send 16 bits at a time (a short)
-	SPI2CONbits.MODE16 = 1; // Send 16 bits at a time (a short)
-	SPI2CONbits.ON = 1; // turn SPI on
+  Description:
+    This function prints the USB traffic capture ring on UART2, one record
+    per line, between "USBCAP BEGIN" and "USBCAP END" lines.  The capture
+    is stopped while the ring is printed so that it holds still.  Save the
+    console output to a file and convert it with Tools/usb_capture_pcap to
+    open it in Wireshark.
+
+    The BEGIN line gives the timestamp rate in ticks per second.  Each
+    record line gives the sequence number, timestamp (hex), 'S' for a token
+    or 'C' for its result, transfer type, device address, endpoint (hex),
+    PID (hex), U1EIR (hex), packet length, and the captured data bytes.
+
+  Precondition:
+    UART2Init() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void App_DumpCapture(void)
+{
+#if defined(USB_ENABLE_TRAFFIC_CAPTURE)
+    USB_CAPTURE_RECORD record;
+    char line[80];
+    DWORD sequence;
+    DWORD count;
+    BYTE i;
+
+    USBHostCaptureEnable(FALSE);
+
+    count = USBHostCaptureCount();
+    sequence = (count > USB_CAPTURE_RECORDS) ? (count - USB_CAPTURE_RECORDS) : 0;
+    sprintf(line, "\r\nUSBCAP BEGIN %lu\r\n", (unsigned long)USB_CAPTURE_TICKS_PER_SECOND);
+    UART2PrintString(line);
+    for(; sequence < count; sequence++)
+    {
+        if(!USBHostCaptureRecord(sequence, &record))
+        {
+            continue;
+        }
+        sprintf(line, "USBCAP %lu %08lX %c %u %u %02X %02X %02X %u",
+                (unsigned long)sequence, (unsigned long)record.time, record.event,
+                record.transferType, record.address, record.endpoint, record.pid,
+                record.error, record.length);
+        UART2PrintString(line);
+        for(i = 0; (i < record.length) && (i < USB_CAPTURE_DATA_SIZE); i++)
+        {
+            sprintf(line, " %02X", record.data[i]);
+            UART2PrintString(line);
+        }
+        UART2PrintString("\r\n");
+    }
+    UART2PrintString("USBCAP END\r\n");
+
+    USBHostCaptureEnable(TRUE);
+#endif
+}
+
+/****************************************************************************
+  Function:
+    void App_DumpEndpointStatistics(void)
+
+  Description:
+    This function prints the transfer statistics of each endpoint of the
+    mouse on UART2: one line of counts, and one line with the latency
+    histogram in frames (SOFs) from submitting a transfer to its
+    completion.  Many NAKs point at the device, errors at the bus, and
+    long latencies with few NAKs at the host's own scheduling.
+
+  Precondition:
+    UART2Init() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    The mouse is always device address 1, as in the USBHostHID_Api macros.
+  ***************************************************************************/
+void App_DumpEndpointStatistics(void)
+{
+#if defined(USB_ENABLE_ENDPOINT_STATISTICS)
+    USB_ENDPOINT_STATISTICS statistics;
+    char line[80];
+    BYTE index;
+    BYTE endpoint;
+    BYTE bin;
+
+    UART2PrintString("\r\nEndpoint statistics\r\n");
+    for(index = 0; index < 31; index++)
+    {
+        // EP0 first, then OUT endpoints 1-15, then IN endpoints 1-15.
+        endpoint = (index == 0) ? 0 : ((index <= 15) ? index : ((index - 15) | 0x80));
+        if(USBHostEndpointStatistics(1, endpoint, &statistics, FALSE) != USB_SUCCESS)
+        {
+            continue;
+        }
+
+        sprintf(line, "EP %02X: %lu transfers, %lu transactions, %lu bytes\r\n",
+                endpoint, (unsigned long)statistics.transfers,
+                (unsigned long)statistics.transactions, (unsigned long)statistics.bytes);
+        UART2PrintString(line);
+        sprintf(line, "  %lu NAKs, %u STALLs, %u errors, max latency %u frames\r\n",
+                (unsigned long)statistics.naks, statistics.stalls, statistics.errors,
+                statistics.maxLatency);
+        UART2PrintString(line);
+        UART2PrintString("  latency");
+        for(bin = 0; bin < USB_ENDPOINT_LATENCY_BINS; bin++)
+        {
+            if(bin <= 1)
+            {
+                sprintf(line, " %u:%u", bin, statistics.latency[bin]);
+            }
+            else if(bin == USB_ENDPOINT_LATENCY_BINS - 1)
+            {
+                sprintf(line, " %u+:%u", 1u << (bin - 1), statistics.latency[bin]);
+            }
+            else
+            {
+                sprintf(line, " %u-%u:%u", 1u << (bin - 1), (1u << bin) - 1, statistics.latency[bin]);
+            }
+            UART2PrintString(line);
+        }
+        UART2PrintString("\r\n");
+    }
+#endif
 }
 
-long spi_send_receive(long send) {
-	SPI2BUF = send; // send data to slave
-	while (!SPI2STATbits.SPIBUSY); // wait until received buffer fills, indicating data received 
-	return SPI2BUF; // return received data and clear the read buffer full
+/****************************************************************************
+  Function:
+    void App_MouseReportHandler(BYTE reportID, const HID_ROUTE_FIELD *pFields,
+                const HID_USER_DATA_SIZE *pValues, BYTE count)
+
+  Description:
+    This function is the route handler of the mouse collection.  It picks
+    the buttons, X, Y and wheel out of the report's fields by their usages,
+    so it does not depend on the order or size of the fields, and leaves the
+    movement in Appl_mouse_report.
+
+  Precondition:
+    None
+
+  Parameters:
+    BYTE reportID                       - Report ID of the report
+    const HID_ROUTE_FIELD *pFields      - Usages of the fields
+    const HID_USER_DATA_SIZE *pValues   - Values of the fields
+    BYTE count                          - Number of fields
+
+  Returns:
+    None
+
+  Remarks:
+    Called from USBHostHID_ApiRouteReport().
+  ***************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+void App_MouseReportHandler(BYTE reportID, const HID_ROUTE_FIELD *pFields, const HID_USER_DATA_SIZE *pValues, BYTE count)
+{
+    BYTE i;
+
+    (void)reportID;     // The usages identify the fields, whatever the report.
+
+    Appl_mouse_report.xMvmt = 0;
+    Appl_mouse_report.yMvmt = 0;
+    Appl_mouse_report.wheel = 0;
+    Appl_mouse_report.buttons = 0;
+    for(i = 0; i < count; i++)
+    {
+        if(pFields[i].usagePage == USAGE_PAGE_BUTTONS)
+        {
+            // Buttons 1-3 are left, right and middle
+            if((pFields[i].usage >= 1) && (pFields[i].usage <= 3) && pValues[i])
+            {
+                Appl_mouse_report.buttons |= 1 << (pFields[i].usage - 1);
+            }
+        }
+        else if(pFields[i].usagePage == USAGE_PAGE_GEN_DESKTOP)
+        {
+            switch(pFields[i].usage)
+            {
+                case USAGE_X:
+                    Appl_mouse_report.xMvmt = APPL_AXIS_VALUE(pValues[i]);
+                    break;
+                case USAGE_Y:
+                    Appl_mouse_report.yMvmt = APPL_AXIS_VALUE(pValues[i]);
+                    break;
+                case USAGE_WHEEL:
+                    Appl_mouse_report.wheel = APPL_AXIS_VALUE(pValues[i]);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    Appl_mouse_report.updated = TRUE;
 }
+#endif
 
 //******************************************************************************
 //******************************************************************************
@@ -330,7 +760,9 @@ long spi_send_receive(long send) {
 
 BOOL USB_ApplicationEventHandler( BYTE address, USB_EVENT event, void *data, DWORD size )
 {
-    switch( event )
+    // Client driver events such as the HID ones are outside the USB_EVENT
+    // enumeration, so switch on the plain value.
+    switch( (INT)event )
     {
         case EVENT_VBUS_REQUEST_POWER:
             // The data pointer points to a byte that represents the amount of power
@@ -390,6 +822,13 @@ BOOL USB_ApplicationEventHandler( BYTE address, USB_EVENT event, void *data, DWO
 			 #endif
 			break;
 
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+        case EVENT_HID_RPT_RECEIVED:
+            // Reports are collected from the queue in main().
+            return TRUE;
+            break;
+#endif
+
         default:
             break;
     }
@@ -480,6 +919,30 @@ BOOL USB_HID_DataCollectionHandler(void)
   pitemListPtrs = USBHostHID_GetItemListPointers();   // Get pointer to list of item pointers
 
   BOOL status = FALSE;
+
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+   /* Route each report ID to the handler of its collection, so devices with
+      several reports (wireless receivers, composite mice) are accepted. */
+   if(!USBHostHID_ApiBuildRoutes(&Appl_route_table, Appl_route_applications,
+                                 sizeof(Appl_route_applications) / sizeof(Appl_route_applications[0])))
+   {
+       return FALSE;
+   }
+
+   /* Read reports as long as the longest input report */
+   Appl_raw_report_buffer.Report_ID = 0;
+   Appl_raw_report_buffer.ReportSize = 0;
+   for(i = 0; i < pDeviceRptinfo->reports; i++)
+   {
+       if(((pitemListPtrs->reportList[i].inputBits + 7)/8) > Appl_raw_report_buffer.ReportSize)
+       {
+           Appl_raw_report_buffer.ReportSize = (pitemListPtrs->reportList[i].inputBits + 7)/8;
+       }
+   }
+   Appl_raw_report_buffer.ReportPollRate = pDeviceRptinfo->reportPollingRate;
+   return(Appl_raw_report_buffer.ReportSize <= APPL_MAX_REPORT_SIZE);
+#endif
+
    /* Find Report Item Index for Modifier Keys */
    /* Once report Item is located , extract information from data structures provided by the parser */
    NumOfReportItem = pDeviceRptinfo->reportItems;
@@ -500,6 +963,7 @@ BOOL USB_HID_DataCollectionHandler(void)
             Appl_XY_Axis_Details.bitOffset = (BYTE)reportItem->startBit;
             Appl_XY_Axis_Details.bitLength = (BYTE)reportItem->globals.reportsize;
             Appl_XY_Axis_Details.count=(BYTE)reportItem->globals.reportCount;
+            Appl_XY_Axis_Details.signExtend = (reportItem->globals.logicalMinimum < 0);
             Appl_XY_Axis_Details.interfaceNum= USBHostHID_ApiGetCurrentInterfaceNum();
         }
         else if((reportItem->reportType==hidReportInput) && (reportItem->dataModes == HIDData_Variable)&&
@@ -516,11 +980,13 @@ BOOL USB_HID_DataCollectionHandler(void)
             Appl_Mouse_Buttons_Details.bitOffset = (BYTE)reportItem->startBit;
             Appl_Mouse_Buttons_Details.bitLength = (BYTE)reportItem->globals.reportsize;
             Appl_Mouse_Buttons_Details.count=(BYTE)reportItem->globals.reportCount;
+            Appl_Mouse_Buttons_Details.signExtend = 0;
             Appl_Mouse_Buttons_Details.interfaceNum= USBHostHID_ApiGetCurrentInterfaceNum();
         }
     }
 
-   if(pDeviceRptinfo->reports == 1)
+   if((pDeviceRptinfo->reports == 1) &&
+      (((pitemListPtrs->reportList[reportIndex].inputBits + 7)/8) <= APPL_MAX_REPORT_SIZE))
     {
         Appl_raw_report_buffer.Report_ID = 0;
         Appl_raw_report_buffer.ReportSize = (pitemListPtrs->reportList[reportIndex].inputBits + 7)/8;
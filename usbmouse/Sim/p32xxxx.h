@@ -0,0 +1,480 @@
+/******************************************************************************
+
+    PIC32MX Register Model for the Host Simulator
+
+This file stands in for the C32 <p32xxxx.h> when the USB host stack is built
+as a native Linux program (see usb_sim.h).  Every special function register
+the stack, the HID client and the mouse application touch is routed through
+USBSimRegister(), which hands back a latch for the register and lets the
+virtual SIE apply the hardware semantics of the previous access (write-1-to-
+clear flags, SET/CLR/INV aliases, token and SPI writes) before the next one.
+
+ File Name:       p32xxxx.h
+ Dependencies:    None
+ Processor:       Host simulator (PIC32MX register layout)
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#ifndef _SIM_P32XXXX_H_
+#define _SIM_P32XXXX_H_
+
+#if !defined( USB_HOST_SIMULATOR )
+    #error This header is only used by the host simulator build.
+#endif
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Register Identifiers
+// *****************************************************************************
+// *****************************************************************************
+
+typedef enum
+{
+    SIM_U1OTGIR = 0,
+    SIM_U1OTGIE,
+    SIM_U1OTGSTAT,
+    SIM_U1OTGCON,
+    SIM_U1PWRC,
+    SIM_U1IR,
+    SIM_U1IE,
+    SIM_U1EIR,
+    SIM_U1EIE,
+    SIM_U1STAT,
+    SIM_U1CON,
+    SIM_U1ADDR,
+    SIM_U1BDTP1,
+    SIM_U1FRML,
+    SIM_U1FRMH,
+    SIM_U1TOK,
+    SIM_U1SOF,
+    SIM_U1BDTP2,
+    SIM_U1BDTP3,
+    SIM_U1CNFG1,
+    SIM_U1CNFG2,
+    SIM_U1EP0,
+    SIM_U1EP1,
+    SIM_U1EP2,
+    SIM_U1EP3,
+    SIM_U1EP4,
+    SIM_U1EP5,
+    SIM_U1EP6,
+    SIM_U1EP7,
+    SIM_U1EP8,
+    SIM_U1EP9,
+    SIM_U1EP10,
+    SIM_U1EP11,
+    SIM_U1EP12,
+    SIM_U1EP13,
+    SIM_U1EP14,
+    SIM_U1EP15,
+    SIM_IFS1,
+    SIM_IFS1CLR,
+    SIM_IFS1SET,
+    SIM_IEC1,
+    SIM_IEC1CLR,
+    SIM_IEC1SET,
+    SIM_IPC11,
+    SIM_IPC11CLR,
+    SIM_IPC11SET,
+    SIM_SPI2CON,
+    SIM_SPI2STAT,
+    SIM_SPI2BUF,
+    SIM_SPI2BRG,
+    SIM_DMACON,
+    SIM_DCH0CON,
+    SIM_DCH0CONCLR,
+    SIM_DCH0CONSET,
+    SIM_DCH0ECON,
+    SIM_DCH0ECONCLR,
+    SIM_DCH0ECONSET,
+    SIM_DCH0INT,
+    SIM_DCH0INTCLR,
+    SIM_DCH0INTSET,
+    SIM_DCH0SSA,
+    SIM_DCH0DSA,
+    SIM_DCH0SSIZ,
+    SIM_DCH0DSIZ,
+    SIM_DCH0SPTR,
+    SIM_DCH0CSIZ,
+    SIM_TRISB,
+    SIM_TRISD,
+    SIM_TRISE,
+    SIM_TRISF,
+    SIM_TRISG,
+    SIM_PORTD,
+    SIM_WDTCON,
+    SIM_WDTCONSET,
+    SIM_NUM_REGISTERS
+} SIM_REGISTER;
+
+volatile void * USBSimRegister( SIM_REGISTER reg );
+
+#define _SIM_REG(r)                 (*(volatile unsigned int *)USBSimRegister(SIM_##r))
+#define _SIM_BITS(r,t)              (*(volatile t *)USBSimRegister(SIM_##r))
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Bit Field Layouts
+// *****************************************************************************
+// *****************************************************************************
+
+typedef struct {
+    unsigned VBUSVDIF:1;
+    unsigned :1;
+    unsigned SESENDIF:1;
+    unsigned SESVDIF:1;
+    unsigned ACTVIF:1;
+    unsigned LSTATEIF:1;
+    unsigned T1MSECIF:1;
+    unsigned IDIF:1;
+} __U1OTGIRbits_t;
+
+typedef struct {
+    unsigned VBUSVDIE:1;
+    unsigned :1;
+    unsigned SESENDIE:1;
+    unsigned SESVDIE:1;
+    unsigned ACTVIE:1;
+    unsigned LSTATEIE:1;
+    unsigned T1MSECIE:1;
+    unsigned IDIE:1;
+} __U1OTGIEbits_t;
+
+typedef struct {
+    unsigned VBUSVD:1;
+    unsigned :1;
+    unsigned SESEND:1;
+    unsigned SESVD:1;
+    unsigned :1;
+    unsigned LSTATE:1;
+    unsigned :1;
+    unsigned ID:1;
+} __U1OTGSTATbits_t;
+
+typedef struct {
+    unsigned VBUSDIS:1;
+    unsigned VBUSCHG:1;
+    unsigned OTGEN:1;
+    unsigned VBUSON:1;
+    unsigned DMPULDWN:1;
+    unsigned DPPULDWN:1;
+    unsigned DMPULUP:1;
+    unsigned DPPULUP:1;
+} __U1OTGCONbits_t;
+
+typedef struct {
+    unsigned USBPWR:1;
+    unsigned USUSPEND:1;
+    unsigned :1;
+    unsigned USBBUSY:1;
+    unsigned USLPGRD:1;
+    unsigned :2;
+    unsigned UACTPND:1;
+} __U1PWRCbits_t;
+
+typedef union {
+    struct {
+        unsigned URSTIF:1;
+        unsigned UERRIF:1;
+        unsigned SOFIF:1;
+        unsigned TRNIF:1;
+        unsigned IDLEIF:1;
+        unsigned RESUMEIF:1;
+        unsigned ATTACHIF:1;
+        unsigned STALLIF:1;
+    };
+    struct {
+        unsigned DETACHIF:1;
+    };
+} __U1IRbits_t;
+
+typedef union {
+    struct {
+        unsigned URSTIE:1;
+        unsigned UERRIE:1;
+        unsigned SOFIE:1;
+        unsigned TRNIE:1;
+        unsigned IDLEIE:1;
+        unsigned RESUMEIE:1;
+        unsigned ATTACHIE:1;
+        unsigned STALLIE:1;
+    };
+    struct {
+        unsigned DETACHIE:1;
+    };
+} __U1IEbits_t;
+
+typedef union {
+    struct {
+        unsigned PIDEF:1;
+        unsigned CRC5EF:1;
+        unsigned CRC16EF:1;
+        unsigned DFN8EF:1;
+        unsigned BTOEF:1;
+        unsigned DMAEF:1;
+        unsigned BMXEF:1;
+        unsigned BTSEF:1;
+    };
+    struct {
+        unsigned :1;
+        unsigned EOFEF:1;
+    };
+} __U1EIRbits_t;
+
+typedef struct {
+    unsigned :2;
+    unsigned PPBI:1;
+    unsigned DIR:1;
+    unsigned ENDPT:4;
+} __U1STATbits_t;
+
+typedef union {
+    struct {
+        unsigned USBEN:1;
+        unsigned PPBRST:1;
+        unsigned RESUME:1;
+        unsigned HOSTEN:1;
+        unsigned USBRST:1;
+        unsigned PKTDIS:1;
+        unsigned SE0:1;
+        unsigned JSTATE:1;
+    };
+    struct {
+        unsigned SOFEN:1;
+        unsigned :4;
+        unsigned TOKBUSY:1;
+    };
+} __U1CONbits_t;
+
+typedef struct {
+    unsigned EPHSHK:1;
+    unsigned EPSTALL:1;
+    unsigned EPTXEN:1;
+    unsigned EPRXEN:1;
+    unsigned EPCONDIS:1;
+    unsigned :1;
+    unsigned RETRYDIS:1;
+    unsigned LSPD:1;
+} __U1EP0bits_t;
+
+typedef struct {
+    unsigned :25;
+    unsigned USBIF:1;
+} __IFS1bits_t;
+
+typedef struct {
+    unsigned :25;
+    unsigned USBIE:1;
+} __IEC1bits_t;
+
+typedef struct {
+    unsigned SRXISEL:2;
+    unsigned STXISEL:2;
+    unsigned DISSDI:1;
+    unsigned MSTEN:1;
+    unsigned CKP:1;
+    unsigned SSEN:1;
+    unsigned CKE:1;
+    unsigned SMP:1;
+    unsigned MODE16:1;
+    unsigned MODE32:1;
+    unsigned DISSDO:1;
+    unsigned SIDL:1;
+    unsigned :1;
+    unsigned ON:1;
+    unsigned ENHBUF:1;
+    unsigned SPIFE:1;
+    unsigned :6;
+    unsigned FRMCNT:3;
+    unsigned FRMSYPW:1;
+    unsigned MSSEN:1;
+    unsigned FRMPOL:1;
+    unsigned FRMSYNC:1;
+    unsigned FRMEN:1;
+} __SPI2CONbits_t;
+
+typedef struct {
+    unsigned SPIRBF:1;
+    unsigned SPITBF:1;
+    unsigned :1;
+    unsigned SPITBE:1;
+    unsigned :2;
+    unsigned SPIROV:1;
+    unsigned :4;
+    unsigned SPIBUSY:1;
+} __SPI2STATbits_t;
+
+typedef struct {
+    unsigned :11;
+    unsigned DMABUSY:1;
+    unsigned SUSPEND:1;
+    unsigned :2;
+    unsigned ON:1;
+} __DMACONbits_t;
+
+typedef struct {
+    unsigned CHPRI:2;
+    unsigned CHEDET:1;
+    unsigned :1;
+    unsigned CHAEN:1;
+    unsigned CHCHN:1;
+    unsigned CHAED:1;
+    unsigned CHEN:1;
+    unsigned CHCHNS:1;
+    unsigned :6;
+    unsigned CHBUSY:1;
+} __DCH0CONbits_t;
+
+typedef struct {
+    unsigned CHERIF:1;
+    unsigned CHTAIF:1;
+    unsigned CHCCIF:1;
+    unsigned CHBCIF:1;
+    unsigned CHDHIF:1;
+    unsigned CHDDIF:1;
+    unsigned CHSHIF:1;
+    unsigned CHSDIF:1;
+    unsigned :8;
+    unsigned CHERIE:1;
+    unsigned CHTAIE:1;
+    unsigned CHCCIE:1;
+    unsigned CHBCIE:1;
+    unsigned CHDHIE:1;
+    unsigned CHDDIE:1;
+    unsigned CHSHIE:1;
+    unsigned CHSDIE:1;
+} __DCH0INTbits_t;
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Register Names
+// *****************************************************************************
+// *****************************************************************************
+
+#define U1OTGIR         _SIM_REG(U1OTGIR)
+#define U1OTGIRbits     _SIM_BITS(U1OTGIR, __U1OTGIRbits_t)
+#define U1OTGIE         _SIM_REG(U1OTGIE)
+#define U1OTGIEbits     _SIM_BITS(U1OTGIE, __U1OTGIEbits_t)
+#define U1OTGSTAT       _SIM_REG(U1OTGSTAT)
+#define U1OTGSTATbits   _SIM_BITS(U1OTGSTAT, __U1OTGSTATbits_t)
+#define U1OTGCON        _SIM_REG(U1OTGCON)
+#define U1OTGCONbits    _SIM_BITS(U1OTGCON, __U1OTGCONbits_t)
+#define U1PWRC          _SIM_REG(U1PWRC)
+#define U1PWRCbits      _SIM_BITS(U1PWRC, __U1PWRCbits_t)
+#define U1IR            _SIM_REG(U1IR)
+#define U1IRbits        _SIM_BITS(U1IR, __U1IRbits_t)
+#define U1IE            _SIM_REG(U1IE)
+#define U1IEbits        _SIM_BITS(U1IE, __U1IEbits_t)
+#define U1EIR           _SIM_REG(U1EIR)
+#define U1EIRbits       _SIM_BITS(U1EIR, __U1EIRbits_t)
+#define U1EIE           _SIM_REG(U1EIE)
+#define U1STAT          _SIM_REG(U1STAT)
+#define U1STATbits      _SIM_BITS(U1STAT, __U1STATbits_t)
+#define U1CON           _SIM_REG(U1CON)
+#define U1CONbits       _SIM_BITS(U1CON, __U1CONbits_t)
+#define U1ADDR          _SIM_REG(U1ADDR)
+#define U1BDTP1         _SIM_REG(U1BDTP1)
+#define U1FRML          _SIM_REG(U1FRML)
+#define U1FRMH          _SIM_REG(U1FRMH)
+#define U1TOK           _SIM_REG(U1TOK)
+#define U1SOF           _SIM_REG(U1SOF)
+#define U1BDTP2         _SIM_REG(U1BDTP2)
+#define U1BDTP3         _SIM_REG(U1BDTP3)
+#define U1CNFG1         _SIM_REG(U1CNFG1)
+#define U1CNFG2         _SIM_REG(U1CNFG2)
+#define U1EP0           _SIM_REG(U1EP0)
+#define U1EP0bits       _SIM_BITS(U1EP0, __U1EP0bits_t)
+#define U1EP1           _SIM_REG(U1EP1)
+#define U1EP2           _SIM_REG(U1EP2)
+#define U1EP3           _SIM_REG(U1EP3)
+#define U1EP4           _SIM_REG(U1EP4)
+#define U1EP5           _SIM_REG(U1EP5)
+#define U1EP6           _SIM_REG(U1EP6)
+#define U1EP7           _SIM_REG(U1EP7)
+#define U1EP8           _SIM_REG(U1EP8)
+#define U1EP9           _SIM_REG(U1EP9)
+#define U1EP10          _SIM_REG(U1EP10)
+#define U1EP11          _SIM_REG(U1EP11)
+#define U1EP12          _SIM_REG(U1EP12)
+#define U1EP13          _SIM_REG(U1EP13)
+#define U1EP14          _SIM_REG(U1EP14)
+#define U1EP15          _SIM_REG(U1EP15)
+
+#define IFS1            _SIM_REG(IFS1)
+#define IFS1bits        _SIM_BITS(IFS1, __IFS1bits_t)
+#define IFS1CLR         _SIM_REG(IFS1CLR)
+#define IFS1SET         _SIM_REG(IFS1SET)
+#define IEC1            _SIM_REG(IEC1)
+#define IEC1bits        _SIM_BITS(IEC1, __IEC1bits_t)
+#define IEC1CLR         _SIM_REG(IEC1CLR)
+#define IEC1SET         _SIM_REG(IEC1SET)
+#define IPC11           _SIM_REG(IPC11)
+#define IPC11CLR        _SIM_REG(IPC11CLR)
+#define IPC11SET        _SIM_REG(IPC11SET)
+
+#define SPI2CON         _SIM_REG(SPI2CON)
+#define SPI2CONbits     _SIM_BITS(SPI2CON, __SPI2CONbits_t)
+#define SPI2STAT        _SIM_REG(SPI2STAT)
+#define SPI2STATbits    _SIM_BITS(SPI2STAT, __SPI2STATbits_t)
+#define SPI2BUF         _SIM_REG(SPI2BUF)
+#define SPI2BRG         _SIM_REG(SPI2BRG)
+
+#define DMACON          _SIM_REG(DMACON)
+#define DMACONbits      _SIM_BITS(DMACON, __DMACONbits_t)
+#define DCH0CON         _SIM_REG(DCH0CON)
+#define DCH0CONbits     _SIM_BITS(DCH0CON, __DCH0CONbits_t)
+#define DCH0CONCLR      _SIM_REG(DCH0CONCLR)
+#define DCH0CONSET      _SIM_REG(DCH0CONSET)
+#define DCH0ECON        _SIM_REG(DCH0ECON)
+#define DCH0ECONCLR     _SIM_REG(DCH0ECONCLR)
+#define DCH0ECONSET     _SIM_REG(DCH0ECONSET)
+#define DCH0INT         _SIM_REG(DCH0INT)
+#define DCH0INTbits     _SIM_BITS(DCH0INT, __DCH0INTbits_t)
+#define DCH0INTCLR      _SIM_REG(DCH0INTCLR)
+#define DCH0INTSET      _SIM_REG(DCH0INTSET)
+#define DCH0SSA         _SIM_REG(DCH0SSA)
+#define DCH0DSA         _SIM_REG(DCH0DSA)
+#define DCH0SSIZ        _SIM_REG(DCH0SSIZ)
+#define DCH0DSIZ        _SIM_REG(DCH0DSIZ)
+#define DCH0SPTR        _SIM_REG(DCH0SPTR)
+#define DCH0CSIZ        _SIM_REG(DCH0CSIZ)
+
+#define _DCH0CON_CHEN_MASK          0x00000080
+#define _DCH0CON_CHBUSY_MASK        0x00008000
+#define _DCH0ECON_SIRQEN_MASK       0x00000010
+#define _DCH0ECON_CFORCE_MASK       0x00000080
+#define _DCH0ECON_CHSIRQ_POSITION   8
+#define _DCH0INT_CHBCIF_MASK        0x00000008
+
+#define _SPI2_TX_IRQ                55      // PIC32MX5xx/6xx/7xx numbering
+
+#define TRISB           _SIM_REG(TRISB)
+#define TRISD           _SIM_REG(TRISD)
+#define TRISE           _SIM_REG(TRISE)
+#define TRISF           _SIM_REG(TRISF)
+#define TRISG           _SIM_REG(TRISG)
+#define PORTD           _SIM_REG(PORTD)
+
+#define WDTCON          _SIM_REG(WDTCON)
+#define WDTCONSET       _SIM_REG(WDTCONSET)
+#define _WDTCON_WDTCLR_MASK     0x00000001
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Address Translation
+// *****************************************************************************
+// *****************************************************************************
+
+// The simulator is linked non-PIE, so every static object and the simulated
+// heap sit below 4GB and a virtual address fits in the 32-bit BDT ADR field
+// unchanged.  USBSimInit() checks this before the stack starts.
+#define KVA_TO_PA(v)        ((unsigned int)(unsigned long)(v))
+#define PA_TO_KVA0(pa)      ((void *)(unsigned long)(pa))
+#define PA_TO_KVA1(pa)      ((void *)(unsigned long)(pa))
+
+#endif  // _SIM_P32XXXX_H_
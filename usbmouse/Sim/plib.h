@@ -0,0 +1,58 @@
+/******************************************************************************
+
+    PIC32 Peripheral Library Stand-in for the Host Simulator
+
+Replaces the handful of C32 peripheral library calls used by the mouse
+application, and routes the heap through the simulator so that the
+enumeration footprint can be measured against the 1000 byte heap the MPLAB
+project links with.
+
+ File Name:       plib.h
+ Dependencies:    p32xxxx.h
+ Processor:       Host simulator
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#ifndef _SIM_PLIB_H_
+#define _SIM_PLIB_H_
+
+#include <stdlib.h>
+#include <string.h>
+#include "p32xxxx.h"
+
+
+// *****************************************************************************
+// Section: System Services
+// *****************************************************************************
+
+#define SYSTEMConfigWaitStatesAndPB(clk)    ((int)(clk))
+#define SYSTEMConfigPerformance(clk)        ((int)(clk))
+#define CheKseg0CacheOn()
+#define INTEnableSystemMultiVectoredInt()
+#define INTEnableInterrupts()               0
+#define INTDisableInterrupts()              0
+#define SoftReset()                         USBSimAbort( "SoftReset()" )
+#define Nop()
+
+// The core timer counts at half the 80 MHz system clock, every 25 ns.
+unsigned long long USBSimTimeNs( void );
+#define ReadCoreTimer()                     ((unsigned int)(USBSimTimeNs() / 25))
+
+
+// *****************************************************************************
+// Section: Heap
+// *****************************************************************************
+
+void *  USBSimMalloc( size_t size );
+void *  USBSimCalloc( size_t count, size_t size );
+void *  USBSimRealloc( void *ptr, size_t size );
+void    USBSimFree( void *ptr );
+void    USBSimAbort( const char *reason );
+
+#define malloc(s)           USBSimMalloc(s)
+#define calloc(n,s)         USBSimCalloc(n,s)
+#define realloc(p,s)        USBSimRealloc(p,s)
+#define free(p)             USBSimFree(p)
+
+#endif  // _SIM_PLIB_H_
@@ -0,0 +1,1952 @@
+/******************************************************************************
+
+    USB Host Simulator
+
+This file implements the register model, the virtual SIE and the scripted
+device behind Sim/p32xxxx.h.  See usb_sim.h for an overview and the build
+command.
+
+The register model works on latches.  USBSimRegister() returns a pointer to
+a per-register latch that the caller may read or write.  On the next call
+every latch is compared with the value that was loaded into it; a difference
+is a write, and is applied with the semantics of the real register (plain,
+write-1-to-clear, CLR/SET alias, token or SPI transmit).  Registers whose
+writes are triggers or whose flags are write-1-to-clear are loaded with a
+canary in the unimplemented upper bits, so that writing back the value that
+was read is still detected.
+
+Time only moves forward when the program touches a register, runs an ISR
+or passes through USBTasks().  Bus events (SOF, 1ms timer, token completion,
+attach and detach) are processed in time order up to the current time, and
+the USB interrupt is delivered by calling _USB1Interrupt() from the main
+context when it is enabled in IEC1.
+
+ File Name:       usb_sim.c
+ Dependencies:    None
+ Processor:       Host simulator
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "GenericTypeDefs.h"
+#include "usb_config.h"
+#include "USB/usb.h"
+#include "USB/usb_host_hid.h"
+#include "uart2.h"
+#include "usb_sim.h"
+
+// The heap in this file is the one everything else uses.
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Constants
+// *****************************************************************************
+// *****************************************************************************
+
+#define SIM_CANARY                  0x5A5A0000ul    // Loaded into unimplemented bits of trigger registers
+
+#define SIM_FRAME_NS                1000000ull      // 1ms frame / T1MSEC period
+#define SIM_FS_BIT_PS               83333ull        // Full speed bit time in picoseconds
+#define SIM_LS_BIT_PS               666667ull       // Low speed bit time in picoseconds
+
+// Bus cost of the packet pieces, in bit times.  Bit stuffing is ignored.
+#define SIM_BITS_TOKEN              35      // SYNC + PID + ADDR/ENDP + CRC5 + EOP
+#define SIM_BITS_DATA               35      // SYNC + PID + CRC16 + EOP, plus 8 per byte
+#define SIM_BITS_HANDSHAKE          19      // SYNC + PID + EOP
+#define SIM_BITS_TURNAROUND         16      // Inter-packet delay and bus turnaround
+#define SIM_BITS_TIMEOUT            18      // Bus turnaround timeout
+
+#define SIM_U1IR_DETACH             0x01
+#define SIM_U1IR_UERR               0x02
+#define SIM_U1IR_SOF                0x04
+#define SIM_U1IR_TRN                0x08
+#define SIM_U1IR_ATTACH             0x40
+#define SIM_U1OTGIR_T1MSEC          0x40
+#define SIM_U1EIR_BTO               0x10
+#define SIM_U1EIR_DMA               0x20
+
+#define SIM_U1CON_SOFEN             0x01
+#define SIM_U1CON_PPBRST            0x02
+#define SIM_U1CON_HOSTEN            0x08
+#define SIM_U1CON_USBRST            0x10
+#define SIM_U1CON_TOKBUSY           0x20
+#define SIM_U1CON_SE0               0x40
+#define SIM_U1CON_JSTATE            0x80
+
+#define SIM_USB_INTERRUPT           0x02000000ul    // IFS1/IEC1 USB bit
+#define SIM_SPI_BUSY                0x00000800ul
+#define SIM_SPI_TBE                 0x00000008ul
+#define SIM_SPI_RBF                 0x00000001ul
+
+#define SIM_DMACON_ON               0x00008000ul
+#define SIM_DCH_CHEN                0x00000080ul
+#define SIM_DCH_CHBUSY              0x00008000ul
+#define SIM_DCH_SIRQEN              0x00000010ul
+#define SIM_DCH_CFORCE              0x00000080ul
+#define SIM_DCH_CHBCIF              0x00000008ul
+
+#define SIM_CONTROL_BUFFER_SIZE     64
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Register Model
+// *****************************************************************************
+// *****************************************************************************
+
+typedef enum
+{
+    SIM_KIND_PLAIN = 0,     // Read/write, some bits may be read-only status
+    SIM_KIND_W1C,           // Interrupt flags, cleared by writing '1'
+    SIM_KIND_STATUS,        // Read-only
+    SIM_KIND_CLR,           // CLR alias of another register
+    SIM_KIND_SET,           // SET alias of another register
+    SIM_KIND_TOKEN,         // U1TOK, a write starts a transaction
+    SIM_KIND_SPI_BUFFER     // SPI2BUF, a write starts a transfer
+} SIM_REGISTER_KIND;
+
+typedef struct _SIM_REGISTER_INFO
+{
+    const char          *name;
+    BYTE                kind;
+    BYTE                target;     // Register an alias writes to
+    unsigned int        readOnly;   // Status bits a write does not change
+} SIM_REGISTER_INFO;
+
+typedef struct _SIM_REGISTER_STATE
+{
+    unsigned int        value;      // Current hardware value
+    unsigned int        latch;      // What the program reads and writes
+    unsigned int        snapshot;   // Latch contents when it was loaded
+    BOOL                live;       // Latch has been handed out
+} SIM_REGISTER_STATE;
+
+#define _SIM_INFO(r,k,t,ro)     [SIM_##r] = { #r, k, SIM_##t, ro }
+
+static const SIM_REGISTER_INFO simRegisterInfo[SIM_NUM_REGISTERS] =
+{
+    _SIM_INFO( U1OTGIR,     SIM_KIND_W1C,           U1OTGIR,    0 ),
+    _SIM_INFO( U1OTGIE,     SIM_KIND_PLAIN,         U1OTGIE,    0 ),
+    _SIM_INFO( U1OTGSTAT,   SIM_KIND_STATUS,        U1OTGSTAT,  0 ),
+    _SIM_INFO( U1OTGCON,    SIM_KIND_PLAIN,         U1OTGCON,   0 ),
+    _SIM_INFO( U1PWRC,      SIM_KIND_PLAIN,         U1PWRC,     0x08 ),
+    _SIM_INFO( U1IR,        SIM_KIND_W1C,           U1IR,       0 ),
+    _SIM_INFO( U1IE,        SIM_KIND_PLAIN,         U1IE,       0 ),
+    _SIM_INFO( U1EIR,       SIM_KIND_W1C,           U1EIR,      0 ),
+    _SIM_INFO( U1EIE,       SIM_KIND_PLAIN,         U1EIE,      0 ),
+    _SIM_INFO( U1STAT,      SIM_KIND_STATUS,        U1STAT,     0 ),
+    _SIM_INFO( U1CON,       SIM_KIND_PLAIN,         U1CON,      SIM_U1CON_JSTATE | SIM_U1CON_SE0 | SIM_U1CON_TOKBUSY ),
+    _SIM_INFO( U1ADDR,      SIM_KIND_PLAIN,         U1ADDR,     0 ),
+    _SIM_INFO( U1BDTP1,     SIM_KIND_PLAIN,         U1BDTP1,    0 ),
+    _SIM_INFO( U1FRML,      SIM_KIND_STATUS,        U1FRML,     0 ),
+    _SIM_INFO( U1FRMH,      SIM_KIND_STATUS,        U1FRMH,     0 ),
+    _SIM_INFO( U1TOK,       SIM_KIND_TOKEN,         U1TOK,      0 ),
+    _SIM_INFO( U1SOF,       SIM_KIND_PLAIN,         U1SOF,      0 ),
+    _SIM_INFO( U1BDTP2,     SIM_KIND_PLAIN,         U1BDTP2,    0 ),
+    _SIM_INFO( U1BDTP3,     SIM_KIND_PLAIN,         U1BDTP3,    0 ),
+    _SIM_INFO( U1CNFG1,     SIM_KIND_PLAIN,         U1CNFG1,    0 ),
+    _SIM_INFO( U1CNFG2,     SIM_KIND_PLAIN,         U1CNFG2,    0 ),
+    _SIM_INFO( U1EP0,       SIM_KIND_PLAIN,         U1EP0,      0 ),
+    _SIM_INFO( U1EP1,       SIM_KIND_PLAIN,         U1EP1,      0 ),
+    _SIM_INFO( U1EP2,       SIM_KIND_PLAIN,         U1EP2,      0 ),
+    _SIM_INFO( U1EP3,       SIM_KIND_PLAIN,         U1EP3,      0 ),
+    _SIM_INFO( U1EP4,       SIM_KIND_PLAIN,         U1EP4,      0 ),
+    _SIM_INFO( U1EP5,       SIM_KIND_PLAIN,         U1EP5,      0 ),
+    _SIM_INFO( U1EP6,       SIM_KIND_PLAIN,         U1EP6,      0 ),
+    _SIM_INFO( U1EP7,       SIM_KIND_PLAIN,         U1EP7,      0 ),
+    _SIM_INFO( U1EP8,       SIM_KIND_PLAIN,         U1EP8,      0 ),
+    _SIM_INFO( U1EP9,       SIM_KIND_PLAIN,         U1EP9,      0 ),
+    _SIM_INFO( U1EP10,      SIM_KIND_PLAIN,         U1EP10,     0 ),
+    _SIM_INFO( U1EP11,      SIM_KIND_PLAIN,         U1EP11,     0 ),
+    _SIM_INFO( U1EP12,      SIM_KIND_PLAIN,         U1EP12,     0 ),
+    _SIM_INFO( U1EP13,      SIM_KIND_PLAIN,         U1EP13,     0 ),
+    _SIM_INFO( U1EP14,      SIM_KIND_PLAIN,         U1EP14,     0 ),
+    _SIM_INFO( U1EP15,      SIM_KIND_PLAIN,         U1EP15,     0 ),
+    _SIM_INFO( IFS1,        SIM_KIND_PLAIN,         IFS1,       0 ),
+    _SIM_INFO( IFS1CLR,     SIM_KIND_CLR,           IFS1,       0 ),
+    _SIM_INFO( IFS1SET,     SIM_KIND_SET,           IFS1,       0 ),
+    _SIM_INFO( IEC1,        SIM_KIND_PLAIN,         IEC1,       0 ),
+    _SIM_INFO( IEC1CLR,     SIM_KIND_CLR,           IEC1,       0 ),
+    _SIM_INFO( IEC1SET,     SIM_KIND_SET,           IEC1,       0 ),
+    _SIM_INFO( IPC11,       SIM_KIND_PLAIN,         IPC11,      0 ),
+    _SIM_INFO( IPC11CLR,    SIM_KIND_CLR,           IPC11,      0 ),
+    _SIM_INFO( IPC11SET,    SIM_KIND_SET,           IPC11,      0 ),
+    _SIM_INFO( SPI2CON,     SIM_KIND_PLAIN,         SPI2CON,    0 ),
+    _SIM_INFO( SPI2STAT,    SIM_KIND_STATUS,        SPI2STAT,   0 ),
+    _SIM_INFO( SPI2BUF,     SIM_KIND_SPI_BUFFER,    SPI2BUF,    0 ),
+    _SIM_INFO( SPI2BRG,     SIM_KIND_PLAIN,         SPI2BRG,    0 ),
+    _SIM_INFO( DMACON,      SIM_KIND_PLAIN,         DMACON,     0x0800 ),
+    _SIM_INFO( DCH0CON,     SIM_KIND_PLAIN,         DCH0CON,    SIM_DCH_CHBUSY ),
+    _SIM_INFO( DCH0CONCLR,  SIM_KIND_CLR,           DCH0CON,    0 ),
+    _SIM_INFO( DCH0CONSET,  SIM_KIND_SET,           DCH0CON,    0 ),
+    _SIM_INFO( DCH0ECON,    SIM_KIND_PLAIN,         DCH0ECON,   0 ),
+    _SIM_INFO( DCH0ECONCLR, SIM_KIND_CLR,           DCH0ECON,   0 ),
+    _SIM_INFO( DCH0ECONSET, SIM_KIND_SET,           DCH0ECON,   0 ),
+    _SIM_INFO( DCH0INT,     SIM_KIND_PLAIN,         DCH0INT,    0 ),
+    _SIM_INFO( DCH0INTCLR,  SIM_KIND_CLR,           DCH0INT,    0 ),
+    _SIM_INFO( DCH0INTSET,  SIM_KIND_SET,           DCH0INT,    0 ),
+    _SIM_INFO( DCH0SSA,     SIM_KIND_PLAIN,         DCH0SSA,    0 ),
+    _SIM_INFO( DCH0DSA,     SIM_KIND_PLAIN,         DCH0DSA,    0 ),
+    _SIM_INFO( DCH0SSIZ,    SIM_KIND_PLAIN,         DCH0SSIZ,   0 ),
+    _SIM_INFO( DCH0DSIZ,    SIM_KIND_PLAIN,         DCH0DSIZ,   0 ),
+    _SIM_INFO( DCH0SPTR,    SIM_KIND_STATUS,        DCH0SPTR,   0 ),
+    _SIM_INFO( DCH0CSIZ,    SIM_KIND_PLAIN,         DCH0CSIZ,   0 ),
+    _SIM_INFO( TRISB,       SIM_KIND_PLAIN,         TRISB,      0 ),
+    _SIM_INFO( TRISD,       SIM_KIND_PLAIN,         TRISD,      0 ),
+    _SIM_INFO( TRISE,       SIM_KIND_PLAIN,         TRISE,      0 ),
+    _SIM_INFO( TRISF,       SIM_KIND_PLAIN,         TRISF,      0 ),
+    _SIM_INFO( TRISG,       SIM_KIND_PLAIN,         TRISG,      0 ),
+    _SIM_INFO( PORTD,       SIM_KIND_PLAIN,         PORTD,      0 ),
+    _SIM_INFO( WDTCON,      SIM_KIND_PLAIN,         WDTCON,     0 ),
+    _SIM_INFO( WDTCONSET,   SIM_KIND_SET,           WDTCON,     0 ),
+};
+
+static SIM_REGISTER_STATE   simRegister[SIM_NUM_REGISTERS];
+
+#define SIM_VALUE(r)        (simRegister[SIM_##r].value)
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Simulator State
+// *****************************************************************************
+// *****************************************************************************
+
+// Virtual SIE
+typedef struct _SIM_SIE
+{
+    BYTE                ppIn;           // Next IN BD (0 even, 1 odd)
+    BYTE                ppOut;          // Next OUT/SETUP BD
+    DWORD               frameNumber;
+
+    BOOL                tokenActive;
+    BOOL                tokenDeferred;  // Waiting for the next frame (U1SOF threshold)
+    QWORD               tokenDoneNs;
+    BYTE                tokenPid;
+    BYTE                tokenEndpoint;
+    BDT_ENTRY           *tokenBD;
+    BYTE                tokenBDParity;
+    BYTE                resultPid;      // PID written back to the BD, 0 on error
+    BYTE                resultError;    // U1EIR bits
+    WORD                resultCount;
+    BYTE                resultData[SIM_CONTROL_BUFFER_SIZE];
+    BYTE                resultAction;   // Device side effect applied on completion
+    WORD                resultReport;   // Script report delivered, or 0xFFFF
+
+    BOOL                spiBusy;
+    QWORD               spiDoneNs;
+    BOOL                spiReceived;    // A word has come in and SPI2BUF has not been read since
+    BOOL                dmaRequest;     // SPI2 transmit request (or CFORCE) not yet served by DMA channel 0
+} SIM_SIE;
+
+// Scripted device
+typedef enum
+{
+    SIM_ACTION_NONE = 0,
+    SIM_ACTION_SET_ADDRESS,
+    SIM_ACTION_SET_CONFIGURATION,
+    SIM_ACTION_STATUS_DONE
+} SIM_ACTION;
+
+typedef struct _SIM_DEVICE_STATE
+{
+    BOOL                attached;
+    BOOL                inReset;
+    BYTE                address;
+    BYTE                configuration;
+
+    BYTE                setup[8];
+    BOOL                controlIn;      // Data stage direction
+    BOOL                controlStall;
+    const BYTE          *controlData;
+    WORD                controlLength;
+    WORD                controlOffset;
+    BYTE                controlAction;
+    WORD                controlValue;
+    BYTE                toggleIn;       // EP0 IN toggle
+    BYTE                toggleOut;      // EP0 OUT toggle
+    BYTE                toggleReport;   // Report endpoint toggle
+    BYTE                scratch[2];     // GET_STATUS / GET_CONFIGURATION data
+
+    WORD                nextReport;
+} SIM_DEVICE_STATE;
+
+// Statistics
+typedef struct _SIM_REPORT_TIMES
+{
+    QWORD               deliveredNs;
+    QWORD               consumedNs;
+    DWORD               deliveredTask;
+    DWORD               consumedTask;
+} SIM_REPORT_TIMES;
+
+typedef struct _SIM_STATS
+{
+    QWORD               attachNs;
+    QWORD               resetNs;
+    QWORD               firstSetupNs;
+    QWORD               setAddressNs;
+    QWORD               reportDescriptorNs;
+    QWORD               setConfigurationNs;
+    QWORD               firstInterruptInNs;
+    QWORD               firstReportNs;
+    QWORD               firstSpiNs;
+    QWORD               reattachNs;
+    QWORD               reattachSetAddressNs;
+    QWORD               reattachSetConfigurationNs;
+    DWORD               configurationReads;
+    DWORD               reportDescriptorReads;
+
+    DWORD               tasks;
+    DWORD               registerAccesses;
+    DWORD               isrCalls;
+    DWORD               isrSof;
+    DWORD               isrTransfer;
+    DWORD               isrTimer;
+    DWORD               isrError;
+    DWORD               sofs;
+    DWORD               tokensSetup;
+    DWORD               tokensIn;
+    DWORD               tokensOut;
+    DWORD               tokensDeferred;
+    DWORD               naks;
+    DWORD               stalls;
+    DWORD               timeouts;
+    DWORD               toggleErrors;
+    DWORD               violations;
+    DWORD               spiWrites;
+    DWORD               lastSpiWord;
+    DWORD               dmaCells;
+    DWORD               dmaBlocks;
+    QWORD               busyNs;         // Bus time spent on tokens
+
+    DWORD               heapInUse;
+    DWORD               heapPeak;
+    DWORD               heapAllocs;
+    DWORD               heapFrees;
+    DWORD               heapFailures;
+    DWORD               heapLargest;
+
+    SIM_REPORT_TIMES    report[USB_SIM_MAX_REPORTS];
+} SIM_STATS;
+
+static BOOL                 simInitialized;
+static BOOL                 simInIsr;
+static BOOL                 simTrace;
+static QWORD                simNowNs;
+static QWORD                simNextFrameNs;
+static SIM_SIE              simSIE;
+static SIM_DEVICE_STATE     simDev;
+static SIM_STATS            simStats;
+
+extern void _USB1Interrupt( void );
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Local Prototypes
+// *****************************************************************************
+// *****************************************************************************
+
+static void     _SimInitialize( void );
+static void     _SimStep( QWORD cpuNs );
+static void     _SimCommit( void );
+static void     _SimWrite( int reg, unsigned int written );
+static void     _SimRegisterChanged( int reg, unsigned int old );
+static void     _SimAdvance( void );
+static void     _SimFrame( void );
+static void     _SimStartToken( void );
+static void     _SimExecuteToken( QWORD startNs );
+static void     _SimCompleteToken( void );
+static void     _SimDeviceReset( void );
+static void     _SimDeviceSetup( const BYTE *setup );
+static void     _SimUpdateStatus( void );
+static void     _SimSpiTransmit( unsigned int written );
+static void     _SimDmaService( void );
+static void     _SimDispatchInterrupt( void );
+static void     _SimFinish( void );
+static void     _SimTrace( const char *format, ... ) __attribute__ ((format (printf, 1, 2)));
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Register Access
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    volatile void * USBSimRegister( SIM_REGISTER reg )
+
+  Description:
+    Entry point for every SFR access made through Sim/p32xxxx.h.  Applies
+    any writes made to previously returned latches, lets simulated time
+    advance by one register access, delivers a pending USB interrupt, then
+    loads the latch for the requested register and returns it.
+
+  Precondition:
+    None
+
+  Parameters:
+    SIM_REGISTER reg    - Register being accessed
+
+  Returns:
+    Pointer to the latch for the register.
+
+  Remarks:
+    The interrupt is only delivered from the main context, so the ISR never
+    interrupts itself.
+  ***************************************************************************/
+
+volatile void * USBSimRegister( SIM_REGISTER reg )
+{
+    SIM_REGISTER_STATE  *pReg;
+
+    if (!simInitialized)
+    {
+        _SimInitialize();
+    }
+
+    simStats.registerAccesses++;
+    _SimStep( USB_SIM_REGISTER_ACCESS_NS );
+
+    _SimUpdateStatus();
+
+    pReg = &simRegister[reg];
+    switch (simRegisterInfo[reg].kind)
+    {
+        case SIM_KIND_W1C:
+        case SIM_KIND_TOKEN:
+            pReg->latch = pReg->value | SIM_CANARY;
+            break;
+
+        case SIM_KIND_CLR:
+        case SIM_KIND_SET:
+            pReg->latch = 0;
+            break;
+
+        case SIM_KIND_SPI_BUFFER:
+            pReg->latch         = USB_SIM_SPI_STATUS;
+            simSIE.spiReceived  = FALSE;
+            break;
+
+        default:
+            pReg->latch = pReg->value;
+            break;
+    }
+    pReg->snapshot  = pReg->latch;
+    pReg->live      = TRUE;
+
+    return &pReg->latch;
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimCommit( void )
+
+  Description:
+    Compares every latch handed out so far with the value it was loaded
+    with, and applies the difference as a register write.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    All live latches are checked, not just the last one, because the
+    compiler is free to store through an earlier pointer after a later
+    register has been accessed.
+  ***************************************************************************/
+
+static void _SimCommit( void )
+{
+    int                 reg;
+    SIM_REGISTER_STATE  *pReg;
+
+    for (reg = 0; reg < SIM_NUM_REGISTERS; reg++)
+    {
+        pReg = &simRegister[reg];
+        if (pReg->live && (pReg->latch != pReg->snapshot))
+        {
+            pReg->snapshot = pReg->latch;
+            _SimWrite( reg, pReg->latch );
+        }
+    }
+}
+
+
+static void _SimWrite( int reg, unsigned int written )
+{
+    const SIM_REGISTER_INFO *pInfo = &simRegisterInfo[reg];
+    SIM_REGISTER_STATE      *pReg;
+    unsigned int            old;
+
+    switch (pInfo->kind)
+    {
+        case SIM_KIND_PLAIN:
+            pReg        = &simRegister[reg];
+            old         = pReg->value;
+            pReg->value = (written & ~pInfo->readOnly) | (old & pInfo->readOnly);
+            _SimRegisterChanged( reg, old );
+            break;
+
+        case SIM_KIND_W1C:
+            simRegister[reg].value &= ~(written & 0xFF);
+            break;
+
+        case SIM_KIND_CLR:
+            pReg        = &simRegister[pInfo->target];
+            old         = pReg->value;
+            pReg->value &= ~written;
+            _SimRegisterChanged( pInfo->target, old );
+            break;
+
+        case SIM_KIND_SET:
+            pReg        = &simRegister[pInfo->target];
+            old         = pReg->value;
+            pReg->value |= written;
+            _SimRegisterChanged( pInfo->target, old );
+            break;
+
+        case SIM_KIND_TOKEN:
+            simRegister[reg].value = written & 0xFF;
+            _SimStartToken();
+            break;
+
+        case SIM_KIND_SPI_BUFFER:
+            _SimSpiTransmit( written );
+            break;
+
+        default:
+            simStats.violations++;
+            _SimTrace( "write to read-only %s ignored\n", pInfo->name );
+            break;
+    }
+}
+
+
+static void _SimRegisterChanged( int reg, unsigned int old )
+{
+    unsigned int value = simRegister[reg].value;
+
+    if (reg == SIM_U1CON)
+    {
+        if (value & SIM_U1CON_PPBRST)
+        {
+            simSIE.ppIn     = 0;
+            simSIE.ppOut    = 0;
+        }
+        if ((value & SIM_U1CON_USBRST) && !(old & SIM_U1CON_USBRST))
+        {
+            if (!simStats.resetNs && simDev.attached)
+            {
+                simStats.resetNs = simNowNs;
+            }
+            _SimTrace( "bus reset asserted\n" );
+            _SimDeviceReset();
+            simDev.inReset = TRUE;
+        }
+        if (!(value & SIM_U1CON_USBRST) && (old & SIM_U1CON_USBRST))
+        {
+            _SimTrace( "bus reset released\n" );
+            simDev.inReset = FALSE;
+        }
+        if ((value & SIM_U1CON_SOFEN) && !(old & SIM_U1CON_SOFEN))
+        {
+            _SimTrace( "SOF enabled\n" );
+        }
+    }
+    else if (reg == SIM_DCH0CON)
+    {
+        if ((value & SIM_DCH_CHEN) && !(old & SIM_DCH_CHEN))
+        {
+            SIM_VALUE(DCH0SPTR) = 0;
+            _SimTrace( "DMA0 enabled, %u bytes from %08X\n", SIM_VALUE(DCH0SSIZ), SIM_VALUE(DCH0SSA) );
+        }
+    }
+    else if (reg == SIM_DCH0ECON)
+    {
+        // CFORCE reads back as zero; it only raises a transfer request.
+        if (value & SIM_DCH_CFORCE)
+        {
+            simRegister[reg].value &= ~SIM_DCH_CFORCE;
+            simSIE.dmaRequest = TRUE;
+        }
+    }
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: SPI and DMA
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    static void _SimSpiTransmit( unsigned int written )
+
+  Description:
+    Starts shifting a word out of SPI2, whether the CPU or DMA channel 0
+    wrote SPI2BUF, and marks every report that reached the application
+    since the previous word as consumed.
+
+  Precondition:
+    None
+
+  Parameters:
+    unsigned int written    - Word written to SPI2BUF
+
+  Returns:
+    None
+
+  Remarks:
+    The transmit buffer is modelled as a single word: the next write is
+    expected once SPIBUSY has dropped.
+  ***************************************************************************/
+
+static void _SimSpiTransmit( unsigned int written )
+{
+    DWORD   bits;
+    WORD    index;
+
+    if (!(SIM_VALUE(SPI2CON) & 0x8000))
+    {
+        simStats.violations++;
+        _SimTrace( "SPI2BUF written with the module off\n" );
+        return;
+    }
+    if (simSIE.spiBusy)
+    {
+        simStats.violations++;
+        _SimTrace( "SPI2BUF written while a word is still shifting out\n" );
+    }
+
+    bits = (SIM_VALUE(SPI2CON) & 0x0800) ? 32 : ((SIM_VALUE(SPI2CON) & 0x0400) ? 16 : 8);
+    simSIE.spiBusy      = TRUE;
+    simSIE.spiDoneNs    = simNowNs + (QWORD)bits * 2 * (SIM_VALUE(SPI2BRG) + 1) * 1000000000ull / USB_SIM_PBCLK_HZ;
+
+    simStats.spiWrites++;
+    simStats.lastSpiWord = written;
+
+    // Every report that reached the application since the last
+    // SPI write is now on its way to the FPGA.  The first SPI word is the
+    // first to carry a report, not the labels drawn before attach.
+    for (index = 0; (index < simDev.nextReport) && (index < USB_SIM_MAX_REPORTS); index++)
+    {
+        if (simStats.report[index].deliveredNs && !simStats.report[index].consumedNs)
+        {
+            simStats.report[index].consumedNs   = simSIE.spiDoneNs;
+            simStats.report[index].consumedTask = simStats.tasks;
+            if (!simStats.firstSpiNs)
+            {
+                simStats.firstSpiNs = simSIE.spiDoneNs;
+            }
+        }
+    }
+    _SimTrace( "SPI2BUF <- %08X\n", written );
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimDmaService( void )
+
+  Description:
+    Moves one cell from the source buffer of DMA channel 0 into SPI2BUF when
+    the channel is enabled, a transfer request is pending and SPI2 can take
+    a word.  Raises CHBCIF and disables the channel at the end of the block.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Only the SPI2BUF destination used by spi_link.c is modelled: one DWORD
+    cell per request, with the request coming from CFORCE or from SPI2
+    finishing a word.  DWORD is 8 bytes on the host, so the cell size is
+    checked against sizeof(DWORD) rather than 4 and the low 32 bits are
+    sent.
+  ***************************************************************************/
+
+static void _SimDmaService( void )
+{
+    unsigned int    dsa;
+    DWORD           word;
+    BYTE            *pSource;
+
+    if (!(SIM_VALUE(DMACON) & SIM_DMACON_ON) || !(SIM_VALUE(DCH0CON) & SIM_DCH_CHEN) ||
+        !simSIE.dmaRequest || simSIE.spiBusy)
+    {
+        return;
+    }
+    simSIE.dmaRequest = FALSE;
+
+    dsa = KVA_TO_PA( &simRegister[SIM_SPI2BUF].latch );
+    if ((SIM_VALUE(DCH0DSA) != dsa) || (SIM_VALUE(DCH0CSIZ) != sizeof(DWORD)) || (SIM_VALUE(DCH0DSIZ) != sizeof(DWORD)) ||
+        !SIM_VALUE(DCH0SSIZ) || (SIM_VALUE(DCH0SSIZ) % sizeof(DWORD)) || !SIM_VALUE(DCH0SSA))
+    {
+        simStats.violations++;
+        _SimTrace( "DMA0 set up for something other than DWORD cells into SPI2BUF, disabled\n" );
+        SIM_VALUE(DCH0CON) &= ~SIM_DCH_CHEN;
+        return;
+    }
+
+    pSource = (BYTE *)PA_TO_KVA1( SIM_VALUE(DCH0SSA) ) + SIM_VALUE(DCH0SPTR);
+    memcpy( &word, pSource, sizeof(word) );
+    SIM_VALUE(DCH0SPTR) += sizeof(DWORD);
+    if (SIM_VALUE(DCH0SPTR) == sizeof(DWORD))
+    {
+        simStats.dmaBlocks++;
+    }
+    simStats.dmaCells++;
+
+    _SimSpiTransmit( (unsigned int)word );
+
+    if (SIM_VALUE(DCH0SPTR) >= SIM_VALUE(DCH0SSIZ))
+    {
+        SIM_VALUE(DCH0SPTR) = 0;
+        SIM_VALUE(DCH0CON)  &= ~SIM_DCH_CHEN;
+        SIM_VALUE(DCH0INT)  |= SIM_DCH_CHBCIF;
+        _SimTrace( "DMA0 block complete\n" );
+    }
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Time and Interrupts
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    static void _SimStep( QWORD cpuNs )
+
+  Description:
+    Applies pending writes, charges CPU time, processes the bus events that
+    are now due and delivers the USB interrupt if it is pending.
+
+  Precondition:
+    None
+
+  Parameters:
+    QWORD cpuNs - CPU time consumed since the last step
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+
+static void _SimStep( QWORD cpuNs )
+{
+    _SimCommit();
+    simNowNs += cpuNs;
+    _SimAdvance();
+
+    if (!simInIsr)
+    {
+        _SimDispatchInterrupt();
+    }
+}
+
+
+static void _SimAdvance( void )
+{
+    const USB_SIM_DEVICE    *pScript = usbSimDevice;
+    QWORD                   next;
+    int                     event;
+
+    while (1)
+    {
+        // Find the earliest event that is due.
+        next    = simNextFrameNs;
+        event   = 0;
+        if (simSIE.tokenActive && (simSIE.tokenDoneNs < next))
+        {
+            next    = simSIE.tokenDoneNs;
+            event   = 1;
+        }
+        if (!simDev.attached && !simStats.attachNs && ((QWORD)pScript->attachUs * 1000 < next))
+        {
+            next    = (QWORD)pScript->attachUs * 1000;
+            event   = 2;
+        }
+        if (simDev.attached && pScript->detachUs && !simStats.reattachNs && ((QWORD)pScript->detachUs * 1000 < next))
+        {
+            next    = (QWORD)pScript->detachUs * 1000;
+            event   = 3;
+        }
+        if (!simDev.attached && simStats.attachNs && !simStats.reattachNs && pScript->reattachUs &&
+            ((QWORD)pScript->reattachUs * 1000 < next))
+        {
+            next    = (QWORD)pScript->reattachUs * 1000;
+            event   = 4;
+        }
+        if (next > simNowNs)
+        {
+            break;
+        }
+
+        switch (event)
+        {
+            case 0:
+                _SimFrame();
+                break;
+
+            case 1:
+                _SimCompleteToken();
+                break;
+
+            case 2:
+                simDev.attached     = TRUE;
+                simStats.attachNs   = next;
+                _SimDeviceReset();
+                _SimTrace( "device attached (%s speed)\n", pScript->lowSpeed ? "low" : "full" );
+                break;
+
+            case 3:
+                simDev.attached     = FALSE;
+                if (SIM_VALUE(U1CON) & SIM_U1CON_HOSTEN)
+                {
+                    SIM_VALUE(U1IR) |= SIM_U1IR_DETACH;
+                }
+                _SimTrace( "device detached\n" );
+                break;
+
+            case 4:
+                simDev.attached     = TRUE;
+                simStats.reattachNs = next;
+                _SimDeviceReset();
+                _SimTrace( "device reattached\n" );
+                break;
+        }
+    }
+
+    if (simSIE.spiBusy && (simSIE.spiDoneNs <= simNowNs))
+    {
+        // The transmit buffer has emptied, which is a DMA start request if
+        // channel 0 is waiting on SPI2.
+        simSIE.spiBusy      = FALSE;
+        simSIE.spiReceived  = TRUE;
+        if ((SIM_VALUE(DCH0ECON) & SIM_DCH_SIRQEN) && (((SIM_VALUE(DCH0ECON) >> 8) & 0xFF) == _SPI2_TX_IRQ))
+        {
+            simSIE.dmaRequest = TRUE;
+        }
+    }
+    _SimDmaService();
+
+    // Attach is level sensitive: the flag stays up while a device is present.
+    if (simDev.attached && (SIM_VALUE(U1CON) & SIM_U1CON_HOSTEN))
+    {
+        SIM_VALUE(U1IR) |= SIM_U1IR_ATTACH;
+    }
+
+    if ((SIM_VALUE(U1IR) & SIM_VALUE(U1IE) & 0xFF) || (SIM_VALUE(U1OTGIR) & SIM_VALUE(U1OTGIE) & 0xFF))
+    {
+        SIM_VALUE(IFS1) |= SIM_USB_INTERRUPT;
+    }
+
+    if (simNowNs >= (QWORD)pScript->endUs * 1000)
+    {
+        _SimFinish();
+    }
+}
+
+
+static void _SimFrame( void )
+{
+    QWORD frameNs = simNextFrameNs;
+
+    simNextFrameNs += SIM_FRAME_NS;
+
+    SIM_VALUE(U1OTGIR) |= SIM_U1OTGIR_T1MSEC;
+
+    if ((SIM_VALUE(U1CON) & (SIM_U1CON_HOSTEN | SIM_U1CON_SOFEN | SIM_U1CON_USBRST)) == (SIM_U1CON_HOSTEN | SIM_U1CON_SOFEN))
+    {
+        simSIE.frameNumber  = (simSIE.frameNumber + 1) & 0x7FF;
+        SIM_VALUE(U1IR)     |= SIM_U1IR_SOF;
+        simStats.sofs++;
+
+        if (simSIE.tokenDeferred)
+        {
+            simSIE.tokenDeferred = FALSE;
+            _SimExecuteToken( frameNs + SIM_BITS_TOKEN * SIM_FS_BIT_PS / 1000 );
+        }
+    }
+}
+
+
+static void _SimUpdateStatus( void )
+{
+    unsigned int con = SIM_VALUE(U1CON) & ~(SIM_U1CON_JSTATE | SIM_U1CON_SE0 | SIM_U1CON_TOKBUSY);
+
+    if (!simDev.attached)
+    {
+        con |= SIM_U1CON_SE0;
+    }
+    else if (!usbSimDevice->lowSpeed)
+    {
+        con |= SIM_U1CON_JSTATE;
+    }
+    if (simSIE.tokenActive || simSIE.tokenDeferred)
+    {
+        con |= SIM_U1CON_TOKBUSY;
+    }
+    SIM_VALUE(U1CON) = con;
+
+    SIM_VALUE(U1FRML)   = simSIE.frameNumber & 0xFF;
+    SIM_VALUE(U1FRMH)   = (simSIE.frameNumber >> 8) & 0x07;
+    SIM_VALUE(U1OTGSTAT) = (SIM_VALUE(U1OTGCON) & 0x08) ? 0x89 : 0x80;     // A-side, VBUS valid when driven
+    SIM_VALUE(SPI2STAT) = (simSIE.spiBusy ? SIM_SPI_BUSY : SIM_SPI_TBE) | (simSIE.spiReceived ? SIM_SPI_RBF : 0);
+    SIM_VALUE(DCH0CON)  = (SIM_VALUE(DCH0CON) & ~SIM_DCH_CHBUSY) |
+                          ((SIM_VALUE(DCH0CON) & SIM_DCH_CHEN) ? SIM_DCH_CHBUSY : 0);
+}
+
+
+static void _SimDispatchInterrupt( void )
+{
+    unsigned int pending;
+
+    if (!(SIM_VALUE(IFS1) & SIM_VALUE(IEC1) & SIM_USB_INTERRUPT))
+    {
+        return;
+    }
+
+    pending = SIM_VALUE(U1IR) & SIM_VALUE(U1IE);
+
+    simStats.isrCalls++;
+    if (pending & SIM_U1IR_SOF)     simStats.isrSof++;
+    if (pending & SIM_U1IR_TRN)     simStats.isrTransfer++;
+    if (pending & SIM_U1IR_UERR)    simStats.isrError++;
+    if (SIM_VALUE(U1OTGIR) & SIM_VALUE(U1OTGIE) & SIM_U1OTGIR_T1MSEC)
+    {
+        simStats.isrTimer++;
+    }
+
+    simInIsr = TRUE;
+    simNowNs += USB_SIM_ISR_NS;
+    _USB1Interrupt();
+    _SimCommit();
+    simInIsr = FALSE;
+
+    // The interrupt is persistent: it comes straight back if the ISR left
+    // an enabled flag set.
+    _SimAdvance();
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Virtual SIE
+// *****************************************************************************
+// *****************************************************************************
+
+static QWORD _SimBits( DWORD bits )
+{
+    return (QWORD)bits * (usbSimDevice->lowSpeed ? SIM_LS_BIT_PS : SIM_FS_BIT_PS) / 1000;
+}
+
+
+static void _SimStartToken( void )
+{
+    QWORD threshold;
+
+    if (simSIE.tokenActive || simSIE.tokenDeferred)
+    {
+        simStats.violations++;
+        _SimTrace( "U1TOK written while a token is in progress\n" );
+        return;
+    }
+
+    // A token that cannot finish before the SOF threshold waits for the
+    // next frame.  U1SOF is in byte times at full speed.
+    if ((SIM_VALUE(U1CON) & SIM_U1CON_SOFEN) && !(SIM_VALUE(U1CON) & SIM_U1CON_USBRST))
+    {
+        threshold = (QWORD)SIM_VALUE(U1SOF) * 8 * SIM_FS_BIT_PS / 1000;
+        if (simNextFrameNs - simNowNs < threshold)
+        {
+            simSIE.tokenDeferred = TRUE;
+            simStats.tokensDeferred++;
+            return;
+        }
+    }
+
+    _SimExecuteToken( simNowNs );
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimExecuteToken( QWORD startNs )
+
+  Description:
+    Runs the transaction described by U1TOK, U1ADDR and the next BD for the
+    token direction against the scripted device.  The result is held until
+    the bus time of the transaction has passed, then _SimCompleteToken()
+    writes it back to the BD and raises TRNIF or UERRIF.
+
+  Precondition:
+    U1TOK holds the token.
+
+  Parameters:
+    QWORD startNs   - Time the token goes out on the bus
+
+  Returns:
+    None
+
+  Remarks:
+    In host mode only the EP0 BDs are used, whatever the endpoint.
+  ***************************************************************************/
+
+static void _SimExecuteToken( QWORD startNs )
+{
+    const USB_SIM_DEVICE    *pScript = usbSimDevice;
+    unsigned long           bdtAddress;
+    BDT_ENTRY               *pBDT;
+    BYTE                    *pBuffer;
+    BYTE                    pid;
+    BYTE                    endpoint;
+    BYTE                    address;
+    WORD                    length;
+    WORD                    bufferSize;
+    DWORD                   bits;
+    BOOL                    responds;
+
+    pid         = (SIM_VALUE(U1TOK) >> 4) & 0x0F;
+    endpoint    = SIM_VALUE(U1TOK) & 0x0F;
+    address     = SIM_VALUE(U1ADDR) & 0x7F;
+
+    bdtAddress  = ((unsigned long)SIM_VALUE(U1BDTP3) << 24) | ((unsigned long)SIM_VALUE(U1BDTP2) << 16) |
+                  ((unsigned long)SIM_VALUE(U1BDTP1) << 8);
+    pBDT        = (BDT_ENTRY *)bdtAddress;
+
+    if (pid == PID_IN)
+    {
+        simSIE.tokenBDParity = simSIE.ppIn;
+        pBDT += simSIE.ppIn;
+    }
+    else
+    {
+        simSIE.tokenBDParity = simSIE.ppOut;
+        pBDT += 2 + simSIE.ppOut;
+    }
+
+    if (!bdtAddress || !pBDT->STAT.UOWN)
+    {
+        simStats.violations++;
+        _SimTrace( "token %X ep%u issued without an armed BD, dropped\n", pid, endpoint );
+        return;
+    }
+
+    pBuffer     = (BYTE *)PA_TO_KVA1( pBDT->ADR );
+    bufferSize  = pBDT->count;
+
+    simSIE.tokenActive      = TRUE;
+    simSIE.tokenPid         = pid;
+    simSIE.tokenEndpoint    = endpoint;
+    simSIE.tokenBD          = pBDT;
+    simSIE.resultPid        = 0;
+    simSIE.resultError      = 0;
+    simSIE.resultCount      = bufferSize;
+    simSIE.resultAction     = SIM_ACTION_NONE;
+    simSIE.resultReport     = 0xFFFF;
+
+    responds = simDev.attached && !simDev.inReset && (address == simDev.address) &&
+               (((SIM_VALUE(U1ADDR) & 0x80) != 0) == (pScript->lowSpeed != 0));
+
+    if (!responds)
+    {
+        simSIE.resultError  = SIM_U1EIR_BTO;
+        bits                = SIM_BITS_TOKEN + SIM_BITS_TIMEOUT;
+        simStats.timeouts++;
+    }
+    else if (pid == PID_SETUP)
+    {
+        simStats.tokensSetup++;
+        if (!simStats.firstSetupNs)
+        {
+            simStats.firstSetupNs = startNs;
+        }
+        if ((endpoint == 0) && (bufferSize == 8))
+        {
+            _SimDeviceSetup( pBuffer );
+        }
+        else
+        {
+            simStats.violations++;
+            _SimTrace( "malformed SETUP (ep%u, %u bytes)\n", endpoint, bufferSize );
+        }
+        simSIE.resultPid    = PID_ACK;
+        bits                = SIM_BITS_TOKEN + SIM_BITS_TURNAROUND + SIM_BITS_DATA + 8 * bufferSize +
+                              SIM_BITS_TURNAROUND + SIM_BITS_HANDSHAKE;
+    }
+    else if (pid == PID_OUT)
+    {
+        simStats.tokensOut++;
+        if ((endpoint != 0) || simDev.controlStall)
+        {
+            simSIE.resultPid = PID_STALL;
+            simStats.stalls++;
+        }
+        else
+        {
+            if (pBDT->STAT.DTS != simDev.toggleOut)
+            {
+                simStats.toggleErrors++;
+                _SimTrace( "OUT with DATA%u, device expects DATA%u\n", pBDT->STAT.DTS, simDev.toggleOut );
+            }
+            else
+            {
+                simDev.toggleOut ^= 1;
+                if (simDev.controlIn)
+                {
+                    // Status stage of a control read.
+                    simSIE.resultAction = SIM_ACTION_STATUS_DONE;
+                }
+            }
+            simSIE.resultPid = PID_ACK;
+        }
+        bits = SIM_BITS_TOKEN + SIM_BITS_TURNAROUND + SIM_BITS_DATA + 8 * bufferSize +
+               SIM_BITS_TURNAROUND + SIM_BITS_HANDSHAKE;
+        if (simSIE.resultPid == PID_STALL)
+        {
+            bits -= SIM_BITS_DATA + 8 * bufferSize;
+        }
+    }
+    else if (pid == PID_IN)
+    {
+        simStats.tokensIn++;
+        length = 0;
+
+        if (endpoint == 0)
+        {
+            if (simDev.controlStall)
+            {
+                simSIE.resultPid = PID_STALL;
+            }
+            else if (simDev.controlIn)
+            {
+                // Data stage of a control read.
+                length = simDev.controlLength - simDev.controlOffset;
+                if (length > pScript->deviceDescriptor[7])
+                {
+                    length = pScript->deviceDescriptor[7];
+                }
+                memcpy( simSIE.resultData, simDev.controlData + simDev.controlOffset, length );
+                simDev.controlOffset    += length;
+                simSIE.resultPid        = simDev.toggleIn ? PID_DATA1 : PID_DATA0;
+                simDev.toggleIn         ^= 1;
+            }
+            else
+            {
+                // Status stage of a control write or no data request.
+                simSIE.resultPid    = PID_DATA1;
+                simSIE.resultAction = simDev.controlAction ? simDev.controlAction : SIM_ACTION_STATUS_DONE;
+            }
+        }
+        else if (endpoint == (pScript->reportEndpoint & 0x0F))
+        {
+            if (!simStats.firstInterruptInNs)
+            {
+                simStats.firstInterruptInNs = startNs;
+            }
+            if (!simDev.configuration)
+            {
+                simSIE.resultPid = PID_STALL;
+            }
+            else if ((simDev.nextReport < pScript->numReports) &&
+                     ((QWORD)pScript->reports[simDev.nextReport].timeUs * 1000 <= startNs))
+            {
+                const USB_SIM_REPORT *pReport = &pScript->reports[simDev.nextReport];
+
+                length = pReport->length;
+                memcpy( simSIE.resultData, pReport->data, length );
+                simSIE.resultPid        = simDev.toggleReport ? PID_DATA1 : PID_DATA0;
+                simSIE.resultReport     = simDev.nextReport;
+                simDev.toggleReport     ^= 1;
+                simDev.nextReport++;
+            }
+            else
+            {
+                simSIE.resultPid = PID_NAK;
+                simStats.naks++;
+            }
+        }
+        else
+        {
+            simSIE.resultPid = PID_STALL;
+        }
+
+        if (simSIE.resultPid == PID_STALL)
+        {
+            simStats.stalls++;
+            bits = SIM_BITS_TOKEN + SIM_BITS_TURNAROUND + SIM_BITS_HANDSHAKE;
+        }
+        else if (simSIE.resultPid == PID_NAK)
+        {
+            bits = SIM_BITS_TOKEN + SIM_BITS_TURNAROUND + SIM_BITS_HANDSHAKE;
+        }
+        else
+        {
+            if (pBDT->STAT.DTSEN && (pBDT->STAT.DTS != (simSIE.resultPid == PID_DATA1)))
+            {
+                simStats.toggleErrors++;
+                _SimTrace( "IN returned DATA%u, host expects DATA%u\n", simSIE.resultPid == PID_DATA1, pBDT->STAT.DTS );
+            }
+            if (length > bufferSize)
+            {
+                // The packet does not fit in the buffer the host armed.
+                simSIE.resultError  = SIM_U1EIR_DMA;
+                length              = bufferSize;
+            }
+            simSIE.resultCount = length;
+            bits = SIM_BITS_TOKEN + SIM_BITS_TURNAROUND + SIM_BITS_DATA + 8 * length +
+                   SIM_BITS_TURNAROUND + SIM_BITS_HANDSHAKE;
+        }
+    }
+    else
+    {
+        simStats.violations++;
+        simSIE.resultError  = SIM_U1EIR_BTO;
+        bits                = SIM_BITS_TOKEN + SIM_BITS_TIMEOUT;
+        _SimTrace( "unsupported token PID %X\n", pid );
+    }
+
+    simSIE.tokenDoneNs  = startNs + _SimBits( bits );
+    simStats.busyNs     += simSIE.tokenDoneNs - startNs;
+}
+
+
+static void _SimCompleteToken( void )
+{
+    BDT_ENTRY   *pBDT = simSIE.tokenBD;
+    BYTE        *pBuffer;
+    const char  *names[16] = { "?", "OUT", "ACK", "DATA0", "?", "?", "?", "?",
+                               "?", "IN", "NAK", "DATA1", "?", "SETUP", "STALL", "?" };
+
+    simSIE.tokenActive = FALSE;
+
+    if (((simSIE.resultPid == PID_DATA0) || (simSIE.resultPid == PID_DATA1)) && simSIE.resultCount)
+    {
+        pBuffer = (BYTE *)PA_TO_KVA1( pBDT->ADR );
+        memcpy( pBuffer, simSIE.resultData, simSIE.resultCount );
+    }
+
+    pBDT->STAT.Val  = 0;
+    pBDT->STAT.PID  = simSIE.resultPid;
+    pBDT->count     = simSIE.resultCount;
+
+    if (simSIE.tokenPid == PID_IN)
+    {
+        simSIE.ppIn ^= 1;
+    }
+    else
+    {
+        simSIE.ppOut ^= 1;
+    }
+
+    SIM_VALUE(U1STAT) = (simSIE.tokenPid != PID_IN ? 0x08 : 0x00) | (simSIE.tokenBDParity << 2);
+
+    if (simSIE.resultError)
+    {
+        SIM_VALUE(U1EIR) |= simSIE.resultError;
+        if (SIM_VALUE(U1EIR) & SIM_VALUE(U1EIE))
+        {
+            SIM_VALUE(U1IR) |= SIM_U1IR_UERR;
+        }
+        _SimTrace( "%-5s ep%u -> error %02X\n", names[simSIE.tokenPid], simSIE.tokenEndpoint, simSIE.resultError );
+        return;
+    }
+
+    SIM_VALUE(U1IR) |= SIM_U1IR_TRN;
+    _SimTrace( "%-5s ep%u -> %-5s %u bytes\n", names[simSIE.tokenPid], simSIE.tokenEndpoint,
+               names[simSIE.resultPid], simSIE.resultCount );
+
+    if (simSIE.resultAction != SIM_ACTION_NONE)
+    {
+        simDev.controlAction = SIM_ACTION_NONE;
+    }
+    switch (simSIE.resultAction)
+    {
+        case SIM_ACTION_SET_ADDRESS:
+            simDev.address          = simDev.controlValue & 0x7F;
+            if (simStats.reattachNs)
+            {
+                simStats.reattachSetAddressNs   = simNowNs;
+            }
+            else
+            {
+                simStats.setAddressNs           = simNowNs;
+            }
+            _SimTrace( "device address %u\n", simDev.address );
+            break;
+
+        case SIM_ACTION_SET_CONFIGURATION:
+            simDev.configuration        = simDev.controlValue & 0xFF;
+            simDev.toggleReport         = 0;
+            if (simStats.reattachNs)
+            {
+                simStats.reattachSetConfigurationNs = simNowNs;
+            }
+            else
+            {
+                simStats.setConfigurationNs         = simNowNs;
+            }
+            _SimTrace( "device configuration %u\n", simDev.configuration );
+            break;
+    }
+
+    if ((simSIE.resultReport != 0xFFFF) && (simSIE.resultReport < USB_SIM_MAX_REPORTS))
+    {
+        simStats.report[simSIE.resultReport].deliveredNs    = simNowNs;
+        simStats.report[simSIE.resultReport].deliveredTask  = simStats.tasks;
+        if (!simStats.firstReportNs)
+        {
+            simStats.firstReportNs = simNowNs;
+        }
+    }
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Scripted Device
+// *****************************************************************************
+// *****************************************************************************
+
+static void _SimDeviceReset( void )
+{
+    simDev.address          = 0;
+    simDev.configuration    = 0;
+    simDev.controlIn        = FALSE;
+    simDev.controlStall     = FALSE;
+    simDev.controlAction    = SIM_ACTION_NONE;
+    simDev.toggleReport     = 0;
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimDeviceSetup( const BYTE *setup )
+
+  Description:
+    Decodes a SETUP packet and prepares the data and status stages.  The
+    standard descriptor requests, SET_ADDRESS and SET_CONFIGURATION are
+    implemented; any other request without a data stage is accepted, and
+    any other request with an IN data stage is stalled.
+
+  Precondition:
+    None
+
+  Parameters:
+    const BYTE *setup   - The 8 byte SETUP packet
+
+  Returns:
+    None
+
+  Remarks:
+    SET_ADDRESS and SET_CONFIGURATION take effect when the status stage
+    completes, as on a real device.
+  ***************************************************************************/
+
+static void _SimDeviceSetup( const BYTE *setup )
+{
+    const USB_SIM_DEVICE    *pScript = usbSimDevice;
+    BYTE                    requestType = setup[0];
+    BYTE                    request     = setup[1];
+    WORD                    value       = setup[2] | (setup[3] << 8);
+    WORD                    length      = setup[6] | (setup[7] << 8);
+
+    memcpy( simDev.setup, setup, 8 );
+    simDev.controlIn        = (requestType & USB_SETUP_DEVICE_TO_HOST) != 0;
+    simDev.controlStall     = FALSE;
+    simDev.controlData      = NULL;
+    simDev.controlLength    = 0;
+    simDev.controlOffset    = 0;
+    simDev.controlAction    = SIM_ACTION_NONE;
+    simDev.controlValue     = value;
+    simDev.toggleIn         = 1;
+    simDev.toggleOut        = 1;
+
+    _SimTrace( "SETUP %02X %02X %04X len %u\n", requestType, request, value, length );
+
+    if (simDev.controlIn)
+    {
+        if ((request == USB_REQUEST_GET_DESCRIPTOR) && ((requestType & 0x60) == USB_SETUP_TYPE_STANDARD))
+        {
+            switch (value >> 8)
+            {
+                case USB_DESCRIPTOR_DEVICE:
+                    simDev.controlData      = pScript->deviceDescriptor;
+                    simDev.controlLength    = pScript->deviceDescriptor[0];
+                    break;
+
+                case USB_DESCRIPTOR_CONFIGURATION:
+                    simDev.controlData      = pScript->configurationDescriptor;
+                    simDev.controlLength    = pScript->configurationLength;
+                    simStats.configurationReads++;
+                    break;
+
+                case (DSC_RPT >> 8):
+                    simDev.controlData      = pScript->reportDescriptor;
+                    simDev.controlLength    = pScript->reportDescriptorLength;
+                    simStats.reportDescriptorReads++;
+                    if (!simStats.reportDescriptorNs)
+                    {
+                        simStats.reportDescriptorNs = simNowNs;
+                    }
+                    break;
+            }
+        }
+        else if (request == USB_REQUEST_GET_CONFIGURATION)
+        {
+            simDev.scratch[0]       = simDev.configuration;
+            simDev.controlData      = simDev.scratch;
+            simDev.controlLength    = 1;
+        }
+        else if (request == USB_REQUEST_GET_STATUS)
+        {
+            simDev.scratch[0]       = 0;
+            simDev.scratch[1]       = 0;
+            simDev.controlData      = simDev.scratch;
+            simDev.controlLength    = 2;
+        }
+
+        if (simDev.controlData == NULL)
+        {
+            simDev.controlStall = TRUE;
+            _SimTrace( "request stalled\n" );
+        }
+        else if (simDev.controlLength > length)
+        {
+            simDev.controlLength = length;
+        }
+    }
+    else if ((requestType & 0x60) == USB_SETUP_TYPE_STANDARD)
+    {
+        if (request == USB_REQUEST_SET_ADDRESS)
+        {
+            simDev.controlAction = SIM_ACTION_SET_ADDRESS;
+        }
+        else if (request == USB_REQUEST_SET_CONFIGURATION)
+        {
+            simDev.controlAction = SIM_ACTION_SET_CONFIGURATION;
+        }
+    }
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Initialization and Reporting
+// *****************************************************************************
+// *****************************************************************************
+
+static BYTE __attribute__ ((aligned(8))) simHeap[USB_SIM_HEAP_SIZE];
+
+static void _SimInitialize( void )
+{
+    simInitialized = TRUE;
+    simTrace       = (getenv( "USB_SIM_TRACE" ) != NULL);
+    simNextFrameNs = SIM_FRAME_NS;
+
+    if (((unsigned long)simHeap >> 32) || ((unsigned long)&simRegister >> 32))
+    {
+        USBSimAbort( "data is above 4GB, link with -no-pie" );
+    }
+
+    SIM_VALUE(SPI2STAT)     = SIM_SPI_TBE;
+    SIM_VALUE(U1OTGSTAT)    = 0x80;
+    SIM_VALUE(U1CON)        = SIM_U1CON_SE0;
+
+    printf( "USB host simulator: %s, %s speed, attach at %lu.%03lums, run to %lu.%03lums\n",
+            usbSimDevice->name, usbSimDevice->lowSpeed ? "low" : "full",
+            (unsigned long)usbSimDevice->attachUs / 1000, (unsigned long)usbSimDevice->attachUs % 1000,
+            (unsigned long)usbSimDevice->endUs / 1000, (unsigned long)usbSimDevice->endUs % 1000 );
+}
+
+
+static void _SimTrace( const char *format, ... )
+{
+    va_list args;
+
+    if (!simTrace)
+    {
+        return;
+    }
+
+    printf( "[%10.3f ms]%s ", simNowNs / 1e6, simInIsr ? " isr" : "    " );
+    va_start( args, format );
+    vprintf( format, args );
+    va_end( args );
+}
+
+
+static void _SimPrintTime( const char *label, QWORD ns, QWORD since )
+{
+    if (ns)
+    {
+        printf( "  %-26s %10.3f ms   (+%.3f ms)\n", label, ns / 1e6, (ns - since) / 1e6 );
+    }
+    else
+    {
+        printf( "  %-26s %10s\n", label, "never" );
+    }
+}
+
+
+static void _SimFinish( void )
+{
+    const USB_SIM_DEVICE    *pScript = usbSimDevice;
+    WORD                    index;
+    WORD                    missed = 0;
+
+    USBSimReport();
+
+    for (index = 0; (index < pScript->numReports) && (index < USB_SIM_MAX_REPORTS); index++)
+    {
+        if (!simStats.report[index].consumedNs)
+        {
+            missed++;
+        }
+    }
+    if (missed)
+    {
+        printf( "FAIL: %u of %u reports did not reach SPI2BUF\n", missed, pScript->numReports );
+    }
+    exit( missed ? 1 : 0 );
+}
+
+
+/****************************************************************************
+  Function:
+    void USBSimReport( void )
+
+  Summary:
+    Prints the statistics gathered so far.
+
+  Description:
+    See usb_sim.h.
+  ***************************************************************************/
+
+void USBSimReport( void )
+{
+    const USB_SIM_DEVICE    *pScript = usbSimDevice;
+    WORD                    index;
+    WORD                    count = 0;
+    QWORD                   readyNs;
+    QWORD                   sieNs, appNs, totalNs;
+    QWORD                   sieMin = ~0ull, sieMax = 0, sieSum = 0;
+    QWORD                   appMin = ~0ull, appMax = 0, appSum = 0;
+    QWORD                   totMin = ~0ull, totMax = 0, totSum = 0;
+    DWORD                   tasks, taskMin = ~0ul, taskMax = 0, taskSum = 0;
+
+    printf( "\n==== USB host simulator report at %.3f ms ====\n", simNowNs / 1e6 );
+
+    printf( "Enumeration\n" );
+    _SimPrintTime( "attach",                simStats.attachNs,              0 );
+    _SimPrintTime( "bus reset",             simStats.resetNs,               simStats.attachNs );
+    _SimPrintTime( "first SETUP",           simStats.firstSetupNs,          simStats.attachNs );
+    _SimPrintTime( "SET_ADDRESS done",      simStats.setAddressNs,          simStats.attachNs );
+    _SimPrintTime( "SET_CONFIGURATION done",simStats.setConfigurationNs,    simStats.attachNs );
+    _SimPrintTime( "report descriptor",     simStats.reportDescriptorNs,    simStats.attachNs );
+    _SimPrintTime( "first interrupt IN",    simStats.firstInterruptInNs,    simStats.attachNs );
+    _SimPrintTime( "first report",          simStats.firstReportNs,         simStats.attachNs );
+    _SimPrintTime( "first SPI word",        simStats.firstSpiNs,            simStats.attachNs );
+    if (simStats.reattachNs)
+    {
+        _SimPrintTime( "reattach",              simStats.reattachNs,                    0 );
+        _SimPrintTime( "SET_ADDRESS done",      simStats.reattachSetAddressNs,          simStats.reattachNs );
+        _SimPrintTime( "SET_CONFIGURATION done",simStats.reattachSetConfigurationNs,    simStats.reattachNs );
+    }
+    printf( "  configuration descriptor reads %lu\n", (unsigned long)simStats.configurationReads );
+    printf( "  report descriptor reads %lu\n", (unsigned long)simStats.reportDescriptorReads );
+
+#if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+    {
+        const USB_ENUMERATION_TELEMETRY *pTelemetry = USBHostEnumerationTelemetry();
+
+        printf( "Host telemetry (ms since attach, %u bus resets)\n", (unsigned int)pTelemetry->resets );
+        printf( "  settled %u, reset %u, device descriptor %u, addressed %u\n",
+                pTelemetry->settled, pTelemetry->reset, pTelemetry->deviceDescriptor, pTelemetry->addressed );
+        printf( "  config descriptors %u, configured %u, running %u, first data %u\n",
+                pTelemetry->configDescriptors, pTelemetry->configured, pTelemetry->running, pTelemetry->firstData );
+    }
+#endif
+
+#if defined( USB_ENABLE_TRANSFER_EVENT )
+    {
+        const USB_EVENT_QUEUE_STATISTICS *pQueue = USBHostEventQueueStatistics();
+
+        printf( "Event queue (%u entries)\n", (unsigned int)USB_EVENT_QUEUE_DEPTH );
+        printf( "  high-water mark %u, %u deferred, %u dropped\n",
+                (unsigned int)pQueue->highWater, pQueue->deferred, pQueue->dropped );
+    }
+#endif
+
+    for (index = 0; (index < pScript->numReports) && (index < USB_SIM_MAX_REPORTS); index++)
+    {
+        SIM_REPORT_TIMES *pTimes = &simStats.report[index];
+
+        if (!pTimes->consumedNs)
+        {
+            continue;
+        }
+        readyNs = (QWORD)pScript->reports[index].timeUs * 1000;
+        sieNs   = pTimes->deliveredNs - readyNs;
+        appNs   = pTimes->consumedNs - pTimes->deliveredNs;
+        totalNs = pTimes->consumedNs - readyNs;
+        tasks   = pTimes->consumedTask - pTimes->deliveredTask;
+
+        if (sieNs < sieMin)     sieMin = sieNs;
+        if (sieNs > sieMax)     sieMax = sieNs;
+        if (appNs < appMin)     appMin = appNs;
+        if (appNs > appMax)     appMax = appNs;
+        if (totalNs < totMin)   totMin = totalNs;
+        if (totalNs > totMax)   totMax = totalNs;
+        if (tasks < taskMin)    taskMin = tasks;
+        if (tasks > taskMax)    taskMax = tasks;
+        sieSum  += sieNs;
+        appSum  += appNs;
+        totSum  += totalNs;
+        taskSum += tasks;
+        count++;
+    }
+
+    printf( "Report latency (%u of %u reports reached SPI2BUF)       min        avg        max\n",
+            count, pScript->numReports );
+    if (count)
+    {
+        printf( "  device -> SIE (us)                      %10.1f %10.1f %10.1f\n",
+                sieMin / 1e3, sieSum / 1e3 / count, sieMax / 1e3 );
+        printf( "  SIE -> SPI2BUF (us)                     %10.1f %10.1f %10.1f\n",
+                appMin / 1e3, appSum / 1e3 / count, appMax / 1e3 );
+        printf( "  device -> SPI2BUF (us)                  %10.1f %10.1f %10.1f\n",
+                totMin / 1e3, totSum / 1e3 / count, totMax / 1e3 );
+        printf( "  USBTasks() passes per report            %10lu %10.1f %10lu\n",
+                (unsigned long)taskMin, (double)taskSum / count, (unsigned long)taskMax );
+    }
+
+    printf( "Bus\n" );
+    printf( "  tokens: %lu SETUP, %lu IN, %lu OUT, %lu deferred to next frame\n",
+            (unsigned long)simStats.tokensSetup, (unsigned long)simStats.tokensIn,
+            (unsigned long)simStats.tokensOut, (unsigned long)simStats.tokensDeferred );
+    printf( "  handshakes: %lu NAK, %lu STALL, %lu timeout, %lu toggle mismatch\n",
+            (unsigned long)simStats.naks, (unsigned long)simStats.stalls,
+            (unsigned long)simStats.timeouts, (unsigned long)simStats.toggleErrors );
+    printf( "  SOFs: %lu, bus busy %.3f ms (%.2f%% of run)\n", (unsigned long)simStats.sofs,
+            simStats.busyNs / 1e6, simNowNs ? 100.0 * simStats.busyNs / simNowNs : 0.0 );
+
+    printf( "CPU\n" );
+    printf( "  USBTasks() passes: %lu, register accesses: %lu\n",
+            (unsigned long)simStats.tasks, (unsigned long)simStats.registerAccesses );
+    printf( "  ISR calls: %lu (%lu SOF, %lu transfer, %lu timer, %lu error)\n",
+            (unsigned long)simStats.isrCalls, (unsigned long)simStats.isrSof,
+            (unsigned long)simStats.isrTransfer, (unsigned long)simStats.isrTimer,
+            (unsigned long)simStats.isrError );
+    printf( "  SPI2BUF writes: %lu (%lu by DMA in %lu blocks), last %08lX\n", (unsigned long)simStats.spiWrites,
+            (unsigned long)simStats.dmaCells, (unsigned long)simStats.dmaBlocks,
+            (unsigned long)simStats.lastSpiWord );
+
+    printf( "Heap (%u bytes)\n", USB_SIM_HEAP_SIZE );
+    printf( "  in use %lu, peak %lu, largest request %lu\n", (unsigned long)simStats.heapInUse,
+            (unsigned long)simStats.heapPeak, (unsigned long)simStats.heapLargest );
+    printf( "  %lu allocations, %lu frees, %lu failed\n", (unsigned long)simStats.heapAllocs,
+            (unsigned long)simStats.heapFrees, (unsigned long)simStats.heapFailures );
+    #if defined( USB_HOST_ARENA_SIZE )
+        printf( "Enumeration arena (%u bytes)\n", USB_HOST_ARENA_SIZE );
+        printf( "  high-water mark %u\n", (unsigned int)USBHostArenaHighWater() );
+    #endif
+
+    if (simStats.violations)
+    {
+        printf( "WARNING: %lu register protocol violations (run with USB_SIM_TRACE=1)\n",
+                (unsigned long)simStats.violations );
+    }
+}
+
+
+/****************************************************************************
+  Function:
+    void USBSimTaskTick( void )
+
+  Summary:
+    Marks one pass through USBTasks().
+
+  Description:
+    See usb_sim.h.
+  ***************************************************************************/
+
+void USBSimTaskTick( void )
+{
+    if (!simInitialized)
+    {
+        _SimInitialize();
+    }
+
+    simStats.tasks++;
+    _SimStep( USB_SIM_TASK_NS );
+}
+
+
+/****************************************************************************
+  Function:
+    QWORD USBSimTimeNs( void )
+
+  Summary:
+    Returns the simulated time.
+
+  Description:
+    See usb_sim.h.
+  ***************************************************************************/
+
+QWORD USBSimTimeNs( void )
+{
+    return simNowNs;
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: UART2 Console
+// *****************************************************************************
+// *****************************************************************************
+
+// Stand-ins for Common/uart2.c.  Output goes to stdout with the carriage
+// returns removed, and the script's consoleInput is typed at consoleUs.
+
+static const char *simConsoleNext;
+
+void UART2Init( void )
+{
+    simConsoleNext = usbSimDevice->consoleInput;
+}
+
+
+char UART2IsPressed( void )
+{
+    return (simConsoleNext != NULL) && (*simConsoleNext != 0) && (usbSimDevice->consoleUs != 0) &&
+           (simNowNs >= (QWORD)usbSimDevice->consoleUs * 1000);
+}
+
+
+char UART2GetChar( void )
+{
+    if (!UART2IsPressed())
+    {
+        USBSimAbort( "UART2GetChar() with no console input" );
+    }
+    return *simConsoleNext++;
+}
+
+
+void UART2PutChar( char ch )
+{
+    if (ch != '\r')
+    {
+        putchar( ch );
+    }
+}
+
+
+void UART2PrintString( char *str )
+{
+    while (*str)
+    {
+        UART2PutChar( *str++ );
+    }
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Heap
+// *****************************************************************************
+// *****************************************************************************
+
+// First fit allocator over a fixed pool, with the same 8 byte block header
+// and 8 byte alignment as the C32 heap, so that fragmentation and the peak
+// footprint are comparable with the target.
+
+typedef struct _SIM_HEAP_BLOCK
+{
+    unsigned int        size;       // Including this header
+    unsigned int        used;       // SIM_HEAP_USED or 0
+} SIM_HEAP_BLOCK;
+
+#define SIM_HEAP_USED       0x55534544ul
+#define SIM_HEAP_ALIGN(s)   (((s) + 7) & ~7u)
+#define SIM_HEAP_END        (sizeof(simHeap) & ~7u)
+
+static BOOL simHeapReady;
+
+static void _SimHeapInitialize( void )
+{
+    SIM_HEAP_BLOCK *pBlock = (SIM_HEAP_BLOCK *)simHeap;
+
+    pBlock->size    = SIM_HEAP_END;
+    pBlock->used    = 0;
+    simHeapReady    = TRUE;
+}
+
+
+void * USBSimMalloc( size_t size )
+{
+    SIM_HEAP_BLOCK  *pBlock;
+    SIM_HEAP_BLOCK  *pNext;
+    unsigned int    offset;
+    unsigned int    needed;
+
+    if (!simHeapReady)
+    {
+        _SimHeapInitialize();
+    }
+
+    if (size > simStats.heapLargest)
+    {
+        simStats.heapLargest = size;
+    }
+
+    needed = SIM_HEAP_ALIGN( size + sizeof(SIM_HEAP_BLOCK) );
+    for (offset = 0; offset < SIM_HEAP_END; offset += pBlock->size)
+    {
+        pBlock = (SIM_HEAP_BLOCK *)&simHeap[offset];
+        if (!pBlock->used && (pBlock->size >= needed))
+        {
+            if (pBlock->size - needed >= 2 * sizeof(SIM_HEAP_BLOCK))
+            {
+                pNext           = (SIM_HEAP_BLOCK *)&simHeap[offset + needed];
+                pNext->size     = pBlock->size - needed;
+                pNext->used     = 0;
+                pBlock->size    = needed;
+            }
+            pBlock->used = SIM_HEAP_USED;
+
+            simStats.heapAllocs++;
+            simStats.heapInUse += pBlock->size;
+            if (simStats.heapInUse > simStats.heapPeak)
+            {
+                simStats.heapPeak = simStats.heapInUse;
+            }
+            _SimTrace( "malloc(%lu) = +%u\n", (unsigned long)size, offset );
+            return pBlock + 1;
+        }
+    }
+
+    simStats.heapFailures++;
+    _SimTrace( "malloc(%lu) failed\n", (unsigned long)size );
+    return NULL;
+}
+
+
+void * USBSimCalloc( size_t count, size_t size )
+{
+    void *ptr = USBSimMalloc( count * size );
+
+    if (ptr != NULL)
+    {
+        memset( ptr, 0, count * size );
+    }
+    return ptr;
+}
+
+
+void * USBSimRealloc( void *ptr, size_t size )
+{
+    SIM_HEAP_BLOCK  *pBlock;
+    void            *pNew;
+    size_t          oldSize;
+
+    if (ptr == NULL)
+    {
+        return USBSimMalloc( size );
+    }
+
+    pBlock  = (SIM_HEAP_BLOCK *)ptr - 1;
+    oldSize = pBlock->size - sizeof(SIM_HEAP_BLOCK);
+    pNew    = USBSimMalloc( size );
+    if (pNew != NULL)
+    {
+        memcpy( pNew, ptr, (oldSize < size) ? oldSize : size );
+        USBSimFree( ptr );
+    }
+    return pNew;
+}
+
+
+void USBSimFree( void *ptr )
+{
+    SIM_HEAP_BLOCK  *pBlock;
+    SIM_HEAP_BLOCK  *pNext;
+    unsigned int    offset;
+
+    if (ptr == NULL)
+    {
+        return;
+    }
+
+    pBlock = (SIM_HEAP_BLOCK *)ptr - 1;
+    if (((BYTE *)pBlock < simHeap) || ((BYTE *)pBlock >= simHeap + sizeof(simHeap)) ||
+        (pBlock->used != SIM_HEAP_USED))
+    {
+        USBSimAbort( "free() of a pointer that is not allocated" );
+    }
+
+    pBlock->used = 0;
+    simStats.heapFrees++;
+    simStats.heapInUse -= pBlock->size;
+    _SimTrace( "free(+%u)\n", (unsigned int)((BYTE *)pBlock - simHeap) );
+
+    // Merge adjacent free blocks.
+    for (offset = 0; offset < SIM_HEAP_END; offset += pBlock->size)
+    {
+        pBlock = (SIM_HEAP_BLOCK *)&simHeap[offset];
+        while (!pBlock->used && (offset + pBlock->size < SIM_HEAP_END))
+        {
+            pNext = (SIM_HEAP_BLOCK *)&simHeap[offset + pBlock->size];
+            if (pNext->used || !pNext->size)
+            {
+                break;
+            }
+            pBlock->size += pNext->size;
+        }
+        if (!pBlock->size)
+        {
+            break;
+        }
+    }
+}
+
+
+void USBSimAbort( const char *reason )
+{
+    printf( "\nUSB host simulator aborted: %s\n", reason );
+    if (simInitialized)
+    {
+        USBSimReport();
+    }
+    exit( 2 );
+}
@@ -0,0 +1,206 @@
+/******************************************************************************
+
+    USB Host Simulator (Header File)
+
+Summary:
+    Native Linux build of the USB embedded host stack with a virtual SIE.
+
+Description:
+    The simulator compiles usb_host.c, the HID client driver, the HID parser
+    and the mouse application unchanged against a software model of the
+    PIC32MX USB OTG module (Sim/p32xxxx.h).  The virtual SIE walks the Buffer
+    Descriptor Table exactly as the hardware does, answers each token from a
+    scripted device (see USB_SIM_DEVICE), and raises the same U1IR/U1OTGIR
+    flags, which are delivered by calling _USB1Interrupt() whenever the
+    interrupt is enabled in IEC1.
+
+    Bus timing is modelled in full speed bit times (or low speed, if the
+    script says so), including SOF generation, the U1SOF threshold and the 1ms
+    timer.  CPU time is not simulated instruction by instruction; instead each
+    register access and each pass through USBTasks() advances the clock by a
+    configurable cost (USB_SIM_REGISTER_ACCESS_NS, USB_SIM_TASK_NS), which is
+    enough to compare scheduling changes against each other.
+
+    When the script runs out the simulator prints a report with enumeration
+    phase times, per-report latency (device -> SIE -> SPI2BUF), state machine
+    iterations, token/NAK counts and heap usage, then exits.  The exit code is
+    non-zero if any scripted report failed to reach the application.
+
+    Build from the usbmouse directory:
+
+        gcc -std=gnu99 -O2 -no-pie -fno-pie -D__PIC32MX__ -DUSB_HOST_SIMULATOR \
+            -ISim -I. -IInclude -IUSB \
+            Mouse_demo.c usb_config.c spi_link.c USB/usb_host.c \
+            "USB/HID Host Driver/usb_host_hid.c" \
+            "USB/HID Host Driver/usb_host_hid_parser.c" \
+            Sim/usb_sim.c Sim/usb_sim_mouse.c -o usb_sim
+
+    -no-pie is required: the BDT holds 32-bit physical addresses, so all
+    buffers handed to the SIE must live below 4GB.  Pointers and DWORDs are
+    8 bytes on the host, so the heap figures overstate what the PIC32 uses;
+    compare runs with each other rather than with the target.
+
+ File Name:       usb_sim.h
+ Dependencies:    None
+ Processor:       Host simulator
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#ifndef _USB_SIM_H_
+#define _USB_SIM_H_
+
+#include "GenericTypeDefs.h"
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Configuration
+// *****************************************************************************
+// *****************************************************************************
+
+#ifndef USB_SIM_HEAP_SIZE
+    #define USB_SIM_HEAP_SIZE           1000    // Matches _min_heap_size in the MPLAB project
+#endif
+
+#ifndef USB_SIM_REGISTER_ACCESS_NS
+    #define USB_SIM_REGISTER_ACCESS_NS  50      // CPU time charged per SFR access
+#endif
+
+#ifndef USB_SIM_TASK_NS
+    #define USB_SIM_TASK_NS             2000    // CPU time charged per USBTasks() pass
+#endif
+
+#ifndef USB_SIM_ISR_NS
+    #define USB_SIM_ISR_NS              1500    // Interrupt entry, exit and dispatch overhead
+#endif
+
+#ifndef USB_SIM_PBCLK_HZ
+    #define USB_SIM_PBCLK_HZ            20000000ul
+#endif
+
+#ifndef USB_SIM_MAX_REPORTS
+    #define USB_SIM_MAX_REPORTS         1024    // Reports tracked for latency statistics
+#endif
+
+#ifndef USB_SIM_SPI_STATUS
+    #define USB_SIM_SPI_STATUS          0x5A1401E0ul    // SPI2BUF read value, the FPGA's status word (mode 0, 640 x 480)
+#endif
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Device Script
+// *****************************************************************************
+// *****************************************************************************
+
+// One interrupt IN report.  The report becomes available to the SIE at
+// timeUs (simulated time since power up) and is returned by the first IN
+// token on the report endpoint after that; until then the endpoint NAKs.
+typedef struct _USB_SIM_REPORT
+{
+    DWORD       timeUs;
+    BYTE        length;
+    BYTE        data[16];
+} USB_SIM_REPORT;
+
+// A scripted device.  The descriptors are returned verbatim to GET_DESCRIPTOR
+// requests; other standard and class requests are accepted with a zero
+// length status stage.
+typedef struct _USB_SIM_DEVICE
+{
+    const char              *name;
+    const BYTE              *deviceDescriptor;
+    const BYTE              *configurationDescriptor;
+    WORD                    configurationLength;
+    const BYTE              *reportDescriptor;
+    WORD                    reportDescriptorLength;
+    BYTE                    reportEndpoint;     // Interrupt IN endpoint address (e.g. 0x81)
+    BOOL                    lowSpeed;
+    DWORD                   attachUs;           // Time the device is plugged in
+    DWORD                   detachUs;           // Time the device is unplugged, 0 for never
+    DWORD                   reattachUs;         // Time the device is plugged back in, 0 for never
+    DWORD                   endUs;              // Time the run stops and the report is printed
+    DWORD                   consoleUs;          // Time consoleInput is typed on UART2, 0 for never
+    const char              *consoleInput;      // Console commands for the application
+    const USB_SIM_REPORT    *reports;
+    WORD                    numReports;
+} USB_SIM_DEVICE;
+
+// Selected at link time; the default script is in usb_sim_mouse.c.
+extern const USB_SIM_DEVICE *usbSimDevice;
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Simulator Interface
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    void USBSimTaskTick( void )
+
+  Description:
+    Called from USBTasks() in the simulator build.  Counts state machine
+    iterations, charges USB_SIM_TASK_NS of CPU time and delivers any pending
+    USB interrupt.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Does not return once the script has finished.
+  ***************************************************************************/
+void USBSimTaskTick( void );
+
+/****************************************************************************
+  Function:
+    QWORD USBSimTimeNs( void )
+
+  Description:
+    Returns the current simulated time in nanoseconds since power up.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    Simulated time in nanoseconds.
+
+  Remarks:
+    None
+  ***************************************************************************/
+QWORD USBSimTimeNs( void );
+
+/****************************************************************************
+  Function:
+    void USBSimReport( void )
+
+  Description:
+    Prints the enumeration, latency, iteration and heap statistics gathered
+    so far to stdout.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Called automatically when the script ends.
+  ***************************************************************************/
+void USBSimReport( void );
+
+#endif  // _USB_SIM_H_
@@ -0,0 +1,217 @@
+/******************************************************************************
+
+    USB Host Simulator - Boot Mouse Script
+
+Default device for the simulator: a full speed HID boot mouse with three
+buttons, X, Y and a wheel in a 4 byte report on interrupt endpoint 0x81
+(bInterval 10ms).  It is plugged in 100ms after power up and, once the
+host has had time to enumerate it, moves in a square at 100 reports per
+second with a button press half way round.
+
+Build with -DSIM_MOUSE_WIDE for a high resolution mouse instead: 12 bit X,
+Y and wheel packed into a 6 byte report, moving in steps too large for an
+8 bit axis.  Build with -DSIM_MOUSE_RECEIVER for a wireless receiver with
+a keyboard (report ID 1) and the mouse (report ID 2) on one interface, which
+also types a key half way round.
+
+Replace this file (or point usbSimDevice at another USB_SIM_DEVICE) to
+simulate a different device.
+
+ File Name:       usb_sim_mouse.c
+ Dependencies:    usb_sim.h
+ Processor:       Host simulator
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#include "GenericTypeDefs.h"
+#include "usb_sim.h"
+
+
+// *****************************************************************************
+// Section: Descriptors
+// *****************************************************************************
+
+static const BYTE simMouseDeviceDescriptor[] =
+{
+    0x12,                   // bLength
+    0x01,                   // bDescriptorType - device
+    0x10, 0x01,             // bcdUSB 1.10
+    0x00, 0x00, 0x00,       // Class, subclass, protocol defined by the interface
+    0x08,                   // bMaxPacketSize0
+    0xD8, 0x04,             // idVendor
+    0x01, 0x00,             // idProduct
+    0x00, 0x01,             // bcdDevice
+    0x00, 0x00, 0x00,       // No strings
+    0x01                    // bNumConfigurations
+};
+
+#if defined( SIM_MOUSE_WIDE )
+    #define SIM_MOUSE_REPORT_SIZE   6
+    #define SIM_MOUSE_MAX_PACKET    6
+#elif defined( SIM_MOUSE_RECEIVER )
+    #define SIM_MOUSE_REPORT_SIZE   5       // Report ID, then the boot mouse report
+    #define SIM_MOUSE_MAX_PACKET    9       // Keyboard report
+#else
+    #define SIM_MOUSE_REPORT_SIZE   4
+    #define SIM_MOUSE_MAX_PACKET    4
+#endif
+
+static const BYTE simMouseReportDescriptor[] =
+{
+#ifdef SIM_MOUSE_RECEIVER
+    0x05, 0x01,             // Usage Page (Generic Desktop)
+    0x09, 0x06,             // Usage (Keyboard)
+    0xA1, 0x01,             // Collection (Application)
+    0x85, 0x01,             //   Report ID (1)
+    0x05, 0x07,             //   Usage Page (Keyboard)
+    0x19, 0xE0,             //   Usage Minimum (Left Control)
+    0x29, 0xE7,             //   Usage Maximum (Right GUI)
+    0x15, 0x00,             //   Logical Minimum (0)
+    0x25, 0x01,             //   Logical Maximum (1)
+    0x75, 0x01,             //   Report Size (1)
+    0x95, 0x08,             //   Report Count (8)
+    0x81, 0x02,             //   Input (Data, Variable, Absolute) - modifiers
+    0x95, 0x01,             //   Report Count (1)
+    0x75, 0x08,             //   Report Size (8)
+    0x81, 0x01,             //   Input (Constant) - reserved
+    0x95, 0x06,             //   Report Count (6)
+    0x75, 0x08,             //   Report Size (8)
+    0x25, 0x65,             //   Logical Maximum (101)
+    0x19, 0x00,             //   Usage Minimum (0)
+    0x29, 0x65,             //   Usage Maximum (101)
+    0x81, 0x00,             //   Input (Data, Array) - keys
+    0xC0,                   // End Collection
+#endif
+    0x05, 0x01,             // Usage Page (Generic Desktop)
+    0x09, 0x02,             // Usage (Mouse)
+    0xA1, 0x01,             // Collection (Application)
+#ifdef SIM_MOUSE_RECEIVER
+    0x85, 0x02,             //   Report ID (2)
+#endif
+    0x09, 0x01,             //   Usage (Pointer)
+    0xA1, 0x00,             //   Collection (Physical)
+    0x05, 0x09,             //     Usage Page (Buttons)
+    0x19, 0x01,             //     Usage Minimum (1)
+    0x29, 0x03,             //     Usage Maximum (3)
+    0x15, 0x00,             //     Logical Minimum (0)
+    0x25, 0x01,             //     Logical Maximum (1)
+    0x95, 0x03,             //     Report Count (3)
+    0x75, 0x01,             //     Report Size (1)
+    0x81, 0x02,             //     Input (Data, Variable, Absolute)
+    0x95, 0x01,             //     Report Count (1)
+    0x75, 0x05,             //     Report Size (5)
+    0x81, 0x01,             //     Input (Constant) - padding
+    0x05, 0x01,             //     Usage Page (Generic Desktop)
+    0x09, 0x30,             //     Usage (X)
+    0x09, 0x31,             //     Usage (Y)
+    0x09, 0x38,             //     Usage (Wheel)
+#ifdef SIM_MOUSE_WIDE
+    0x16, 0x01, 0xF8,       //     Logical Minimum (-2047)
+    0x26, 0xFF, 0x07,       //     Logical Maximum (2047)
+    0x75, 0x0C,             //     Report Size (12)
+#else
+    0x15, 0x81,             //     Logical Minimum (-127)
+    0x25, 0x7F,             //     Logical Maximum (127)
+    0x75, 0x08,             //     Report Size (8)
+#endif
+    0x95, 0x03,             //     Report Count (3)
+    0x81, 0x06,             //     Input (Data, Variable, Relative)
+    0xC0,                   //   End Collection
+    0xC0                    // End Collection
+};
+
+static const BYTE simMouseConfigurationDescriptor[] =
+{
+    // Configuration
+    0x09, 0x02, 0x22, 0x00, 0x01, 0x01, 0x00, 0xA0, 0x32,
+    // Interface 0: HID, boot subclass, mouse protocol
+    0x09, 0x04, 0x00, 0x00, 0x01, 0x03, 0x01, 0x02, 0x00,
+    // HID 1.11, one report descriptor
+    0x09, 0x21, 0x11, 0x01, 0x00, 0x01, 0x22, sizeof(simMouseReportDescriptor), 0x00,
+    // Endpoint 0x81, interrupt, one report, 10ms
+    0x07, 0x05, 0x81, 0x03, SIM_MOUSE_MAX_PACKET, 0x00, 0x0A
+};
+
+
+// *****************************************************************************
+// Section: Reports
+// *****************************************************************************
+
+#define SIM_MOUSE_START_US      1000000ul   // Leaves time for insertion debounce, reset and enumeration
+#define SIM_MOUSE_PERIOD_US     10000ul
+
+// Unplug, replug and end times; build with -DSIM_MOUSE_DETACH_US=... to
+// exercise reattachment.
+#ifndef SIM_MOUSE_DETACH_US
+    #define SIM_MOUSE_DETACH_US     0
+#endif
+#ifndef SIM_MOUSE_REATTACH_US
+    #define SIM_MOUSE_REATTACH_US   0
+#endif
+#ifndef SIM_MOUSE_END_US
+    #define SIM_MOUSE_END_US        (SIM_MOUSE_START_US + 40 * SIM_MOUSE_PERIOD_US)
+#endif
+
+#ifdef SIM_MOUSE_WIDE
+    // 12 bit axes, 4 times the movement of the boot mouse
+    #define SIM_MOVE(n,b,dx,dy) { SIM_MOUSE_START_US + (n) * SIM_MOUSE_PERIOD_US, SIM_MOUSE_REPORT_SIZE, \
+                                  { (b), (BYTE)((dx) * 4), (BYTE)((((dx) * 4) >> 8) & 0x0F) | (BYTE)(((dy) * 4) << 4), \
+                                    (BYTE)(((dy) * 4) >> 4), 0, 0 } }
+#elif defined( SIM_MOUSE_RECEIVER )
+    #define SIM_MOVE(n,b,dx,dy) { SIM_MOUSE_START_US + (n) * SIM_MOUSE_PERIOD_US, SIM_MOUSE_REPORT_SIZE, { 2, (b), (BYTE)(dx), (BYTE)(dy), 0 } }
+    // Keyboard report half way between two mouse reports
+    #define SIM_KEY(n,key)      { SIM_MOUSE_START_US + (n) * SIM_MOUSE_PERIOD_US + SIM_MOUSE_PERIOD_US / 2, SIM_MOUSE_MAX_PACKET, { 1, 0, 0, (key), 0, 0, 0, 0, 0 } }
+#else
+    #define SIM_MOVE(n,b,dx,dy) { SIM_MOUSE_START_US + (n) * SIM_MOUSE_PERIOD_US, SIM_MOUSE_REPORT_SIZE, { (b), (BYTE)(dx), (BYTE)(dy), 0 } }
+#endif
+
+static const USB_SIM_REPORT simMouseReports[] =
+{
+    SIM_MOVE(  0, 0,  10,   0 ), SIM_MOVE(  1, 0,  10,   0 ), SIM_MOVE(  2, 0,  10,   0 ), SIM_MOVE(  3, 0,  10,   0 ),
+    SIM_MOVE(  4, 0,  10,   0 ), SIM_MOVE(  5, 0,  10,   0 ), SIM_MOVE(  6, 0,  10,   0 ), SIM_MOVE(  7, 0,  10,   0 ),
+    SIM_MOVE(  8, 0,   0,  10 ), SIM_MOVE(  9, 0,   0,  10 ), SIM_MOVE( 10, 0,   0,  10 ), SIM_MOVE( 11, 0,   0,  10 ),
+    SIM_MOVE( 12, 0,   0,  10 ), SIM_MOVE( 13, 0,   0,  10 ), SIM_MOVE( 14, 0,   0,  10 ), SIM_MOVE( 15, 0,   0,  10 ),
+#ifdef SIM_MOUSE_RECEIVER
+    SIM_MOVE( 16, 1,   0,   0 ), SIM_KEY( 16, 0x04 ), SIM_MOVE( 17, 0,   0,   0 ), SIM_KEY( 17, 0x00 ),
+#else
+    SIM_MOVE( 16, 1,   0,   0 ), SIM_MOVE( 17, 0,   0,   0 ),
+#endif
+    SIM_MOVE( 18, 0, -10,   0 ), SIM_MOVE( 19, 0, -10,   0 ), SIM_MOVE( 20, 0, -10,   0 ), SIM_MOVE( 21, 0, -10,   0 ),
+    SIM_MOVE( 22, 0, -10,   0 ), SIM_MOVE( 23, 0, -10,   0 ), SIM_MOVE( 24, 0, -10,   0 ), SIM_MOVE( 25, 0, -10,   0 ),
+    SIM_MOVE( 26, 0,   0, -10 ), SIM_MOVE( 27, 0,   0, -10 ), SIM_MOVE( 28, 0,   0, -10 ), SIM_MOVE( 29, 0,   0, -10 ),
+    SIM_MOVE( 30, 0,   0, -10 ), SIM_MOVE( 31, 0,   0, -10 ), SIM_MOVE( 32, 0,   0, -10 ), SIM_MOVE( 33, 0,   0, -10 ),
+};
+
+
+// *****************************************************************************
+// Section: Device
+// *****************************************************************************
+
+static const USB_SIM_DEVICE simMouse =
+{
+#if defined( SIM_MOUSE_WIDE )
+    "HID 12 bit mouse",
+#elif defined( SIM_MOUSE_RECEIVER )
+    "HID keyboard and mouse receiver",
+#else
+    "HID boot mouse",
+#endif
+    simMouseDeviceDescriptor,
+    simMouseConfigurationDescriptor,
+    sizeof(simMouseConfigurationDescriptor),
+    simMouseReportDescriptor,
+    sizeof(simMouseReportDescriptor),
+    0x81,                                   // reportEndpoint
+    FALSE,                                  // lowSpeed
+    100000ul,                               // attachUs
+    SIM_MOUSE_DETACH_US,                    // detachUs
+    SIM_MOUSE_REATTACH_US,                  // reattachUs
+    SIM_MOUSE_END_US,                       // endUs
+    SIM_MOUSE_END_US - 10000ul,             // consoleUs
+    "sp",                                   // consoleInput: dump statistics and capture
+    simMouseReports,
+    sizeof(simMouseReports) / sizeof(simMouseReports[0])
+};
+
+const USB_SIM_DEVICE *usbSimDevice = &simMouse;
@@ -0,0 +1,1108 @@
+/******************************************************************************
+
+    HID Report Descriptor Parser Fuzzer and Benchmark
+
+Runs the HID host driver's report descriptor parser and data import
+functions on the development machine, to check that they are safe on any
+descriptor a device can send and to measure how long they take.
+
+The program has a built-in corpus of report descriptors of real kinds of
+device (boot and wheel mice, a high resolution mouse, boot and NKRO
+keyboards, a gamepad, a joystick, a wireless receiver and a vendor defined
+device).  Descriptor files given on the command line are added to it, for
+example from /sys/class/hidraw/hidraw0/device/report_descriptor on Linux.
+For each descriptor it prints the parse result, the entries of the parser's
+static pools it used and the bytes they take, and the time taken by
+_USBHostHID_Parse_Report(), by the streamed parser fed in 8 byte packets,
+and by USBHostHID_ApiImportData() and USBHostHID_ApiImportReport() per
+field extracted.
+
+With -f it then mutates the corpus at random, mutating again the results
+that parse so they can grow to the pool limits, and checks every result:
+
+    - The descriptor is parsed in one piece and again in random slices,
+      and both must give the same error or the same parsed items.
+    - Every index in the parsed items must be inside the pools.
+    - Every input field is imported from a report of exactly the length
+      the parser gave, with USBHostHID_ApiImportData() and with an import
+      program, and both must extract the same values.
+
+Each buffer is allocated with exactly the size it should need, so building
+with AddressSanitizer catches any access out of bounds.  A failed check
+prints the descriptor and aborts.
+
+The parser is built with the pool limits and import options of usb_config.h,
+so the results are those of the firmware.  Build and run from the usbmouse
+directory on the development machine:
+
+    gcc -O1 -g -fsanitize=address,undefined -fno-omit-frame-pointer -no-pie \
+        -D__PIC32MX__ -DUSB_HOST_SIMULATOR -ISim -I. -IInclude -IUSB \
+        -o hid_parser_fuzz Tools/hid_parser_fuzz.c usb_config.c USB/usb_host.c \
+        "USB/HID Host Driver/usb_host_hid.c" "USB/HID Host Driver/usb_host_hid_parser.c" \
+        Sim/usb_sim.c Sim/usb_sim_mouse.c
+    ./hid_parser_fuzz -f 1000000
+
+Build with -O2 and without the sanitizers for the benchmark figures.  To
+fuzz with libFuzzer instead, build with clang, -DHID_PARSER_LIBFUZZER and
+-fsanitize=fuzzer,address, and seed it with the corpus written by -w:
+
+    mkdir corpus && ./hid_parser_fuzz -w corpus
+    ./hid_parser_libfuzzer corpus
+
+ File Name:       hid_parser_fuzz.c
+ Dependencies:    HID host driver, host simulator
+ Processor:       Development host
+ Compiler:        GCC, Clang
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "GenericTypeDefs.h"
+#include "HardwareProfile.h"
+#include "usb_config.h"
+#include "USB/usb.h"
+#include "USB/usb_host_hid.h"
+#include "USB/usb_host_hid_parser.h"
+
+// The simulator's plib.h maps malloc() onto its small firmware heap.  The
+// program's own buffers come from the C library, where the sanitizers see
+// them.
+#undef malloc
+#undef free
+
+extern USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE*, WORD, WORD, BYTE);
+extern void _USBHostHID_Parse_Begin(WORD, BYTE);
+extern USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Bytes(BYTE*, WORD);
+extern USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_End(void);
+
+
+// *****************************************************************************
+// Section: Constants
+// *****************************************************************************
+
+#define MAX_DESCRIPTOR          1024        // Largest descriptor fuzzed or read from a file
+#define MAX_DESCRIPTORS         64          // Built-in corpus and files
+#define POLL_RATE               10
+#define PACKET_SIZE             8           // EP0 packet size of the streamed benchmark
+#define DEFAULT_ITERATIONS      20000
+#define EVOLVED_DESCRIPTORS     64          // Mutated descriptors kept for further mutation
+
+
+// *****************************************************************************
+// Section: Random Numbers
+// *****************************************************************************
+
+static DWORD randomState = 1;
+
+static DWORD Random( void )
+{
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+static void RandomSeed( DWORD seed )
+{
+    randomState = seed ? seed : 1;
+}
+
+
+// *****************************************************************************
+// Section: Parser Results
+// *****************************************************************************
+
+static const char *errorNames[] =
+{
+    "ok", "NotEnoughMemory", "NullPointer", "UnexpectedEndCollection", "UnexpectedPop",
+    "MissingEndCollection", "MissingTopLevelCollection", "NoReports", "UnmatchedUsageRange",
+    "UnmatchedStringRange", "UnmatchedDesignatorRange", "UnexpectedEndOfDescriptor",
+    "BadLogicalMin", "BadLogicalMax", "BadLogical", "ZeroReportSize", "ZeroReportID",
+    "ZeroReportCount", "BadUsageRangePage", "BadUsageRange"
+};
+
+static const char *ErrorName( USB_HID_RPT_DESC_ERROR error )
+{
+    if ((unsigned int)error < (sizeof(errorNames) / sizeof(errorNames[0])))
+    {
+        return errorNames[error];
+    }
+    return "?";
+}
+
+// What a parse produced, reduced to the counts and a hash of every field, so
+// two parses of one descriptor can be compared.
+typedef struct
+{
+    USB_HID_RPT_DESC_ERROR  error;
+    BYTE                    collections;
+    BYTE                    reportItems;
+    BYTE                    reports;
+    BYTE                    usageItems;
+    BYTE                    stringItems;
+    BYTE                    designatorItems;
+    DWORD                   hash;
+} PARSE_RESULT;
+
+static void Hash( DWORD *pHash, DWORD value )
+{
+    int i;
+
+    // FNV-1a, a byte at a time
+    for (i = 0; i < 4; i++)
+    {
+        *pHash = (*pHash ^ ((value >> (8 * i)) & 0xFF)) * 16777619ul;
+    }
+}
+
+static void HashGlobals( DWORD *pHash, const HID_GLOBALS *pGlobals )
+{
+    Hash( pHash, pGlobals->usagePage );
+    Hash( pHash, pGlobals->logicalMinimum );
+    Hash( pHash, pGlobals->logicalMaximum );
+    Hash( pHash, pGlobals->physicalMinimum );
+    Hash( pHash, pGlobals->physicalMaximum );
+    Hash( pHash, pGlobals->unitExponent );
+    Hash( pHash, pGlobals->unit );
+    Hash( pHash, pGlobals->reportIndex );
+    Hash( pHash, pGlobals->reportID );
+    Hash( pHash, pGlobals->reportsize );
+    Hash( pHash, pGlobals->reportCount );
+}
+
+static void GetResult( USB_HID_RPT_DESC_ERROR error, PARSE_RESULT *pResult )
+{
+    DWORD   hash = 2166136261ul;
+    int     i;
+
+    memset( pResult, 0, sizeof(PARSE_RESULT) );
+    pResult->error = error;
+    if (error != HID_ERR)
+    {
+        return;
+    }
+
+    pResult->collections     = deviceRptInfo.collections;
+    pResult->reportItems     = deviceRptInfo.reportItems;
+    pResult->reports         = deviceRptInfo.reports;
+    pResult->usageItems      = deviceRptInfo.usageItems;
+    pResult->stringItems     = deviceRptInfo.stringItems;
+    pResult->designatorItems = deviceRptInfo.designatorItems;
+
+    for (i = 0; i < deviceRptInfo.collections; i++)
+    {
+        const HID_COLLECTION *p = &itemListPtrs.collectionList[i];
+
+        Hash( &hash, p->data );
+        Hash( &hash, p->usagePage );
+        Hash( &hash, p->firstUsageItem );
+        Hash( &hash, p->usageItems );
+        Hash( &hash, p->firstReportItem );
+        Hash( &hash, p->reportItems );
+        Hash( &hash, p->parent );
+        Hash( &hash, p->firstChild );
+        Hash( &hash, p->nextSibling );
+    }
+    for (i = 0; i < deviceRptInfo.reportItems; i++)
+    {
+        const HID_REPORTITEM *p = &itemListPtrs.reportItemList[i];
+
+        Hash( &hash, p->reportType );
+        HashGlobals( &hash, &p->globals );
+        Hash( &hash, p->startBit );
+        Hash( &hash, p->parent );
+        Hash( &hash, p->dataModes );
+        Hash( &hash, p->firstUsageItem );
+        Hash( &hash, p->usageItems );
+        Hash( &hash, p->firstStringItem );
+        Hash( &hash, p->stringItems );
+        Hash( &hash, p->firstDesignatorItem );
+        Hash( &hash, p->designatorItems );
+    }
+    for (i = 0; i < deviceRptInfo.reports; i++)
+    {
+        const HID_REPORT *p = &itemListPtrs.reportList[i];
+
+        Hash( &hash, p->reportID );
+        Hash( &hash, p->inputBits );
+        Hash( &hash, p->outputBits );
+        Hash( &hash, p->featureBits );
+    }
+    for (i = 0; i < deviceRptInfo.usageItems; i++)
+    {
+        const HID_USAGEITEM *p = &itemListPtrs.usageItemList[i];
+
+        Hash( &hash, p->isRange );
+        Hash( &hash, p->usagePage );
+        Hash( &hash, p->usage );
+        Hash( &hash, p->usageMinimum );
+        Hash( &hash, p->usageMaximum );
+    }
+    for (i = 0; i < deviceRptInfo.stringItems; i++)
+    {
+        const HID_STRINGITEM *p = &itemListPtrs.stringItemList[i];
+
+        Hash( &hash, p->isRange );
+        Hash( &hash, p->index );
+        Hash( &hash, p->minimum );
+        Hash( &hash, p->maximum );
+    }
+    for (i = 0; i < deviceRptInfo.designatorItems; i++)
+    {
+        const HID_DESIGITEM *p = &itemListPtrs.designatorItemList[i];
+
+        Hash( &hash, p->isRange );
+        Hash( &hash, p->index );
+        Hash( &hash, p->minimum );
+        Hash( &hash, p->maximum );
+    }
+    pResult->hash = hash;
+}
+
+// *****************************************************************************
+// Section: Parsing
+// *****************************************************************************
+
+static USB_HID_RPT_DESC_ERROR ParseWhole( const BYTE *data, WORD length )
+{
+    USB_HID_RPT_DESC_ERROR  error;
+    BYTE                    *copy;
+
+    // An exact copy, so reading past the end is caught.
+    copy  = (BYTE *)malloc( length ? length : 1 );
+    memcpy( copy, data, length );
+    error = _USBHostHID_Parse_Report( copy, length, POLL_RATE, 0 );
+    free( copy );
+    return error;
+}
+
+// Feeds the streamed parser the way the HID driver does: each slice in its
+// own buffer, stopping at the first error.  A sliceSize of 0 picks the size
+// of each slice at random.
+static USB_HID_RPT_DESC_ERROR ParseStreamed( const BYTE *data, WORD length, WORD sliceSize )
+{
+    USB_HID_RPT_DESC_ERROR  error;
+    BYTE                    *copy;
+    WORD                    offset;
+    WORD                    size;
+
+    _USBHostHID_Parse_Begin( POLL_RATE, 0 );
+    for (offset = 0; offset < length; offset += size)
+    {
+        size = sliceSize ? sliceSize : (WORD)(1 + Random() % 16);
+        if (size > (length - offset))
+        {
+            size = length - offset;
+        }
+        copy  = (BYTE *)malloc( size );
+        memcpy( copy, data + offset, size );
+        error = _USBHostHID_Parse_Bytes( copy, size );
+        free( copy );
+        if (error != HID_ERR)
+        {
+            return error;
+        }
+    }
+    return _USBHostHID_Parse_End();
+}
+
+// Checks that every index in the parsed items is inside the pools.  Returns
+// what is wrong, or NULL.
+static const char *CheckItems( void )
+{
+    int i;
+
+    if ((deviceRptInfo.collections > USB_HID_MAX_COLLECTIONS) ||
+        (deviceRptInfo.reportItems > USB_HID_MAX_REPORT_ITEMS) ||
+        (deviceRptInfo.reports > USB_HID_MAX_REPORTS) ||
+        (deviceRptInfo.usageItems > USB_HID_MAX_USAGE_ITEMS) ||
+        (deviceRptInfo.stringItems > USB_HID_MAX_STRING_ITEMS) ||
+        (deviceRptInfo.designatorItems > USB_HID_MAX_DESIGNATOR_ITEMS))
+    {
+        return "pool count over its limit";
+    }
+
+    for (i = 0; i < deviceRptInfo.collections; i++)
+    {
+        const HID_COLLECTION *p = &itemListPtrs.collectionList[i];
+
+        if (p->parent >= deviceRptInfo.collections)
+        {
+            return "collection parent out of range";
+        }
+        if ((p->firstUsageItem + p->usageItems) > deviceRptInfo.usageItems)
+        {
+            return "collection usages out of range";
+        }
+        if ((p->firstReportItem + p->reportItems) > deviceRptInfo.reportItems)
+        {
+            return "collection report items out of range";
+        }
+    }
+
+    for (i = 0; i < deviceRptInfo.reportItems; i++)
+    {
+        const HID_REPORTITEM *p = &itemListPtrs.reportItemList[i];
+
+        if (p->globals.reportIndex >= deviceRptInfo.reports)
+        {
+            return "report item report out of range";
+        }
+        if (p->parent >= deviceRptInfo.collections)
+        {
+            return "report item parent out of range";
+        }
+        if ((p->firstUsageItem + p->usageItems) > deviceRptInfo.usageItems)
+        {
+            return "report item usages out of range";
+        }
+        if ((p->firstStringItem + p->stringItems) > deviceRptInfo.stringItems)
+        {
+            return "report item strings out of range";
+        }
+        if ((p->firstDesignatorItem + p->designatorItems) > deviceRptInfo.designatorItems)
+        {
+            return "report item designators out of range";
+        }
+    }
+    return NULL;
+}
+
+
+// *****************************************************************************
+// Section: Data Import
+// *****************************************************************************
+
+// Fills in the data details of an input item the way the application does
+// while handling EVENT_HID_RPT_DESC_PARSED.  Returns FALSE if the item
+// cannot be imported.
+static BOOL GetDataDetails( const HID_REPORTITEM *pItem, HID_DATA_DETAILS *pDetails )
+{
+    WORD reportLength;
+
+    if ((pItem->reportType != hidReportInput) || (pItem->globals.reportCount == 0) ||
+        (pItem->globals.reportsize == 0) || (pItem->globals.reportsize > 32))
+    {
+        return FALSE;
+    }
+    reportLength = (itemListPtrs.reportList[pItem->globals.reportIndex].inputBits + 7) / 8;
+    if (reportLength == 0)
+    {
+        return FALSE;
+    }
+
+    pDetails->reportLength = reportLength;
+    pDetails->reportID     = pItem->globals.reportID;
+    pDetails->bitOffset    = (BYTE)pItem->startBit;
+    pDetails->bitLength    = pItem->globals.reportsize;
+    pDetails->count        = pItem->globals.reportCount;
+    pDetails->signExtend   = (pItem->globals.logicalMinimum < 0);
+    pDetails->interfaceNum = 0;
+    return TRUE;
+}
+
+static void RandomReport( BYTE *report, const HID_DATA_DETAILS *pDetails )
+{
+    WORD i;
+
+    for (i = 0; i < pDetails->reportLength; i++)
+    {
+        report[i] = (BYTE)Random();
+    }
+    if (pDetails->reportID != 0)
+    {
+        report[0] = (BYTE)pDetails->reportID;
+    }
+}
+
+// Imports every input field of the parsed descriptor from a random report,
+// through USBHostHID_ApiImportData() and an import program.  Returns what is
+// wrong, or NULL.
+static const char *CheckImports( void )
+{
+    HID_DATA_DETAILS    details;
+    HID_USER_DATA_SIZE  *pData;
+    BYTE                *report;
+    BOOL                imported;
+    int                 i;
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+    HID_IMPORT_PROGRAM  program;
+    HID_DATA_DETAILS    *pDetails = &details;
+    HID_USER_DATA_SIZE  *pProgramData;
+    const char          *problem = NULL;
+#endif
+
+    for (i = 0; i < deviceRptInfo.reportItems; i++)
+    {
+        if (!GetDataDetails( &itemListPtrs.reportItemList[i], &details ))
+        {
+            continue;
+        }
+
+        report = (BYTE *)malloc( details.reportLength );
+        pData  = (HID_USER_DATA_SIZE *)malloc( details.count * sizeof(HID_USER_DATA_SIZE) );
+        RandomReport( report, &details );
+        imported = USBHostHID_ApiImportData( report, details.reportLength, pData, &details );
+
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+        if (USBHostHID_ApiCompileImport( &program, &pDetails, 1 ))
+        {
+            pProgramData = (HID_USER_DATA_SIZE *)malloc( details.count * sizeof(HID_USER_DATA_SIZE) );
+            if (USBHostHID_ApiImportReport( report, details.reportLength, pProgramData, &program ) != imported)
+            {
+                problem = "import program and ImportData disagree on the report";
+            }
+            else if (imported && memcmp( pData, pProgramData, details.count * sizeof(HID_USER_DATA_SIZE) ))
+            {
+                problem = "import program and ImportData extract different values";
+            }
+            free( pProgramData );
+        }
+#endif
+
+        free( pData );
+        free( report );
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+        if (problem != NULL)
+        {
+            return problem;
+        }
+#endif
+    }
+    return NULL;
+}
+
+
+// *****************************************************************************
+// Section: Checking
+// *****************************************************************************
+
+static void Fail( const char *problem, const BYTE *data, WORD length )
+{
+    WORD i;
+
+    printf( "FAIL: %s\n", problem );
+    printf( "descriptor (%u bytes):", length );
+    for (i = 0; i < length; i++)
+    {
+        printf( "%s%02X", (i % 16) ? " " : "\n    ", data[i] );
+    }
+    printf( "\n" );
+    fflush( stdout );
+    abort();
+}
+
+// Runs every check on one descriptor.  Returns the parse error.
+static USB_HID_RPT_DESC_ERROR CheckDescriptor( const BYTE *data, WORD length )
+{
+    PARSE_RESULT    whole;
+    PARSE_RESULT    streamed;
+    const char      *problem;
+
+    // _USBHostHID_Parse_Report() rejects an empty descriptor before parsing.
+    if (length != 0)
+    {
+        GetResult( ParseStreamed( data, length, 0 ), &streamed );
+    }
+    GetResult( ParseWhole( data, length ), &whole );
+    if ((length != 0) && memcmp( &whole, &streamed, sizeof(PARSE_RESULT) ))
+    {
+        printf( "whole: %s, streamed: %s\n", ErrorName( whole.error ), ErrorName( streamed.error ) );
+        Fail( "streamed parse differs from the whole parse", data, length );
+    }
+
+    if (whole.error == HID_ERR)
+    {
+        if ((problem = CheckItems()) != NULL)
+        {
+            Fail( problem, data, length );
+        }
+        if ((problem = CheckImports()) != NULL)
+        {
+            Fail( problem, data, length );
+        }
+    }
+    return whole.error;
+}
+
+
+// *****************************************************************************
+// Section: libFuzzer Entry
+// *****************************************************************************
+
+#ifdef HID_PARSER_LIBFUZZER
+
+int LLVMFuzzerTestOneInput( const unsigned char *data, size_t size )
+{
+    if (size > MAX_DESCRIPTOR)
+    {
+        return 0;
+    }
+
+    // The slices and reports depend only on the input, so crashes reproduce.
+    RandomSeed( size * 2654435761ul + (size ? data[0] : 0) );
+    CheckDescriptor( data, (WORD)size );
+    return 0;
+}
+
+#else
+
+
+// *****************************************************************************
+// Section: Descriptor Corpus
+// *****************************************************************************
+
+typedef struct
+{
+    const char          *name;
+    const BYTE          *data;
+    WORD                length;
+} HID_DESCRIPTOR;
+
+// HID 1.11 Appendix B.2
+static const BYTE bootMouse[] =
+{
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03,
+    0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+    0xC0, 0xC0
+};
+
+// Five buttons and a wheel
+static const BYTE wheelMouse[] =
+{
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x05,
+    0x15, 0x00, 0x25, 0x01, 0x95, 0x05, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x03, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x03,
+    0x81, 0x06, 0xC0, 0xC0
+};
+
+// 12 bit X, Y and wheel packed after the buttons
+static const BYTE wideMouse[] =
+{
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03,
+    0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+    0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x16, 0x01, 0xF8, 0x26, 0xFF, 0x07, 0x75, 0x0C,
+    0x95, 0x03, 0x81, 0x06, 0xC0, 0xC0
+};
+
+// HID 1.11 Appendix B.1
+static const BYTE bootKeyboard[] =
+{
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01,
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+    0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0
+};
+
+// Key bitmap, consumer control and system control, by report ID
+static const BYTE nkroKeyboard[] =
+{
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00,
+    0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x19, 0x00, 0x29, 0x97, 0x95, 0x98, 0x81, 0x02,
+    0xC0,
+    0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x02, 0x19, 0x00, 0x2A, 0x3C, 0x02, 0x15, 0x00, 0x26,
+    0x3C, 0x02, 0x75, 0x10, 0x95, 0x01, 0x81, 0x00, 0xC0,
+    0x05, 0x01, 0x09, 0x80, 0xA1, 0x01, 0x85, 0x03, 0x19, 0x81, 0x29, 0x83, 0x15, 0x00, 0x25, 0x01,
+    0x75, 0x01, 0x95, 0x03, 0x81, 0x02, 0x95, 0x05, 0x81, 0x01, 0xC0
+};
+
+// Four axes, a hat switch in degrees and twelve buttons
+static const BYTE gamepad[] =
+{
+    0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x35, 0x00, 0x46, 0xFF, 0x00,
+    0x75, 0x08, 0x95, 0x04, 0x09, 0x30, 0x09, 0x31, 0x09, 0x32, 0x09, 0x35, 0x81, 0x02, 0x09, 0x39,
+    0x15, 0x00, 0x25, 0x07, 0x35, 0x00, 0x46, 0x3B, 0x01, 0x65, 0x14, 0x75, 0x04, 0x95, 0x01, 0x81,
+    0x42, 0x65, 0x00, 0x75, 0x04, 0x95, 0x01, 0x81, 0x01, 0x05, 0x09, 0x19, 0x01, 0x29, 0x0C, 0x15,
+    0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x0C, 0x81, 0x02, 0x75, 0x01, 0x95, 0x04, 0x81, 0x01, 0xC0
+};
+
+// Nested collections, Push and Pop, string and designator items
+static const BYTE joystick[] =
+{
+    0x05, 0x01, 0x09, 0x04, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81,
+    0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02, 0xC0, 0xA4, 0x05, 0x09, 0x19, 0x01, 0x29, 0x04,
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x04, 0x39, 0x01, 0x89, 0x01, 0x99, 0x04, 0x81, 0x02,
+    0x75, 0x04, 0x95, 0x01, 0x81, 0x01, 0xB4, 0xC0
+};
+
+// Keyboard (report ID 1), mouse (2) and consumer control (3) on one interface
+static const BYTE receiver[] =
+{
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00,
+    0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x06,
+    0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0,
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x02, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01,
+    0x29, 0x03, 0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05,
+    0x81, 0x01, 0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x09, 0x38, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08,
+    0x95, 0x03, 0x81, 0x06, 0xC0, 0xC0,
+    0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x03, 0x15, 0x00, 0x26, 0xFF, 0x03, 0x19, 0x00, 0x2A,
+    0xFF, 0x03, 0x75, 0x10, 0x95, 0x01, 0x81, 0x00, 0xC0
+};
+
+// 64 byte input and output reports and an 8 byte feature report
+static const BYTE vendorDefined[] =
+{
+    0x06, 0x00, 0xFF, 0x09, 0x01, 0xA1, 0x01, 0x09, 0x02, 0x15, 0x00, 0x26, 0xFF, 0x00, 0x75, 0x08,
+    0x95, 0x40, 0x81, 0x02, 0x09, 0x03, 0x95, 0x40, 0x91, 0x02, 0x09, 0x04, 0x95, 0x08, 0xB1, 0x02,
+    0xC0
+};
+
+#define CORPUS_ENTRY(n,d)       { n, d, sizeof(d) }
+
+static const HID_DESCRIPTOR builtInCorpus[] =
+{
+    CORPUS_ENTRY( "boot mouse",      bootMouse ),
+    CORPUS_ENTRY( "wheel mouse",     wheelMouse ),
+    CORPUS_ENTRY( "12 bit mouse",    wideMouse ),
+    CORPUS_ENTRY( "boot keyboard",   bootKeyboard ),
+    CORPUS_ENTRY( "NKRO keyboard",   nkroKeyboard ),
+    CORPUS_ENTRY( "gamepad",         gamepad ),
+    CORPUS_ENTRY( "joystick",        joystick ),
+    CORPUS_ENTRY( "receiver",        receiver ),
+    CORPUS_ENTRY( "vendor defined",  vendorDefined ),
+};
+
+#define BUILT_IN_DESCRIPTORS    (sizeof(builtInCorpus) / sizeof(HID_DESCRIPTOR))
+
+static HID_DESCRIPTOR   corpus[MAX_DESCRIPTORS];
+static unsigned int     corpusSize;
+
+// *****************************************************************************
+// Section: Mutation
+// *****************************************************************************
+
+// Item prefixes most likely to reach the parser's limits and error paths.
+static const BYTE interestingPrefixes[] =
+{
+    0xA1, 0xC0, 0xA4, 0xB4, 0x85, 0x75, 0x95, 0x15, 0x25, 0x19, 0x29, 0x09, 0x05,
+    0x39, 0x49, 0x59, 0x79, 0x89, 0x99, 0x81, 0x91, 0xB1, 0xFE
+};
+
+static const BYTE interestingValues[] = { 0x00, 0x01, 0x07, 0x08, 0x10, 0x20, 0x7F, 0x80, 0xFF };
+
+#define ARRAY_SIZE(a)           (sizeof(a) / sizeof((a)[0]))
+
+static WORD Mutate( BYTE *data, WORD length )
+{
+    const HID_DESCRIPTOR    *pOther;
+    WORD                    at;
+    WORD                    count;
+    int                     mutations;
+
+    for (mutations = 1 + Random() % 4; mutations > 0; mutations--)
+    {
+        at = length ? (WORD)(Random() % length) : 0;
+        switch (Random() % 8)
+        {
+            case 0:     // Flip a bit
+                if (length) data[at] ^= (BYTE)(1 << (Random() % 8));
+                break;
+
+            case 1:     // Set a byte to an interesting value
+                if (length) data[at] = interestingValues[Random() % ARRAY_SIZE(interestingValues)];
+                break;
+
+            case 2:     // Change the data size of an item
+                if (length) data[at] = (data[at] & ~0x03) | (Random() & 0x03);
+                break;
+
+            case 3:     // Delete bytes
+                count = 1 + Random() % 4;
+                if (count > (length - at)) count = length - at;
+                memmove( data + at, data + at + count, length - at - count );
+                length -= count;
+                break;
+
+            case 4:     // Insert an item
+                if (length + 2 <= MAX_DESCRIPTOR)
+                {
+                    memmove( data + at + 2, data + at, length - at );
+                    data[at]     = interestingPrefixes[Random() % ARRAY_SIZE(interestingPrefixes)];
+                    data[at + 1] = interestingValues[Random() % ARRAY_SIZE(interestingValues)];
+                    length += 2;
+                }
+                break;
+
+            case 5:     // Repeat a run of bytes
+                count = 1 + Random() % 32;
+                if (count > (length - at)) count = length - at;
+                if (length + count <= MAX_DESCRIPTOR)
+                {
+                    memmove( data + at + count, data + at, length - at );
+                    length += count;
+                }
+                break;
+
+            case 6:     // Replace the tail with the tail of another descriptor
+                pOther = &corpus[Random() % corpusSize];
+                count  = (WORD)(Random() % (pOther->length + 1));
+                if (at + count > MAX_DESCRIPTOR) count = MAX_DESCRIPTOR - at;
+                memcpy( data + at, pOther->data + pOther->length - count, count );
+                length = at + count;
+                break;
+
+            default:    // Truncate
+                length = at;
+                break;
+        }
+    }
+    return length;
+}
+
+// Valid mutated descriptors are kept and mutated again, so that they can
+// grow until they reach the limits of the parser's pools.
+static BYTE     evolved[EVOLVED_DESCRIPTORS][MAX_DESCRIPTOR];
+static WORD     evolvedLength[EVOLVED_DESCRIPTORS];
+static WORD     evolvedCount;
+
+static int Fuzz( unsigned long iterations )
+{
+    BYTE            data[MAX_DESCRIPTOR];
+    unsigned long   errors[20];
+    unsigned long   n;
+    WORD            length;
+    unsigned int    i;
+    USB_HID_RPT_DESC_ERROR error;
+
+    memset( errors, 0, sizeof(errors) );
+    for (n = 0; n < iterations; n++)
+    {
+        if ((evolvedCount != 0) && (Random() & 1))
+        {
+            i = Random() % evolvedCount;
+            length = evolvedLength[i];
+            memcpy( data, evolved[i], length );
+        }
+        else
+        {
+            i = Random() % corpusSize;
+            length = corpus[i].length;
+            memcpy( data, corpus[i].data, length );
+        }
+        length = Mutate( data, length );
+
+        error = CheckDescriptor( data, length );
+        errors[((unsigned int)error < ARRAY_SIZE(errors)) ? error : 0] ++;
+
+        if (error == HID_ERR)
+        {
+            i = (evolvedCount < EVOLVED_DESCRIPTORS) ? evolvedCount++ : Random() % EVOLVED_DESCRIPTORS;
+            evolvedLength[i] = length;
+            memcpy( evolved[i], data, length );
+        }
+    }
+
+    printf( "\n%lu mutated descriptors, all checks passed\n", iterations );
+    for (i = 0; i < ARRAY_SIZE(errors); i++)
+    {
+        if (errors[i] != 0)
+        {
+            printf( "  %-26s %10lu\n", ErrorName( (USB_HID_RPT_DESC_ERROR)i ), errors[i] );
+        }
+    }
+    return 0;
+}
+
+
+// *****************************************************************************
+// Section: Benchmark
+// *****************************************************************************
+
+// Bytes of the parser's pools that the parsed descriptor uses.
+static unsigned long MemoryUsed( void )
+{
+    return (unsigned long)deviceRptInfo.collections * sizeof(HID_COLLECTION) +
+           (unsigned long)deviceRptInfo.reportItems * sizeof(HID_REPORTITEM) +
+           (unsigned long)deviceRptInfo.reports * sizeof(HID_REPORT) +
+           (unsigned long)deviceRptInfo.usageItems * sizeof(HID_USAGEITEM) +
+           (unsigned long)deviceRptInfo.stringItems * sizeof(HID_STRINGITEM) +
+           (unsigned long)deviceRptInfo.designatorItems * sizeof(HID_DESIGITEM) +
+           (unsigned long)deviceRptInfo.maxCollectionNesting +
+           (unsigned long)deviceRptInfo.maxGlobalsNesting * sizeof(HID_GLOBALS);
+}
+
+static unsigned long MemoryReserved( void )
+{
+    return (unsigned long)USB_HID_MAX_COLLECTIONS * sizeof(HID_COLLECTION) +
+           (unsigned long)USB_HID_MAX_REPORT_ITEMS * sizeof(HID_REPORTITEM) +
+           (unsigned long)USB_HID_MAX_REPORTS * sizeof(HID_REPORT) +
+           (unsigned long)USB_HID_MAX_USAGE_ITEMS * sizeof(HID_USAGEITEM) +
+           (unsigned long)USB_HID_MAX_STRING_ITEMS * sizeof(HID_STRINGITEM) +
+           (unsigned long)USB_HID_MAX_DESIGNATOR_ITEMS * sizeof(HID_DESIGITEM) +
+           (unsigned long)USB_HID_MAX_COLLECTION_NESTING +
+           (unsigned long)USB_HID_MAX_GLOBALS_NESTING * sizeof(HID_GLOBALS);
+}
+
+static double Now( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+// Times the import of every input field of the parsed descriptor.  Returns
+// the time per field in ns, and 0 if there is nothing to import.
+static double TimeImports( unsigned long iterations, BOOL useProgram )
+{
+    HID_DATA_DETAILS    details[USB_HID_MAX_REPORT_ITEMS];
+    BYTE                *reports[USB_HID_MAX_REPORT_ITEMS];
+    HID_USER_DATA_SIZE  data[256];
+    unsigned long       fields = 0;
+    unsigned long       n;
+    double              start;
+    double              time;
+    int                 items = 0;
+    int                 i;
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+    HID_IMPORT_PROGRAM  programs[USB_HID_MAX_REPORT_ITEMS];
+    HID_DATA_DETAILS    *pDetails;
+#endif
+
+    for (i = 0; i < deviceRptInfo.reportItems; i++)
+    {
+        if (GetDataDetails( &itemListPtrs.reportItemList[i], &details[items] ))
+        {
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+            pDetails = &details[items];
+            if (useProgram && !USBHostHID_ApiCompileImport( &programs[items], &pDetails, 1 ))
+            {
+                continue;
+            }
+#endif
+            reports[items] = (BYTE *)malloc( details[items].reportLength );
+            RandomReport( reports[items], &details[items] );
+            fields += details[items].count;
+            items ++;
+        }
+    }
+    if (fields == 0)
+    {
+        return 0;
+    }
+
+    start = Now();
+    for (n = 0; n < iterations; n++)
+    {
+        for (i = 0; i < items; i++)
+        {
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+            if (useProgram)
+            {
+                USBHostHID_ApiImportReport( reports[i], details[i].reportLength, data, &programs[i] );
+                continue;
+            }
+#endif
+            USBHostHID_ApiImportData( reports[i], details[i].reportLength, data, &details[i] );
+        }
+    }
+    time = (Now() - start) / ((double)iterations * fields);
+
+    for (i = 0; i < items; i++)
+    {
+        free( reports[i] );
+    }
+    return time;
+}
+
+static void PrintTime( double time )
+{
+    if (time == 0)
+    {
+        printf( " %8s", "-" );      // Nothing could be imported
+    }
+    else
+    {
+        printf( " %8.1f", time );
+    }
+}
+
+static void Benchmark( unsigned long iterations )
+{
+    const HID_DESCRIPTOR    *pDescriptor;
+    USB_HID_RPT_DESC_ERROR  error;
+    unsigned long           n;
+    double                  start;
+    double                  parseTime;
+    double                  streamTime;
+    unsigned int            i;
+
+    printf( "Parser pools: %lu bytes (%u collections, %u report items, %u reports, %u usages)\n",
+            MemoryReserved(), USB_HID_MAX_COLLECTIONS, USB_HID_MAX_REPORT_ITEMS, USB_HID_MAX_REPORTS,
+            USB_HID_MAX_USAGE_ITEMS );
+    printf( "%lu iterations, times in ns\n\n", iterations );
+    printf( "%-18s %5s %-16s %4s %4s %4s %4s %6s %8s %7s %8s %8s %8s\n",
+            "descriptor", "bytes", "result", "coll", "item", "rpt", "use", "memory",
+            "parse", "/byte", "streamed", "import", "program" );
+
+    for (i = 0; i < corpusSize; i++)
+    {
+        pDescriptor = &corpus[i];
+        error = CheckDescriptor( pDescriptor->data, pDescriptor->length );
+
+        start = Now();
+        for (n = 0; n < iterations; n++)
+        {
+            _USBHostHID_Parse_Report( (BYTE *)pDescriptor->data, pDescriptor->length, POLL_RATE, 0 );
+        }
+        parseTime = (Now() - start) / iterations;
+
+        start = Now();
+        for (n = 0; n < iterations; n++)
+        {
+            ParseStreamed( pDescriptor->data, pDescriptor->length, PACKET_SIZE );
+        }
+        streamTime = (Now() - start) / iterations;
+
+        printf( "%-18.18s %5u %-16.16s", pDescriptor->name, pDescriptor->length, ErrorName( error ) );
+        if (error == HID_ERR)
+        {
+            printf( " %4u %4u %4u %4u %6lu", deviceRptInfo.collections, deviceRptInfo.reportItems,
+                    deviceRptInfo.reports, deviceRptInfo.usageItems, MemoryUsed() );
+        }
+        else
+        {
+            printf( " %4s %4s %4s %4s %6s", "-", "-", "-", "-", "-" );
+        }
+        printf( " %8.0f %7.1f %8.0f", parseTime, parseTime / pDescriptor->length, streamTime );
+        if (error == HID_ERR)
+        {
+            PrintTime( TimeImports( iterations, FALSE ) );
+            #ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+                PrintTime( TimeImports( iterations, TRUE ) );
+            #endif
+        }
+        printf( "\n" );
+    }
+    printf( "\nimport and program: ns per field extracted, - if no field fits\n" );
+}
+
+
+// *****************************************************************************
+// Section: Main
+// *****************************************************************************
+
+static void AddBuiltInCorpus( void )
+{
+    for (corpusSize = 0; corpusSize < BUILT_IN_DESCRIPTORS; corpusSize++)
+    {
+        corpus[corpusSize] = builtInCorpus[corpusSize];
+    }
+}
+
+static int AddFile( const char *path )
+{
+    FILE    *file;
+    BYTE    *data;
+    size_t  length;
+
+    if (corpusSize >= MAX_DESCRIPTORS)
+    {
+        fprintf( stderr, "%s: too many descriptors\n", path );
+        return 0;
+    }
+    if ((file = fopen( path, "rb" )) == NULL)
+    {
+        perror( path );
+        return 0;
+    }
+    data   = (BYTE *)malloc( MAX_DESCRIPTOR );
+    length = fread( data, 1, MAX_DESCRIPTOR, file );
+    fclose( file );
+
+    corpus[corpusSize].name   = strrchr( path, '/' ) ? strrchr( path, '/' ) + 1 : path;
+    corpus[corpusSize].data   = data;
+    corpus[corpusSize].length = (WORD)length;
+    corpusSize ++;
+    return 1;
+}
+
+static int WriteCorpus( const char *directory )
+{
+    char            path[512];
+    char            *p;
+    FILE            *file;
+    unsigned int    i;
+
+    for (i = 0; i < BUILT_IN_DESCRIPTORS; i++)
+    {
+        snprintf( path, sizeof(path), "%s/%s.bin", directory, builtInCorpus[i].name );
+        for (p = path + strlen( directory ) + 1; *p; p++)
+        {
+            if (*p == ' ') *p = '_';
+        }
+        if ((file = fopen( path, "wb" )) == NULL)
+        {
+            perror( path );
+            return 1;
+        }
+        fwrite( builtInCorpus[i].data, 1, builtInCorpus[i].length, file );
+        fclose( file );
+    }
+    printf( "%u descriptors written to %s\n", (unsigned int)BUILT_IN_DESCRIPTORS, directory );
+    return 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    unsigned long   iterations = DEFAULT_ITERATIONS;
+    unsigned long   fuzzIterations = 0;
+    int             i;
+
+    AddBuiltInCorpus();
+    for (i = 1; i < argc; i++)
+    {
+        if ((strcmp( argv[i], "-n" ) == 0) && (i + 1 < argc))
+        {
+            iterations = strtoul( argv[++i], NULL, 0 );
+        }
+        else if ((strcmp( argv[i], "-f" ) == 0) && (i + 1 < argc))
+        {
+            fuzzIterations = strtoul( argv[++i], NULL, 0 );
+        }
+        else if ((strcmp( argv[i], "-s" ) == 0) && (i + 1 < argc))
+        {
+            RandomSeed( strtoul( argv[++i], NULL, 0 ) );
+        }
+        else if ((strcmp( argv[i], "-w" ) == 0) && (i + 1 < argc))
+        {
+            return WriteCorpus( argv[++i] );
+        }
+        else if (argv[i][0] == '-')
+        {
+            fprintf( stderr, "usage: %s [-n iterations] [-f fuzz_iterations] [-s seed] [-w directory] [descriptor files]\n", argv[0] );
+            return 2;
+        }
+        else if (!AddFile( argv[i] ))
+        {
+            return 1;
+        }
+    }
+
+    if (iterations != 0)
+    {
+        Benchmark( iterations );
+    }
+    if (fuzzIterations != 0)
+    {
+        return Fuzz( fuzzIterations );
+    }
+    return 0;
+}
+
+#endif
+
+// The host stack is linked in for the import functions; it never runs.
+BOOL USB_ApplicationEventHandler( BYTE address, USB_EVENT event, void *data, DWORD size )
+{
+    (void)address;
+    (void)event;
+    (void)data;
+    (void)size;
+    return FALSE;
+}
@@ -0,0 +1,487 @@
+/******************************************************************************
+
+    SPI Link Test
+
+Runs spi_link.c on the development machine against a stand-in for the SPI2
+and DMA channel 0 registers, and checks the transmit ring:
+
+    - A cursor frame sent to a full ring replaces the newest queued frame
+      when that is a cursor frame too, and is the one sent in its place.
+    - Any other frame sent to a full ring is refused and nothing changes.
+    - A DMA block never runs past the end of the ring, never holds the
+      whole ring, and a block after one that ended at the end of the ring
+      starts again at its beginning.
+    - Frames come out of the DMA channel in the order they were queued,
+      and none is changed while the DMA channel owns it.
+
+The fixed cases are followed by a random run of sends and DMA completions
+checked against a model of the ring.  The registers are plain latches: the
+program decides when a DMA block completes, by copying the block out of
+memory and raising the block complete flag, so the ring is tested with the
+channel running as slow or as fast as the test needs.
+
+The ring depth is SPI_LINK_QUEUE_DEPTH from spi_link.h.  Build and run from
+the usbmouse directory on the development machine:
+
+    gcc -g -Wall -fsanitize=address,undefined -no-pie \
+        -D__PIC32MX__ -DUSB_HOST_SIMULATOR -ISim -I. -IInclude \
+        -o spi_link_test Tools/spi_link_test.c spi_link.c
+    ./spi_link_test
+
+It prints the result of each case and exits with 1 if any check failed.
+
+ File Name:       spi_link_test.c
+ Dependencies:    spi_link.c, Sim/p32xxxx.h
+ Processor:       Development host
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "GenericTypeDefs.h"
+#include <p32xxxx.h>
+#include "spi_link.h"
+
+
+// *****************************************************************************
+// Section: Constants
+// *****************************************************************************
+
+#define FRAME_BYTES             (sizeof(SPI_LINK_FRAME))
+#define STATUS_WORD             0x5A1401E0ul    // Mode 0, 640 x 480
+#define RANDOM_STEPS            100000
+#define MAX_PENDING             (SPI_LINK_QUEUE_DEPTH + 1)
+
+
+// *****************************************************************************
+// Section: Registers
+// *****************************************************************************
+
+// Every register is a plain latch.  Writes to the CLR and SET aliases are
+// applied to their register on the next access, as on the PIC32.  SPI2BUF
+// always reads back the FPGA's status word, with SPI2STAT saying a word has
+// arrived, so SPILinkInitialize() finds the mode straight away.
+static volatile unsigned int registers[SIM_NUM_REGISTERS];
+
+static void ApplyAlias( SIM_REGISTER reg, SIM_REGISTER clr, SIM_REGISTER set )
+{
+    registers[reg]  &= ~registers[clr];
+    registers[reg]  |= registers[set];
+    registers[clr]  = 0;
+    registers[set]  = 0;
+}
+
+static void ApplyWrites( void )
+{
+    ApplyAlias( SIM_DCH0CON, SIM_DCH0CONCLR, SIM_DCH0CONSET );
+    ApplyAlias( SIM_DCH0ECON, SIM_DCH0ECONCLR, SIM_DCH0ECONSET );
+    ApplyAlias( SIM_DCH0INT, SIM_DCH0INTCLR, SIM_DCH0INTSET );
+}
+
+volatile void * USBSimRegister( SIM_REGISTER reg )
+{
+    ApplyWrites();
+
+    if (reg == SIM_SPI2BUF)
+    {
+        registers[reg] = STATUS_WORD;
+    }
+    else if (reg == SIM_SPI2STAT)
+    {
+        registers[reg] = 0x01;                  // SPIRBF
+    }
+
+    return &registers[reg];
+}
+
+
+// *****************************************************************************
+// Section: Checks
+// *****************************************************************************
+
+static int failures;
+static int caseFailures;
+
+#define CHECK(c)    Check( (c), #c, __LINE__ )
+
+static void Check( BOOL condition, const char *text, int line )
+{
+    if (!condition)
+    {
+        printf( "    line %d: %s\n", line, text );
+        caseFailures++;
+    }
+}
+
+static void BeginCase( const char *name )
+{
+    printf( "%s\n", name );
+    caseFailures = 0;
+}
+
+static void EndCase( void )
+{
+    printf( "    %s\n", caseFailures ? "FAILED" : "ok" );
+    failures += caseFailures;
+}
+
+
+// *****************************************************************************
+// Section: DMA Channel
+// *****************************************************************************
+
+// The block the DMA channel was given, copied when it was started, and the
+// frames it has sent so far.
+static DWORD        ringStart;          // Address of the first frame of the ring, 0 until found
+static DWORD        blockAddress;
+static int          blockFrames;
+static SPI_LINK_FRAME   block[SPI_LINK_QUEUE_DEPTH];
+static int          blocksStarted;
+static int          blocksWrapped;      // Blocks at the start of the ring after one that ended at its end
+static DWORD        lastBlockEnd;
+static SPI_LINK_FRAME   sent[RANDOM_STEPS + 16];
+static int          sentFrames;
+
+// Takes note of a block the link has just started.  The ring is found from
+// the very first block, which the link starts at the first frame of the
+// ring, and every block is checked against it.
+static void DmaWatch( void )
+{
+    ApplyWrites();
+
+    if (blockFrames || !(registers[SIM_DCH0CON] & _DCH0CON_CHEN_MASK))
+    {
+        return;
+    }
+
+    blockAddress    = registers[SIM_DCH0SSA];
+    blockFrames     = registers[SIM_DCH0SSIZ] / FRAME_BYTES;
+    if (!ringStart)
+    {
+        ringStart = blockAddress;
+    }
+
+    CHECK( (registers[SIM_DCH0SSIZ] % FRAME_BYTES) == 0 );
+    CHECK( blockFrames >= 1 );
+    CHECK( blockFrames <= (SPI_LINK_QUEUE_DEPTH - 1) );
+    CHECK( blockAddress >= ringStart );
+    CHECK( ((blockAddress - ringStart) % FRAME_BYTES) == 0 );
+    CHECK( (blockAddress + blockFrames * FRAME_BYTES) <= (ringStart + SPI_LINK_QUEUE_DEPTH * FRAME_BYTES) );
+    CHECK( registers[SIM_DCH0DSA] == KVA_TO_PA( &registers[SIM_SPI2BUF] ) );
+    if ((blockFrames < 1) || caseFailures)
+    {
+        blockFrames = 0;
+        return;
+    }
+
+    if ((lastBlockEnd == ringStart + SPI_LINK_QUEUE_DEPTH * FRAME_BYTES) && (blockAddress == ringStart))
+    {
+        blocksWrapped++;
+    }
+    lastBlockEnd = blockAddress + blockFrames * FRAME_BYTES;
+    blocksStarted++;
+
+    memcpy( block, PA_TO_KVA1( blockAddress ), blockFrames * FRAME_BYTES );
+}
+
+// Finishes the block the DMA channel owns, if it has one: the frames must
+// not have changed since the block started.
+static BOOL DmaComplete( void )
+{
+    DmaWatch();
+    if (!blockFrames)
+    {
+        return FALSE;
+    }
+
+    CHECK( memcmp( block, PA_TO_KVA1( blockAddress ), blockFrames * FRAME_BYTES ) == 0 );
+    memcpy( &sent[sentFrames], block, blockFrames * FRAME_BYTES );
+    sentFrames += blockFrames;
+    blockFrames = 0;
+
+    registers[SIM_DCH0CON] &= ~_DCH0CON_CHEN_MASK;
+    registers[SIM_DCH0INT] |= _DCH0INT_CHBCIF_MASK;
+    return TRUE;
+}
+
+static void Reset( void )
+{
+    memset( (void *)registers, 0, sizeof(registers) );
+    ringStart       = 0;
+    blockFrames     = 0;
+    blocksStarted   = 0;
+    blocksWrapped   = 0;
+    lastBlockEnd    = 0;
+    sentFrames      = 0;
+
+    SPILinkInitialize();
+    DmaWatch();
+}
+
+
+// *****************************************************************************
+// Section: Frames
+// *****************************************************************************
+
+// Test frames carry the start of frame marker and a number that identifies
+// them; the link does not look at anything else.
+static SPI_LINK_FRAME MakeFrame( BYTE sof, DWORD number )
+{
+    SPI_LINK_FRAME  frame;
+
+    frame.word[0] = ((DWORD)sof << 24) | (number & 0x00FFFFFF);
+    frame.word[1] = number;
+    return frame;
+}
+
+static BOOL Send( BYTE sof, DWORD number )
+{
+    SPI_LINK_FRAME  frame   = MakeFrame( sof, number );
+    BOOL            queued  = SPILinkSend( &frame );
+
+    DmaWatch();
+    return queued;
+}
+
+static BOOL SentIs( int index, BYTE sof, DWORD number )
+{
+    SPI_LINK_FRAME  frame = MakeFrame( sof, number );
+
+    return (index < sentFrames) && (memcmp( &sent[index], &frame, FRAME_BYTES ) == 0);
+}
+
+static void Drain( void )
+{
+    int     passes;
+
+    for (passes = 0; passes < 4 * SPI_LINK_QUEUE_DEPTH; passes++)
+    {
+        DmaComplete();
+        SPILinkTasks();
+        DmaWatch();
+        if (SPILinkIsIdle())
+        {
+            break;
+        }
+    }
+    CHECK( SPILinkIsIdle() );
+}
+
+
+// *****************************************************************************
+// Section: Fixed Cases
+// *****************************************************************************
+
+// Fills the ring with cursor frames while the first is in DMA, then sends
+// one more: it takes the place of the newest, and the frames in DMA and
+// waiting behind it are untouched.
+static void TestReplaceOnFull( void )
+{
+    const SPI_LINK_STATS    *stats = SPILinkGetStats();
+    DWORD                   n;
+
+    BeginCase( "cursor frame replaces the newest cursor frame of a full ring" );
+    Reset();
+    CHECK( SPILinkGetScreen()->reported && (SPILinkGetScreen()->width == 640) );
+
+    for (n = 0; n < SPI_LINK_QUEUE_DEPTH; n++)
+    {
+        CHECK( Send( SPI_LINK_SOF_CURSOR, n ) );
+    }
+    CHECK( blocksStarted == 1 );
+    CHECK( !Send( SPI_LINK_SOF_CURSOR, 100 ) );
+    CHECK( !Send( SPI_LINK_SOF_CURSOR, 101 ) );
+    CHECK( stats->framesReplaced == 2 );
+    CHECK( stats->framesRefused == 0 );
+    CHECK( stats->framesQueued == SPI_LINK_QUEUE_DEPTH );
+
+    Drain();
+    CHECK( sentFrames == SPI_LINK_QUEUE_DEPTH );
+    for (n = 0; n < (SPI_LINK_QUEUE_DEPTH - 1); n++)
+    {
+        CHECK( SentIs( n, SPI_LINK_SOF_CURSOR, n ) );
+    }
+    CHECK( SentIs( SPI_LINK_QUEUE_DEPTH - 1, SPI_LINK_SOF_CURSOR, 101 ) );
+    CHECK( stats->framesSent == SPI_LINK_QUEUE_DEPTH );
+    EndCase();
+}
+
+// A tile frame is refused by a full ring, and so is a cursor frame when the
+// newest queued frame is a tile; neither changes what is sent.
+static void TestRefuse( void )
+{
+    const SPI_LINK_STATS    *stats = SPILinkGetStats();
+    DWORD                   n;
+
+    BeginCase( "full ring refuses other frames, and cursor frames behind them" );
+    Reset();
+
+    for (n = 0; n < SPI_LINK_QUEUE_DEPTH; n++)
+    {
+        CHECK( Send( SPI_LINK_SOF_CURSOR, n ) );
+    }
+    CHECK( !Send( SPI_LINK_SOF_TILE, 200 ) );
+    CHECK( !Send( SPI_LINK_SOF_SPRITE, 201 ) );
+    CHECK( stats->framesRefused == 2 );
+
+    CHECK( DmaComplete() );
+    CHECK( Send( SPI_LINK_SOF_TILE, 202 ) );
+    CHECK( !Send( SPI_LINK_SOF_CURSOR, 203 ) );
+    CHECK( stats->framesRefused == 3 );
+    CHECK( stats->framesReplaced == 0 );
+
+    Drain();
+    CHECK( sentFrames == SPI_LINK_QUEUE_DEPTH + 1 );
+    for (n = 0; n < SPI_LINK_QUEUE_DEPTH; n++)
+    {
+        CHECK( SentIs( n, SPI_LINK_SOF_CURSOR, n ) );
+    }
+    CHECK( SentIs( SPI_LINK_QUEUE_DEPTH, SPI_LINK_SOF_TILE, 202 ) );
+    EndCase();
+}
+
+// Walks the oldest frame round the ring one slot at a time with the ring
+// kept full, so blocks start at every slot; the ones at the end of the ring
+// must stop there and the next start again at the beginning.
+static void TestBlockWrap( void )
+{
+    const SPI_LINK_STATS    *stats = SPILinkGetStats();
+    DWORD                   n;
+    DWORD                   next    = 0;
+    int                     slot;
+
+    BeginCase( "DMA blocks stop at the end of the ring and wrap to its start" );
+    Reset();
+
+    for (n = 0; n < SPI_LINK_QUEUE_DEPTH; n++)
+    {
+        CHECK( Send( SPI_LINK_SOF_TILE, next++ ) );
+    }
+    for (slot = 0; slot < 3 * SPI_LINK_QUEUE_DEPTH; slot++)
+    {
+        CHECK( DmaComplete() );
+        while (Send( SPI_LINK_SOF_TILE, next ))
+        {
+            next++;
+        }
+    }
+
+    Drain();
+    CHECK( blocksWrapped >= 2 );
+    CHECK( sentFrames == (int)next );
+    CHECK( stats->framesSent == next );
+    for (n = 0; n < next; n++)
+    {
+        CHECK( SentIs( n, SPI_LINK_SOF_TILE, n ) );
+    }
+    EndCase();
+}
+
+
+// *****************************************************************************
+// Section: Random Run
+// *****************************************************************************
+
+static DWORD randomState = 1;
+
+static DWORD Random( void )
+{
+    // xorshift32
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return randomState;
+}
+
+// Sends frames of random kinds and completes DMA blocks at random, keeping
+// the frames the ring should hold, oldest first.  Every result of
+// SPILinkSend() is checked against the model, and every frame the DMA
+// channel sends must be the oldest the model holds.
+static void TestRandom( void )
+{
+    const SPI_LINK_STATS    *stats = SPILinkGetStats();
+    SPI_LINK_FRAME          pending[MAX_PENDING];
+    int                     pendingFrames   = 0;
+    int                     checked         = 0;
+    DWORD                   replaced;
+    DWORD                   refused;
+    DWORD                   step;
+    BOOL                    queued;
+    BYTE                    sof;
+
+    BeginCase( "random sends and DMA completions against a model of the ring" );
+    Reset();
+
+    for (step = 0; (step < RANDOM_STEPS) && !caseFailures; step++)
+    {
+        if ((Random() % 3) == 0)
+        {
+            DmaComplete();
+            SPILinkTasks();
+            DmaWatch();
+        }
+        else
+        {
+            sof         = ((Random() % 4) == 0) ? SPI_LINK_SOF_TILE : SPI_LINK_SOF_CURSOR;
+            replaced    = stats->framesReplaced;
+            refused     = stats->framesRefused;
+            queued      = Send( sof, step );
+
+            if (queued)
+            {
+                CHECK( pendingFrames < SPI_LINK_QUEUE_DEPTH );
+                pending[pendingFrames++] = MakeFrame( sof, step );
+            }
+            else if (stats->framesReplaced != replaced)
+            {
+                CHECK( pendingFrames == SPI_LINK_QUEUE_DEPTH );
+                CHECK( sof == SPI_LINK_SOF_CURSOR );
+                CHECK( (pending[pendingFrames - 1].word[0] >> 24) == SPI_LINK_SOF_CURSOR );
+                pending[pendingFrames - 1] = MakeFrame( sof, step );
+            }
+            else
+            {
+                CHECK( stats->framesRefused == refused + 1 );
+                CHECK( pendingFrames == SPI_LINK_QUEUE_DEPTH );
+                CHECK( (sof != SPI_LINK_SOF_CURSOR) ||
+                       ((pending[pendingFrames - 1].word[0] >> 24) != SPI_LINK_SOF_CURSOR) );
+            }
+        }
+
+        while ((checked < sentFrames) && (pendingFrames > 0))
+        {
+            CHECK( memcmp( &sent[checked], &pending[0], FRAME_BYTES ) == 0 );
+            memmove( &pending[0], &pending[1], --pendingFrames * FRAME_BYTES );
+            checked++;
+        }
+        CHECK( checked == sentFrames );
+    }
+
+    printf( "    %u steps, %d frames sent in %d blocks, %d wrapped, %u replaced, %u refused\n",
+            (unsigned int)step, sentFrames, blocksStarted, blocksWrapped,
+            (unsigned int)stats->framesReplaced, (unsigned int)stats->framesRefused );
+    CHECK( blocksWrapped > 0 );
+    CHECK( stats->framesReplaced > 0 );
+    CHECK( stats->framesRefused > 0 );
+    EndCase();
+}
+
+
+// *****************************************************************************
+// Section: Main
+// *****************************************************************************
+
+int main( void )
+{
+    printf( "SPI link ring of %d frames\n", SPI_LINK_QUEUE_DEPTH );
+
+    TestReplaceOnFull();
+    TestRefuse();
+    TestBlockWrap();
+    TestRandom();
+
+    printf( "%s\n", failures ? "FAILED" : "PASSED" );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,291 @@
+/******************************************************************************
+
+    USB Traffic Capture to pcap Converter
+
+Converts the USB traffic capture printed on the UART2 console by the mouse
+application ('p' command) into a pcap file that Wireshark opens as Linux
+usbmon traffic (LINKTYPE_USB_LINUX), so the stack's own view of the bus can
+be read with Wireshark's USB dissectors.
+
+Every token the host sends becomes a submit ('S') packet and its result a
+complete ('C') packet with the same URB id.  The result maps to the status
+usbmon would report: 0 for ACK or data, -EAGAIN for NAK, -EPIPE for STALL,
+and -EPROTO for a bus error.  Only the first USB_CAPTURE_DATA_SIZE bytes of
+each packet are in the capture, so len_cap may be less than length.
+
+Lines that do not start with "USBCAP" (after any prefix added by the
+terminal program) are ignored, so a whole console log can be converted.
+Records that appear in more than one dump are written once.
+
+Build and run on the development machine:
+
+    gcc -O2 -o usb_capture_pcap Tools/usb_capture_pcap.c
+    ./usb_capture_pcap console.log capture.pcap
+
+ File Name:       usb_capture_pcap.c
+ Dependencies:    None
+ Processor:       Development host
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// *****************************************************************************
+// Section: Constants
+// *****************************************************************************
+
+#define LINKTYPE_USB_LINUX      189         // 48 byte usbmon header
+#define USBMON_HEADER_SIZE      48
+#define MAX_DATA                64          // Most data bytes on a record line
+
+#define PID_SETUP               0x0D
+#define PID_NAK                 0x0A
+#define PID_STALL               0x0E
+
+#define STATUS_EINPROGRESS      (-115)
+#define STATUS_EAGAIN           (-11)
+#define STATUS_EPIPE            (-32)
+#define STATUS_EPROTO           (-71)
+
+
+// *****************************************************************************
+// Section: Capture Records
+// *****************************************************************************
+
+typedef struct
+{
+    unsigned long       sequence;
+    unsigned long       time;
+    char                event;
+    unsigned int        transferType;
+    unsigned int        address;
+    unsigned int        endpoint;
+    unsigned int        pid;
+    unsigned int        error;
+    unsigned int        length;
+    unsigned int        captured;
+    unsigned char       data[MAX_DATA];
+} CAPTURE_RECORD;
+
+typedef struct
+{
+    FILE                *file;
+    unsigned long       ticksPerSecond;
+    int                 haveRecords;
+    unsigned long       lastSequence;       // Last record written
+    unsigned long       lastTime;           // Timestamp of the last record
+    unsigned long long  timeHigh;           // Timestamp wraps so far, << 32
+    unsigned long long  id;                 // URB id of the last token
+    unsigned long       packets;
+} PCAP_WRITER;
+
+
+// *****************************************************************************
+// Section: pcap Output
+// *****************************************************************************
+
+static void PutLE( unsigned char *p, unsigned long long value, int size )
+{
+    int i;
+
+    for (i = 0; i < size; i++)
+    {
+        p[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void WriteFileHeader( FILE *file )
+{
+    unsigned char header[24];
+
+    PutLE( &header[0],  0xA1B2C3D4ul, 4 );      // Magic, microsecond timestamps
+    PutLE( &header[4],  2, 2 );                 // Version 2.4
+    PutLE( &header[6],  4, 2 );
+    PutLE( &header[8],  0, 4 );                 // GMT offset
+    PutLE( &header[12], 0, 4 );                 // Timestamp accuracy
+    PutLE( &header[16], 65535, 4 );             // Snapshot length
+    PutLE( &header[20], LINKTYPE_USB_LINUX, 4 );
+    fwrite( header, 1, sizeof(header), file );
+}
+
+// Maps the bmAttributes transfer type to the usbmon one.
+static unsigned char UsbmonTransferType( unsigned int transferType )
+{
+    static const unsigned char map[4] = { 2, 0, 3, 1 };   // Control, isochronous, bulk, interrupt
+
+    return map[transferType & 0x03];
+}
+
+static int CompleteStatus( const CAPTURE_RECORD *pRecord )
+{
+    if (pRecord->error != 0)
+    {
+        return STATUS_EPROTO;
+    }
+    switch (pRecord->pid)
+    {
+        case PID_NAK:
+            return STATUS_EAGAIN;
+        case PID_STALL:
+            return STATUS_EPIPE;
+        case 0:
+            return STATUS_EPROTO;               // No handshake at all
+        default:
+            return 0;
+    }
+}
+
+static void WriteRecord( PCAP_WRITER *pWriter, const CAPTURE_RECORD *pRecord )
+{
+    unsigned char       header[16];
+    unsigned char       usbmon[USBMON_HEADER_SIZE];
+    unsigned long long  ticks;
+    unsigned long long  seconds;
+    unsigned long       microseconds;
+    unsigned int        captured;
+    int                 isSetup;
+
+    // Unwrap the 32-bit timestamp.
+    if (pWriter->haveRecords && (pRecord->time < pWriter->lastTime))
+    {
+        pWriter->timeHigh += 0x100000000ull;
+    }
+    pWriter->lastTime = pRecord->time;
+    ticks        = pWriter->timeHigh + pRecord->time;
+    seconds      = ticks / pWriter->ticksPerSecond;
+    microseconds = (unsigned long)(((ticks % pWriter->ticksPerSecond) * 1000000ull) / pWriter->ticksPerSecond);
+
+    if ((pRecord->event == 'S') || !pWriter->haveRecords)
+    {
+        pWriter->id = pRecord->sequence;
+    }
+    isSetup  = (pRecord->event == 'S') && (pRecord->pid == PID_SETUP);
+    captured = isSetup ? 0 : pRecord->captured;
+
+    memset( usbmon, 0, sizeof(usbmon) );
+    PutLE( &usbmon[0], pWriter->id, 8 );
+    usbmon[8]  = (unsigned char)pRecord->event;
+    usbmon[9]  = UsbmonTransferType( pRecord->transferType );
+    usbmon[10] = (unsigned char)pRecord->endpoint;
+    usbmon[11] = (unsigned char)pRecord->address;
+    PutLE( &usbmon[12], 1, 2 );                 // Bus number
+    usbmon[14] = isSetup ? 0 : '-';
+    usbmon[15] = captured ? 0 : ((pRecord->endpoint & 0x80) ? '<' : '>');
+    PutLE( &usbmon[16], seconds, 8 );
+    PutLE( &usbmon[24], microseconds, 4 );
+    PutLE( &usbmon[28], (unsigned long)((pRecord->event == 'S') ? STATUS_EINPROGRESS : CompleteStatus( pRecord )), 4 );
+    PutLE( &usbmon[32], isSetup ? 0 : pRecord->length, 4 );
+    PutLE( &usbmon[36], captured, 4 );
+    if (isSetup)
+    {
+        memcpy( &usbmon[40], pRecord->data, (pRecord->captured < 8) ? pRecord->captured : 8 );
+    }
+
+    PutLE( &header[0],  seconds, 4 );
+    PutLE( &header[4],  microseconds, 4 );
+    PutLE( &header[8],  USBMON_HEADER_SIZE + captured, 4 );
+    PutLE( &header[12], USBMON_HEADER_SIZE + captured, 4 );
+    fwrite( header, 1, sizeof(header), pWriter->file );
+    fwrite( usbmon, 1, sizeof(usbmon), pWriter->file );
+    fwrite( pRecord->data, 1, captured, pWriter->file );
+
+    pWriter->haveRecords  = 1;
+    pWriter->lastSequence = pRecord->sequence;
+    pWriter->packets ++;
+}
+
+
+// *****************************************************************************
+// Section: Console Log Parsing
+// *****************************************************************************
+
+// Parses "USBCAP <seq> <time> <S|C> <type> <addr> <ep> <pid> <error> <length> <data...>".
+static int ParseRecord( const char *line, CAPTURE_RECORD *pRecord )
+{
+    int             used;
+    unsigned int    byte;
+
+    memset( pRecord, 0, sizeof(CAPTURE_RECORD) );
+    if (sscanf( line, "USBCAP %lu %lx %c %u %u %x %x %x %u%n",
+                &pRecord->sequence, &pRecord->time, &pRecord->event,
+                &pRecord->transferType, &pRecord->address, &pRecord->endpoint,
+                &pRecord->pid, &pRecord->error, &pRecord->length, &used ) != 9)
+    {
+        return 0;
+    }
+    if ((pRecord->event != 'S') && (pRecord->event != 'C'))
+    {
+        return 0;
+    }
+
+    line += used;
+    while ((pRecord->captured < MAX_DATA) && (sscanf( line, " %2x%n", &byte, &used ) == 1))
+    {
+        pRecord->data[pRecord->captured++] = (unsigned char)byte;
+        line += used;
+    }
+    return 1;
+}
+
+int main( int argc, char *argv[] )
+{
+    FILE            *input;
+    PCAP_WRITER     writer;
+    CAPTURE_RECORD  record;
+    char            line[512];
+    char            *start;
+
+    if (argc != 3)
+    {
+        fprintf( stderr, "usage: %s console.log capture.pcap\n", argv[0] );
+        return 2;
+    }
+
+    input = fopen( argv[1], "r" );
+    if (input == NULL)
+    {
+        perror( argv[1] );
+        return 1;
+    }
+
+    memset( &writer, 0, sizeof(writer) );
+    writer.file = fopen( argv[2], "wb" );
+    if (writer.file == NULL)
+    {
+        perror( argv[2] );
+        fclose( input );
+        return 1;
+    }
+    WriteFileHeader( writer.file );
+
+    while (fgets( line, sizeof(line), input ) != NULL)
+    {
+        start = strstr( line, "USBCAP " );
+        if (start == NULL)
+        {
+            continue;
+        }
+        if (sscanf( start, "USBCAP BEGIN %lu", &writer.ticksPerSecond ) == 1)
+        {
+            continue;
+        }
+        if (!ParseRecord( start, &record ) || (writer.ticksPerSecond == 0))
+        {
+            continue;
+        }
+        if (writer.haveRecords && (record.sequence <= writer.lastSequence))
+        {
+            continue;
+        }
+        WriteRecord( &writer, &record );
+    }
+
+    fclose( input );
+    fclose( writer.file );
+    printf( "%lu packets written to %s\n", writer.packets, argv[2] );
+    return 0;
+}
@@ -39,6 +39,11 @@ extra RAM.
 Since HID transfers are performed with interrupt taransfers,
 USB_SUPPORT_INTERRUPT_TRANSFERS must be defined.
 
+Defining USB_HID_ENABLE_REPORT_PIPELINE on top of USB_ENABLE_TRANSFER_EVENT
+makes the driver own the interrupt IN endpoint of the first interface: a read
+is armed as soon as the device is running and re-armed from every completion
+event, with the SIE writing straight into a per-device report queue.
+
 FileName:        usb_host_hid.c
 Dependencies:    None
 Processor:       PIC24/dsPIC30/dsPIC33/PIC32MX
@@ -87,9 +92,12 @@ CONSEQUENTIAL DAMAGES, FOR ANY REASON WHATSOEVER.
 #include "GenericTypeDefs.h"
 #include "HardwareProfile.h"
 #include "usb_config.h"
-#include "USB\usb.h"
-#include "USB\usb_host_hid.h"
-#include "USB\usb_host_hid_parser.h"
+#include "USB/usb.h"
+#include "USB/usb_host_hid.h"
+#include "USB/usb_host_hid_parser.h"
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+    #include "struct_queue.h"
+#endif
 
 //#define DEBUG_MODE
 #ifdef DEBUG_MODE
@@ -114,6 +122,10 @@ Currently this must be set to 1, due to limitations in the USB Host layer.
     #define USB_MAX_HID_DEVICES        1
 #endif
 
+#if defined( USB_HID_ENABLE_REPORT_PIPELINE ) && !defined( USB_ENABLE_TRANSFER_EVENT )
+    #error "USB_HID_ENABLE_REPORT_PIPELINE requires USB_ENABLE_TRANSFER_EVENT"
+#endif
+
 // *****************************************************************************
 // *****************************************************************************
 // Constants
@@ -222,6 +234,19 @@ typedef struct _USB_HID_INTERFACE_DETAILS
     BYTE                                endpointPollInterval; // Polling rate of corresponding interface.
 }   USB_HID_INTERFACE_DETAILS;
 
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+/*
+   Queue of pipelined reports.  See "struct_queue.h" for usage and operations.
+*/
+typedef struct _USB_HID_PIPELINE_QUEUE
+{
+    int                                 head;
+    int                                 tail;
+    int                                 count;
+    HID_PIPELINE_REPORT                 buffer[USB_HID_PIPELINE_DEPTH];
+}   USB_HID_PIPELINE_QUEUE;
+#endif
+
 /*
    This structure is used to hold information about device common to all the interfaces
 */
@@ -241,6 +266,7 @@ typedef struct _USB_HID_DEVICE_INFO
             BYTE                        bfClearDataIN        : 1;   // Flag indicating to clear the IN endpoint.
             BYTE                        bfClearDataOUT       : 1;   // Flag indicating to clear the OUT endpoint.
             BYTE                        breportDataCollected : 1;   // Flag indicationg report data is collected ny application
+            BYTE                        bfPipelineArmed      : 1;   // Flag indicating a pipelined read is outstanding.
         };
         BYTE                            val;
     }                                   flags;
@@ -253,8 +279,30 @@ typedef struct _USB_HID_DEVICE_INFO
     BYTE                                bytesTransferred;      // Number of bytes transferred to/from the user's data buffer.
     BYTE                                reportSize;            // Size of report currently requested for transfer.
     BYTE                                endpointDATA;          // Endpoint to use for the current transfer.
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+    BYTE                                pipelineEndpoint;      // Interrupt IN endpoint owned by the pipeline, 0 if none.
+    BYTE                                pipelineInterface;     // Interface number of the pipelined endpoint.
+    BYTE                                pipelineSize;          // Byte count requested for each pipelined read.
+    USB_HID_PIPELINE_QUEUE              pipelineQueue;         // Reports received and not yet collected.
+#endif
 } USB_HID_DEVICE_INFO;
 
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+/*
+   Parsed report descriptor of an interface seen before, see _USBHostHID_Parse_Save().
+*/
+typedef struct _USB_HID_REPORT_CACHE_ENTRY
+{
+    WORD                                vid;                   // Key: vendor ID of the device.
+    WORD                                pid;                   // Key: product ID of the device.
+    WORD                                bcdDevice;             // Key: release number of the device.
+    WORD                                sizeOfRptDescriptor;   // Key: length of the report descriptor.
+    BYTE                                interfaceNumber;       // Key: interface number.
+    WORD                                length;                // Bytes of parse in data, 0 if the entry is empty.
+    BYTE                                data[USB_HID_REPORT_CACHE_SIZE];
+} USB_HID_REPORT_CACHE_ENTRY;
+#endif
+
 
 
 
@@ -265,6 +313,31 @@ typedef struct _USB_HID_DEVICE_INFO
 //******************************************************************************
 void _USBHostHID_FreeRptDecriptorDataMem(BYTE deviceAddress);
 void _USBHostHID_ResetStateJump( BYTE i );
+BYTE _USBHostHID_GetReportDescriptor( BYTE i );
+USB_HID_RPT_DESC_ERROR _USBHostHID_ParseReportDescriptor( BYTE i );
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+    void _USBHostHID_StreamReportDescriptor( BYTE i );
+#endif
+#ifdef USB_ENABLE_TRANSFER_EVENT
+    void _USBHostHID_ReportDescriptorParsed( BYTE i );
+#endif
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+    BOOL _USBHostHID_ReportCacheRestore( BYTE i );
+    void _USBHostHID_ReportCacheStore( BYTE i );
+#endif
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+    void _USBHostHID_PipelineArm( BYTE i );
+#endif
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+    BOOL _USBHostHID_CompileImportOp( HID_IMPORT_OP *pOp, WORD start, BYTE bitLength, BOOL signExtend, WORD reportLength );
+    void _USBHostHID_RunImport( BYTE *report, HID_IMPORT_OP *pOp, BYTE fields, HID_USER_DATA_SIZE *buffer );
+#endif
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+    void _USBHostHID_FieldUsage( HID_REPORTITEM *pItem, BYTE index, HID_ROUTE_FIELD *pField );
+    BYTE _USBHostHID_ItemApplication( HID_REPORTITEM *pItem, const HID_ROUTE_APPLICATION *pApplications, BYTE applications );
+    BOOL _USBHostHID_AddRoute( HID_ROUTE_TABLE *pTable, WORD reportIndex, const HID_ROUTE_APPLICATION *pApplications,
+                               BYTE application, BYTE applications );
+#endif
 
 
 //******************************************************************************
@@ -330,15 +403,29 @@ static USB_HID_INTERFACE_DETAILS*   pCurrInterfaceDetails = NULL;
     static HID_TRANSFER_DATA            transferEventData;
 #endif
 
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+    static BYTE                         rptDescriptorWindow[USB_HID_REPORT_DESCRIPTOR_WINDOW];
+#endif
+
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+    static USB_HID_REPORT_CACHE_ENTRY   reportCache[USB_HID_REPORT_CACHE_ENTRIES];     // Parses of recently seen interfaces.
+    static BYTE                         reportCacheNext;                                // Entry to replace when the cache is full.
+#endif
+
 //******************************************************************************
 //******************************************************************************
 // Section: HID Host External Variables
 //******************************************************************************
 //******************************************************************************
 
-extern BYTE* parsedDataMem;
-
 extern USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE*, WORD, WORD, BYTE);
+extern void _USBHostHID_Parse_Begin(WORD, BYTE);
+extern USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Bytes(BYTE*, WORD);
+extern USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_End(void);
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+extern WORD _USBHostHID_Parse_Save(BYTE*, WORD);
+extern void _USBHostHID_Parse_Restore(BYTE*);
+#endif
 
 // *****************************************************************************
 // *****************************************************************************
@@ -492,6 +579,59 @@ BYTE    USBHostHIDDeviceStatus( BYTE deviceAddress )
     }
 }
 
+/*******************************************************************************
+  Function:
+    BOOL USBHostHIDPipelineGetReport( BYTE deviceAddress,
+                HID_PIPELINE_REPORT *report )
+
+  Summary:
+    This function removes the oldest pipelined report from the queue.
+
+  Description:
+    This function copies the oldest report received on the pipelined interrupt
+    IN endpoint into the caller's buffer and removes it from the queue.  If
+    the pipelined read was left unarmed because the queue was full, it is
+    armed again.
+
+  Precondition:
+    USB_HID_ENABLE_REPORT_PIPELINE is defined.
+
+  Parameters:
+    BYTE deviceAddress          - Device address
+    HID_PIPELINE_REPORT *report - Buffer to receive the report
+
+  Return Values:
+    TRUE    - A report was copied to the buffer
+    FALSE   - No device with specified address, or no report is queued
+
+  Remarks:
+    None
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+BOOL USBHostHIDPipelineGetReport( BYTE deviceAddress, HID_PIPELINE_REPORT *report )
+{
+    BYTE    i;
+
+    // Find the correct device.
+    for (i=0; (i<USB_MAX_HID_DEVICES) && (deviceInfoHID[i].ID.deviceAddress != deviceAddress); i++);
+    if ((i == USB_MAX_HID_DEVICES) || (deviceAddress == 0))
+    {
+        return FALSE;
+    }
+
+    if (StructQueueIsEmpty( &deviceInfoHID[i].pipelineQueue, USB_HID_PIPELINE_DEPTH ))
+    {
+        return FALSE;
+    }
+
+    memcpy( report, StructQueueRemove( &deviceInfoHID[i].pipelineQueue, USB_HID_PIPELINE_DEPTH ), sizeof(HID_PIPELINE_REPORT) );
+    _USBHostHID_PipelineArm( i );
+
+    return TRUE;
+}
+#endif
+
+
 /*******************************************************************************
   Function:
     BYTE USBHostHIDResetDevice( BYTE deviceAddress )
@@ -615,7 +755,8 @@ BYTE USBHostHIDResetDeviceWithWait( BYTE deviceAddress  )
     class.  If transfer events from the host layer are not being used, then
     it should be called on a regular basis by the application.  If transfer
     events from the host layer are being used, this function is compiled out,
-    and does not need to be called.
+    and does not need to be called, unless USB_HID_STREAM_REPORT_DESCRIPTOR
+    is defined.  The report descriptor is then parsed here as it arrives.
 
   Precondition:
     USBHostHIDInitialize() has been called.
@@ -631,11 +772,43 @@ BYTE USBHostHIDResetDeviceWithWait( BYTE deviceAddress  )
 *******************************************************************************/
 void USBHostHIDTasks( void )
 {
+#if !defined( USB_ENABLE_TRANSFER_EVENT ) || defined( USB_HID_STREAM_REPORT_DESCRIPTOR ) || defined( USB_HID_REPORT_CACHE_ENTRIES )
+    BYTE    i;
+#endif
 #ifndef USB_ENABLE_TRANSFER_EVENT
     DWORD   byteCount;
     BYTE    errorCode;
-    BYTE    i;
+#endif
+
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+    // Parse what has arrived of a report descriptor, making room in the
+    // window for the rest.
+    for (i=0; i<USB_MAX_HID_DEVICES; i++)
+    {
+        #ifndef USB_ENABLE_TRANSFER_EVENT
+        if (deviceInfoHID[i].state == (STATE_GET_REPORT_DSC | SUBSTATE_WAIT_FOR_REPORT_DSC))
+        #else
+        if (deviceInfoHID[i].state == STATE_WAIT_FOR_REPORT_DSC)
+        #endif
+        {
+            _USBHostHID_StreamReportDescriptor( i );
+        }
+    }
+#endif
+
+#if defined( USB_ENABLE_TRANSFER_EVENT ) && defined( USB_HID_REPORT_CACHE_ENTRIES )
+    // A report descriptor restored from the cache has no transfer event to
+    // finish it.
+    for (i=0; i<USB_MAX_HID_DEVICES; i++)
+    {
+        if (deviceInfoHID[i].state == STATE_PARSING_COMPLETE)
+        {
+            _USBHostHID_ReportDescriptorParsed( i );
+        }
+    }
+#endif
 
+#ifndef USB_ENABLE_TRANSFER_EVENT
     for (i=0; i<USB_MAX_HID_DEVICES; i++)
     {
         if (deviceInfoHID[i].ID.deviceAddress == 0) /* device address updated by lower layer */
@@ -681,22 +854,23 @@ void USBHostHIDTasks( void )
                         {
                             if(pCurrInterfaceDetails->sizeOfRptDescriptor !=0) // interface must have a Report Descriptor
                             {
-                                if((deviceInfoHID[i].rptDescriptor = (BYTE *)malloc(pCurrInterfaceDetails->sizeOfRptDescriptor)) == NULL)
-                                {
-                                    _USBHostHID_LockDevice( USB_MEMORY_ALLOCATION_ERROR );
-                                    break;
-                                }
+                                #ifdef USB_HID_REPORT_CACHE_ENTRIES
+                                    if (_USBHostHID_ReportCacheRestore( i ))
+                                    {
+                                        // We have parsed this report descriptor before.
+                                        deviceInfoHID[i].state = STATE_GET_REPORT_DSC | SUBSTATE_PARSING_COMPLETE;
+                                        break;
+                                    }
+                                #endif
                                 // send new interface request
-                                if (!USBHostIssueDeviceRequest( deviceInfoHID[i].ID.deviceAddress, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
-                                     USB_REQUEST_GET_DESCRIPTOR, DSC_RPT, pCurrInterfaceDetails->interfaceNumber,pCurrInterfaceDetails->sizeOfRptDescriptor, deviceInfoHID[i].rptDescriptor,
-                                     USB_DEVICE_REQUEST_GET, deviceInfoHID[i].ID.clientDriverID ))
+                                errorCode = _USBHostHID_GetReportDescriptor( i );
+                                if (errorCode == USB_SUCCESS)
                                 {
                                      _USBHostHID_SetNextSubState();
                                 }
-                                else
+                                else if (errorCode == USB_MEMORY_ALLOCATION_ERROR)
                                 {
-                                    free(deviceInfoHID[i].rptDescriptor);
-                                    deviceInfoHID[i].rptDescriptor = NULL;
+                                    _USBHostHID_LockDevice( USB_MEMORY_ALLOCATION_ERROR );
                                 }
                             }
                         }
@@ -729,8 +903,7 @@ void USBHostHIDTasks( void )
 
                     case SUBSTATE_PARSE_REPORT_DSC:
                         /* Invoke HID Parser ,, validate for all the errors in report Descriptor */
-                        deviceInfoHID[i].HIDparserError = _USBHostHID_Parse_Report((BYTE*)deviceInfoHID[i].rptDescriptor , (WORD)pCurrInterfaceDetails->sizeOfRptDescriptor,
-                                                                               (WORD)pCurrInterfaceDetails->endpointPollInterval, pCurrInterfaceDetails->interfaceNumber);
+                        deviceInfoHID[i].HIDparserError = _USBHostHID_ParseReportDescriptor( i );
                         if(deviceInfoHID[i].HIDparserError)
                         {
                             /* Report Descriptor is flawed , flag error and free memory ,
@@ -753,6 +926,9 @@ void USBHostHIDTasks( void )
                         if (USB_HOST_APP_EVENT_HANDLER(deviceInfoHID[i].ID.deviceAddress, EVENT_HID_RPT_DESC_PARSED, NULL, 0 ))
                         {
                             deviceInfoHID[i].flags.breportDataCollected = 1;
+                            #ifdef USB_HID_REPORT_CACHE_ENTRIES
+                                _USBHostHID_ReportCacheStore( i );
+                            #endif
                         }
                         else
                         {
@@ -1205,6 +1381,140 @@ BOOL USBHostHIDTransferIsComplete( BYTE deviceAddress, BYTE *errorCode, BYTE *by
 }
 
 
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiBuildRoutes(HID_ROUTE_TABLE *pTable,
+                const HID_ROUTE_APPLICATION *pApplications, BYTE applications)
+
+  Description:
+    This function builds a report routing table from the report descriptor
+    that has just been parsed.  The input reports are taken one at a time,
+    and for each of them the non-constant input items of each registered
+    application collection become one route.  The routes of a report are
+    consecutive in the table, and their fields are compiled into import
+    operations as they are added.
+
+  Precondition:
+    The report descriptor has been parsed.
+
+  Parameters:
+    HID_ROUTE_TABLE *pTable                     - Table to build
+    const HID_ROUTE_APPLICATION *pApplications  - Collections the application
+                                                  handles
+    BYTE applications                           - Number of collections
+
+  Return Values:
+    TRUE    - At least one route was built
+    FALSE   - The device has none of the collections, or the routes do not
+              fit the table.
+
+  Remarks:
+    An empty table is left in pTable if the build fails.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+BOOL USBHostHID_ApiBuildRoutes(HID_ROUTE_TABLE *pTable, const HID_ROUTE_APPLICATION *pApplications, BYTE applications)
+{
+    WORD    reportIndex;
+    BYTE    application;
+
+    memset(pTable->firstRoute, USB_HID_NO_ROUTE, sizeof(pTable->firstRoute));
+    pTable->routes      = 0;
+    pTable->fields      = 0;
+    pTable->reportIDs   = (deviceRptInfo.reports > 1);
+
+    for (reportIndex=0; reportIndex<deviceRptInfo.reports; reportIndex++) {
+        if (itemListPtrs.reportList[reportIndex].inputBits == 0) continue;
+
+        for (application=0; application<applications; application++) {
+            if (!_USBHostHID_AddRoute(pTable, reportIndex, pApplications, application, applications)) {
+                memset(pTable->firstRoute, USB_HID_NO_ROUTE, sizeof(pTable->firstRoute));
+                pTable->routes = 0;
+                pTable->fields = 0;
+                return FALSE;
+            }
+        }
+    }
+    return (pTable->routes != 0);
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiCompileImport(HID_IMPORT_PROGRAM *pProgram,
+                          HID_DATA_DETAILS **ppDataDetails, BYTE detailCount)
+
+  Description:
+    This function compiles a set of data details into an import program for
+    USBHostHID_ApiImportReport().  The start byte, shift, mask and sign bit
+    of every field are worked out here, once, instead of for every report.
+    The fields of ppDataDetails[0] come first in the program, followed by
+    those of ppDataDetails[1], and so on.
+
+  Precondition:
+    None
+
+  Parameters:
+    HID_IMPORT_PROGRAM *pProgram    - Program to compile
+    HID_DATA_DETAILS **ppDataDetails- Data details of the fields to extract
+    BYTE detailCount                - Number of data details
+
+  Return Values:
+    TRUE    - The program was compiled
+    FALSE   - The data details are for different reports, a field lies
+              outside the report or is wider than 32 bits, or there are
+              more than USB_HID_IMPORT_MAX_FIELDS fields.
+
+  Remarks:
+    An empty program is left in pProgram if the compile fails.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+BOOL USBHostHID_ApiCompileImport(HID_IMPORT_PROGRAM *pProgram, HID_DATA_DETAILS **ppDataDetails, BYTE detailCount)
+{
+    HID_DATA_DETAILS    *pDataDetails;
+    HID_IMPORT_OP       *pOp;
+    WORD                start;
+    BYTE                i;
+    BYTE                j;
+
+    pProgram->fields = 0;
+    if (detailCount == 0) return FALSE;
+
+    pProgram->reportLength  = ppDataDetails[0]->reportLength;
+    pProgram->reportID      = ppDataDetails[0]->reportID;
+    pOp = pProgram->op;
+
+    for (i=0; i<detailCount; i++) {
+        pDataDetails = ppDataDetails[i];
+
+//      All the fields must be in the same report
+
+        if ((pDataDetails->reportLength != pProgram->reportLength) ||
+            (pDataDetails->reportID != pProgram->reportID) ||
+            ((pProgram->fields + pDataDetails->count) > USB_HID_IMPORT_MAX_FIELDS)) {
+            pProgram->fields = 0;
+            return FALSE;
+        }
+
+//      One operation per count
+
+        start = pDataDetails->bitOffset;
+        for (j=0; j<pDataDetails->count; j++) {
+            if (!_USBHostHID_CompileImportOp(pOp, start, pDataDetails->bitLength, pDataDetails->signExtend, pProgram->reportLength)) {
+                pProgram->fields = 0;
+                return FALSE;
+            }
+
+            pOp++;
+            pProgram->fields++;
+            start += pDataDetails->bitLength;
+        }
+    }
+    return TRUE;
+}
+#endif
+
+
 /*******************************************************************************
   Function:
     BOOL USBHostHID_ApiFindBit(WORD usagePage,WORD usage,HIDReportTypeEnum type,
@@ -1420,10 +1730,11 @@ BYTE USBHostHID_ApiGetCurrentInterfaceNum(void)
 *******************************************************************************/
 BOOL USBHostHID_ApiImportData(BYTE *report, WORD reportLength, HID_USER_DATA_SIZE *buffer, HID_DATA_DETAILS *pDataDetails)
 {
-    WORD data;
-    WORD signBit;
-    WORD mask;
-    WORD extendMask;
+    DWORD data;
+    DWORD signBit;
+    DWORD mask;
+    DWORD extendMask;
+    BYTE  highByte;
     WORD start;
     WORD startByte;
     WORD startBit;
@@ -1441,8 +1752,9 @@ BOOL USBHostHID_ApiImportData(BYTE *report, WORD reportLength, HID_USER_DATA_SIZ
 //  Length must be ok
 
     if (pDataDetails->reportLength != reportLength) return FALSE;
+    if ((pDataDetails->bitLength == 0) || (pDataDetails->bitLength > 32)) return FALSE;
     lastByte = (pDataDetails->bitOffset + (pDataDetails->bitLength * pDataDetails->count) - 1)/8;
-    if (lastByte > reportLength) return FALSE;
+    if (lastByte >= reportLength) return FALSE;
 
 //  Extract data one count at a time
 
@@ -1452,26 +1764,34 @@ BOOL USBHostHID_ApiImportData(BYTE *report, WORD reportLength, HID_USER_DATA_SIZ
         startBit = start&7;
         lastByte = (start + pDataDetails->bitLength - 1)/8;
 
+//      A 32 bit field that is not byte aligned spans five bytes
+
+        highByte = 0;
+        if ((lastByte - startByte) >= 4) highByte = report[lastByte--];
+
 //      Pick up the data bytes backwards
 
         data = 0;
         do {
             data <<= 8;
-            data |= (int) report[lastByte];
+            data |= (DWORD) report[lastByte];
         }
         while (lastByte-- > startByte);
 
 //      Shift to the right to byte align the least significant bit
 
-        if (startBit > 0) data >>= startBit;
+        if (startBit > 0) {
+            data >>= startBit;
+            data |= (DWORD) highByte << (32 - startBit);
+        }
 
-//      Done if 16 bits long
+//      Done if 32 bits long
 
-        if (pDataDetails->bitLength < 16) {
+        if (pDataDetails->bitLength < 32) {
 
 //          Mask off the other bits
 
-            mask = 1 << pDataDetails->bitLength;
+            mask = 1ul << pDataDetails->bitLength;
             mask--;
             data &= mask;
 
@@ -1498,6 +1818,110 @@ BOOL USBHostHID_ApiImportData(BYTE *report, WORD reportLength, HID_USER_DATA_SIZ
 }
 
 
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiImportReport(BYTE *report, WORD reportLength,
+                     HID_USER_DATA_SIZE *buffer, HID_IMPORT_PROGRAM *pProgram)
+  Description:
+    This function runs an import program over an input report, extracting
+    all of its fields in one pass.  Each field is assembled from the bytes
+    it spans, shifted, masked and sign extended as worked out by
+    USBHostHID_ApiCompileImport().
+
+  Precondition:
+    USBHostHID_ApiCompileImport() has compiled the program.
+
+  Parameters:
+    BYTE *report                    - Input report received from device
+    WORD reportLength               - Length of input report
+    HID_USER_DATA_SIZE *buffer      - Buffer into which data needs to be
+                                      populated, pProgram->fields entries
+    HID_IMPORT_PROGRAM *pProgram    - Compiled import program
+
+  Return Values:
+    TRUE    - If the data is retrieved from the report
+    FALSE   - If the report is not the one the program was compiled for.
+
+  Remarks:
+    None
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+BOOL USBHostHID_ApiImportReport(BYTE *report, WORD reportLength, HID_USER_DATA_SIZE *buffer, HID_IMPORT_PROGRAM *pProgram)
+{
+//  Report must be ok, and the one the program was compiled for
+
+    if (report == NULL) return FALSE;
+    if ((pProgram->reportID != 0) && (pProgram->reportID != report[0])) return FALSE;
+    if (pProgram->reportLength != reportLength) return FALSE;
+
+    _USBHostHID_RunImport(report, pProgram->op, pProgram->fields, buffer);
+    return TRUE;
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BOOL USBHostHID_ApiRouteReport(HID_ROUTE_TABLE *pTable, BYTE *report,
+                     WORD reportLength)
+  Description:
+    This function passes an input report to the handlers of its routes.  The
+    report ID indexes firstRoute[], the fields of all the routes of the
+    report are decoded in one pass, and then each route's handler is called
+    with its part of the fields.
+
+  Precondition:
+    USBHostHID_ApiBuildRoutes() has built the table.
+
+  Parameters:
+    HID_ROUTE_TABLE *pTable         - Routing table
+    BYTE *report                    - Input report received from device
+    WORD reportLength               - Length of input report
+
+  Return Values:
+    TRUE    - The report was passed to its handlers
+    FALSE   - The report has no routes, or is not the expected length.
+
+  Remarks:
+    The handlers are called from this function, so they run in the
+    application's context.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+BOOL USBHostHID_ApiRouteReport(HID_ROUTE_TABLE *pTable, BYTE *report, WORD reportLength)
+{
+    HID_USER_DATA_SIZE  values[USB_HID_ROUTE_MAX_FIELDS];
+    HID_ROUTE           *pRoute;
+    HID_ROUTE           *pLastRoute;
+    BYTE                reportID;
+    BYTE                firstField;
+
+    if ((report == NULL) || (reportLength == 0)) return FALSE;
+
+//  Find the routes of the report
+
+    reportID = pTable->reportIDs ? report[0] : 0;
+    if ((reportID > USB_HID_ROUTE_MAX_REPORT_ID) || (pTable->firstRoute[reportID] == USB_HID_NO_ROUTE)) return FALSE;
+
+    pRoute = &pTable->route[pTable->firstRoute[reportID]];
+    if (pRoute->reportLength != reportLength) return FALSE;
+
+    pLastRoute = pRoute;
+    while ((pLastRoute < &pTable->route[pTable->routes - 1]) && (pLastRoute[1].reportID == reportID)) pLastRoute++;
+
+//  Decode all their fields, then hand each route its share
+
+    firstField = pRoute->firstField;
+    _USBHostHID_RunImport(report, &pTable->op[firstField],
+                          pLastRoute->firstField + pLastRoute->fields - firstField, values);
+    for (; pRoute<=pLastRoute; pRoute++) {
+        pRoute->handler(reportID, &pTable->field[pRoute->firstField],
+                        &values[pRoute->firstField - firstField], pRoute->fields);
+    }
+    return TRUE;
+}
+#endif
+
+
 // *****************************************************************************
 // *****************************************************************************
 // Section: Host Stack Interface Functions
@@ -1557,6 +1981,10 @@ BOOL USBHostHIDEventHandler( BYTE address, USB_EVENT event, void *data, DWORD si
                 _USBHostHID_FreeRptDecriptorDataMem(address);
                 deviceInfoHID[i].ID.deviceAddress   = 0;
                 deviceInfoHID[i].state              = STATE_DETACHED;
+                #ifdef USB_HID_ENABLE_REPORT_PIPELINE
+                    deviceInfoHID[i].flags.bfPipelineArmed  = 0;
+                    deviceInfoHID[i].pipelineEndpoint       = 0;
+                #endif
             }
 
             return TRUE;
@@ -1582,6 +2010,57 @@ BOOL USBHostHIDEventHandler( BYTE address, USB_EVENT event, void *data, DWORD si
  //                   UART2PrintString( "\r\n" );
                 #endif
 
+                #ifdef USB_HID_ENABLE_REPORT_PIPELINE
+                    // Pipelined reads complete independently of any application
+                    // transfer on the other endpoints, so check for them first.
+                    if (deviceInfoHID[i].flags.bfPipelineArmed &&
+                        (((HOST_TRANSFER_DATA *)data)->bEndpointAddress == deviceInfoHID[i].pipelineEndpoint))
+                    {
+                        deviceInfoHID[i].flags.bfPipelineArmed = 0;
+                        if (((HOST_TRANSFER_DATA *)data)->bErrorCode)
+                        {
+                            #ifdef DEBUG_MODE
+                                UART2PrintString( "HID: Pipelined read error " );
+                                UART2PutHex( ((HOST_TRANSFER_DATA *)data)->bErrorCode );
+                                UART2PrintString( "\r\n" );
+                            #endif
+                            USBHostClearEndpointErrors( deviceInfoHID[i].ID.deviceAddress, deviceInfoHID[i].pipelineEndpoint );
+                            if ((USB_ENDPOINT_STALLED == ((HOST_TRANSFER_DATA *)data)->bErrorCode) &&
+                                (deviceInfoHID[i].state == STATE_RUNNING))
+                            {
+                                // The read is armed again when the reset completes.
+                                deviceInfoHID[i].returnState = STATE_RUNNING;
+                                deviceInfoHID[i].flags.bfReset = 1;
+                                _USBHostHID_ResetStateJump( i );
+                                return TRUE;
+                            }
+                            _USBHostHID_PipelineArm( i );
+                        }
+                        else if (((HOST_TRANSFER_DATA *)data)->dataCount == 0)
+                        {
+                            // The device NAKed the poll, so there is no report to
+                            // commit.  Poll again into the same queue entry.
+                            _USBHostHID_PipelineArm( i );
+                        }
+                        else
+                        {
+                            HID_PIPELINE_REPORT *pReport;
+
+                            // The SIE has already written the report into the next
+                            // queue entry, so it only has to be committed.
+                            pReport = StructQueueAdd( &deviceInfoHID[i].pipelineQueue, USB_HID_PIPELINE_DEPTH );
+                            pReport->interfaceNum   = deviceInfoHID[i].pipelineInterface;
+                            pReport->length         = (BYTE)((HOST_TRANSFER_DATA *)data)->dataCount;
+
+                            // Re-arm before telling the application so the next
+                            // report is not held up by its processing.
+                            _USBHostHID_PipelineArm( i );
+                            USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_RPT_RECEIVED, pReport, sizeof(HID_PIPELINE_REPORT) );
+                        }
+                        return TRUE;
+                    }
+                #endif
+
                 switch (deviceInfoHID[i].state)
                 {
                     case STATE_WAIT_FOR_REPORT_DSC:
@@ -1593,8 +2072,7 @@ BOOL USBHostHIDEventHandler( BYTE address, USB_EVENT event, void *data, DWORD si
                         {
                             /* Invoke HID Parser ,, validate for all the errors in report Descriptor */
 //                             deviceInfoHID[i].bytesTransferred = ((HOST_TRANSFER_DATA *)data)->dataCount;
-                             deviceInfoHID[i].HIDparserError = _USBHostHID_Parse_Report((BYTE*)deviceInfoHID[i].rptDescriptor , (WORD)pCurrInterfaceDetails->sizeOfRptDescriptor,
-                                                                                    (WORD)pCurrInterfaceDetails->endpointPollInterval, pCurrInterfaceDetails->interfaceNumber);
+                             deviceInfoHID[i].HIDparserError = _USBHostHID_ParseReportDescriptor( i );
 
                             if(deviceInfoHID[i].HIDparserError)
                             {
@@ -1611,77 +2089,7 @@ BOOL USBHostHIDEventHandler( BYTE address, USB_EVENT event, void *data, DWORD si
                             }
                             else
                             {
-                                /* Inform Application layer of new device attached */
-                                #ifdef DEBUG_MODE
-                                    UART2PrintString( "HID: Sending Report Descriptor Parsed event\r\n" );
-                                #endif
-                                if (USB_HOST_APP_EVENT_HANDLER(deviceInfoHID[i].ID.deviceAddress, EVENT_HID_RPT_DESC_PARSED, NULL, 0 ))
-                                {
-                                    deviceInfoHID[i].flags.breportDataCollected = 1;
-                                }
-                                else
-                                {
-                                    if ((pCurrInterfaceDetails->interfaceNumber == (deviceInfoHID[i].noOfInterfaces-1)) &&
-                                        (deviceInfoHID[i].flags.breportDataCollected == 0))
-                                    {
-                                        #ifdef DEBUG_MODE
-                                            UART2PrintString( "HID: Error parsing descriptor\r\n" );
-                                        #endif
-                                        _USBHostHID_FreeRptDecriptorDataMem(deviceInfoHID[i].ID.deviceAddress);
-                                        _USBHostHID_LockDevice( USB_HID_REPORT_DESCRIPTOR_BAD );
-                                        USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_BAD_REPORT_DESCRIPTOR, NULL, 0 );
-                                    }
-                                }
-                                free(deviceInfoHID[i].rptDescriptor);
-                                pCurrInterfaceDetails = pCurrInterfaceDetails->next;
-
-                                if(pCurrInterfaceDetails != NULL)
-                                {
-                                    if(pCurrInterfaceDetails->sizeOfRptDescriptor !=0)
-                                    {
-                                        if((deviceInfoHID[i].rptDescriptor = (BYTE *)malloc(pCurrInterfaceDetails->sizeOfRptDescriptor)) == NULL)
-                                        {
-                                            #ifdef DEBUG_MODE
-                                                UART2PrintString( "HID: Out of memory\r\n" );
-                                            #endif
-                                            _USBHostHID_LockDevice( USB_MEMORY_ALLOCATION_ERROR );
-                                            break;
-                                        }
-                                    }
-                                    if(USBHostIssueDeviceRequest( deviceInfoHID[i].ID.deviceAddress, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
-                                            USB_REQUEST_GET_DESCRIPTOR, DSC_RPT, pCurrInterfaceDetails->interfaceNumber, pCurrInterfaceDetails->sizeOfRptDescriptor, deviceInfoHID[i].rptDescriptor,
-                                            USB_DEVICE_REQUEST_GET, deviceInfoHID[i].ID.clientDriverID ))
-                                    {
-                                        #ifdef DEBUG_MODE
-                                            UART2PrintString( "HID: Error getting descriptor\r\n" );
-                                        #endif
-                                        free(deviceInfoHID[i].rptDescriptor);
-                                        break;
-                                    }
-                                    deviceInfoHID[i].state = STATE_WAIT_FOR_REPORT_DSC;
-                                }
-                                else
-                                {
-                                    if(deviceInfoHID[i].flags.breportDataCollected == 0)
-                                    {
-                                        #ifdef DEBUG_MODE
-                                            UART2PrintString( "HID: Problem collecting report data\r\n" );
-                                        #endif
-                                        _USBHostHID_FreeRptDecriptorDataMem(deviceInfoHID[i].ID.deviceAddress);
-                                        _USBHostHID_LockDevice( USB_HID_REPORT_DESCRIPTOR_BAD );
-                                        USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_BAD_REPORT_DESCRIPTOR, NULL, 0 );
-                                    }
-                                    else
-                                    {
-                                        #ifdef DEBUG_MODE
-                                            UART2PrintString( "HID: Proceeding to run state\r\n" );
-                                        #endif
-                                        deviceInfoHID[i].state = STATE_RUNNING;
-
-                                        // Tell the application layer that we have a device.
-                                        USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_ATTACH, &(deviceInfoHID[i].ID), sizeof(USB_HID_DEVICE_ID) );
-                                    }
-                                }
+                                _USBHostHID_ReportDescriptorParsed( i );
                             }
                         }
                         else
@@ -1885,6 +2293,9 @@ BOOL USBHostHIDInitialize( BYTE address, DWORD flags, BYTE clientDriverID )
     BYTE                        numofinterfaces         = 0;
     BYTE                        temp_i                  = 0;
     USB_HID_INTERFACE_DETAILS   *pNewInterfaceDetails   = NULL;
+    #ifdef USB_ENABLE_TRANSFER_EVENT
+        BYTE                    errorCode;
+    #endif
 
     #ifdef DEBUG_MODE
         UART2PrintString( "HID: USBHostHIDInitialize(0x" );
@@ -1914,6 +2325,11 @@ BOOL USBHostHIDInitialize( BYTE address, DWORD flags, BYTE clientDriverID )
     deviceInfoHID[device].ID.vid            = ((USB_DEVICE_DESCRIPTOR *)descriptor)->idVendor;
     deviceInfoHID[device].ID.pid            = ((USB_DEVICE_DESCRIPTOR *)descriptor)->idProduct;
     deviceInfoHID[device].ID.clientDriverID = clientDriverID;
+    #ifdef USB_HID_ENABLE_REPORT_PIPELINE
+        deviceInfoHID[device].flags.bfPipelineArmed = 0;
+        deviceInfoHID[device].pipelineEndpoint      = 0;
+        StructQueueInit( &deviceInfoHID[device].pipelineQueue, USB_HID_PIPELINE_DEPTH );
+    #endif
 
     // Get ready to parse the configuration descriptor.
     descriptor = USBHostGetCurrentConfigurationDescriptor( address );
@@ -2073,29 +2489,29 @@ BOOL USBHostHIDInitialize( BYTE address, DWORD flags, BYTE clientDriverID )
             deviceInfoHID[device].state                = STATE_INITIALIZE_DEVICE;
         #else
             pCurrInterfaceDetails = pInterfaceDetails;
-            if (pCurrInterfaceDetails->sizeOfRptDescriptor !=0)
-            {
-                if (deviceInfoHID[device].rptDescriptor != NULL)
-                {
-                    freezHID( deviceInfoHID[device].rptDescriptor );
-                }
-
-                if((deviceInfoHID[device].rptDescriptor = (BYTE *)malloc(pCurrInterfaceDetails->sizeOfRptDescriptor)) == NULL)
+            #ifdef USB_HID_REPORT_CACHE_ENTRIES
+                if (_USBHostHID_ReportCacheRestore( device ))
                 {
                     #ifdef DEBUG_MODE
-                        UART2PrintString("HID: Out of memory for report descriptor\r\n" );
+                        UART2PrintString("HID: Using cached report descriptor\r\n" );
                     #endif
-                    return FALSE;
+                    deviceInfoHID[device].state            = STATE_PARSING_COMPLETE;
+                    return TRUE;
                 }
-            }
-            if (USBHostIssueDeviceRequest( deviceInfoHID[device].ID.deviceAddress, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
-                 USB_REQUEST_GET_DESCRIPTOR, DSC_RPT, pCurrInterfaceDetails->interfaceNumber, pCurrInterfaceDetails->sizeOfRptDescriptor, deviceInfoHID[device].rptDescriptor,
-                 USB_DEVICE_REQUEST_GET, deviceInfoHID[device].ID.clientDriverID ))
+            #endif
+            errorCode = _USBHostHID_GetReportDescriptor( device );
+            if (errorCode == USB_MEMORY_ALLOCATION_ERROR)
+            {
+                #ifdef DEBUG_MODE
+                    UART2PrintString("HID: Out of memory for report descriptor\r\n" );
+                #endif
+                return FALSE;
+            }
+            if (errorCode != USB_SUCCESS)
             {
                 #ifdef DEBUG_MODE
                     UART2PrintString("HID: Error getting report descriptor\r\n" );
                 #endif
-                free(deviceInfoHID[device].rptDescriptor);
                 return FALSE;
             }
             #ifdef DEBUG_MODE
@@ -2160,12 +2576,6 @@ void _USBHostHID_FreeRptDecriptorDataMem(BYTE deviceAddress)
     for (i=0; (i<USB_MAX_HID_DEVICES) && (deviceInfoHID[i].ID.deviceAddress != deviceAddress); i++);
     if (i < USB_MAX_HID_DEVICES)
     {
-    /* free memory allocated to HID parser */
-        if(parsedDataMem != NULL)
-        {
-            free(parsedDataMem); /* will be indexed once multiple  device support is added */
-            parsedDataMem = NULL;
-        }
         if(deviceInfoHID[i].rptDescriptor != NULL)
         {
             free(deviceInfoHID[i].rptDescriptor);
@@ -2185,6 +2595,423 @@ void _USBHostHID_FreeRptDecriptorDataMem(BYTE deviceAddress)
     }
 }
 
+
+/****************************************************************************
+  Function:
+    BYTE _USBHostHID_GetReportDescriptor( BYTE i )
+
+  Summary:
+    This function requests the report descriptor of the current interface.
+
+  Description:
+    This function requests the report descriptor of the interface at
+    pCurrInterfaceDetails.  If USB_HID_STREAM_REPORT_DESCRIPTOR is defined,
+    the parser is started and the descriptor is streamed through
+    rptDescriptorWindow.  Otherwise a buffer of the full descriptor size is
+    allocated for it, and freed again if the request cannot be issued.
+
+  Precondition:
+    pCurrInterfaceDetails points to the interface.
+
+  Parameters:
+    BYTE i              - Index of the device in deviceInfoHID[]
+
+  Returns:
+    USB_SUCCESS                 - The request was issued
+    USB_MEMORY_ALLOCATION_ERROR - No memory for the descriptor
+    Others                      - Return values from USBHostIssueDeviceRequest()
+
+  Remarks:
+    None
+***************************************************************************/
+BYTE _USBHostHID_GetReportDescriptor( BYTE i )
+{
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+    _USBHostHID_Parse_Begin( (WORD)pCurrInterfaceDetails->endpointPollInterval, pCurrInterfaceDetails->interfaceNumber );
+    deviceInfoHID[i].HIDparserError = HID_ERR;
+
+    return USBHostIssueStreamedDeviceRequest( deviceInfoHID[i].ID.deviceAddress, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
+                USB_REQUEST_GET_DESCRIPTOR, DSC_RPT, pCurrInterfaceDetails->interfaceNumber, pCurrInterfaceDetails->sizeOfRptDescriptor,
+                rptDescriptorWindow, USB_HID_REPORT_DESCRIPTOR_WINDOW, deviceInfoHID[i].ID.clientDriverID );
+#else
+    BYTE    errorCode;
+
+    freezHID( deviceInfoHID[i].rptDescriptor );
+    if (pCurrInterfaceDetails->sizeOfRptDescriptor != 0)
+    {
+        if ((deviceInfoHID[i].rptDescriptor = (BYTE *)malloc(pCurrInterfaceDetails->sizeOfRptDescriptor)) == NULL)
+        {
+            return USB_MEMORY_ALLOCATION_ERROR;
+        }
+    }
+
+    errorCode = USBHostIssueDeviceRequest( deviceInfoHID[i].ID.deviceAddress, USB_SETUP_DEVICE_TO_HOST | USB_SETUP_TYPE_STANDARD | USB_SETUP_RECIPIENT_INTERFACE,
+                    USB_REQUEST_GET_DESCRIPTOR, DSC_RPT, pCurrInterfaceDetails->interfaceNumber, pCurrInterfaceDetails->sizeOfRptDescriptor,
+                    deviceInfoHID[i].rptDescriptor, USB_DEVICE_REQUEST_GET, deviceInfoHID[i].ID.clientDriverID );
+    if (errorCode)
+    {
+        freezHID( deviceInfoHID[i].rptDescriptor );
+    }
+    return errorCode;
+#endif
+}
+
+
+/****************************************************************************
+  Function:
+    USB_HID_RPT_DESC_ERROR _USBHostHID_ParseReportDescriptor( BYTE i )
+
+  Summary:
+    This function finishes parsing the report descriptor once it has been
+    read.
+
+  Description:
+    If USB_HID_STREAM_REPORT_DESCRIPTOR is defined, this function parses the
+    last bytes of the descriptor left in the window and checks that the
+    descriptor is complete.  Otherwise it parses the whole descriptor from
+    the buffer it was read into.
+
+  Precondition:
+    The report descriptor request has completed without error.
+
+  Parameters:
+    BYTE i              - Index of the device in deviceInfoHID[]
+
+  Returns:
+    The parser error, or HID_ERR if the descriptor is valid.
+
+  Remarks:
+    None
+***************************************************************************/
+USB_HID_RPT_DESC_ERROR _USBHostHID_ParseReportDescriptor( BYTE i )
+{
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+    _USBHostHID_StreamReportDescriptor( i );
+    if (deviceInfoHID[i].HIDparserError)
+    {
+        return deviceInfoHID[i].HIDparserError;
+    }
+    return _USBHostHID_Parse_End();
+#else
+    return _USBHostHID_Parse_Report( (BYTE*)deviceInfoHID[i].rptDescriptor, (WORD)pCurrInterfaceDetails->sizeOfRptDescriptor,
+                (WORD)pCurrInterfaceDetails->endpointPollInterval, pCurrInterfaceDetails->interfaceNumber );
+#endif
+}
+
+
+/****************************************************************************
+  Function:
+    void _USBHostHID_StreamReportDescriptor( BYTE i )
+
+  Summary:
+    This function parses the part of the report descriptor that has arrived.
+
+  Description:
+    This function passes the bytes of the report descriptor that have
+    arrived in rptDescriptorWindow to the parser, and frees their space in
+    the window so the host can read the next packets.  Once the parser has
+    found an error, the rest of the descriptor is read and discarded.
+
+  Precondition:
+    _USBHostHID_GetReportDescriptor() has issued the request.
+
+  Parameters:
+    BYTE i              - Index of the device in deviceInfoHID[]
+
+  Returns:
+    None
+
+  Remarks:
+    This function is available only if USB_HID_STREAM_REPORT_DESCRIPTOR is
+    defined.
+***************************************************************************/
+#ifdef USB_HID_STREAM_REPORT_DESCRIPTOR
+void _USBHostHID_StreamReportDescriptor( BYTE i )
+{
+    BYTE    *pData;
+    WORD    length;
+
+    while ((length = USBHostStreamPeek( deviceInfoHID[i].ID.deviceAddress, &pData )) != 0)
+    {
+        if (deviceInfoHID[i].HIDparserError == HID_ERR)
+        {
+            deviceInfoHID[i].HIDparserError = _USBHostHID_Parse_Bytes( pData, length );
+        }
+        USBHostStreamConsume( deviceInfoHID[i].ID.deviceAddress, length );
+    }
+}
+#endif
+
+/****************************************************************************
+  Function:
+    void _USBHostHID_ReportDescriptorParsed( BYTE i )
+
+  Summary:
+    This function hands a parsed report descriptor to the application and
+    moves on to the next interface.
+
+  Description:
+    This function sends EVENT_HID_RPT_DESC_PARSED for the interface at
+    pCurrInterfaceDetails, then requests the report descriptor of the next
+    interface, or restores its parse from the cache.  After the last
+    interface the device is running, provided the application collected
+    the data of at least one report.
+
+  Precondition:
+    The report descriptor of the interface at pCurrInterfaceDetails has
+    been parsed, or its parse restored from the cache.
+
+  Parameters:
+    BYTE i              - Index of the device in deviceInfoHID[]
+
+  Returns:
+    None
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRANSFER_EVENT is
+    defined.
+***************************************************************************/
+#ifdef USB_ENABLE_TRANSFER_EVENT
+void _USBHostHID_ReportDescriptorParsed( BYTE i )
+{
+    BYTE    errorCode;
+
+    /* Inform Application layer of new device attached */
+    #ifdef DEBUG_MODE
+        UART2PrintString( "HID: Sending Report Descriptor Parsed event\r\n" );
+    #endif
+    if (USB_HOST_APP_EVENT_HANDLER(deviceInfoHID[i].ID.deviceAddress, EVENT_HID_RPT_DESC_PARSED, NULL, 0 ))
+    {
+        deviceInfoHID[i].flags.breportDataCollected = 1;
+        #ifdef USB_HID_REPORT_CACHE_ENTRIES
+            _USBHostHID_ReportCacheStore( i );
+        #endif
+    }
+    else
+    {
+        if ((pCurrInterfaceDetails->interfaceNumber == (deviceInfoHID[i].noOfInterfaces-1)) &&
+            (deviceInfoHID[i].flags.breportDataCollected == 0))
+        {
+            #ifdef DEBUG_MODE
+                UART2PrintString( "HID: Error parsing descriptor\r\n" );
+            #endif
+            _USBHostHID_FreeRptDecriptorDataMem(deviceInfoHID[i].ID.deviceAddress);
+            _USBHostHID_LockDevice( USB_HID_REPORT_DESCRIPTOR_BAD );
+            USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_BAD_REPORT_DESCRIPTOR, NULL, 0 );
+        }
+    }
+    freezHID(deviceInfoHID[i].rptDescriptor);
+    pCurrInterfaceDetails = pCurrInterfaceDetails->next;
+
+    if(pCurrInterfaceDetails != NULL)
+    {
+        #ifdef USB_HID_REPORT_CACHE_ENTRIES
+            if (_USBHostHID_ReportCacheRestore( i ))
+            {
+                // USBHostHIDTasks() finishes this interface too.
+                deviceInfoHID[i].state = STATE_PARSING_COMPLETE;
+                return;
+            }
+        #endif
+        errorCode = _USBHostHID_GetReportDescriptor( i );
+        if (errorCode == USB_MEMORY_ALLOCATION_ERROR)
+        {
+            #ifdef DEBUG_MODE
+                UART2PrintString( "HID: Out of memory\r\n" );
+            #endif
+            _USBHostHID_LockDevice( USB_MEMORY_ALLOCATION_ERROR );
+            return;
+        }
+        if (errorCode != USB_SUCCESS)
+        {
+            #ifdef DEBUG_MODE
+                UART2PrintString( "HID: Error getting descriptor\r\n" );
+            #endif
+            return;
+        }
+        deviceInfoHID[i].state = STATE_WAIT_FOR_REPORT_DSC;
+    }
+    else
+    {
+        if(deviceInfoHID[i].flags.breportDataCollected == 0)
+        {
+            #ifdef DEBUG_MODE
+                UART2PrintString( "HID: Problem collecting report data\r\n" );
+            #endif
+            _USBHostHID_FreeRptDecriptorDataMem(deviceInfoHID[i].ID.deviceAddress);
+            _USBHostHID_LockDevice( USB_HID_REPORT_DESCRIPTOR_BAD );
+            USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_BAD_REPORT_DESCRIPTOR, NULL, 0 );
+        }
+        else
+        {
+            #ifdef DEBUG_MODE
+                UART2PrintString( "HID: Proceeding to run state\r\n" );
+            #endif
+            deviceInfoHID[i].state = STATE_RUNNING;
+
+            // Tell the application layer that we have a device.
+            USB_HOST_APP_EVENT_HANDLER( deviceInfoHID[i].ID.deviceAddress, EVENT_HID_ATTACH, &(deviceInfoHID[i].ID), sizeof(USB_HID_DEVICE_ID) );
+
+            #ifdef USB_HID_ENABLE_REPORT_PIPELINE
+                // The pipeline owns the IN endpoint of the first interface that has one.
+                pCurrInterfaceDetails = pInterfaceDetails;
+                while ((pCurrInterfaceDetails != NULL) && (pCurrInterfaceDetails->endpointIN == 0))
+                {
+                    pCurrInterfaceDetails = pCurrInterfaceDetails->next;
+                }
+                if (pCurrInterfaceDetails != NULL)
+                {
+                    deviceInfoHID[i].pipelineEndpoint   = pCurrInterfaceDetails->endpointIN;
+                    deviceInfoHID[i].pipelineInterface  = pCurrInterfaceDetails->interfaceNumber;
+                    deviceInfoHID[i].pipelineSize       = USB_HID_PIPELINE_REPORT_SIZE;
+                    if (pCurrInterfaceDetails->endpointMaxDataSize < USB_HID_PIPELINE_REPORT_SIZE)
+                    {
+                        deviceInfoHID[i].pipelineSize   = (BYTE)pCurrInterfaceDetails->endpointMaxDataSize;
+                    }
+                    _USBHostHID_PipelineArm( i );
+                }
+            #endif
+        }
+    }
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    BOOL _USBHostHID_ReportCacheRestore( BYTE i )
+
+  Summary:
+    This function restores the parsed report descriptor of the current
+    interface from the cache.
+
+  Description:
+    This function looks for a cache entry with the VID, PID and bcdDevice of
+    the device and the number and report descriptor length of the interface
+    at pCurrInterfaceDetails.  If there is one, the parse is restored into
+    the parser and the cache entry is emptied.
+
+  Precondition:
+    pCurrInterfaceDetails points to the interface.
+
+  Parameters:
+    BYTE i              - Index of the device in deviceInfoHID[]
+
+  Return Values:
+    TRUE    - The parse was restored.
+    FALSE   - The interface is not in the cache.  The report descriptor
+                must be read and parsed.
+
+  Remarks:
+    This function is available only if USB_HID_REPORT_CACHE_ENTRIES is
+    defined.
+***************************************************************************/
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+BOOL _USBHostHID_ReportCacheRestore( BYTE i )
+{
+    USB_HID_REPORT_CACHE_ENTRY  *pEntry;
+    WORD                        bcdDevice;
+
+    bcdDevice = ((USB_DEVICE_DESCRIPTOR *)USBHostGetDeviceDescriptor( deviceInfoHID[i].ID.deviceAddress ))->bcdDevice;
+    for (pEntry = reportCache; pEntry < &reportCache[USB_HID_REPORT_CACHE_ENTRIES]; pEntry++)
+    {
+        if ((pEntry->length != 0) &&
+            (pEntry->vid                 == deviceInfoHID[i].ID.vid) &&
+            (pEntry->pid                 == deviceInfoHID[i].ID.pid) &&
+            (pEntry->bcdDevice           == bcdDevice) &&
+            (pEntry->interfaceNumber     == pCurrInterfaceDetails->interfaceNumber) &&
+            (pEntry->sizeOfRptDescriptor == pCurrInterfaceDetails->sizeOfRptDescriptor))
+        {
+            _USBHostHID_Parse_Restore( pEntry->data );
+            deviceInfoHID[i].HIDparserError = HID_ERR;
+
+            // If the application rejects the parse, it is read again next time.
+            pEntry->length = 0;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+/****************************************************************************
+  Function:
+    void _USBHostHID_ReportCacheStore( BYTE i )
+
+  Summary:
+    This function saves the parsed report descriptor of the current
+    interface in the cache.
+
+  Description:
+    This function saves the parser's output for the interface at
+    pCurrInterfaceDetails in the cache entry for its key.  If the interface
+    has no entry, an empty entry is used, or the entries are replaced in
+    turn.
+
+  Precondition:
+    The application has accepted the parse of the report descriptor of the
+    interface at pCurrInterfaceDetails.
+
+  Parameters:
+    BYTE i              - Index of the device in deviceInfoHID[]
+
+  Returns:
+    None
+
+  Remarks:
+    Parses longer than USB_HID_REPORT_CACHE_SIZE are not cached.  This
+    function is available only if USB_HID_REPORT_CACHE_ENTRIES is defined.
+***************************************************************************/
+void _USBHostHID_ReportCacheStore( BYTE i )
+{
+    USB_HID_REPORT_CACHE_ENTRY  *pEntry;
+    USB_HID_REPORT_CACHE_ENTRY  *pEmpty;
+    WORD                        bcdDevice;
+
+    // Use the entry for this interface, or an empty one, or the oldest one.
+    bcdDevice = ((USB_DEVICE_DESCRIPTOR *)USBHostGetDeviceDescriptor( deviceInfoHID[i].ID.deviceAddress ))->bcdDevice;
+    pEmpty = NULL;
+    for (pEntry = reportCache; pEntry < &reportCache[USB_HID_REPORT_CACHE_ENTRIES]; pEntry++)
+    {
+        if (pEntry->length == 0)
+        {
+            if (pEmpty == NULL)
+            {
+                pEmpty = pEntry;
+            }
+        }
+        else if ((pEntry->vid                 == deviceInfoHID[i].ID.vid) &&
+                 (pEntry->pid                 == deviceInfoHID[i].ID.pid) &&
+                 (pEntry->bcdDevice           == bcdDevice) &&
+                 (pEntry->interfaceNumber     == pCurrInterfaceDetails->interfaceNumber) &&
+                 (pEntry->sizeOfRptDescriptor == pCurrInterfaceDetails->sizeOfRptDescriptor))
+        {
+            break;
+        }
+    }
+    if (pEntry == &reportCache[USB_HID_REPORT_CACHE_ENTRIES])
+    {
+        if (pEmpty)
+        {
+            pEntry = pEmpty;
+        }
+        else
+        {
+            pEntry = &reportCache[reportCacheNext];
+            reportCacheNext = (reportCacheNext + 1) % USB_HID_REPORT_CACHE_ENTRIES;
+        }
+    }
+
+    pEntry->vid                 = deviceInfoHID[i].ID.vid;
+    pEntry->pid                 = deviceInfoHID[i].ID.pid;
+    pEntry->bcdDevice           = bcdDevice;
+    pEntry->interfaceNumber     = pCurrInterfaceDetails->interfaceNumber;
+    pEntry->sizeOfRptDescriptor = pCurrInterfaceDetails->sizeOfRptDescriptor;
+    pEntry->length              = _USBHostHID_Parse_Save( pEntry->data, USB_HID_REPORT_CACHE_SIZE );
+}
+#endif
+
+
 /*******************************************************************************
   Function:
     void _USBHostHID_ResetStateJump( BYTE i )
@@ -2244,6 +3071,462 @@ void _USBHostHID_ResetStateJump( BYTE i )
 
         deviceInfoHID[i].state = deviceInfoHID[i].returnState;
     }
+
+    #ifdef USB_HID_ENABLE_REPORT_PIPELINE
+        _USBHostHID_PipelineArm( i );
+    #endif
 }
 
 
+/*******************************************************************************
+  Function:
+    void _USBHostHID_PipelineArm( BYTE i )
+
+  Summary:
+
+  Description:
+    This function starts a read on the pipelined interrupt IN endpoint into
+    the next free entry of the report queue, if the device is running, no read
+    is outstanding and the queue has room.
+
+Precondition:
+    The device information must be in the deviceInfoHID array.
+
+  Parameters:
+    BYTE i  - Index into the deviceInfoHID structure for the device.
+
+  Returns:
+    None
+
+  Remarks:
+    If the queue is full the read is armed by USBHostHIDPipelineGetReport()
+    once a report has been removed.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_PIPELINE
+void _USBHostHID_PipelineArm( BYTE i )
+{
+    USB_HID_PIPELINE_QUEUE  *queue;
+    BYTE                    errorCode;
+
+    if (deviceInfoHID[i].flags.bfPipelineArmed || (deviceInfoHID[i].pipelineEndpoint == 0))
+    {
+        return;
+    }
+
+    // Only while the device is running; reset recovery re-arms when it is done.
+    if ((deviceInfoHID[i].state < STATE_RUNNING) || (deviceInfoHID[i].state > STATE_WRITE_REQ_WAIT))
+    {
+        return;
+    }
+
+    queue = &deviceInfoHID[i].pipelineQueue;
+    if (StructQueueIsFull( queue, USB_HID_PIPELINE_DEPTH ))
+    {
+        return;
+    }
+
+    // Read straight into the entry that StructQueueAdd() will return.
+    errorCode = USBHostRead( deviceInfoHID[i].ID.deviceAddress, deviceInfoHID[i].pipelineEndpoint,
+                             StructQueuePeekHead( queue, USB_HID_PIPELINE_DEPTH )->data, deviceInfoHID[i].pipelineSize );
+    if (!errorCode)
+    {
+        deviceInfoHID[i].flags.bfPipelineArmed = 1;
+    }
+    #ifdef DEBUG_MODE
+    else
+    {
+        UART2PrintString( "HID: Could not arm pipelined read " );
+        UART2PutHex( errorCode );
+        UART2PrintString( "\r\n" );
+    }
+    #endif
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BOOL _USBHostHID_AddRoute( HID_ROUTE_TABLE *pTable, WORD reportIndex,
+                const HID_ROUTE_APPLICATION *pApplications, BYTE application,
+                BYTE applications )
+
+  Summary:
+    This function adds the route of one report and collection.
+
+  Description:
+    This function compiles the fields of the non-constant input items of a
+    report that belong to one registered collection, and adds them to the
+    table as a route to the collection's handler.  Nothing is added if the
+    report has no such items.
+
+  Precondition:
+    The report descriptor has been parsed.
+
+  Parameters:
+    HID_ROUTE_TABLE *pTable                     - Table being built
+    WORD reportIndex                            - Index of the report in
+                                                  the parser's report list
+    const HID_ROUTE_APPLICATION *pApplications  - Registered collections
+    BYTE application                            - Index of the collection
+    BYTE applications                           - Number of collections
+
+  Return Values:
+    TRUE    - The route was added, or there was none to add
+    FALSE   - The route does not fit the table
+
+  Remarks:
+    None
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+BOOL _USBHostHID_AddRoute( HID_ROUTE_TABLE *pTable, WORD reportIndex, const HID_ROUTE_APPLICATION *pApplications,
+                           BYTE application, BYTE applications )
+{
+    HID_REPORT      *pReport;
+    HID_REPORTITEM  *pItem;
+    HID_ROUTE       *pRoute;
+    WORD            reportLength;
+    WORD            start;
+    BYTE            firstField;
+    BYTE            itemIndex;
+    BYTE            j;
+
+    pReport         = &itemListPtrs.reportList[reportIndex];
+    reportLength    = (pReport->inputBits + 7)/8;
+    firstField      = pTable->fields;
+
+    for (itemIndex=0; itemIndex<deviceRptInfo.reportItems; itemIndex++)
+    {
+        pItem = &itemListPtrs.reportItemList[itemIndex];
+        if ((pItem->reportType != hidReportInput) ||
+            (pItem->globals.reportIndex != reportIndex) ||
+            (pItem->dataModes & HIDData_Constant) ||
+            (_USBHostHID_ItemApplication( pItem, pApplications, applications ) != application))
+        {
+            continue;
+        }
+
+        if ((pReport->reportID > USB_HID_ROUTE_MAX_REPORT_ID) ||
+            ((pTable->fields + pItem->globals.reportCount) > USB_HID_ROUTE_MAX_FIELDS))
+        {
+            return FALSE;
+        }
+
+        start = pItem->startBit;
+        for (j=0; j<pItem->globals.reportCount; j++)
+        {
+            if (!_USBHostHID_CompileImportOp( &pTable->op[pTable->fields], start, pItem->globals.reportsize,
+                                              (pItem->globals.logicalMinimum < 0), reportLength ))
+            {
+                return FALSE;
+            }
+            _USBHostHID_FieldUsage( pItem, j, &pTable->field[pTable->fields] );
+            pTable->fields++;
+            start += pItem->globals.reportsize;
+        }
+    }
+
+    if (pTable->fields == firstField)
+    {
+        return TRUE;
+    }
+    if (pTable->routes >= USB_HID_MAX_ROUTES)
+    {
+        return FALSE;
+    }
+
+    // The routes of a report are added one after another.
+    if (pTable->firstRoute[pReport->reportID] == USB_HID_NO_ROUTE)
+    {
+        pTable->firstRoute[pReport->reportID] = pTable->routes;
+    }
+    pRoute = &pTable->route[pTable->routes++];
+    pRoute->handler         = pApplications[application].handler;
+    pRoute->reportLength    = reportLength;
+    pRoute->reportID        = (BYTE)pReport->reportID;
+    pRoute->firstField      = firstField;
+    pRoute->fields          = pTable->fields - firstField;
+    return TRUE;
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BOOL _USBHostHID_CompileImportOp( HID_IMPORT_OP *pOp, WORD start,
+                BYTE bitLength, BOOL signExtend, WORD reportLength )
+
+  Summary:
+    This function compiles the import operation of one field.
+
+  Description:
+    This function works out the first byte, the number of bytes, the shift,
+    the mask and the sign bit of a field from its position in the report.
+
+  Precondition:
+    None
+
+  Parameters:
+    HID_IMPORT_OP *pOp  - Operation to compile
+    WORD start          - Bit offset of the field in the report
+    BYTE bitLength      - Length of the field in bits
+    BOOL signExtend     - TRUE if the field is signed
+    WORD reportLength   - Length of the report in bytes
+
+  Return Values:
+    TRUE    - The operation was compiled
+    FALSE   - The field is empty, wider than 32 bits, or lies outside the
+              report
+
+  Remarks:
+    None
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+BOOL _USBHostHID_CompileImportOp( HID_IMPORT_OP *pOp, WORD start, BYTE bitLength, BOOL signExtend, WORD reportLength )
+{
+    WORD    lastBit;
+
+    if ((bitLength == 0) || (bitLength > 32))
+    {
+        return FALSE;
+    }
+    lastBit = start + bitLength - 1;
+    if ((lastBit/8) >= reportLength)
+    {
+        return FALSE;
+    }
+
+    pOp->byteOffset = start/8;
+    pOp->byteCount  = lastBit/8 - start/8 + 1;
+    pOp->shift      = start&7;
+
+    if (bitLength == 32)
+    {
+        pOp->mask = 0xFFFFFFFFul;
+    }
+    else
+    {
+        pOp->mask = (1ul << bitLength) - 1;
+    }
+    if (signExtend)
+    {
+        pOp->signBit = 1ul << (bitLength - 1);
+    }
+    else
+    {
+        pOp->signBit = 0;
+    }
+    return TRUE;
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    void _USBHostHID_FieldUsage( HID_REPORTITEM *pItem, BYTE index,
+                HID_ROUTE_FIELD *pField )
+
+  Summary:
+    This function finds the usage of one field of a report item.
+
+  Description:
+    This function walks the usage items of a report item to find the usage
+    of its index'th field.  Each usage covers one field and each usage range
+    one field per usage; the last usage covers any fields that are left.
+    All the fields of an array item report usage indices, so they are given
+    the item's first usage.
+
+  Precondition:
+    None
+
+  Parameters:
+    HID_REPORTITEM *pItem   - Report item
+    BYTE index              - Index of the field in the item
+    HID_ROUTE_FIELD *pField - Usage of the field
+
+  Returns:
+    None
+
+  Remarks:
+    None
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+void _USBHostHID_FieldUsage( HID_REPORTITEM *pItem, BYTE index, HID_ROUTE_FIELD *pField )
+{
+    HID_USAGEITEM   *pUsage;
+    WORD            firstUsage;
+    WORD            usages;
+    BYTE            i;
+
+    pField->dataModes   = (BYTE)pItem->dataModes;
+    pField->usagePage   = pItem->globals.usagePage;
+    pField->usage       = 0;
+
+    for (i=0; i<pItem->usageItems; i++)
+    {
+        pUsage = &itemListPtrs.usageItemList[pItem->firstUsageItem + i];
+        if (pUsage->isRange)
+        {
+            firstUsage  = pUsage->usageMinimum;
+            usages      = pUsage->usageMaximum - pUsage->usageMinimum + 1;
+        }
+        else
+        {
+            firstUsage  = pUsage->usage;
+            usages      = 1;
+        }
+        pField->usagePage = pUsage->usagePage;
+
+        // An array field holds a usage index, so it gets the first usage.
+        if (!(pItem->dataModes & HIDData_Variable))
+        {
+            pField->usage = firstUsage;
+            return;
+        }
+        if ((index < usages) || ((i + 1) == pItem->usageItems))
+        {
+            pField->usage = firstUsage + ((index < usages) ? index : (usages - 1));
+            return;
+        }
+        index -= usages;
+    }
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    BYTE _USBHostHID_ItemApplication( HID_REPORTITEM *pItem,
+                const HID_ROUTE_APPLICATION *pApplications, BYTE applications )
+
+  Summary:
+    This function finds the registered application collection of an item.
+
+  Description:
+    This function follows the parents of a report item up to its top level
+    collection, and looks up that collection's usage in pApplications.
+
+  Precondition:
+    None
+
+  Parameters:
+    HID_REPORTITEM *pItem                       - Report item
+    const HID_ROUTE_APPLICATION *pApplications  - Registered collections
+    BYTE applications                           - Number of collections
+
+  Returns:
+    Index of the collection in pApplications, or applications if the item
+    is not in a registered collection
+
+  Remarks:
+    Collection 0 is the parser's virtual collection around the whole
+    descriptor.
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_REPORT_ROUTING
+BYTE _USBHostHID_ItemApplication( HID_REPORTITEM *pItem, const HID_ROUTE_APPLICATION *pApplications, BYTE applications )
+{
+    HID_COLLECTION  *pCollection;
+    HID_USAGEITEM   *pUsage;
+    WORD            usage;
+    BYTE            index;
+    BYTE            i;
+
+    index = pItem->parent;
+    if (index == 0)
+    {
+        return applications;
+    }
+    while (itemListPtrs.collectionList[index].parent != 0)
+    {
+        index = itemListPtrs.collectionList[index].parent;
+    }
+
+    // The collection's usage is the last one before it.
+    pCollection = &itemListPtrs.collectionList[index];
+    if (pCollection->usageItems == 0)
+    {
+        return applications;
+    }
+    pUsage = &itemListPtrs.usageItemList[pCollection->firstUsageItem + pCollection->usageItems - 1];
+    usage = pUsage->isRange ? pUsage->usageMinimum : pUsage->usage;
+
+    for (i=0; i<applications; i++)
+    {
+        if ((pApplications[i].usagePage == pUsage->usagePage) && (pApplications[i].usage == usage))
+        {
+            return i;
+        }
+    }
+    return applications;
+}
+#endif
+
+
+/*******************************************************************************
+  Function:
+    void _USBHostHID_RunImport( BYTE *report, HID_IMPORT_OP *pOp,
+                BYTE fields, HID_USER_DATA_SIZE *buffer )
+
+  Summary:
+    This function runs import operations over a report.
+
+  Description:
+    This function extracts one field per import operation: it assembles the
+    bytes the field spans, then shifts, masks and sign extends it.
+
+  Precondition:
+    The operations were compiled for a report of this length.
+
+  Parameters:
+    BYTE *report                - Input report
+    HID_IMPORT_OP *pOp          - First operation
+    BYTE fields                 - Number of operations
+    HID_USER_DATA_SIZE *buffer  - Buffer for the fields
+
+  Returns:
+    None
+
+  Remarks:
+    None
+*******************************************************************************/
+#ifdef USB_HID_ENABLE_IMPORT_PROGRAM
+void _USBHostHID_RunImport( BYTE *report, HID_IMPORT_OP *pOp, BYTE fields, HID_USER_DATA_SIZE *buffer )
+{
+    BYTE    *pData;
+    DWORD   data;
+
+    for (; fields>0; fields--)
+    {
+        // Pick up the bytes the field spans
+        pData = &report[pOp->byteOffset];
+        data = pData[0];
+        switch (pOp->byteCount)
+        {
+            case 5:
+            case 4:
+                data |= (DWORD)pData[3] << 24;
+                // Fall through
+            case 3:
+                data |= (DWORD)pData[2] << 16;
+                // Fall through
+            case 2:
+                data |= (WORD)pData[1] << 8;
+                break;
+        }
+
+        // Shift, mask and sign extend the field
+        data >>= pOp->shift;
+        if (pOp->byteCount > 4)
+        {
+            data |= (DWORD)pData[4] << (32 - pOp->shift);
+        }
+        data &= pOp->mask;
+        if (data & pOp->signBit)
+        {
+            data |= ~pOp->mask;
+        }
+
+        *buffer++ = (HID_USER_DATA_SIZE)data;
+        pOp++;
+    }
+}
+#endif
@@ -54,9 +54,9 @@ Change History:
 #include "GenericTypeDefs.h"
 #include "HardwareProfile.h"
 #include "usb_config.h"
-#include "USB\usb.h"
-#include "USB\usb_host_hid.h"
-#include "USB\usb_host_hid_parser.h"
+#include "USB/usb.h"
+#include "USB/usb_host_hid.h"
+#include "USB/usb_host_hid_parser.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -79,14 +79,6 @@ Change History:
 //******************************************************************************
 
 
-//******************************************************************************
-//******************************************************************************
-// Section: Macros
-//******************************************************************************
-//******************************************************************************
-
-#define freezHID(x)                        { free(x); x = NULL; }
-
 //******************************************************************************
 //******************************************************************************
 // Section: Local Prototypes
@@ -94,8 +86,9 @@ Change History:
 //******************************************************************************
 
 static void _USBHostHID_InitDeviceRptInfo(void);
-static void _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem);
-static void _USBHostHID_Parse_EndCollection(HID_ITEM_INFO* ptrItem);
+static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Item(HID_ITEM_INFO* item);
+static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem);
+static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_EndCollection(void);
 static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_ReportType(HID_ITEM_INFO* item);
 static void _USBHostHID_ConvertDataToSigned(HID_ITEM_INFO* item);
 
@@ -107,172 +100,176 @@ static void _USBHostHID_ConvertDataToSigned(HID_ITEM_INFO* item);
 
 USB_HID_DEVICE_RPT_INFO deviceRptInfo = {0};
 USB_HID_ITEM_LIST       itemListPtrs   ={NULL};
-BYTE*                   parsedDataMem = NULL;
+
+// The parsed descriptor is kept in fixed pools, sized by the USB_HID_MAX_...
+// limits, instead of on the heap.  itemListPtrs points into them.
+static HID_COLLECTION   hidCollectionPool[USB_HID_MAX_COLLECTIONS];
+static HID_REPORTITEM   hidReportItemPool[USB_HID_MAX_REPORT_ITEMS];
+static HID_REPORT       hidReportPool[USB_HID_MAX_REPORTS];
+static HID_USAGEITEM    hidUsageItemPool[USB_HID_MAX_USAGE_ITEMS];
+static HID_STRINGITEM   hidStringItemPool[USB_HID_MAX_STRING_ITEMS];
+static HID_DESIGITEM    hidDesignatorItemPool[USB_HID_MAX_DESIGNATOR_ITEMS];
+static BYTE             hidCollectionStack[USB_HID_MAX_COLLECTION_NESTING];
+static HID_GLOBALS      hidGlobalsStack[USB_HID_MAX_GLOBALS_NESTING];
+
+// Item the descriptor stream is in the middle of
+static HID_ITEM_INFO            parseItem;
+static BYTE                     parseDataSize;      // Data bytes that follow the item's header
+static BYTE                     parseDataCount;     // Data bytes of the item received so far
+static BOOL                     parseHaveHeader;    // The header of parseItem has been received
+static USB_HID_RPT_DESC_ERROR   parseError;         // First error found in the descriptor
 
 /****************************************************************************
   Function:
-    USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE* hidReportDescriptor
-                                 ,WORD lengthOfDescriptor, WORD pollRate, 
-                                  BYTE interfaceNum)
+    void _USBHostHID_Parse_Begin(WORD pollRate, BYTE interfaceNum)
 
   Description:
-    This function is called by usb_host_hid.c after a valid configuration
-    device is found. This function parses the report descriptor and stores
-    data in data structures. Application can access these data structures
-    to understand report format and device capabilities
+    This function starts the parse of a new report descriptor.  The
+    descriptor is then passed to _USBHostHID_Parse_Bytes(), in as many
+    pieces as it arrives in, and the parse is finished by
+    _USBHostHID_Parse_End().
 
   Precondition:
     None
 
   Parameters:
-    BYTE* hidReportDescriptor - Pointer to raw report descriptor 
-    WORD  lengthOfDescriptor  - Length of Report Descriptor
     WORD  pollRate            - Poll rate of the report
     BYTE interfaceNum         - interface number of the respective report
                                 descriptor.
 
   Return Values:
-    USB_HID_RPT_DESC_ERROR    - Returns error code(enum) if found while
-                                parsing the report descriptor
+    None
 
   Remarks:
-    None
+    The results of the previous parse are lost.
 ***************************************************************************/
-USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE* hidReportDescriptor , WORD lengthOfDescriptor , WORD pollRate, BYTE interfaceNum)
+void _USBHostHID_Parse_Begin(WORD pollRate, BYTE interfaceNum)
 {
-   WORD  sizeRequired = 0;
-   WORD  len_to_be_parsed =0;
-   BYTE* currentRptDescPtr = NULL;
-   BYTE* assignMem = NULL;
-   /* Main Item Vars */
-   HID_COLLECTION *collectionLocal = NULL;
-   HID_REPORT *reportLocal = NULL;
+    HID_COLLECTION *collectionLocal;
+    HID_REPORT *reportLocal;
 
-   /* Global Item Vars */
-   HID_REPORT *lreport = NULL;
-   BYTE lreportIndex = (BYTE)NULL;
+    _USBHostHID_InitDeviceRptInfo();
 
-   /* Local Item Vars */
-   HID_DESIGITEM *ldesignatorItem = NULL;
-   HID_STRINGITEM *lstringItem = NULL;
-   HID_USAGEITEM *lusageItem = NULL;
+    deviceRptInfo.interfaceNumber = interfaceNum;  // update interface number for the report
+    deviceRptInfo.reportPollingRate = pollRate;
 
-   /*HID  Error */
-   USB_HID_RPT_DESC_ERROR lhidError = HID_ERR;
+    itemListPtrs.collectionList = hidCollectionPool;
+    itemListPtrs.reportItemList = hidReportItemPool;
+    itemListPtrs.reportList = hidReportPool;
+    itemListPtrs.usageItemList = hidUsageItemPool;
+    itemListPtrs.stringItemList = hidStringItemPool;
+    itemListPtrs.designatorItemList = hidDesignatorItemPool;
+    itemListPtrs.collectionStack = hidCollectionStack;
+    itemListPtrs.globalsStack = hidGlobalsStack;
 
-   HID_ITEM_INFO item;
+//  Initialize the virtual collection
 
-   BYTE  i=0;
-   BYTE  dataByte=0 ;
-   BYTE  ldataSize=0;
+    collectionLocal = itemListPtrs.collectionList;
+    collectionLocal->data = 0;
+    collectionLocal->firstChild = 0;
+    collectionLocal->firstReportItem = 0;
+    collectionLocal->firstUsageItem = 0;
+    collectionLocal->nextSibling = 0;
+    collectionLocal->parent = 0;
+    collectionLocal->reportItems = 0;
+    collectionLocal->usageItems = 0;
+    collectionLocal->usagePage = 0;
 
-   if((hidReportDescriptor == NULL) ||(lengthOfDescriptor == 0))
-    {
-       /* set error flag */
-       return(HID_ERR_NullPointer);
-    }
+//  Initialize the default report
 
-    _USBHostHID_InitDeviceRptInfo();
-   
-    deviceRptInfo.interfaceNumber = interfaceNum;  // update interface number for the report
-    deviceRptInfo.reportPollingRate = pollRate;
+    reportLocal = itemListPtrs.reportList;
+    reportLocal->featureBits = 0;
+    reportLocal->inputBits = 0;
+    reportLocal->outputBits = 0;
+    reportLocal->reportID = 0;
 
-    len_to_be_parsed = lengthOfDescriptor;
-    currentRptDescPtr = hidReportDescriptor;
+    parseHaveHeader = FALSE;
+    parseError = HID_ERR;
+}
 
-    while(len_to_be_parsed > 0)    /* First parse to calculate the space required for all the items */
-    {
-       item.ItemDetails.val = *currentRptDescPtr;
-       /* Data need not be parsed at this point */
-       ldataSize = item.ItemDetails.ItemSize ;
-       if(item.ItemDetails.ItemSize == 3) 
-           ldataSize = 4; 
+/****************************************************************************
+  Function:
+    USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Bytes(BYTE* data, WORD length)
 
-       currentRptDescPtr += (ldataSize+1) ; /* point to next item i.e size of item data + 1(item detail) */
-       len_to_be_parsed -= (ldataSize+1);   /* remaining bytes = current - (length of data + 1)*/
+  Description:
+    This function parses the next piece of the report descriptor.  Items
+    may be split across pieces; an item is parsed as soon as its last data
+    byte arrives.
 
-        switch (item.ItemDetails.ItemType)
-            {
-                case HIDType_Main:           /* Main Items */
-                    switch (item.ItemDetails.ItemTag)
-                    {
-                        case HIDTag_Collection:
-                            deviceRptInfo.collections++;
-                            deviceRptInfo.collectionNesting++;
-                            if (deviceRptInfo.collectionNesting > deviceRptInfo.maxCollectionNesting)
-                                deviceRptInfo.maxCollectionNesting = deviceRptInfo.collectionNesting;
-                            break;
-                        case HIDTag_EndCollection:
-                            if (deviceRptInfo.collectionNesting-- == 0)
-                                  lhidError = HID_ERR_UnexpectedEndCollection ;/* Error: UnexpectedEndCollection */
-                            break;
-                        case HIDTag_Input:
-                        case HIDTag_Output:
-                        case HIDTag_Feature:
-                            deviceRptInfo.reportItems++;
-                            break;
-                        default :
-                    break;
-                    }
-                    break;
-                case HIDType_Global:         /* Global Items */
-                    switch (item.ItemDetails.ItemTag)
-                    {
-                        case HIDTag_ReportID:
-                            deviceRptInfo.reports++;
-                            break;
-                        case HIDTag_Push:
-                            deviceRptInfo.globalsNesting++;
-                            if (deviceRptInfo.globalsNesting > deviceRptInfo.maxGlobalsNesting)
-                                deviceRptInfo.maxGlobalsNesting = deviceRptInfo.globalsNesting;
-                            break;
-                        case HIDTag_Pop:
-                            deviceRptInfo.globalsNesting--;
-                            if (deviceRptInfo.globalsNesting > deviceRptInfo.maxGlobalsNesting)
-                                lhidError = HID_ERR_UnexpectedPop ;/* Error: global nesting rolled to negative ... */
-                            break;
-                        default :
-                            break;
-                    }
-                    break;
-                case HIDType_Local:          /* Local Item */
-                    switch (item.ItemDetails.ItemTag)
-                    {
-                        case HIDTag_Usage:
-                            deviceRptInfo.usages++;
-                            break;
-                        case HIDTag_UsageMinimum:
-                        case HIDTag_UsageMaximum:
-                            deviceRptInfo.usageRanges++;
-                            break;
-                        case HIDTag_StringIndex:
-                            deviceRptInfo.strings++;
-                            break;
-                        case HIDTag_StringMinimum:
-                        case HIDTag_StringMaximum:
-                            deviceRptInfo.stringRanges++;
-                            break;
-                        case HIDTag_DesignatorIndex:
-                            deviceRptInfo.designators++;
-                            break;
-                        case HIDTag_DesignatorMinimum:
-                        case HIDTag_DesignatorMaximum:
-                            deviceRptInfo.designatorRanges++;
-                            break;
-                        default :
-                            break;
-                    }
-                  break;
-             default :
-                  break;
+  Precondition:
+    _USBHostHID_Parse_Begin() has been called.
 
-        }
-    }
+  Parameters:
+    BYTE* data                - Next bytes of the report descriptor
+    WORD  length              - Number of bytes
 
-    if(lhidError)
+  Return Values:
+    USB_HID_RPT_DESC_ERROR    - The first error found in the descriptor so
+                                far, or HID_ERR.  Once there is an error
+                                the rest of the descriptor is ignored.
+
+  Remarks:
+    None
+***************************************************************************/
+USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Bytes(BYTE* data, WORD length)
+{
+    while((length > 0) && (parseError == HID_ERR))
     {
-        return(lhidError);
+        if(!parseHaveHeader)
+        {
+            parseItem.ItemDetails.val = *data++;
+            parseItem.Data.uItemData = 0;
+            parseDataSize = parseItem.ItemDetails.ItemSize;
+            if(parseItem.ItemDetails.ItemSize == 3)
+                parseDataSize = 4;
+            parseDataCount = 0;
+            parseHaveHeader = TRUE;
+        }
+        else
+        {
+            /* signed data will be taken care in ItemTag it is expected */
+            parseItem.Data.uItemData |= ((DWORD)*data++ << (parseDataCount*8));
+            parseDataCount++;
+        }
+        length--;
+
+        if(parseDataCount == parseDataSize)
+        {
+            parseHaveHeader = FALSE;
+            parseError = _USBHostHID_Parse_Item(&parseItem);
+        }
     }
+    return(parseError);
+}
+
+/****************************************************************************
+  Function:
+    USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_End(void)
+
+  Description:
+    This function finishes the parse of a report descriptor, and checks
+    the descriptor as a whole.
+
+  Precondition:
+    The whole descriptor has been passed to _USBHostHID_Parse_Bytes().
+
+  Parameters:
+    None
+
+  Return Values:
+    USB_HID_RPT_DESC_ERROR    - Returns error code(enum) if found while
+                                parsing the report descriptor
+
+  Remarks:
+    None
+***************************************************************************/
+USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_End(void)
+{
+    BYTE i;
+
+    if (parseError) return(parseError);
+
+    if (parseHaveHeader) return(HID_ERR_UnexpectedEndOfDescriptor);
 
     if (deviceRptInfo.collectionNesting != 0) return(HID_ERR_MissingEndCollection) /* HID_RPT_DESC_FORMAT_IMPROPER */;
 
@@ -280,440 +277,543 @@ USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE* hidReportDescriptor , WORD
 
     if (deviceRptInfo.reportItems == 0) return(HID_ERR_NoReports)/* HID_RPT_DESC_FORMAT_IMPROPER */;
 
-    if ((deviceRptInfo.usageRanges & 1) == 1) return(HID_ERR_UnmatchedUsageRange)/* HID_RPT_DESC_FORMAT_IMPROPER */;
+    if (deviceRptInfo.haveUsageMin || deviceRptInfo.haveUsageMax) return(HID_ERR_UnmatchedUsageRange)/* HID_RPT_DESC_FORMAT_IMPROPER */;
 
-    if ((deviceRptInfo.stringRanges & 1) == 1) return(HID_ERR_UnmatchedStringRange)/* HID_RPT_DESC_FORMAT_IMPROPER */;
+    if (deviceRptInfo.haveStringMin || deviceRptInfo.haveStringMax) return(HID_ERR_UnmatchedStringRange)/* HID_RPT_DESC_FORMAT_IMPROPER */;
 
-    if ((deviceRptInfo.designatorRanges & 1) == 1) return(HID_ERR_UnmatchedDesignatorRange)/* HID_RPT_DESC_FORMAT_IMPROPER */;
+    if (deviceRptInfo.haveDesignatorMin || deviceRptInfo.haveDesignatorMax) return(HID_ERR_UnmatchedDesignatorRange)/* HID_RPT_DESC_FORMAT_IMPROPER */;
 
+//  Remove reports that have just the report id
 
-   /* usages , strings & descriptors are in pair */
-    deviceRptInfo.usages += (deviceRptInfo.usageRanges/2);
-    deviceRptInfo.strings += (deviceRptInfo.stringRanges/2);
-    deviceRptInfo.designators += (deviceRptInfo.designatorRanges/2);
+    for (i=1; i<deviceRptInfo.reports; i++) {
+        if (itemListPtrs.reportList[i].inputBits == 8) itemListPtrs.reportList[i].inputBits = 0;
+        if (itemListPtrs.reportList[i].outputBits == 8) itemListPtrs.reportList[i].outputBits = 0;
+        if (itemListPtrs.reportList[i].featureBits == 8) itemListPtrs.reportList[i].featureBits = 0;
+    }
 
-   /* Calculate space required */
+    return(HID_ERR);
+}
 
-    sizeRequired = (sizeof(HID_COLLECTION) * deviceRptInfo.collections)
-                   + (sizeof(HID_REPORTITEM) * deviceRptInfo.reportItems)
-                   + (sizeof(HID_REPORT) * deviceRptInfo.reports)
-                   + (sizeof(HID_USAGEITEM) * deviceRptInfo.usages)
-                   + (sizeof(HID_STRINGITEM) * deviceRptInfo.strings)
-                   + (sizeof(HID_DESIGITEM) * deviceRptInfo.designators)
-                   + (sizeof(int) * deviceRptInfo.maxCollectionNesting)
-                   + (sizeof(HID_GLOBALS) * deviceRptInfo.maxGlobalsNesting);
+/****************************************************************************
+  Function:
+    USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE* hidReportDescriptor
+                                 ,WORD lengthOfDescriptor, WORD pollRate, 
+                                  BYTE interfaceNum)
 
-    if (parsedDataMem != NULL)
-    {
-		freezHID( parsedDataMem );
-    }
+  Description:
+    This function is called by usb_host_hid.c after a valid configuration
+    device is found. This function parses the report descriptor and stores
+    data in data structures. Application can access these data structures
+    to understand report format and device capabilities
 
-    parsedDataMem = (BYTE*) malloc(sizeRequired);
-    
-#ifdef DEBUG_MODE
-    UART2PrintString( "HID: Memory for Report Descriptor: " );
-    UART2PutHex( sizeRequired );
-#endif
+  Precondition:
+    None
 
-    if (parsedDataMem == NULL) return(HID_ERR_NotEnoughMemory); /* Error: Not enough memory */
-    assignMem = (BYTE*) parsedDataMem;
-    
-    /* Allocate Space */   
-    itemListPtrs.collectionList = (HID_COLLECTION *) assignMem;
-    assignMem += (sizeof(HID_COLLECTION) * deviceRptInfo.collections);
-    itemListPtrs.reportItemList = (HID_REPORTITEM *) assignMem;
-    assignMem += (sizeof(HID_REPORTITEM) * deviceRptInfo.reportItems);
-    itemListPtrs.reportList = (HID_REPORT *) assignMem;
-    assignMem += (sizeof(HID_REPORT) * deviceRptInfo.reports);
-    itemListPtrs.usageItemList = (HID_USAGEITEM *) assignMem;
-    assignMem += (sizeof(HID_USAGEITEM) * deviceRptInfo.usages);
-    itemListPtrs.stringItemList = (HID_STRINGITEM *) assignMem;
-    assignMem += (sizeof(HID_STRINGITEM) * deviceRptInfo.strings);
-    itemListPtrs.designatorItemList = (HID_DESIGITEM *) assignMem;
-    assignMem += (sizeof(HID_DESIGITEM) * deviceRptInfo.designators);
-    itemListPtrs.collectionStack = (BYTE *) assignMem;
-    assignMem += (sizeof(int) * deviceRptInfo.maxCollectionNesting);
-    itemListPtrs.globalsStack = (HID_GLOBALS *) assignMem;
+  Parameters:
+    BYTE* hidReportDescriptor - Pointer to raw report descriptor 
+    WORD  lengthOfDescriptor  - Length of Report Descriptor
+    WORD  pollRate            - Poll rate of the report
+    BYTE interfaceNum         - interface number of the respective report
+                                descriptor.
 
-    _USBHostHID_InitDeviceRptInfo();
+  Return Values:
+    USB_HID_RPT_DESC_ERROR    - Returns error code(enum) if found while
+                                parsing the report descriptor
 
-//  Initialize the virtual collection
+  Remarks:
+    The whole descriptor is passed to _USBHostHID_Parse_Bytes() at once.
+    A descriptor that arrives in pieces can be given to the parser piece by
+    piece instead, see _USBHostHID_Parse_Begin().
+***************************************************************************/
+USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE* hidReportDescriptor , WORD lengthOfDescriptor , WORD pollRate, BYTE interfaceNum)
+{
+    USB_HID_RPT_DESC_ERROR lhidError;
 
-    collectionLocal = itemListPtrs.collectionList;
-    collectionLocal->data = 0;
-    collectionLocal->firstChild = 0;
-    collectionLocal->firstReportItem = 0;
-    collectionLocal->firstUsageItem = 0;
-    collectionLocal->nextSibling = 0;
-    collectionLocal->parent = 0;
-    collectionLocal->reportItems = 0;
-    collectionLocal->usageItems = 0;
-    collectionLocal->usagePage = 0;
+    if((hidReportDescriptor == NULL) ||(lengthOfDescriptor == 0))
+    {
+        /* set error flag */
+        return(HID_ERR_NullPointer);
+    }
 
-//  Initialize the default report
+    _USBHostHID_Parse_Begin(pollRate, interfaceNum);
+    lhidError = _USBHostHID_Parse_Bytes(hidReportDescriptor, lengthOfDescriptor);
+    if(lhidError)
+    {
+        return(lhidError);
+    }
+    return(_USBHostHID_Parse_End());
+}
 
-    reportLocal = itemListPtrs.reportList;
-    reportLocal->featureBits = 0;
-    reportLocal->inputBits = 0;
-    reportLocal->outputBits = 0;
-    reportLocal->reportID = 0;
+#ifdef USB_HID_REPORT_CACHE_ENTRIES
+/****************************************************************************
+  Function:
+    WORD _USBHostHID_Parse_Save(BYTE* buffer, WORD size)
 
-   /* re-init ptr to Rpt Descp & Length of Descp */
-   len_to_be_parsed = lengthOfDescriptor;
-   currentRptDescPtr = hidReportDescriptor;
+  Description:
+    This function copies the result of the last parse, deviceRptInfo and
+    the entries of the pools it uses, into a buffer so that it can be put
+    back later by _USBHostHID_Parse_Restore().
 
-#ifdef DEBUG_MODE
-    UART2PrintString( "HID-HOST: ... 2nd Parse \n" );
-#endif
+  Precondition:
+    The last parse finished without error.
 
+  Parameters:
+    BYTE* buffer              - Buffer for the parse
+    WORD  size                - Size of the buffer
 
-    while(len_to_be_parsed > 0)     /* Second parse to fill the tables with each item detail */
-    {
-       item.ItemDetails.val = *currentRptDescPtr;
-       item.Data.uItemData = 0;
+  Return Values:
+    WORD                      - Bytes written to the buffer, or 0 if the
+                                parse does not fit
 
-       ldataSize = item.ItemDetails.ItemSize ;
-       if(item.ItemDetails.ItemSize == 3) 
-           ldataSize = 4; 
+  Remarks:
+    The collection and globals stacks are only used during a parse and are
+    not saved.
+***************************************************************************/
+WORD _USBHostHID_Parse_Save(BYTE* buffer, WORD size)
+{
+    WORD length;
+
+    length = sizeof(USB_HID_DEVICE_RPT_INFO) +
+             deviceRptInfo.collections * sizeof(HID_COLLECTION) +
+             deviceRptInfo.reportItems * sizeof(HID_REPORTITEM) +
+             deviceRptInfo.reports * sizeof(HID_REPORT) +
+             deviceRptInfo.usageItems * sizeof(HID_USAGEITEM) +
+             deviceRptInfo.stringItems * sizeof(HID_STRINGITEM) +
+             deviceRptInfo.designatorItems * sizeof(HID_DESIGITEM);
+    if (length > size) return(0);
+
+    memcpy(buffer, &deviceRptInfo, sizeof(USB_HID_DEVICE_RPT_INFO));
+    buffer += sizeof(USB_HID_DEVICE_RPT_INFO);
+    memcpy(buffer, hidCollectionPool, deviceRptInfo.collections * sizeof(HID_COLLECTION));
+    buffer += deviceRptInfo.collections * sizeof(HID_COLLECTION);
+    memcpy(buffer, hidReportItemPool, deviceRptInfo.reportItems * sizeof(HID_REPORTITEM));
+    buffer += deviceRptInfo.reportItems * sizeof(HID_REPORTITEM);
+    memcpy(buffer, hidReportPool, deviceRptInfo.reports * sizeof(HID_REPORT));
+    buffer += deviceRptInfo.reports * sizeof(HID_REPORT);
+    memcpy(buffer, hidUsageItemPool, deviceRptInfo.usageItems * sizeof(HID_USAGEITEM));
+    buffer += deviceRptInfo.usageItems * sizeof(HID_USAGEITEM);
+    memcpy(buffer, hidStringItemPool, deviceRptInfo.stringItems * sizeof(HID_STRINGITEM));
+    buffer += deviceRptInfo.stringItems * sizeof(HID_STRINGITEM);
+    memcpy(buffer, hidDesignatorItemPool, deviceRptInfo.designatorItems * sizeof(HID_DESIGITEM));
+
+    return(length);
+}
 
-       currentRptDescPtr++; /* ptr points to data */
-       for (i = 0; i < ldataSize; i++)
-        {
-            dataByte = *currentRptDescPtr++;  /* signed data will be taken care in ItemTag it is expected */
-            item.Data.uItemData |= ((DWORD)dataByte << (i*8));
-        }
-    
-       len_to_be_parsed -= (ldataSize+1);   /* remaining bytes = current - (length of current item + 1)*/
+/****************************************************************************
+  Function:
+    void _USBHostHID_Parse_Restore(BYTE* buffer)
 
-       switch(item.ItemDetails.ItemType)
-        {
-           case HIDType_Main:   /* look for Main Items*/
-                switch(item.ItemDetails.ItemTag)
-                {
-                    case HIDTag_Input :
-                    case HIDTag_Output :
-                    case HIDTag_Feature :
-                                lhidError = _USBHostHID_Parse_ReportType(&item);
-                    break;
-
-                    case HIDTag_Collection :
-                                _USBHostHID_Parse_Collection(&item);
-                    break;
-
-                    case HIDTag_EndCollection :
-                                _USBHostHID_Parse_EndCollection(&item);
-                    break;
-                }
-                break;
-                
-           case HIDType_Global:   /* look for Global Items*/
-                switch(item.ItemDetails.ItemTag)
-                {
-                    case HIDTag_UsagePage :
-                         deviceRptInfo.globals.usagePage = item.Data.uItemData;
-                         break;
-
-                    case HIDTag_LogicalMinimum : /* convert to signed val */
-                         //  Sign extend one value
-                         _USBHostHID_ConvertDataToSigned(&item);
-                        deviceRptInfo.globals.logicalMinimum = item.Data.sItemData;
-                        break;                         
-
-                    case HIDTag_LogicalMaximum :/* convert to signed val */
-                         //  Sign extend one value
-                         _USBHostHID_ConvertDataToSigned(&item);
-                         deviceRptInfo.globals.logicalMaximum = item.Data.uItemData;
-                         break;
-
-                    case HIDTag_PhysicalMinimum :/* convert to signed val */
-                         //  Sign extend one value
-                         _USBHostHID_ConvertDataToSigned(&item);
-                         deviceRptInfo.globals.physicalMinimum = item.Data.uItemData;
-                        break;
-
-                    case HIDTag_PhysicalMaximum :/* convert to signed val */
-                         //  Sign extend one value
-                         _USBHostHID_ConvertDataToSigned(&item);
-                         deviceRptInfo.globals.physicalMaximum = item.Data.uItemData;
-                         break;
-
-                    case HIDTag_UnitExponent :
-                         deviceRptInfo.globals.unitExponent = item.Data.uItemData;
-                         break;
-
-                    case HIDTag_ReportSize :
-                         deviceRptInfo.globals.reportsize = item.Data.uItemData;
-                         if (deviceRptInfo.globals.reportsize == 0)
-                              lhidError = HID_ERR_ZeroReportSize;
-                         break;
-
-                    case HIDTag_ReportID :
-                         if (item.Data.uItemData)
-                            {
-//                               Look for the Report ID in the table
-                                                  
-                                 lreportIndex = 0;
-                                 while ((lreportIndex < deviceRptInfo.reports)
-                                        && (itemListPtrs.reportList[lreportIndex].reportID != item.Data.uItemData))
-                                        lreportIndex++;
-                                 
-//                               initialize the entry if it's new and there's room for it
-//                               Start with 8 bits for the Report ID
-                                 
-                                 if (lreportIndex == deviceRptInfo.reports)
-                                 {
-                                    lreport = &itemListPtrs.reportList[deviceRptInfo.reports++];
-                                    lreport->reportID = item.Data.uItemData;
-                                    lreport->inputBits = 8;
-                                    lreport->outputBits = 8;
-                                    lreport->featureBits = 8;
-                                 }
-                                 
-//                               remember which report is being processed
-                                 
-                                 deviceRptInfo.globals.reportID = item.Data.uItemData;
-                                 deviceRptInfo.globals.reportIndex = lreportIndex;
-                            }
-                            else
-                            {
-                                 lhidError = HID_ERR_ZeroReportID;
-                            }
-                         break;
+  Description:
+    This function puts back a parse saved by _USBHostHID_Parse_Save(), as
+    if the report descriptor had just been parsed again.
 
-                    case HIDTag_ReportCount :
-                         if (item.Data.uItemData)
-                         {
-                             deviceRptInfo.globals.reportCount = item.Data.uItemData;
-                         }
-                         else
-                         {
-                             lhidError = HID_ERR_ZeroReportCount;
-                         }
-                         break;
+  Precondition:
+    The buffer holds a parse saved by _USBHostHID_Parse_Save().
 
-                    case HIDTag_Push :
-                         itemListPtrs.globalsStack[deviceRptInfo.globalsNesting++] =  deviceRptInfo.globals;
-                         break;
+  Parameters:
+    BYTE* buffer              - Saved parse
 
-                    case HIDTag_Pop :
-                         deviceRptInfo.globals = itemListPtrs.globalsStack[--deviceRptInfo.globalsNesting] ;
-                    break;
-            
-                }
-                break;
+  Return Values:
+    None
 
-           case HIDType_Local:  /* look for Local Items*/
-                switch(item.ItemDetails.ItemTag)
-                {
-                    case HIDTag_Usage :
-                         lusageItem = &itemListPtrs.usageItemList[deviceRptInfo.usageItems++];
-                         lusageItem->isRange = FALSE;
-                         if (item.ItemDetails.ItemSize == 3) /* 4 data bytes */
-                            {
-                                lusageItem->usagePage = item.Data.uItemData >> 16;
-                                lusageItem->usage = item.Data.uItemData & 0x00FF;
-                            }
-                         else
-                            {
-                                lusageItem->usagePage = deviceRptInfo.globals.usagePage;
-                                lusageItem->usage = item.Data.uItemData;
-                            }
-                         break;
+  Remarks:
+    The results of the previous parse are lost.
+***************************************************************************/
+void _USBHostHID_Parse_Restore(BYTE* buffer)
+{
+    _USBHostHID_Parse_Begin(0, 0);
+
+    memcpy(&deviceRptInfo, buffer, sizeof(USB_HID_DEVICE_RPT_INFO));
+    buffer += sizeof(USB_HID_DEVICE_RPT_INFO);
+    memcpy(hidCollectionPool, buffer, deviceRptInfo.collections * sizeof(HID_COLLECTION));
+    buffer += deviceRptInfo.collections * sizeof(HID_COLLECTION);
+    memcpy(hidReportItemPool, buffer, deviceRptInfo.reportItems * sizeof(HID_REPORTITEM));
+    buffer += deviceRptInfo.reportItems * sizeof(HID_REPORTITEM);
+    memcpy(hidReportPool, buffer, deviceRptInfo.reports * sizeof(HID_REPORT));
+    buffer += deviceRptInfo.reports * sizeof(HID_REPORT);
+    memcpy(hidUsageItemPool, buffer, deviceRptInfo.usageItems * sizeof(HID_USAGEITEM));
+    buffer += deviceRptInfo.usageItems * sizeof(HID_USAGEITEM);
+    memcpy(hidStringItemPool, buffer, deviceRptInfo.stringItems * sizeof(HID_STRINGITEM));
+    buffer += deviceRptInfo.stringItems * sizeof(HID_STRINGITEM);
+    memcpy(hidDesignatorItemPool, buffer, deviceRptInfo.designatorItems * sizeof(HID_DESIGITEM));
+}
+#endif
 
-                    case HIDTag_UsageMinimum :
-                         if(deviceRptInfo.haveUsageMax)
-                             {
-                                lusageItem = &itemListPtrs.usageItemList[deviceRptInfo.usageItems++];
-                                lusageItem->isRange = TRUE;
-                                if(item.ItemDetails.ItemSize == 3)
-                                 {
-                                    lusageItem->usagePage = item.Data.uItemData >> 16;
-                                    lusageItem->usageMinimum = item.Data.uItemData & 0x00FFL;
-                                 }
-                                else
-                                 {
-                                    lusageItem->usagePage = deviceRptInfo.globals.usagePage;
-                                    lusageItem->usageMinimum = item.Data.uItemData;
-                                 }
-
-                                 if (lusageItem->usagePage != deviceRptInfo.rangeUsagePage);
-                                     lhidError = HID_ERR_BadUsageRangePage; /* Error: BadUsageRangePage */
-                                    
-                                 lusageItem->usageMaximum = deviceRptInfo.usageMaximum;
-                                 
-                                 if (lusageItem->usageMaximum < lusageItem->usageMinimum)
-                                     lhidError = HID_ERR_BadUsageRange; /* Error: BadUsageRange */
-                                 
-                                 deviceRptInfo.haveUsageMax = FALSE;
-                                 deviceRptInfo.haveUsageMin = FALSE;
-                            }
-                         else 
-                            {
-                                if(item.ItemDetails.ItemSize == 3)
-                                {
-                                    deviceRptInfo.rangeUsagePage = item.Data.uItemData >> 16;
-                                    deviceRptInfo.usageMinimum = item.Data.uItemData & 0x00FFL;
-                                }
-                                else
-                                {
-                                    deviceRptInfo.rangeUsagePage = deviceRptInfo.globals.usagePage;
-                                    deviceRptInfo.usageMinimum = item.Data.uItemData;
-                                }
-                                
-                                deviceRptInfo.haveUsageMin = TRUE;
-                            }
-                         break;
+/****************************************************************************
+  Function:
+    static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Item(HID_ITEM_INFO* item)
 
-                    case HIDTag_UsageMaximum :
-                         if(deviceRptInfo.haveUsageMin)
-                             {
-                                lusageItem = &itemListPtrs.usageItemList[deviceRptInfo.usageItems++];
-                                lusageItem->isRange = TRUE;
-                                if(item.ItemDetails.ItemSize == 3)
-                                 {
-                                    lusageItem->usagePage = item.Data.uItemData >> 16;
-                                    lusageItem->usageMaximum = item.Data.uItemData & 0x00FFL;
-                                 }
-                                else
-                                 {
-                                    lusageItem->usagePage = deviceRptInfo.globals.usagePage;
-                                    lusageItem->usageMaximum = item.Data.uItemData;
-                                 }
-
-                                 if (lusageItem->usagePage != deviceRptInfo.rangeUsagePage)
-                                     lhidError = HID_ERR_BadUsageRangePage; /* Error: BadUsageRangePage */
-                                    
-                                 lusageItem->usageMinimum = deviceRptInfo.usageMinimum;
-                                 
-                                 if (lusageItem->usageMaximum < lusageItem->usageMinimum)
-                                     lhidError = HID_ERR_BadUsageRange; /* Error: BadUsageRange */
-                                 
-                                 deviceRptInfo.haveUsageMax = FALSE;
-                                 deviceRptInfo.haveUsageMin = FALSE;
-                            }
-                         else 
-                            {
-                                if(item.ItemDetails.ItemSize == 3)
-                                {
-                                    deviceRptInfo.rangeUsagePage = item.Data.uItemData >> 16;
-                                    deviceRptInfo.usageMaximum = item.Data.uItemData & 0x00FFL;
-                                }
-                                else
-                                {
-                                    deviceRptInfo.rangeUsagePage = deviceRptInfo.globals.usagePage;
-                                    deviceRptInfo.usageMaximum = item.Data.uItemData;
-                                }
-                                
-                                deviceRptInfo.haveUsageMax = TRUE;
-                            }
-                         break;
+  Description:
+    This function is called by _USBHostHID_Parse_Bytes() to add one item
+    of the report descriptor to the parsed data.
 
-                    case HIDTag_DesignatorIndex :
-                         ldesignatorItem = &itemListPtrs.designatorItemList[deviceRptInfo.designatorItems++];
-                         ldesignatorItem->isRange = FALSE;
-                         ldesignatorItem->index = item.Data.uItemData;
+  Precondition:
+    None
 
-                         break;
+  Parameters:
+    HID_ITEM_INFO* item       - pointer to item structure containg raw
+                                information from the report
 
-                    case HIDTag_DesignatorMinimum :
-                         if(deviceRptInfo.haveDesignatorMax)
+  Return Values:
+    USB_HID_RPT_DESC_ERROR    - Returns error code if any error is
+                                encountered in the item, or
+                                HID_ERR_NotEnoughMemory if one of the pools
+                                is full.
+
+  Remarks:
+    None
+***************************************************************************/
+static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Item(HID_ITEM_INFO* item)
+{
+    /* Global Item Vars */
+    HID_REPORT *lreport = NULL;
+    BYTE lreportIndex = 0;
+
+    /* Local Item Vars */
+    HID_DESIGITEM *ldesignatorItem = NULL;
+    HID_STRINGITEM *lstringItem = NULL;
+    HID_USAGEITEM *lusageItem = NULL;
+
+    /*HID  Error */
+    USB_HID_RPT_DESC_ERROR lhidError = HID_ERR;
+
+    switch(item->ItemDetails.ItemType)
+     {
+        case HIDType_Main:   /* look for Main Items*/
+             switch(item->ItemDetails.ItemTag)
+             {
+                 case HIDTag_Input :
+                 case HIDTag_Output :
+                 case HIDTag_Feature :
+                             lhidError = _USBHostHID_Parse_ReportType(item);
+                 break;
+
+                 case HIDTag_Collection :
+                             lhidError = _USBHostHID_Parse_Collection(item);
+                 break;
+
+                 case HIDTag_EndCollection :
+                             lhidError = _USBHostHID_Parse_EndCollection();
+                 break;
+             }
+             break;
+             
+        case HIDType_Global:   /* look for Global Items*/
+             switch(item->ItemDetails.ItemTag)
+             {
+                 case HIDTag_UsagePage :
+                      deviceRptInfo.globals.usagePage = item->Data.uItemData;
+                      break;
+
+                 case HIDTag_LogicalMinimum : /* convert to signed val */
+                      //  Sign extend one value
+                      _USBHostHID_ConvertDataToSigned(item);
+                     deviceRptInfo.globals.logicalMinimum = item->Data.sItemData;
+                     break;                         
+
+                 case HIDTag_LogicalMaximum :/* convert to signed val */
+                      //  Sign extend one value
+                      _USBHostHID_ConvertDataToSigned(item);
+                      deviceRptInfo.globals.logicalMaximum = item->Data.uItemData;
+                      break;
+
+                 case HIDTag_PhysicalMinimum :/* convert to signed val */
+                      //  Sign extend one value
+                      _USBHostHID_ConvertDataToSigned(item);
+                      deviceRptInfo.globals.physicalMinimum = item->Data.uItemData;
+                     break;
+
+                 case HIDTag_PhysicalMaximum :/* convert to signed val */
+                      //  Sign extend one value
+                      _USBHostHID_ConvertDataToSigned(item);
+                      deviceRptInfo.globals.physicalMaximum = item->Data.uItemData;
+                      break;
+
+                 case HIDTag_UnitExponent :
+                      deviceRptInfo.globals.unitExponent = item->Data.uItemData;
+                      break;
+
+                 case HIDTag_ReportSize :
+                      deviceRptInfo.globals.reportsize = item->Data.uItemData;
+                      if (deviceRptInfo.globals.reportsize == 0)
+                           lhidError = HID_ERR_ZeroReportSize;
+                      break;
+
+                 case HIDTag_ReportID :
+                      if (item->Data.uItemData)
                          {
-                             ldesignatorItem = &itemListPtrs.designatorItemList[deviceRptInfo.designatorItems++];
-                             ldesignatorItem->isRange = TRUE;
-                             ldesignatorItem->minimum = item.Data.uItemData;
-                             ldesignatorItem->maximum = deviceRptInfo.designatorMaximum;
-                             deviceRptInfo.haveDesignatorMin = FALSE;
-                             deviceRptInfo.haveDesignatorMax = FALSE;
+//                               Look for the Report ID in the table
+                                               
+                              lreportIndex = 0;
+                              while ((lreportIndex < deviceRptInfo.reports)
+                                     && (itemListPtrs.reportList[lreportIndex].reportID != item->Data.uItemData))
+                                     lreportIndex++;
+                              
+//                               initialize the entry if it's new and there's room for it
+//                               Start with 8 bits for the Report ID
+                              
+                              if (lreportIndex == deviceRptInfo.reports)
+                              {
+                                 if (deviceRptInfo.reports >= USB_HID_MAX_REPORTS)
+                                     return(HID_ERR_NotEnoughMemory);
+                                 lreport = &itemListPtrs.reportList[deviceRptInfo.reports++];
+                                 lreport->reportID = item->Data.uItemData;
+                                 lreport->inputBits = 8;
+                                 lreport->outputBits = 8;
+                                 lreport->featureBits = 8;
+                              }
+                              
+//                               remember which report is being processed
+                              
+                              deviceRptInfo.globals.reportID = item->Data.uItemData;
+                              deviceRptInfo.globals.reportIndex = lreportIndex;
                          }
                          else
                          {
-                             deviceRptInfo.designatorMinimum = item.Data.uItemData;
-                             deviceRptInfo.haveDesignatorMin = TRUE;
+                              lhidError = HID_ERR_ZeroReportID;
                          }
-                         break;
-
-                    case HIDTag_DesignatorMaximum :
-                         if(deviceRptInfo.haveDesignatorMin)
+                      break;
+
+                 case HIDTag_ReportCount :
+                      if (item->Data.uItemData)
+                      {
+                          deviceRptInfo.globals.reportCount = item->Data.uItemData;
+                      }
+                      else
+                      {
+                          lhidError = HID_ERR_ZeroReportCount;
+                      }
+                      break;
+
+                 case HIDTag_Push :
+                      if (deviceRptInfo.globalsNesting >= USB_HID_MAX_GLOBALS_NESTING)
+                          return(HID_ERR_NotEnoughMemory);
+                      itemListPtrs.globalsStack[deviceRptInfo.globalsNesting++] =  deviceRptInfo.globals;
+                      if (deviceRptInfo.globalsNesting > deviceRptInfo.maxGlobalsNesting)
+                          deviceRptInfo.maxGlobalsNesting = deviceRptInfo.globalsNesting;
+                      break;
+
+                 case HIDTag_Pop :
+                      if (deviceRptInfo.globalsNesting == 0)
+                          return(HID_ERR_UnexpectedPop);
+                      deviceRptInfo.globals = itemListPtrs.globalsStack[--deviceRptInfo.globalsNesting] ;
+                 break;
+         
+             }
+             break;
+
+        case HIDType_Local:  /* look for Local Items*/
+             switch(item->ItemDetails.ItemTag)
+             {
+                 case HIDTag_Usage :
+                      if (deviceRptInfo.usageItems >= USB_HID_MAX_USAGE_ITEMS)
+                          return(HID_ERR_NotEnoughMemory);
+                      lusageItem = &itemListPtrs.usageItemList[deviceRptInfo.usageItems++];
+                      lusageItem->isRange = FALSE;
+                      if (item->ItemDetails.ItemSize == 3) /* 4 data bytes */
                          {
-                             ldesignatorItem = &itemListPtrs.designatorItemList[deviceRptInfo.designatorItems++];
-                             ldesignatorItem->isRange = TRUE;
-                             ldesignatorItem->maximum = item.Data.uItemData;
-                             ldesignatorItem->minimum = deviceRptInfo.designatorMinimum;
-                             deviceRptInfo.haveDesignatorMin = FALSE;
-                             deviceRptInfo.haveDesignatorMax = FALSE;
+                             lusageItem->usagePage = item->Data.uItemData >> 16;
+                             lusageItem->usage = item->Data.uItemData & 0x00FF;
                          }
-                         else
+                      else
                          {
-                             deviceRptInfo.designatorMaximum = item.Data.uItemData;
-                             deviceRptInfo.haveDesignatorMax = TRUE;
+                             lusageItem->usagePage = deviceRptInfo.globals.usagePage;
+                             lusageItem->usage = item->Data.uItemData;
                          }
-                         break;
-
-                    case HIDTag_StringIndex :
-                         lstringItem = &itemListPtrs.stringItemList[deviceRptInfo.stringItems++];
-                         lstringItem->isRange = FALSE;
-                         lstringItem->index = item.Data.uItemData;
-                         break;
-
-                    case HIDTag_StringMinimum :
-                         if (deviceRptInfo.haveStringMax) {
-                             lstringItem = &itemListPtrs.stringItemList[deviceRptInfo.stringItems++];
-                             lstringItem->isRange = TRUE;
-                             lstringItem->minimum = item.Data.uItemData;
-                             lstringItem->maximum = deviceRptInfo.stringMaximum;
-                             deviceRptInfo.haveStringMin = FALSE;
-                             deviceRptInfo.haveStringMax = FALSE;
+                      break;
+
+                 case HIDTag_UsageMinimum :
+                      if(deviceRptInfo.haveUsageMax)
+                          {
+                             if (deviceRptInfo.usageItems >= USB_HID_MAX_USAGE_ITEMS)
+                                 return(HID_ERR_NotEnoughMemory);
+                             lusageItem = &itemListPtrs.usageItemList[deviceRptInfo.usageItems++];
+                             lusageItem->isRange = TRUE;
+                             if(item->ItemDetails.ItemSize == 3)
+                              {
+                                 lusageItem->usagePage = item->Data.uItemData >> 16;
+                                 lusageItem->usageMinimum = item->Data.uItemData & 0x00FFL;
+                              }
+                             else
+                              {
+                                 lusageItem->usagePage = deviceRptInfo.globals.usagePage;
+                                 lusageItem->usageMinimum = item->Data.uItemData;
+                              }
+
+                              if (lusageItem->usagePage != deviceRptInfo.rangeUsagePage)
+                                  lhidError = HID_ERR_BadUsageRangePage; /* Error: BadUsageRangePage */
+                                 
+                              lusageItem->usageMaximum = deviceRptInfo.usageMaximum;
+                              
+                              if (lusageItem->usageMaximum < lusageItem->usageMinimum)
+                                  lhidError = HID_ERR_BadUsageRange; /* Error: BadUsageRange */
+                              
+                              deviceRptInfo.haveUsageMax = FALSE;
+                              deviceRptInfo.haveUsageMin = FALSE;
                          }
-                         else {
-                             deviceRptInfo.stringMinimum = item.Data.uItemData;
-                             deviceRptInfo.haveStringMin = TRUE;
+                      else 
+                         {
+                             if(item->ItemDetails.ItemSize == 3)
+                             {
+                                 deviceRptInfo.rangeUsagePage = item->Data.uItemData >> 16;
+                                 deviceRptInfo.usageMinimum = item->Data.uItemData & 0x00FFL;
+                             }
+                             else
+                             {
+                                 deviceRptInfo.rangeUsagePage = deviceRptInfo.globals.usagePage;
+                                 deviceRptInfo.usageMinimum = item->Data.uItemData;
+                             }
+                             
+                             deviceRptInfo.haveUsageMin = TRUE;
                          }
-                         break;
-
-                    case HIDTag_StringMaximum :
-                         if (deviceRptInfo.haveStringMin) {
-                             lstringItem = &itemListPtrs.stringItemList[deviceRptInfo.stringItems++];
-                             lstringItem->isRange = TRUE;
-                             lstringItem->maximum = item.Data.uItemData;
-                             lstringItem->minimum = deviceRptInfo.stringMinimum;
-                             deviceRptInfo.haveStringMin = FALSE;
-                             deviceRptInfo.haveStringMax = FALSE;
+                      break;
+
+                 case HIDTag_UsageMaximum :
+                      if(deviceRptInfo.haveUsageMin)
+                          {
+                             if (deviceRptInfo.usageItems >= USB_HID_MAX_USAGE_ITEMS)
+                                 return(HID_ERR_NotEnoughMemory);
+                             lusageItem = &itemListPtrs.usageItemList[deviceRptInfo.usageItems++];
+                             lusageItem->isRange = TRUE;
+                             if(item->ItemDetails.ItemSize == 3)
+                              {
+                                 lusageItem->usagePage = item->Data.uItemData >> 16;
+                                 lusageItem->usageMaximum = item->Data.uItemData & 0x00FFL;
+                              }
+                             else
+                              {
+                                 lusageItem->usagePage = deviceRptInfo.globals.usagePage;
+                                 lusageItem->usageMaximum = item->Data.uItemData;
+                              }
+
+                              if (lusageItem->usagePage != deviceRptInfo.rangeUsagePage)
+                                  lhidError = HID_ERR_BadUsageRangePage; /* Error: BadUsageRangePage */
+                                 
+                              lusageItem->usageMinimum = deviceRptInfo.usageMinimum;
+                              
+                              if (lusageItem->usageMaximum < lusageItem->usageMinimum)
+                                  lhidError = HID_ERR_BadUsageRange; /* Error: BadUsageRange */
+                              
+                              deviceRptInfo.haveUsageMax = FALSE;
+                              deviceRptInfo.haveUsageMin = FALSE;
                          }
-                         else {
-                             deviceRptInfo.stringMaximum = item.Data.uItemData;
-                             deviceRptInfo.haveStringMax = TRUE;
+                      else 
+                         {
+                             if(item->ItemDetails.ItemSize == 3)
+                             {
+                                 deviceRptInfo.rangeUsagePage = item->Data.uItemData >> 16;
+                                 deviceRptInfo.usageMaximum = item->Data.uItemData & 0x00FFL;
+                             }
+                             else
+                             {
+                                 deviceRptInfo.rangeUsagePage = deviceRptInfo.globals.usagePage;
+                                 deviceRptInfo.usageMaximum = item->Data.uItemData;
+                             }
+                             
+                             deviceRptInfo.haveUsageMax = TRUE;
                          }
-                         break;
-                    break;
-
-                    case HIDTag_SetDelimiter :
-                    break;
-
-                }
-                
-                break;
-
-           default:
-                break;
-        }
-        /* during 2nd parse if any anomaly is found in report format abort parsing and return */
-        if(lhidError)
-        {
-            return(lhidError);
-        }
-    }
-
-//  Update the virtual collection
-
-//    itemListPtrs.collectionList[0].reportItems = deviceRptInfo.reportItems;
-
-//  Remove reports that have just the report id
+                      break;
+
+                 case HIDTag_DesignatorIndex :
+                      if (deviceRptInfo.designatorItems >= USB_HID_MAX_DESIGNATOR_ITEMS)
+                          return(HID_ERR_NotEnoughMemory);
+                      ldesignatorItem = &itemListPtrs.designatorItemList[deviceRptInfo.designatorItems++];
+                      ldesignatorItem->isRange = FALSE;
+                      ldesignatorItem->index = item->Data.uItemData;
+
+                      break;
+
+                 case HIDTag_DesignatorMinimum :
+                      if(deviceRptInfo.haveDesignatorMax)
+                      {
+                          if (deviceRptInfo.designatorItems >= USB_HID_MAX_DESIGNATOR_ITEMS)
+                              return(HID_ERR_NotEnoughMemory);
+                          ldesignatorItem = &itemListPtrs.designatorItemList[deviceRptInfo.designatorItems++];
+                          ldesignatorItem->isRange = TRUE;
+                          ldesignatorItem->minimum = item->Data.uItemData;
+                          ldesignatorItem->maximum = deviceRptInfo.designatorMaximum;
+                          deviceRptInfo.haveDesignatorMin = FALSE;
+                          deviceRptInfo.haveDesignatorMax = FALSE;
+                      }
+                      else
+                      {
+                          deviceRptInfo.designatorMinimum = item->Data.uItemData;
+                          deviceRptInfo.haveDesignatorMin = TRUE;
+                      }
+                      break;
+
+                 case HIDTag_DesignatorMaximum :
+                      if(deviceRptInfo.haveDesignatorMin)
+                      {
+                          if (deviceRptInfo.designatorItems >= USB_HID_MAX_DESIGNATOR_ITEMS)
+                              return(HID_ERR_NotEnoughMemory);
+                          ldesignatorItem = &itemListPtrs.designatorItemList[deviceRptInfo.designatorItems++];
+                          ldesignatorItem->isRange = TRUE;
+                          ldesignatorItem->maximum = item->Data.uItemData;
+                          ldesignatorItem->minimum = deviceRptInfo.designatorMinimum;
+                          deviceRptInfo.haveDesignatorMin = FALSE;
+                          deviceRptInfo.haveDesignatorMax = FALSE;
+                      }
+                      else
+                      {
+                          deviceRptInfo.designatorMaximum = item->Data.uItemData;
+                          deviceRptInfo.haveDesignatorMax = TRUE;
+                      }
+                      break;
+
+                 case HIDTag_StringIndex :
+                      if (deviceRptInfo.stringItems >= USB_HID_MAX_STRING_ITEMS)
+                          return(HID_ERR_NotEnoughMemory);
+                      lstringItem = &itemListPtrs.stringItemList[deviceRptInfo.stringItems++];
+                      lstringItem->isRange = FALSE;
+                      lstringItem->index = item->Data.uItemData;
+                      break;
+
+                 case HIDTag_StringMinimum :
+                      if (deviceRptInfo.haveStringMax) {
+                          if (deviceRptInfo.stringItems >= USB_HID_MAX_STRING_ITEMS)
+                              return(HID_ERR_NotEnoughMemory);
+                          lstringItem = &itemListPtrs.stringItemList[deviceRptInfo.stringItems++];
+                          lstringItem->isRange = TRUE;
+                          lstringItem->minimum = item->Data.uItemData;
+                          lstringItem->maximum = deviceRptInfo.stringMaximum;
+                          deviceRptInfo.haveStringMin = FALSE;
+                          deviceRptInfo.haveStringMax = FALSE;
+                      }
+                      else {
+                          deviceRptInfo.stringMinimum = item->Data.uItemData;
+                          deviceRptInfo.haveStringMin = TRUE;
+                      }
+                      break;
+
+                 case HIDTag_StringMaximum :
+                      if (deviceRptInfo.haveStringMin) {
+                          if (deviceRptInfo.stringItems >= USB_HID_MAX_STRING_ITEMS)
+                              return(HID_ERR_NotEnoughMemory);
+                          lstringItem = &itemListPtrs.stringItemList[deviceRptInfo.stringItems++];
+                          lstringItem->isRange = TRUE;
+                          lstringItem->maximum = item->Data.uItemData;
+                          lstringItem->minimum = deviceRptInfo.stringMinimum;
+                          deviceRptInfo.haveStringMin = FALSE;
+                          deviceRptInfo.haveStringMax = FALSE;
+                      }
+                      else {
+                          deviceRptInfo.stringMaximum = item->Data.uItemData;
+                          deviceRptInfo.haveStringMax = TRUE;
+                      }
+                      break;
+                 break;
+
+                 case HIDTag_SetDelimiter :
+                 break;
+
+             }
+             
+             break;
 
-    for (i=1; i<deviceRptInfo.reports; i++) {
-        if (itemListPtrs.reportList[i].inputBits == 8) itemListPtrs.reportList[i].inputBits = 0;
-        if (itemListPtrs.reportList[i].outputBits == 8) itemListPtrs.reportList[i].outputBits = 0;
-        if (itemListPtrs.reportList[i].featureBits == 8) itemListPtrs.reportList[i].featureBits = 0;
-    }
+        default:
+             break;
+     }
 
     return(lhidError);
 }
@@ -723,7 +823,7 @@ USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Report(BYTE* hidReportDescriptor , WORD
     static void _USBHostHID_InitDeviceRptInfo(void)
 
   Description:
-    This function is called by _USBHostHID_Parse_Report() to Initialize
+    This function is called by _USBHostHID_Parse_Begin() to Initialize
     report information to default value before every parse.
 
   Precondition:
@@ -754,6 +854,13 @@ static void _USBHostHID_InitDeviceRptInfo(void)
     deviceRptInfo.usages = 0;
     deviceRptInfo.usageRanges = 0;
     deviceRptInfo.usageItems = 0;
+    deviceRptInfo.stringItems = 0;
+    deviceRptInfo.designatorItems = 0;
+    deviceRptInfo.firstUsageItem = 0;
+    deviceRptInfo.firstStringItem = 0;
+    deviceRptInfo.firstDesignatorItem = 0;
+    deviceRptInfo.parent = 0;
+    deviceRptInfo.sibling = 0;
     
     deviceRptInfo.haveDesignatorMax = FALSE;
     deviceRptInfo.haveDesignatorMin = FALSE;
@@ -778,10 +885,10 @@ static void _USBHostHID_InitDeviceRptInfo(void)
 
 /****************************************************************************
   Function:
-    static void _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem)
+    static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem)
 
   Description:
-    This function is called by _USBHostHID_Parse_Report() to parse 
+    This function is called by _USBHostHID_Parse_Item() to parse 
     collection item.
 
   Precondition:
@@ -791,16 +898,21 @@ static void _USBHostHID_InitDeviceRptInfo(void)
     HID_ITEM_INFO* ptrItem - pointer to item structure containg raw
                              information from the report
   Return Values:
-    None
+    USB_HID_RPT_DESC_ERROR - HID_ERR_NotEnoughMemory if there are too many
+                             collections, or they are nested too deeply
 
   Remarks:
     None
 ***************************************************************************/
-static void _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem)
+static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem)
 {
     HID_COLLECTION *lcollection;
     WORD i;
 
+    if ((deviceRptInfo.collections >= USB_HID_MAX_COLLECTIONS) ||
+        (deviceRptInfo.collectionNesting >= USB_HID_MAX_COLLECTION_NESTING))
+        return(HID_ERR_NotEnoughMemory);
+
 //  Initialize the new Collection Structure
 
     i = deviceRptInfo.collections++;
@@ -822,34 +934,41 @@ static void _USBHostHID_Parse_Collection(HID_ITEM_INFO* ptrItem)
 
 //  Save the Parent Collection Information on the stack
     itemListPtrs.collectionStack[deviceRptInfo.collectionNesting++] = deviceRptInfo.parent;
+    if (deviceRptInfo.collectionNesting > deviceRptInfo.maxCollectionNesting)
+        deviceRptInfo.maxCollectionNesting = deviceRptInfo.collectionNesting;
     deviceRptInfo.parent = i;
+    return(HID_ERR);
 }
 
 /****************************************************************************
   Function:
-    static void _USBHostHID_Parse_EndCollection(HID_ITEM_INFO* ptrItem)
+    static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_EndCollection(void)
 
   Description:
-    This function is called by _USBHostHID_Parse_Report() to parse end of
+    This function is called by _USBHostHID_Parse_Item() to parse end of
     collection item.
 
   Precondition:
     None
 
   Parameters:
-    HID_ITEM_INFO* ptrItem - pointer to item structure containg raw
-                             information from the report
-  Return Values:
     None
 
+  Return Values:
+    USB_HID_RPT_DESC_ERROR - HID_ERR_UnexpectedEndCollection if no
+                             collection is open
+
   Remarks:
     None
 ***************************************************************************/
-static void _USBHostHID_Parse_EndCollection(HID_ITEM_INFO* ptrItem)
+static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_EndCollection(void)
 {
     HID_COLLECTION *lcollection;
     BYTE i;
 
+    if (deviceRptInfo.collectionNesting == 0)
+        return(HID_ERR_UnexpectedEndCollection);
+
 //  Remember the number of reportItem MainItems in this Collection
 
     lcollection = &itemListPtrs.collectionList[deviceRptInfo.parent];
@@ -860,6 +979,7 @@ static void _USBHostHID_Parse_EndCollection(HID_ITEM_INFO* ptrItem)
     i = itemListPtrs.collectionStack[--deviceRptInfo.collectionNesting];
     deviceRptInfo.sibling = deviceRptInfo.parent;
     deviceRptInfo.parent = i;
+    return(HID_ERR);
 }
 
 /****************************************************************************
@@ -867,7 +987,7 @@ static void _USBHostHID_Parse_EndCollection(HID_ITEM_INFO* ptrItem)
     static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_ReportType(HID_ITEM_INFO* item)
 
   Description:
-    This function is called by _USBHostHID_Parse_Report() to parse
+    This function is called by _USBHostHID_Parse_Item() to parse
     input, output & report item.
 
   Precondition:
@@ -893,15 +1013,19 @@ static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_ReportType(HID_ITEM_INFO* item)
     if(item == NULL)
         return(HID_ERR_NullPointer);
    
-//  Reality Check on the Report Main Item
+//  Reality Check on the Report Main Item.  Any logical value fits a field of 32 bits or more.
 
-    if (deviceRptInfo.globals.logicalMinimum >= ((LONG)1<<deviceRptInfo.globals.reportsize)) return(HID_ERR_BadLogicalMin) ;
-    if (deviceRptInfo.globals.logicalMaximum >= ((LONG)1<<deviceRptInfo.globals.reportsize))return(HID_ERR_BadLogicalMax);
+    if (deviceRptInfo.globals.reportsize < 32)
+    {
+        if (deviceRptInfo.globals.logicalMinimum >= ((LONG)1<<deviceRptInfo.globals.reportsize)) return(HID_ERR_BadLogicalMin) ;
+        if (deviceRptInfo.globals.logicalMaximum >= ((LONG)1<<deviceRptInfo.globals.reportsize))return(HID_ERR_BadLogicalMax);
+    }
     // The barcode scanner has this issue.  We'll ignore it.
 	// if (deviceRptInfo.globals.logicalMinimum > deviceRptInfo.globals.logicalMaximum)return(HID_ERR_BadLogical); 
     if (deviceRptInfo.haveUsageMin || deviceRptInfo.haveUsageMax)return(HID_ERR_UnmatchedUsageRange);
     if (deviceRptInfo.haveStringMin || deviceRptInfo.haveStringMax)return(HID_ERR_UnmatchedStringRange);
     if (deviceRptInfo.haveDesignatorMin || deviceRptInfo.haveDesignatorMax)return(HID_ERR_UnmatchedDesignatorRange);
+    if (deviceRptInfo.reportItems >= USB_HID_MAX_REPORT_ITEMS)return(HID_ERR_NotEnoughMemory);
 
 //  Initialize the new Report Item structure
 
@@ -953,7 +1077,7 @@ static USB_HID_RPT_DESC_ERROR _USBHostHID_Parse_ReportType(HID_ITEM_INFO* item)
     static void _USBHostHID_ConvertDataToSigned(HID_ITEM_INFO* item)
 
   Description:
-    This function is called by _USBHostHID_Parse_Report() convert data
+    This function is called by _USBHostHID_Parse_Item() convert data
     to signed whenever required
 
   Precondition:
@@ -985,7 +1109,7 @@ static void _USBHostHID_ConvertDataToSigned(HID_ITEM_INFO* item)
        if ((dataByte & 0x80) != 0)
        {
            while (index < sizeof(LONG))
-                item->Data.sItemData |= (0xFF << ((index++)*8)); /* extend one */
+                item->Data.uItemData |= ((DWORD)0xFF << ((index++)*8)); /* extend one */
        }
     }
 }
@@ -40,7 +40,7 @@ Change History:
 #ifndef _USB_HAL_LOCAL_H_
 #define _USB_HAL_LOCAL_H_
 
-#include "usb/usb.h"
+#include "USB/usb.h"
 
 #if defined (__18CXX)
     #include "USB PIC18.h"
@@ -216,19 +216,14 @@ typedef union _BDT_SETUP
 
     struct  // Setup Entry
     {
-        #if defined(__18CXX)
-        unsigned short BC_MSB:  2;
-        #else
-        unsigned short spare:   2;
-        #endif
+        unsigned short :        2;  // BC_MSB/spare, named in the status entry
         unsigned short BSTALL:  1;  // Stalls EP if this descriptor needed
         unsigned short DTS:     1;  // Require data-toggle sync
         unsigned short NINC:    1;  // No Increment of DMA address
         unsigned short KEEP:    1;  // HW Keeps this buffer & descriptor
-        unsigned short DAT01:   1;  // Data-toggle number (0 or 1)
-        unsigned short UOWN:    1;  // Descriptor owner: 0=SW, 1=HW
+        unsigned short :        2;  // DAT01 and UOWN, named in the status entry
         #if !defined(__18CXX)
-        unsigned short resvd:   8;
+        unsigned short :        8;
         #endif
      };
 
@@ -273,7 +268,7 @@ typedef union _BYTECOUNT
     struct  // Byte-count field
     {
         unsigned short BC:      10; // Number of bytes in data buffer
-        unsigned short resvd:   6;
+        unsigned short :        6;
     };
     #endif
 
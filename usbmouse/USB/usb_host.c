@@ -70,15 +70,11 @@ Change History:
 #include <stdlib.h>
 #include <string.h>
 #include "GenericTypeDefs.h"
-#include "USB\usb.h"
+#include "USB/usb.h"
 #include "usb_host_local.h"
 #include "usb_hal_local.h"
 #include "HardwareProfile.h"
-//#include "USB\usb_hal.h"
-
-#if defined( USB_ENABLE_TRANSFER_EVENT )
-    #include "struct_queue.h"
-#endif
+//#include "USB/usb_hal.h"
 
 // *****************************************************************************
 // Low Level Functionality Configurations.
@@ -102,6 +98,19 @@ Change History:
 // of a frame.
 #define ALLOW_MULTIPLE_BULK_TRANSACTIONS_PER_FRAME
 
+// This definition allows every interrupt endpoint that is due to be serviced
+// in the same frame, round-robin, up to the periodic share of the frame.
+// Otherwise, the first pending interrupt endpoint ends the interrupt
+// transfers for the frame, even if it is not due yet.
+#define ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME
+
+// This definition lets the host load the idle ping-pong BD with the next
+// packet of a bulk transfer while the current packet is on the bus.  The
+// next token then goes out without setting up a BD first.
+#if defined( USB_SUPPORT_BULK_TRANSFERS )
+    #define ALLOW_BULK_PING_PONG_PREFETCH
+#endif
+
 // If this is defined, then we will repeat a NAK'd request in the same frame.
 // Otherwise, we will wait until the next frame to repeat the request.  Some
 // mass storage devices require the host to wait until the next frame to
@@ -156,6 +165,11 @@ Change History:
     extern BDT_ENTRY BDT[] __attribute__ ((aligned (512)));
 #endif
 
+// Prefetching needs both ping-pong BDs in each direction.
+#if defined( ALLOW_BULK_PING_PONG_PREFETCH ) && (USB_PING_PONG_MODE != USB_PING_PONG__FULL_PING_PONG)
+    #undef ALLOW_BULK_PING_PONG_PREFETCH
+#endif
+
 // These should all be moved into the USB_DEVICE_INFO structure.
 static BYTE                          countConfigurations;                        // Count the Configuration Descriptors read during enumeration.
 static BYTE                          numCommandTries;                            // The number of times the current command has been tried.
@@ -170,6 +184,13 @@ volatile WORD                 usbOverrideHostState;                       // Nex
 #ifdef ENABLE_STATE_TRACE   // Debug trace support
     static WORD prevHostState;
 #endif
+#if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+    static BDT_ENTRY                *pPrefetchBDT;                               // BD loaded ahead with the next bulk packet, or NULL.
+    static USB_ENDPOINT_INFO        *pPrefetchEndpoint;                          // Endpoint that pPrefetchBDT belongs to.
+    static DWORD                     prefetchDataCount;                          // Transfer offset of the packet in pPrefetchBDT.
+    static WORD                      prefetchPacketSize;                         // Size of the packet in pPrefetchBDT.
+    static BYTE                      prefetchDATA01;                             // Data toggle of the packet in pPrefetchBDT.
+#endif
 
 
 static USB_BUS_INFO                  usbBusInfo;                                 // Information about the USB bus.
@@ -178,6 +199,27 @@ static USB_DEVICE_INFO               usbDeviceInfo;
     static USB_EVENT_QUEUE           usbEventQueue;                              // Queue of USB events used to synchronize ISR to main tasks loop.
 #endif
 static USB_ROOT_HUB_INFO             usbRootHubInfo;                             // Information about a specific port.
+static USB_SCHEDULE                  usbSchedule;                                // Flat table of the active endpoints.
+#if defined( USB_HOST_ARENA_SIZE )
+    static BYTE __attribute__ ((aligned(8))) usbArenaBuffer[USB_HOST_ARENA_SIZE];   // Storage for enumeration data.
+    static USB_ARENA                 usbArena;                                   // Allocation state of usbArenaBuffer.
+#endif
+static USB_TIMING_PROFILE            usbTimingProfile = { USB_INSERT_TIME, USB_RESET_TIME, USB_RESET_RECOVERY_TIME };   // Waits used while bringing up a device.
+#if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+    static USB_ENUMERATION_TELEMETRY usbTelemetry;                               // Phase timestamps of the most recent enumeration.
+    static volatile WORD             usbTelemetryClock;                          // Milliseconds since the device attached.
+#endif
+#if defined( USB_ENUMERATION_CACHE_ENTRIES )
+    static USB_ENUMERATION_CACHE_ENTRY usbEnumerationCache[USB_ENUMERATION_CACHE_ENTRIES];  // Configurations of recently seen devices.
+    static BYTE                      usbEnumerationCacheNext;                    // Entry to replace when the cache is full.
+#endif
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+    static USB_CAPTURE_RING          usbCapture;                                 // The last transactions on the bus.
+    static BDT_ENTRY                *pCaptureBDT;                                // BD loaded for the next token.
+#endif
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+    static WORD                      streamWindowSize;                           // Window of the control read being set up, 0 if not streamed.
+#endif
 
 
 
@@ -187,6 +229,165 @@ static USB_ROOT_HUB_INFO             usbRootHubInfo;
 // *****************************************************************************
 // *****************************************************************************
 
+/****************************************************************************
+  Function:
+    WORD USBHostArenaHighWater( void )
+
+  Summary:
+    This function returns the most enumeration arena space ever used.
+
+  Description:
+    This function returns the largest number of bytes that have been in use
+    in the enumeration arena at one time since power up.  It can be used to
+    tune USB_HOST_ARENA_SIZE for the devices that will be attached.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Arena high-water mark, in bytes
+
+  Remarks:
+    This function is available only if USB_HOST_ARENA_SIZE is defined.
+  ***************************************************************************/
+
+#if defined( USB_HOST_ARENA_SIZE )
+WORD USBHostArenaHighWater( void )
+{
+    return usbArena.highWater;
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    DWORD USBHostCaptureCount( void )
+
+  Summary:
+    This function returns the number of traffic capture records made.
+
+  Description:
+    This function returns the number of records that have been added to the
+    traffic capture ring since the host was initialized.  The ring holds the
+    last USB_CAPTURE_RECORDS of them.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Number of records made
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRAFFIC_CAPTURE is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+DWORD USBHostCaptureCount( void )
+{
+    return usbCapture.count;
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    void USBHostCaptureEnable( BOOL enable )
+
+  Summary:
+    This function starts or stops the traffic capture.
+
+  Description:
+    This function starts or stops adding records to the traffic capture
+    ring.  Capture is on after USBHostInit().
+
+  Precondition:
+    None
+
+  Parameters:
+    BOOL enable - TRUE to capture, FALSE to stop
+
+  Returns:
+    None
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRAFFIC_CAPTURE is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+void USBHostCaptureEnable( BOOL enable )
+{
+    usbCapture.enabled = enable;
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    BOOL USBHostCaptureRecord( DWORD sequence, USB_CAPTURE_RECORD *pRecord )
+
+  Summary:
+    This function copies a record from the traffic capture ring.
+
+  Description:
+    This function copies the record with the given sequence number from the
+    traffic capture ring.  Records are numbered from 0 in the order they
+    were made.  USB interrupts are held off while the record is copied, so
+    the copy is never half old and half new.
+
+  Precondition:
+    None
+
+  Parameters:
+    DWORD sequence              - Sequence number of the record
+    USB_CAPTURE_RECORD *pRecord - Copy of the record
+
+  Return Values:
+    TRUE    - The record was copied.
+    FALSE   - The record has not been made yet, or has been overwritten.
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRAFFIC_CAPTURE is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+BOOL USBHostCaptureRecord( DWORD sequence, USB_CAPTURE_RECORD *pRecord )
+{
+    BOOL                found;
+    #if defined( __C30__ )
+        WORD            interrupt_mask;
+    #elif defined( __PIC32MX__ )
+        UINT32          interrupt_mask;
+    #else
+        #error Cannot save interrupt status
+    #endif
+
+    // Guard against USB interrupts
+    interrupt_mask = U1IE;
+    U1IE = 0;
+
+    found = ((usbCapture.count - sequence - 1) < USB_CAPTURE_RECORDS);
+    if (found)
+    {
+        memcpy( pRecord, &usbCapture.record[sequence & (USB_CAPTURE_RECORDS - 1)], sizeof(USB_CAPTURE_RECORD) );
+    }
+
+    // Re-enable USB interrupts
+    U1IE = interrupt_mask;
+
+    return found;
+}
+#endif
+
+
 /****************************************************************************
   Function:
     BYTE USBHostClearEndpointErrors( BYTE deviceAddress, BYTE endpoint )
@@ -356,6 +557,159 @@ BYTE USBHostDeviceStatus( BYTE deviceAddress )
     return USB_DEVICE_ENUMERATING;
 }
 
+/****************************************************************************
+  Function:
+    BYTE USBHostEndpointStatistics( BYTE deviceAddress, BYTE endpoint,
+                USB_ENDPOINT_STATISTICS *pStatistics, BOOL clear )
+
+  Summary:
+    This function returns the transfer statistics of an endpoint.
+
+  Description:
+    This function copies the transfer statistics of an endpoint of an
+    attached device, and optionally clears them.  USB interrupts are held
+    off while the copy is taken, so the counts are consistent with each
+    other.
+
+  Precondition:
+    None
+
+  Parameters:
+    BYTE deviceAddress                  - Device address
+    BYTE endpoint                       - Endpoint address, or 0 for EP0
+    USB_ENDPOINT_STATISTICS *pStatistics - Copy of the statistics.  May be
+                                            NULL if only clearing.
+    BOOL clear                          - Clear the statistics after the
+                                            copy is taken
+
+  Return Values:
+    USB_SUCCESS             - The statistics were returned
+    USB_UNKNOWN_DEVICE      - Device not found
+    USB_ENDPOINT_NOT_FOUND  - Invalid endpoint
+
+  Remarks:
+    This function is available only if USB_ENABLE_ENDPOINT_STATISTICS is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+BYTE USBHostEndpointStatistics( BYTE deviceAddress, BYTE endpoint, USB_ENDPOINT_STATISTICS *pStatistics, BOOL clear )
+{
+    USB_ENDPOINT_INFO *ep;
+    #if defined( __C30__ )
+        WORD            interrupt_mask;
+    #elif defined( __PIC32MX__ )
+        UINT32          interrupt_mask;
+    #else
+        #error Cannot save interrupt status
+    #endif
+
+    // Find the required device
+    if (deviceAddress != usbDeviceInfo.deviceAddress)
+    {
+        return USB_UNKNOWN_DEVICE;
+    }
+
+    ep = _USB_FindEndpoint( endpoint );
+    if (ep == NULL)
+    {
+        return USB_ENDPOINT_NOT_FOUND;
+    }
+
+    // Guard against USB interrupts
+    interrupt_mask = U1IE;
+    U1IE = 0;
+
+    if (pStatistics)
+    {
+        memcpy( pStatistics, &ep->statistics, sizeof(USB_ENDPOINT_STATISTICS) );
+    }
+    if (clear)
+    {
+        _USB_StatisticsClear( ep );
+    }
+
+    // Re-enable USB interrupts
+    U1IE = interrupt_mask;
+
+    return USB_SUCCESS;
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    const USB_ENUMERATION_TELEMETRY * USBHostEnumerationTelemetry( void )
+
+  Summary:
+    This function returns the phase timestamps of the most recent
+    enumeration.
+
+  Description:
+    This function returns a pointer to the telemetry of the most recent
+    enumeration.  Each field is the time, in milliseconds since the device
+    attached, that a phase of the enumeration finished.  The record is
+    cleared when a device attaches, and fields are filled in as the phases
+    finish.  The application can use it to see where enumeration time goes
+    before shortening the waits with USBHostSetTimingProfile().
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Pointer to the enumeration telemetry
+
+  Remarks:
+    This function is available only if USB_ENABLE_ENUMERATION_TELEMETRY is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+const USB_ENUMERATION_TELEMETRY * USBHostEnumerationTelemetry( void )
+{
+    return &usbTelemetry;
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    const USB_EVENT_QUEUE_STATISTICS * USBHostEventQueueStatistics( void )
+
+  Summary:
+    This function returns the counters of the transfer event queue.
+
+  Description:
+    This function returns a pointer to the counters of the queue that passes
+    transfer events from the USB interrupt to USBHostTasks().  Completions
+    that find the queue full are deferred, and isochronous events that find
+    it full are dropped.
+
+  Precondition:
+    None
+
+  Parameters:
+    None - None
+
+  Returns:
+    Pointer to the event queue statistics
+
+  Remarks:
+    This function is available only if USB_ENABLE_TRANSFER_EVENT is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_TRANSFER_EVENT )
+const USB_EVENT_QUEUE_STATISTICS * USBHostEventQueueStatistics( void )
+{
+    return &usbEventQueue.statistics;
+}
+#endif
+
+
 /****************************************************************************
   Function:
     BOOL USBHostInit(  unsigned long flags  )
@@ -390,7 +744,9 @@ BOOL USBHostInit(  unsigned long flags  )
 {
     // Allocate space for Endpoint 0.  We will initialize it in the state machine,
     // so we can reinitialize when another device connects.  If the Endpoint 0
-    // node already exists, free all other allocated memory.
+    // node already exists, free all other allocated memory.  The EP0 node is
+    // kept for the life of the stack, so it comes from the heap rather than
+    // the enumeration arena.
     if (usbDeviceInfo.pEndpoint0 == NULL)
     {
         if ((usbDeviceInfo.pEndpoint0 = (USB_ENDPOINT_INFO*)malloc( sizeof(USB_ENDPOINT_INFO) )) == NULL)
@@ -418,7 +774,13 @@ BOOL USBHostInit(  unsigned long flags  )
 
     // Initialize event queue
     #if defined( USB_ENABLE_TRANSFER_EVENT )
-        StructQueueInit(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
+        memset( (void *)&usbEventQueue, 0, sizeof(USB_EVENT_QUEUE) );
+    #endif
+
+    // Start the traffic capture
+    #if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+        usbCapture.count    = 0;
+        usbCapture.enabled  = TRUE;
     #endif
 
     return TRUE;
@@ -653,6 +1015,7 @@ BYTE USBHostIssueDeviceRequest( BYTE deviceAddress, BYTE bmRequestType, BYTE bRe
         USB_ENDPOINT_INFO           *pEndpoint;
         USB_INTERFACE_INFO          *pInterface;
         USB_INTERFACE_SETTING_INFO  *pSetting;
+        USB_INTERFACE_SETTING_INFO  *pOldSetting;
 
         // Make sure there are no transfers currently in progress on the current
         // interface setting.
@@ -688,8 +1051,16 @@ BYTE USBHostIssueDeviceRequest( BYTE deviceAddress, BYTE bmRequestType, BYTE bRe
             return USB_ILLEGAL_REQUEST;
         }
 
-        // Set the pointer to the new setting.
+        // Set the pointer to the new setting, and rebuild the endpoint schedule
+        // for it.  If the new setting does not fit, go back to the old one.
+        pOldSetting = pInterface->pCurrentSetting;
         pInterface->pCurrentSetting = pSetting;
+        if (!_USB_BuildSchedule())
+        {
+            pInterface->pCurrentSetting = pOldSetting;
+            _USB_BuildSchedule();
+            return USB_ILLEGAL_REQUEST;
+        }
     }
 
     // If the user is doing a CLEAR FEATURE(ENDPOINT_HALT), we must reset DATA0 for that endpoint.
@@ -734,6 +1105,90 @@ BYTE USBHostIssueDeviceRequest( BYTE deviceAddress, BYTE bmRequestType, BYTE bRe
     return USB_SUCCESS;
 }
 
+/****************************************************************************
+  Function:
+    BYTE USBHostIssueStreamedDeviceRequest( BYTE deviceAddress,
+                    BYTE bmRequestType, BYTE bRequest, WORD wValue,
+                    WORD wIndex, WORD wLength, BYTE *window, WORD windowSize,
+                    BYTE clientDriverID )
+
+  Summary:
+    This function sends a device request that reads its data through a
+    small window instead of into a buffer the size of the data.
+
+  Description:
+    This function sends a device request that gets wLength bytes from the
+    device, like USBHostIssueDeviceRequest() with USB_DEVICE_REQUEST_GET.
+    The data is written round the window as it arrives.  The caller reads
+    it with USBHostStreamPeek() and frees the space with
+    USBHostStreamConsume() while the transfer runs.  The host does not ask
+    the device for the next packet until the window has room for it, so no
+    data is lost if the caller falls behind.
+
+    The transfer completes the same way as one started with
+    USBHostIssueDeviceRequest().  Data still in the window when it completes
+    can be read until the next request on EP0 is issued.
+
+  Precondition:
+    The host state machine should be in the running state, and no reads or
+    writes to EP0 should be in progress.
+
+  Parameters:
+    BYTE deviceAddress  - Device address
+    BYTE bmRequestType  - The request type as defined by the USB
+                            specification.
+    BYTE bRequest       - The request as defined by the USB specification.
+    WORD wValue         - The value for the request as defined by the USB
+                            specification.
+    WORD wIndex         - The index for the request as defined by the USB
+                            specification.
+    WORD wLength        - The data length for the request as defined by the
+                            USB specification.
+    BYTE *window        - Buffer the data passes through
+    WORD windowSize     - Size of the window.  Must be a multiple of the
+                            maximum packet size of EP0.
+    BYTE clientDriverID - Client driver to send the event to.
+
+  Return Values:
+    USB_SUCCESS                 - Request processing started
+    USB_UNKNOWN_DEVICE          - Device not found
+    USB_ILLEGAL_REQUEST         - The window size is not a multiple of the
+                                    maximum packet size of EP0
+    Others                      - See USBHostIssueDeviceRequest()
+
+  Remarks:
+    This function is available only if USB_ENABLE_CONTROL_READ_STREAM is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+BYTE USBHostIssueStreamedDeviceRequest( BYTE deviceAddress, BYTE bmRequestType, BYTE bRequest,
+            WORD wValue, WORD wIndex, WORD wLength, BYTE *window, WORD windowSize,
+            BYTE clientDriverID )
+{
+    BYTE    errorCode;
+
+    if (deviceAddress != usbDeviceInfo.deviceAddress)
+    {
+        return USB_UNKNOWN_DEVICE;
+    }
+
+    // Every packet but the last is a full one, so no packet wraps round the
+    // end of the window.
+    if ((windowSize == 0) || ((windowSize % usbDeviceInfo.pEndpoint0->wMaxPacketSize) != 0))
+    {
+        return USB_ILLEGAL_REQUEST;
+    }
+
+    streamWindowSize = windowSize;
+    errorCode = USBHostIssueDeviceRequest( deviceAddress, bmRequestType, bRequest, wValue, wIndex,
+                    wLength, window, USB_DEVICE_REQUEST_GET, clientDriverID );
+    streamWindowSize = 0;
+
+    return errorCode;
+}
+#endif
+
 /****************************************************************************
   Function:
     BYTE USBHostRead( BYTE deviceAddress, BYTE endpoint, BYTE *pData,
@@ -1090,6 +1545,57 @@ BYTE USBHostSetNAKTimeout( BYTE deviceAddress, BYTE endpoint, WORD flags, WORD t
 }
 
 
+/****************************************************************************
+  Function:
+    BYTE USBHostSetTimingProfile( const USB_TIMING_PROFILE *pProfile )
+
+  Summary:
+    This function sets the insertion, reset and reset recovery waits.
+
+  Description:
+    This function sets the waits the host makes after a device attaches.
+    Applications whose devices are known to settle quickly can shorten the
+    waits to bring the device up sooner.  Values below the USB 2.0 minimums
+    are rejected.  Passing NULL restores the defaults.
+
+  Precondition:
+    None
+
+  Parameters:
+    const USB_TIMING_PROFILE *pProfile - New waits, or NULL for the defaults
+
+  Return Values:
+    USB_SUCCESS         - The profile will be used from the next attach
+    USB_ILLEGAL_REQUEST - A value is below its USB 2.0 minimum; the profile
+                            is unchanged
+
+  Remarks:
+    The profile is not used for the enumeration in progress, if any.  Use
+    USBHostEnumerationTelemetry() to measure the effect of a new profile.
+  ***************************************************************************/
+
+BYTE USBHostSetTimingProfile( const USB_TIMING_PROFILE *pProfile )
+{
+    if (pProfile == NULL)
+    {
+        usbTimingProfile.insertTime         = USB_INSERT_TIME;
+        usbTimingProfile.resetTime          = USB_RESET_TIME;
+        usbTimingProfile.resetRecoveryTime  = USB_RESET_RECOVERY_TIME;
+        return USB_SUCCESS;
+    }
+
+    if ((pProfile->insertTime        < USB_MIN_INSERT_TIME) ||
+        (pProfile->resetTime         < USB_MIN_RESET_TIME) ||
+        (pProfile->resetRecoveryTime < USB_MIN_RESET_RECOVERY_TIME))
+    {
+        return USB_ILLEGAL_REQUEST;
+    }
+
+    usbTimingProfile = *pProfile;
+    return USB_SUCCESS;
+}
+
+
 /****************************************************************************
   Function:
     void USBHostShutdown( void )
@@ -1165,6 +1671,106 @@ void USBHostShutdown( void )
 }
 
 
+/****************************************************************************
+  Function:
+    void USBHostStreamConsume( BYTE deviceAddress, WORD length )
+
+  Summary:
+    This function frees data of a streamed device request that the caller
+    has read.
+
+  Description:
+    This function frees the first length bytes returned by
+    USBHostStreamPeek(), so that the window has room for more data from the
+    device.
+
+  Precondition:
+    USBHostIssueStreamedDeviceRequest() has been called.
+
+  Parameters:
+    BYTE deviceAddress  - Device address
+    WORD length         - Number of bytes read.  Must not be more than
+                            USBHostStreamPeek() returned.
+
+  Returns:
+    None
+
+  Remarks:
+    This function is available only if USB_ENABLE_CONTROL_READ_STREAM is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+void USBHostStreamConsume( BYTE deviceAddress, WORD length )
+{
+    if (deviceAddress == usbDeviceInfo.deviceAddress)
+    {
+        usbDeviceInfo.pEndpoint0->streamConsumed += length;
+    }
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    WORD USBHostStreamPeek( BYTE deviceAddress, BYTE **ppData )
+
+  Summary:
+    This function returns the data of a streamed device request that has
+    arrived and not been read yet.
+
+  Description:
+    This function returns the data of a streamed device request that has
+    arrived and has not been freed with USBHostStreamConsume().  The data is
+    returned in one piece up to the end of the window; the rest is returned
+    by the next call, once this piece has been consumed.
+
+  Precondition:
+    USBHostIssueStreamedDeviceRequest() has been called.
+
+  Parameters:
+    BYTE deviceAddress  - Device address
+    BYTE **ppData       - Set to the first unread byte
+
+  Returns:
+    The number of bytes at *ppData.  0 if there are none, or if the last
+    request on EP0 was not streamed.
+
+  Remarks:
+    This function is available only if USB_ENABLE_CONTROL_READ_STREAM is
+    defined.
+  ***************************************************************************/
+
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+WORD USBHostStreamPeek( BYTE deviceAddress, BYTE **ppData )
+{
+    USB_ENDPOINT_INFO   *pEndpoint;
+    WORD                offset;
+    WORD                length;
+
+    if (deviceAddress != usbDeviceInfo.deviceAddress)
+    {
+        return 0;
+    }
+    pEndpoint = usbDeviceInfo.pEndpoint0;
+    if (pEndpoint->streamWindow == 0)
+    {
+        return 0;
+    }
+
+    offset = pEndpoint->streamConsumed % pEndpoint->streamWindow;
+    length = pEndpoint->dataCount - pEndpoint->streamConsumed;
+    if (length > (pEndpoint->streamWindow - offset))
+    {
+        length = pEndpoint->streamWindow - offset;
+    }
+
+    *ppData = pEndpoint->pUserData + offset;
+    return length;
+}
+#endif
+
+
 /****************************************************************************
   Function:
     BYTE USBHostSuspendDevice( BYTE deviceAddress )
@@ -1281,21 +1887,23 @@ void USBHostTasks( void )
         #endif
     #endif
 
-    // Send any queued events to the client and application layers.
+    // Send any queued events to the client and application layers.  The ISR
+    // only writes head and we only write tail, so the queue can be drained
+    // with USB interrupts enabled.  Take the whole batch that is waiting now;
+    // anything the ISR adds meanwhile is sent on the next call.
     #if defined ( USB_ENABLE_TRANSFER_EVENT )
     {
-        USB_EVENT_DATA *item;
-        #if defined( __C30__ )
-            WORD        interrupt_mask;
-        #elif defined( __PIC32MX__ )
-            UINT32      interrupt_mask;
-        #else
-            #error Cannot save interrupt status
-        #endif
+        USB_EVENT_DATA  *item;
+        BYTE            head;
+        BYTE            tail;
 
-        while (StructQueueIsNotEmpty(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
+        head = usbEventQueue.head;
+        tail = usbEventQueue.tail;
+        _USB_MemoryBarrier();
+
+        while (tail != head)
         {
-            item = StructQueuePeekTail(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
+            item = _USB_EventQueueSlot( tail );
 
             switch(item->event)
             {
@@ -1307,14 +1915,11 @@ void USBHostTasks( void )
                     break;
             }
 
-            // Guard against USB interrupts
-            interrupt_mask = U1IE;
-            U1IE = 0;
-
-            item = StructQueueRemove(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-
-            // Re-enable USB interrupts
-            U1IE = interrupt_mask;
+            // Free the slot only after we are done with it, so that the ISR
+            // can reuse it right away.
+            tail ++;
+            _USB_MemoryBarrier();
+            usbEventQueue.tail = tail;
         }
     }
     #endif
@@ -1357,10 +1962,14 @@ void USBHostTasks( void )
                     usbDeviceInfo.pEndpoint0->timeoutNAKs                  = USB_NUM_CONTROL_NAKS;
                     usbDeviceInfo.pEndpoint0->wMaxPacketSize               = 64;
                     usbDeviceInfo.pEndpoint0->dataCount                    = 0;    // Initialize to 0 since we set bfTransferComplete.
+                    #if defined( USB_ENABLE_CONTROL_READ_STREAM )
+                        usbDeviceInfo.pEndpoint0->streamWindow             = 0;
+                    #endif
                     usbDeviceInfo.pEndpoint0->bEndpointAddress             = 0;
                     usbDeviceInfo.pEndpoint0->transferState                = TSTATE_IDLE;
                     usbDeviceInfo.pEndpoint0->bmAttributes.bfTransferType  = USB_TRANSFER_TYPE_CONTROL;
                     usbDeviceInfo.pEndpoint0->clientDriver                 = CLIENT_DRIVER_HOST;
+                    _USB_StatisticsClear( usbDeviceInfo.pEndpoint0 );
 
                     // Initialize any device specific information.
                     numEnumerationTries                 = USB_NUM_ENUMERATION_TRIES;
@@ -1490,8 +2099,14 @@ void USBHostTasks( void )
                             U1IR                    = USB_INTERRUPT_DETACH;   // The interrupt is cleared by writing a '1' to the flag.
                             U1IEbits.DETACHIE       = 1;
 
-                            // Configure and turn on the settling timer - 100ms.
-                            numTimerInterrupts      = USB_INSERT_TIME;
+                            #if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+                                // Start timing the enumeration from the attach.
+                                memset( &usbTelemetry, 0, sizeof(usbTelemetry) );
+                                usbTelemetryClock   = 0;
+                            #endif
+
+                            // Configure and turn on the settling timer.
+                            numTimerInterrupts      = usbTimingProfile.insertTime;
                             U1OTGIR                 = USB_INTERRUPT_T1MSECIF; // The interrupt is cleared by writing a '1' to the flag.
                             U1OTGIEbits.T1MSECIE    = 1;
                             _USB_SetNextSubSubState();
@@ -1502,6 +2117,7 @@ void USBHostTasks( void )
                             break;
 
                         case SUBSUBSTATE_SETTLING_DONE:
+                            _USB_TelemetryMark( settled );
                             _USB_SetNextSubState();
                             break;
 
@@ -1520,13 +2136,13 @@ void USBHostTasks( void )
                                 UART2PrintString( "HOST: Resetting the device.\r\n" );
                             #endif
 
+                            // Release everything from any earlier enumeration attempt, so a
+                            // retry starts with an empty arena.
+                            _USB_FreeMemory();
+
                             // Prepare a data buffer for us to use.  We'll make it 8 bytes for now,
                             // which is the minimum wMaxPacketSize for EP0.
-                            if (pEP0Data != NULL)
-                            {
-                                freez( pEP0Data );
-                            }
-                            if ((pEP0Data = (BYTE *)malloc( 8 )) == NULL)
+                            if ((pEP0Data = (BYTE *)USB_MALLOC( 8 )) == NULL)
                             {
                                 #ifdef DEBUG_MODE
                                     UART2PrintString( "HOST: Error alloc-ing pEP0Data\r\n" );
@@ -1578,6 +2194,9 @@ void USBHostTasks( void )
                             U1CONbits.PPBRST                    = 0;
                             usbDeviceInfo.flags.bfPingPongIn    = 0;
                             usbDeviceInfo.flags.bfPingPongOut   = 0;
+                            #if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+                                pPrefetchBDT                    = NULL;
+                            #endif
 
                             #ifdef  USB_SUPPORT_OTG
                                 //Disable HNP
@@ -1585,9 +2204,13 @@ void USBHostTasks( void )
                                 USBOTGDeactivateHnp();
                             #endif
 
-                            // Assert reset for 10ms.  Start a timer countdown.
+                            #if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+                                usbTelemetry.resets ++;
+                            #endif
+
+                            // Assert reset.  Start a timer countdown.
                             U1CONbits.USBRST                    = 1;
-                            numTimerInterrupts                  = USB_RESET_TIME;
+                            numTimerInterrupts                  = usbTimingProfile.resetTime;
                             //U1OTGIRbits.T1MSECIF                = 1;       // The interrupt is cleared by writing a '1' to the flag.
                             U1OTGIR                             = USB_INTERRUPT_T1MSECIF; // The interrupt is cleared by writing a '1' to the flag.
                             U1OTGIEbits.T1MSECIE                = 1;
@@ -1611,7 +2234,7 @@ void USBHostTasks( void )
                             U1CONbits.SOFEN         = 1;
 
                             // Wait for the reset recovery time.
-                            numTimerInterrupts      = USB_RESET_RECOVERY_TIME;
+                            numTimerInterrupts      = usbTimingProfile.resetRecoveryTime;
                             U1OTGIR                 = USB_INTERRUPT_T1MSECIF; // The interrupt is cleared by writing a '1' to the flag.
                             U1OTGIEbits.T1MSECIE    = 1;
 
@@ -1631,6 +2254,7 @@ void USBHostTasks( void )
                             U1IE                    = USB_INTERRUPT_TRANSFER | USB_INTERRUPT_SOF | USB_INTERRUPT_ERROR | USB_INTERRUPT_DETACH;
                             U1EIE                   = 0xFF;
 
+                            _USB_TelemetryMark( reset );
                             _USB_SetNextSubState();
                             break;
 
@@ -1702,32 +2326,33 @@ void USBHostTasks( void )
                             break;
 
                         case SUBSUBSTATE_GET_DEVICE_DESCRIPTOR_SIZE_COMPLETE:
-                            // Allocate a buffer for the entire Device Descriptor
-                            if ((pDeviceDescriptor = (BYTE *)malloc( *pEP0Data )) == NULL)
+                            // Save the descriptor size (bLength) and set the EP0 packet size.
+                            temp = *pEP0Data;
+                            usbDeviceInfo.pEndpoint0->wMaxPacketSize = ((USB_DEVICE_DESCRIPTOR *)pEP0Data)->bMaxPacketSize0;
+
+                            // Make our pEP0Data buffer the size of the max packet.  This is
+                            // done first, while it is still the last block in the arena.
+                            freez( pEP0Data );
+                            if ((pEP0Data = (BYTE *)USB_MALLOC( usbDeviceInfo.pEndpoint0->wMaxPacketSize )) == NULL)
                             {
                                 // We cannot continue.  Freeze until the device is removed.
+                                #ifdef DEBUG_MODE
+                                    UART2PrintString( "HOST: Error re-alloc-ing pEP0Data\r\n" );
+                                #endif
                                 _USB_SetErrorCode( USB_HOLDING_OUT_OF_MEMORY );
                                 _USB_SetHoldState();
                                 break;
                             }
-                            // Save the descriptor size in the descriptor (bLength)
-                            *pDeviceDescriptor = *pEP0Data;
-
-                            // Set the EP0 packet size.
-                            usbDeviceInfo.pEndpoint0->wMaxPacketSize = ((USB_DEVICE_DESCRIPTOR *)pEP0Data)->bMaxPacketSize0;
 
-                            // Make our pEP0Data buffer the size of the max packet.
-                            freez( pEP0Data );
-                            if ((pEP0Data = (BYTE *)malloc( usbDeviceInfo.pEndpoint0->wMaxPacketSize )) == NULL)
+                            // Allocate a buffer for the entire Device Descriptor
+                            if ((pDeviceDescriptor = (BYTE *)USB_MALLOC( temp )) == NULL)
                             {
                                 // We cannot continue.  Freeze until the device is removed.
-                                #ifdef DEBUG_MODE
-                                    UART2PrintString( "HOST: Error re-alloc-ing pEP0Data\r\n" );
-                                #endif
                                 _USB_SetErrorCode( USB_HOLDING_OUT_OF_MEMORY );
                                 _USB_SetHoldState();
                                 break;
                             }
+                            *pDeviceDescriptor = temp;
 
                             // Clean up and advance to the next substate.
                             _USB_InitErrorCounters();
@@ -1784,6 +2409,7 @@ void USBHostTasks( void )
 
                         case SUBSUBSTATE_GET_DEVICE_DESCRIPTOR_COMPLETE:
                             // Clean up and advance to the next substate.
+                            _USB_TelemetryMark( deviceDescriptor );
                             _USB_InitErrorCounters();
                             _USB_SetNextSubState();
                             break;
@@ -1864,6 +2490,7 @@ void USBHostTasks( void )
                         case SUBSUBSTATE_SET_DEVICE_ADDRESS_COMPLETE:
                             // Set the device's address here.
                             usbDeviceInfo.deviceAddressAndSpeed = (usbDeviceInfo.flags.bfIsLowSpeed << 7) | usbDeviceInfo.deviceAddress;
+                            _USB_TelemetryMark( addressed );
 
                             // Clean up and advance to the next state.
                             _USB_InitErrorCounters();
@@ -1889,10 +2516,22 @@ void USBHostTasks( void )
                     while (usbDeviceInfo.pConfigurationDescriptorList != NULL)
                     {
                         pTemp = (BYTE *)usbDeviceInfo.pConfigurationDescriptorList->next;
-                        free( usbDeviceInfo.pConfigurationDescriptorList->descriptor );
-                        free( usbDeviceInfo.pConfigurationDescriptorList );
+                        USB_FREE( usbDeviceInfo.pConfigurationDescriptorList->descriptor );
+                        USB_FREE( usbDeviceInfo.pConfigurationDescriptorList );
                         usbDeviceInfo.pConfigurationDescriptorList = (USB_CONFIGURATION *)pTemp;
                     }
+                    #if defined( USB_ENUMERATION_CACHE_ENTRIES )
+                        if (_USB_EnumerationCacheRestore())
+                        {
+                            // We have seen this device before.  Skip reading
+                            // the configuration descriptors.
+                            #ifdef DEBUG_MODE
+                                UART2PrintString( "HOST: Using cached Config Descriptor.\r\n" );
+                            #endif
+                            usbHostState = STATE_CONFIGURING | SUBSTATE_SELECT_CONFIGURATION;
+                            break;
+                        }
+                    #endif
                     _USB_SetNextSubState();
                     break;
 
@@ -1937,7 +2576,7 @@ void USBHostTasks( void )
 
                         case SUBSUBSTATE_GET_CONFIG_DESCRIPTOR_SIZECOMPLETE:
                             // Allocate a buffer for an entry in the configuration descriptor list.
-                            if ((pTemp = (BYTE *)malloc( sizeof (USB_CONFIGURATION) )) == NULL)
+                            if ((pTemp = (BYTE *)USB_MALLOC( sizeof (USB_CONFIGURATION) )) == NULL)
                             {
                                 // We cannot continue.  Freeze until the device is removed.
                                 _USB_SetErrorCode( USB_HOLDING_OUT_OF_MEMORY );
@@ -1946,7 +2585,7 @@ void USBHostTasks( void )
                             }
 
                             // Allocate a buffer for the entire Configuration Descriptor
-                            if ((((USB_CONFIGURATION *)pTemp)->descriptor = (BYTE *)malloc( ((WORD)pEP0Data[3] << 8) + (WORD)pEP0Data[2] )) == NULL)
+                            if ((((USB_CONFIGURATION *)pTemp)->descriptor = (BYTE *)USB_MALLOC( ((WORD)pEP0Data[3] << 8) + (WORD)pEP0Data[2] )) == NULL)
                             {
                                 // Not enough memory for the descriptor!
                                 freez( pTemp );
@@ -2045,6 +2684,8 @@ void USBHostTasks( void )
                     switch (usbHostState & SUBSUBSTATE_MASK)
                     {
                         case SUBSUBSTATE_SELECT_CONFIGURATION:
+                            _USB_TelemetryMark( configDescriptors );
+
                             // Free the old configuration (if any)
                             _USB_FreeConfigMemory();
 
@@ -2245,6 +2886,20 @@ void USBHostTasks( void )
                             break;
 
                         case SUBSUBSTATE_SET_CONFIGURATION_COMPLETE:
+                            // Build the endpoint schedule for the new configuration.
+                            if (!_USB_BuildSchedule())
+                            {
+                                _USB_SetErrorCode( USB_HOLDING_OUT_OF_MEMORY );
+                                _USB_SetHoldState();
+                                break;
+                            }
+
+                            #if defined( USB_ENUMERATION_CACHE_ENTRIES )
+                                // Remember the configuration for the next time this device attaches.
+                                _USB_EnumerationCacheStore();
+                            #endif
+                            _USB_TelemetryMark( configured );
+
                             // Clean up and advance to the next state.
                             _USB_InitErrorCounters();
                             _USB_SetNextSubSubState();
@@ -2291,6 +2946,10 @@ void USBHostTasks( void )
                                     pCurrentInterface = pCurrentInterface->next;
                                 }
                             }
+                            if (usbHostState != STATE_HOLDING)
+                            {
+                                _USB_TelemetryMark( running );
+                            }
                             break;
 
                         default:
@@ -2759,157 +3418,639 @@ BYTE USBHostWrite( BYTE deviceAddress, BYTE endpoint, BYTE *data, DWORD size )
 
 /****************************************************************************
   Function:
-    void _USB_CheckCommandAndEnumerationAttempts( void )
+    void * _USB_ArenaAlloc( WORD size )
 
   Summary:
-    This function is called when we've received a STALL or a NAK when trying
-    to enumerate.
+    This function allocates a block from the enumeration arena.
 
   Description:
-    This function is called when we've received a STALL or a NAK when trying
-    to enumerate.  We allow so many attempts at each command, and so many
-    attempts at enumeration.  If the command fails and there are more command
-    attempts, we try the command again.  If the command fails and there are
-    more enumeration attempts, we reset and try to enumerate again.
-    Otherwise, we go to the holding state.
+    This function allocates a block from the top of the enumeration arena.
+    Blocks are aligned for any pointer type.  The time taken does not
+    depend on what has been allocated before.
 
   Precondition:
-    usbHostState != STATE_RUNNING
+    None
 
   Parameters:
-    None - None
+    WORD size   - Number of bytes to allocate
 
   Returns:
-    None
+    Pointer to the block, or NULL if the arena does not have enough space
 
   Remarks:
-    None
+    This is used through USB_MALLOC when USB_HOST_ARENA_SIZE is defined.
   ***************************************************************************/
 
-void _USB_CheckCommandAndEnumerationAttempts( void )
+#if defined( USB_HOST_ARENA_SIZE )
+void * _USB_ArenaAlloc( WORD size )
 {
-    #ifdef DEBUG_MODE
-        UART2PutChar( '=' );
-    #endif
-
-    // Clear the error and stall flags.  A stall here does not require
-    // host intervention to clear.
-    pCurrentEndpoint->status.bfError    = 0;
-    pCurrentEndpoint->status.bfStalled  = 0;
+    WORD    top;
 
-    numCommandTries --;
-    if (numCommandTries != 0)
+    top = usbArena.top;
+    if (USB_ARENA_ALIGN( size ) > (DWORD)(USB_HOST_ARENA_SIZE - top))
     {
-        // We still have retries left on this command.  Try again.
-        usbHostState &= ~SUBSUBSTATE_MASK;
+        return NULL;
     }
-    else
+
+    usbArena.pLastBlock = &usbArenaBuffer[top];
+    usbArena.top        = top + USB_ARENA_ALIGN( size );
+    if (usbArena.top > usbArena.highWater)
     {
-        // This command has timed out.
-        // We are enumerating.  See if we can try to enumerate again.
-        numEnumerationTries --;
-        if (numEnumerationTries != 0)
-        {
-            // We still have retries left to try to enumerate.  Reset and try again.
-            usbHostState = STATE_ATTACHED | SUBSTATE_RESET_DEVICE;
-        }
-        else
-        {
-            // Give up.  The device is not responding properly.
-            _USB_SetErrorCode( USB_CANNOT_ENUMERATE );
-            _USB_SetHoldState();
-        }
+        usbArena.highWater = usbArena.top;
     }
+
+    return usbArena.pLastBlock;
 }
+#endif
 
 
 /****************************************************************************
   Function:
-    BOOL _USB_FindClassDriver( BYTE bClass, BYTE bSubClass, BYTE bProtocol, BYTE *pbClientDrv )
+    void _USB_ArenaFree( void *ptr )
 
   Summary:
-
+    This function gives a block back to the enumeration arena.
 
   Description:
-    This routine scans the TPL table looking for the entry with
-                the given class, subclass, and protocol values.
+    If the block is the most recent one allocated, the top of the arena is
+    moved back to the start of it.  Any other block stays in use until the
+    arena is reset with _USB_ArenaReset().
 
   Precondition:
-    usbTPL must be define by the application.
+    None
 
   Parameters:
-    bClass      - The class of the desired entry
-    bSubClass   - The subclass of the desired entry
-    bProtocol   - The protocol of the desired entry
-    pbClientDrv - Returned index to the client driver in the client driver
-                    table.
+    void *ptr   - Block to free, or NULL
 
-  Return Values:
-    TRUE    - A class driver was found.
-    FALSE   - A class driver was not found.
+  Returns:
+    None
 
   Remarks:
-    None
+    This is used through USB_FREE when USB_HOST_ARENA_SIZE is defined.
   ***************************************************************************/
 
-BOOL _USB_FindClassDriver( BYTE bClass, BYTE bSubClass, BYTE bProtocol, BYTE *pbClientDrv )
+#if defined( USB_HOST_ARENA_SIZE )
+void _USB_ArenaFree( void *ptr )
 {
-    int i;
-
-    i = 0;
-    while (i < NUM_TPL_ENTRIES)
+    if ((ptr != NULL) && (ptr == usbArena.pLastBlock))
     {
-        if ((usbTPL[i].flags.bfIsClassDriver == 1        ) &&
-            (usbTPL[i].device.bClass         == bClass   ) &&
-            (usbTPL[i].device.bSubClass      == bSubClass) &&
-            (usbTPL[i].device.bProtocol      == bProtocol)   )
-        {
-            *pbClientDrv = usbTPL[i].ClientDriver;
-            #ifdef DEBUG_MODE
-                UART2PrintString( "HOST: Client driver found.\r\n" );
-            #endif
-            return TRUE;
-        }
-        i++;
+        usbArena.top        = (BYTE *)ptr - usbArenaBuffer;
+        usbArena.pLastBlock = NULL;
     }
+}
+#endif
 
-    #ifdef DEBUG_MODE
-        UART2PrintString( "HOST: Client driver NOT found.\r\n" );
-    #endif
-    return FALSE;
 
-} // _USB_FindClassDriver
+/****************************************************************************
+  Function:
+    void _USB_ArenaReset( void )
+
+  Summary:
+    This function empties the enumeration arena.
+
+  Description:
+    This function makes the whole enumeration arena available again.  The
+    high-water mark is kept.
+
+  Precondition:
+    Nothing allocated from the arena is still referenced.
+
+  Parameters:
+    None - None
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+
+#if defined( USB_HOST_ARENA_SIZE )
+void _USB_ArenaReset( void )
+{
+    usbArena.top        = 0;
+    usbArena.pLastBlock = NULL;
+}
+#endif
 
 
 /****************************************************************************
   Function:
-    BOOL _USB_FindDeviceLevelClientDriver( void )
+    BOOL _USB_BuildSchedule( void )
+
+  Summary:
+    This function builds the flat endpoint schedule for the current
+    interface settings.
 
   Description:
-    This function searches the TPL to try to find a device-level client
-    driver.
+    This function walks the current setting of every interface and copies
+    pointers to its endpoints into usbSchedule, grouped by transfer type.
+    _USB_FindServiceEndpoint() and the SOF ISR then scan only this table,
+    so the time they take no longer depends on the number of interfaces and
+    alternate settings.  The counts for each transfer type are published
+    after the table is filled, so the ISR never sees a partial group.
 
   Precondition:
-    * usbHostState == STATE_ATTACHED|SUBSTATE_VALIDATE_VID_PID
-    * usbTPL must be define by the application.
+    usbDeviceInfo.pInterfaceList is valid.
 
   Parameters:
     None - None
 
   Return Values:
-    TRUE    - Client driver found
-    FALSE   - Client driver not found
+    TRUE    - The schedule was built.
+    FALSE   - The current settings have more than USB_MAX_SCHEDULED_ENDPOINTS
+                endpoints.  The schedule is left empty.
 
   Remarks:
-    If successful, this function preserves the client's index from the client
-    driver table and sets flags indicating that the device should use a
-    single client driver.
+    EP0 is not placed in the schedule.  _USB_FindServiceEndpoint() always
+    checks it first.
   ***************************************************************************/
 
-BOOL _USB_FindDeviceLevelClientDriver( void )
+BOOL _USB_BuildSchedule( void )
 {
-    WORD                   i;
-    USB_DEVICE_DESCRIPTOR *pDesc = (USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor;
+    USB_ENDPOINT_INFO   *pEndpoint;
+    USB_INTERFACE_INFO  *pInterface;
+    BYTE                count[4];
+    BYTE                index;
+    BYTE                transferType;
+
+    usbSchedule.countEndpoints = 0;
+    for (transferType = 0; transferType < 4; transferType++)
+    {
+        usbSchedule.count[transferType] = 0;
+    }
+
+    index = 0;
+    for (transferType = 0; transferType < 4; transferType++)
+    {
+        usbSchedule.first[transferType] = index;
+        count[transferType]             = 0;
+
+        pInterface = usbDeviceInfo.pInterfaceList;
+        while (pInterface)
+        {
+            pEndpoint = pInterface->pCurrentSetting->pEndpointList;
+            while (pEndpoint)
+            {
+                if (pEndpoint->bmAttributes.bfTransferType == transferType)
+                {
+                    if (index >= USB_MAX_SCHEDULED_ENDPOINTS)
+                    {
+                        return FALSE;
+                    }
+                    usbSchedule.pEndpoints[index++] = pEndpoint;
+                    count[transferType] ++;
+                }
+                pEndpoint = pEndpoint->next;
+            }
+            pInterface = pInterface->next;
+        }
+    }
+
+    for (transferType = 0; transferType < 4; transferType++)
+    {
+        usbSchedule.count[transferType] = count[transferType];
+    }
+    usbSchedule.countEndpoints = index;
+
+    return TRUE;
+}
+
+
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+/****************************************************************************
+  Function:
+    void _USB_CaptureRecord( BYTE event, BYTE pid, BYTE error, BYTE *pData,
+                WORD length )
+
+  Summary:
+    This function adds a record to the traffic capture ring.
+
+  Description:
+    This function adds a record for the token in flight on pCurrentEndpoint
+    to the traffic capture ring, overwriting the oldest record if the ring
+    is full.  Up to USB_CAPTURE_DATA_SIZE bytes of the packet are kept.
+
+  Precondition:
+    Called only from the USB ISR (through _USB_SendToken() or the transfer
+    and error interrupt handlers).
+
+  Parameters:
+    BYTE event      - USB_CAPTURE_TOKEN or USB_CAPTURE_RESULT
+    BYTE pid        - Token PID, or the PID returned in the BDT
+    BYTE error      - U1EIR for a bus error, otherwise 0
+    BYTE *pData     - Packet data, or NULL if there is none
+    WORD length     - Length of the packet
+
+  Returns:
+    None
+
+  Remarks:
+    This is called for every token, so it is kept short enough to leave
+    the capture on in the field.
+  ***************************************************************************/
+
+void _USB_CaptureRecord( BYTE event, BYTE pid, BYTE error, BYTE *pData, WORD length )
+{
+    USB_CAPTURE_RECORD  *pRecord;
+
+    if (!usbCapture.enabled)
+    {
+        return;
+    }
+
+    pRecord = &usbCapture.record[usbCapture.count & (USB_CAPTURE_RECORDS - 1)];
+    pRecord->time           = USB_CAPTURE_TIMESTAMP();
+    pRecord->event          = event;
+    pRecord->transferType   = pCurrentEndpoint->bmAttributes.bfTransferType;
+    pRecord->address        = usbDeviceInfo.deviceAddress;
+    pRecord->endpoint       = usbCapture.endpoint;
+    pRecord->pid            = pid;
+    pRecord->error          = error;
+    pRecord->length         = length;
+    if (pData)
+    {
+        if (length > USB_CAPTURE_DATA_SIZE)
+        {
+            length = USB_CAPTURE_DATA_SIZE;
+        }
+        memcpy( pRecord->data, pData, length );
+    }
+
+    usbCapture.count ++;
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    void _USB_CheckCommandAndEnumerationAttempts( void )
+
+  Summary:
+    This function is called when we've received a STALL or a NAK when trying
+    to enumerate.
+
+  Description:
+    This function is called when we've received a STALL or a NAK when trying
+    to enumerate.  We allow so many attempts at each command, and so many
+    attempts at enumeration.  If the command fails and there are more command
+    attempts, we try the command again.  If the command fails and there are
+    more enumeration attempts, we reset and try to enumerate again.
+    Otherwise, we go to the holding state.
+
+  Precondition:
+    usbHostState != STATE_RUNNING
+
+  Parameters:
+    None - None
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+
+void _USB_CheckCommandAndEnumerationAttempts( void )
+{
+    #ifdef DEBUG_MODE
+        UART2PutChar( '=' );
+    #endif
+
+    // Clear the error and stall flags.  A stall here does not require
+    // host intervention to clear.
+    pCurrentEndpoint->status.bfError    = 0;
+    pCurrentEndpoint->status.bfStalled  = 0;
+
+    numCommandTries --;
+    if (numCommandTries != 0)
+    {
+        // We still have retries left on this command.  Try again.
+        usbHostState &= ~SUBSUBSTATE_MASK;
+    }
+    else
+    {
+        // This command has timed out.
+        // We are enumerating.  See if we can try to enumerate again.
+        numEnumerationTries --;
+        if (numEnumerationTries != 0)
+        {
+            // We still have retries left to try to enumerate.  Reset and try again.
+            usbHostState = STATE_ATTACHED | SUBSTATE_RESET_DEVICE;
+        }
+        else
+        {
+            // Give up.  The device is not responding properly.
+            _USB_SetErrorCode( USB_CANNOT_ENUMERATE );
+            _USB_SetHoldState();
+        }
+    }
+}
+
+
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+/****************************************************************************
+  Function:
+    void _USB_EndpointStatisticsDone( void )
+
+  Summary:
+    This function records the end of a transfer on pCurrentEndpoint.
+
+  Description:
+    This function counts a finished transfer on pCurrentEndpoint, and adds
+    the number of frames since the transfer was submitted to the latency
+    histogram of the endpoint.  Bin 0 holds transfers that finished in the
+    frame they were submitted, bin n holds 2^(n-1) to 2^n - 1 frames, and
+    the last bin holds anything longer.
+
+  Precondition:
+    The transfer was started with one of the _USB_Init... functions.
+
+  Parameters:
+    None - None
+
+  Returns:
+    None
+
+  Remarks:
+    Histogram bins stop counting at 0xFFFF.
+  ***************************************************************************/
+
+void _USB_EndpointStatisticsDone( void )
+{
+    WORD    frames;
+    BYTE    bin;
+
+    frames = usbBusInfo.frameCount - pCurrentEndpoint->submitFrame;
+
+    pCurrentEndpoint->statistics.transfers ++;
+    if (frames > pCurrentEndpoint->statistics.maxLatency)
+    {
+        pCurrentEndpoint->statistics.maxLatency = frames;
+    }
+
+    for (bin = 0; (frames != 0) && (bin < USB_ENDPOINT_LATENCY_BINS - 1); bin++)
+    {
+        frames >>= 1;
+    }
+    if (pCurrentEndpoint->statistics.latency[bin] != 0xFFFF)
+    {
+        pCurrentEndpoint->statistics.latency[bin] ++;
+    }
+}
+#endif
+
+
+#if defined( USB_ENUMERATION_CACHE_ENTRIES )
+/****************************************************************************
+  Function:
+    BOOL _USB_EnumerationCacheRestore( void )
+
+  Summary:
+    This function rebuilds the configuration descriptor list of the current
+    device from the enumeration cache.
+
+  Description:
+    This function looks for a cache entry with the VID, PID and bcdDevice of
+    the current device.  If there is one, it allocates a configuration node
+    holding a copy of the cached descriptor, makes it the only entry in the
+    configuration descriptor list, and empties the cache entry.
+
+  Precondition:
+    The device descriptor has been read, and the configuration descriptor
+    list of the current device is empty.
+
+  Parameters:
+    None - None
+
+  Return Values:
+    TRUE    - The configuration descriptor list was built from the cache.
+    FALSE   - The device is not in the cache, or there is not enough memory.
+                The configuration descriptors must be read from the device.
+
+  Remarks:
+    None
+  ***************************************************************************/
+
+BOOL _USB_EnumerationCacheRestore( void )
+{
+    USB_ENUMERATION_CACHE_ENTRY *pEntry;
+    USB_CONFIGURATION           *pNode;
+    WORD                        length;
+
+    for (pEntry = usbEnumerationCache; pEntry < &usbEnumerationCache[USB_ENUMERATION_CACHE_ENTRIES]; pEntry++)
+    {
+        if ((pEntry->configNumber != 0) &&
+            (pEntry->idVendor  == ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->idVendor) &&
+            (pEntry->idProduct == ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->idProduct) &&
+            (pEntry->bcdDevice == ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->bcdDevice))
+        {
+            break;
+        }
+    }
+    if (pEntry == &usbEnumerationCache[USB_ENUMERATION_CACHE_ENTRIES])
+    {
+        return FALSE;
+    }
+
+    length = ((USB_CONFIGURATION_DESCRIPTOR *)pEntry->descriptor)->wTotalLength;
+    if ((pNode = (USB_CONFIGURATION *)USB_MALLOC( sizeof (USB_CONFIGURATION) )) == NULL)
+    {
+        return FALSE;
+    }
+    if ((pNode->descriptor = (BYTE *)USB_MALLOC( length )) == NULL)
+    {
+        freez( pNode );
+        return FALSE;
+    }
+    memcpy( pNode->descriptor, pEntry->descriptor, length );
+    pNode->configNumber = pEntry->configNumber;
+    pNode->next         = NULL;
+
+    usbDeviceInfo.pConfigurationDescriptorList    = pNode;
+    pCurrentConfigurationDescriptor                 = pNode->descriptor;
+
+    // If the device fails to configure, it is enumerated in full next time.
+    pEntry->configNumber = 0;
+
+    return TRUE;
+}
+
+
+/****************************************************************************
+  Function:
+    void _USB_EnumerationCacheStore( void )
+
+  Summary:
+    This function saves the selected configuration descriptor of the current
+    device in the enumeration cache.
+
+  Description:
+    This function copies the configuration descriptor that was just set into
+    the cache entry for the VID, PID and bcdDevice of the current device.
+    If the device has no entry, an empty entry is used, or the entries are
+    replaced in turn.
+
+  Precondition:
+    SET_CONFIGURATION has completed, and pCurrentConfigurationDescriptor
+    points to the descriptor of the selected configuration.
+
+  Parameters:
+    None - None
+
+  Returns:
+    None
+
+  Remarks:
+    Descriptors longer than USB_ENUMERATION_CACHE_SIZE are not cached.
+  ***************************************************************************/
+
+void _USB_EnumerationCacheStore( void )
+{
+    USB_ENUMERATION_CACHE_ENTRY *pEntry;
+    USB_ENUMERATION_CACHE_ENTRY *pEmpty;
+    USB_CONFIGURATION           *pNode;
+    WORD                        length;
+
+    // Find the configuration number of the selected descriptor.
+    pNode = usbDeviceInfo.pConfigurationDescriptorList;
+    while (pNode && (pNode->descriptor != pCurrentConfigurationDescriptor))
+    {
+        pNode = pNode->next;
+    }
+    length = ((USB_CONFIGURATION_DESCRIPTOR *)pCurrentConfigurationDescriptor)->wTotalLength;
+    if ((pNode == NULL) || (length > USB_ENUMERATION_CACHE_SIZE))
+    {
+        return;
+    }
+
+    // Use the entry for this device, or an empty one, or the oldest one.
+    pEmpty = NULL;
+    for (pEntry = usbEnumerationCache; pEntry < &usbEnumerationCache[USB_ENUMERATION_CACHE_ENTRIES]; pEntry++)
+    {
+        if (pEntry->configNumber == 0)
+        {
+            if (pEmpty == NULL)
+            {
+                pEmpty = pEntry;
+            }
+        }
+        else if ((pEntry->idVendor  == ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->idVendor) &&
+                 (pEntry->idProduct == ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->idProduct) &&
+                 (pEntry->bcdDevice == ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->bcdDevice))
+        {
+            break;
+        }
+    }
+    if (pEntry == &usbEnumerationCache[USB_ENUMERATION_CACHE_ENTRIES])
+    {
+        if (pEmpty)
+        {
+            pEntry = pEmpty;
+        }
+        else
+        {
+            pEntry = &usbEnumerationCache[usbEnumerationCacheNext];
+            usbEnumerationCacheNext = (usbEnumerationCacheNext + 1) % USB_ENUMERATION_CACHE_ENTRIES;
+        }
+    }
+
+    pEntry->idVendor        = ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->idVendor;
+    pEntry->idProduct       = ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->idProduct;
+    pEntry->bcdDevice       = ((USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor)->bcdDevice;
+    pEntry->configNumber    = pNode->configNumber;
+    memcpy( pEntry->descriptor, pCurrentConfigurationDescriptor, length );
+}
+#endif
+
+
+/****************************************************************************
+  Function:
+    BOOL _USB_FindClassDriver( BYTE bClass, BYTE bSubClass, BYTE bProtocol, BYTE *pbClientDrv )
+
+  Summary:
+
+
+  Description:
+    This routine scans the TPL table looking for the entry with
+                the given class, subclass, and protocol values.
+
+  Precondition:
+    usbTPL must be define by the application.
+
+  Parameters:
+    bClass      - The class of the desired entry
+    bSubClass   - The subclass of the desired entry
+    bProtocol   - The protocol of the desired entry
+    pbClientDrv - Returned index to the client driver in the client driver
+                    table.
+
+  Return Values:
+    TRUE    - A class driver was found.
+    FALSE   - A class driver was not found.
+
+  Remarks:
+    None
+  ***************************************************************************/
+
+BOOL _USB_FindClassDriver( BYTE bClass, BYTE bSubClass, BYTE bProtocol, BYTE *pbClientDrv )
+{
+    int i;
+
+    i = 0;
+    while (i < NUM_TPL_ENTRIES)
+    {
+        if ((usbTPL[i].flags.bfIsClassDriver == 1        ) &&
+            (usbTPL[i].device.bClass         == bClass   ) &&
+            (usbTPL[i].device.bSubClass      == bSubClass) &&
+            (usbTPL[i].device.bProtocol      == bProtocol)   )
+        {
+            *pbClientDrv = usbTPL[i].ClientDriver;
+            #ifdef DEBUG_MODE
+                UART2PrintString( "HOST: Client driver found.\r\n" );
+            #endif
+            return TRUE;
+        }
+        i++;
+    }
+
+    #ifdef DEBUG_MODE
+        UART2PrintString( "HOST: Client driver NOT found.\r\n" );
+    #endif
+    return FALSE;
+
+} // _USB_FindClassDriver
+
+
+/****************************************************************************
+  Function:
+    BOOL _USB_FindDeviceLevelClientDriver( void )
+
+  Description:
+    This function searches the TPL to try to find a device-level client
+    driver.
+
+  Precondition:
+    * usbHostState == STATE_ATTACHED|SUBSTATE_VALIDATE_VID_PID
+    * usbTPL must be define by the application.
+
+  Parameters:
+    None - None
+
+  Return Values:
+    TRUE    - Client driver found
+    FALSE   - Client driver not found
+
+  Remarks:
+    If successful, this function preserves the client's index from the client
+    driver table and sets flags indicating that the device should use a
+    single client driver.
+  ***************************************************************************/
+
+BOOL _USB_FindDeviceLevelClientDriver( void )
+{
+    WORD                   i;
+    USB_DEVICE_DESCRIPTOR *pDesc = (USB_DEVICE_DESCRIPTOR *)pDeviceDescriptor;
 
     // Scan TPL
     i = 0;
@@ -3144,51 +4285,31 @@ void _USB_FindNextToken( void )
                             break;
 
                         case TSUBSTATE_CONTROL_NO_DATA_COMPLETE:
-                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                            pCurrentEndpoint->status.bfTransferComplete   = 1;
                             #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
+                                if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                 {
-                                    USB_EVENT_DATA *data;
-
-                                    data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                    data->event = EVENT_TRANSFER;
-                                    data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                    data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                    data->TransferData.bErrorCode       = USB_SUCCESS;
-                                    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                }
-                                else
-                                {
-                                    pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                    // The event queue is full.  Leave the transfer in this state
+                                    // so that it is reported on a later pass.
+                                    break;
                                 }
                             #endif
+                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                            pCurrentEndpoint->status.bfTransferComplete   = 1;
+                            _USB_EndpointStatisticsDone();
                     break;
 
                         case TSUBSTATE_ERROR:
-                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                            pCurrentEndpoint->status.bfTransferComplete   = 1;
                             #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                {
-                                    USB_EVENT_DATA *data;
-
-                                    data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                    data->event = EVENT_BUS_ERROR;
-                                    data->TransferData.dataCount        = 0;
-                                    data->TransferData.pUserData        = NULL;
-                                    data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                }
-                                else
+                                if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                 {
-                                    pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                    // The event queue is full.  Leave the transfer in this state
+                                    // so that it is reported on a later pass.
+                                    break;
                                 }
                             #endif
+                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                            pCurrentEndpoint->status.bfTransferComplete   = 1;
+                            _USB_EndpointStatisticsDone();
                             break;
 
                         default:
@@ -3211,6 +4332,15 @@ void _USB_FindNextToken( void )
                             break;
 
                         case TSUBSTATE_CONTROL_READ_DATA:
+                            #if defined( USB_ENABLE_CONTROL_READ_STREAM )
+                                if (pCurrentEndpoint->streamWindow &&
+                                    ((pCurrentEndpoint->dataCount - pCurrentEndpoint->streamConsumed + pCurrentEndpoint->wMaxPacketSize) > pCurrentEndpoint->streamWindow))
+                                {
+                                    // The client has not read enough of the window to
+                                    // make room for the next packet.  Try again next frame.
+                                    break;
+                                }
+                            #endif
                             _USB_SetBDT( USB_TOKEN_IN );
                             _USB_SendToken( pCurrentEndpoint->bEndpointAddress, USB_TOKEN_IN );
                             #ifdef ONE_CONTROL_TRANSACTION_PER_FRAME
@@ -3231,51 +4361,31 @@ void _USB_FindNextToken( void )
                             break;
 
                         case TSUBSTATE_CONTROL_READ_COMPLETE:
-                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                            pCurrentEndpoint->status.bfTransferComplete   = 1;
                             #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                {
-                                    USB_EVENT_DATA *data;
-
-                                    data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                    data->event = EVENT_TRANSFER;
-                                    data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                    data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                    data->TransferData.bErrorCode       = USB_SUCCESS;
-                                    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                }
-                                else
+                                if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                 {
-                                    pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                    // The event queue is full.  Leave the transfer in this state
+                                    // so that it is reported on a later pass.
+                                    break;
                                 }
                             #endif
+                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                            pCurrentEndpoint->status.bfTransferComplete   = 1;
+                            _USB_EndpointStatisticsDone();
                             break;
 
                         case TSUBSTATE_ERROR:
-                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                            pCurrentEndpoint->status.bfTransferComplete   = 1;
                             #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
+                                if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                 {
-                                    USB_EVENT_DATA *data;
-
-                                    data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                    data->event = EVENT_BUS_ERROR;
-                                    data->TransferData.dataCount        = 0;
-                                    data->TransferData.pUserData        = NULL;
-                                    data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                }
-                                else
-                                {
-                                    pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                    // The event queue is full.  Leave the transfer in this state
+                                    // so that it is reported on a later pass.
+                                    break;
                                 }
                             #endif
+                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                            pCurrentEndpoint->status.bfTransferComplete   = 1;
+                            _USB_EndpointStatisticsDone();
                             break;
 
                         default:
@@ -3318,51 +4428,31 @@ void _USB_FindNextToken( void )
                             break;
 
                         case TSUBSTATE_CONTROL_WRITE_COMPLETE:
-                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                            pCurrentEndpoint->status.bfTransferComplete   = 1;
                             #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                {
-                                    USB_EVENT_DATA *data;
-
-                                    data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                    data->event = EVENT_TRANSFER;
-                                    data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                    data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                    data->TransferData.bErrorCode       = USB_SUCCESS;
-                                    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                }
-                                else
+                                if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                 {
-                                    pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                    // The event queue is full.  Leave the transfer in this state
+                                    // so that it is reported on a later pass.
+                                    break;
                                 }
                             #endif
+                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                            pCurrentEndpoint->status.bfTransferComplete   = 1;
+                            _USB_EndpointStatisticsDone();
                             break;
 
                         case TSUBSTATE_ERROR:
-                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                            pCurrentEndpoint->status.bfTransferComplete   = 1;
                             #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                {
-                                    USB_EVENT_DATA *data;
-
-                                    data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                    data->event = EVENT_BUS_ERROR;
-                                    data->TransferData.dataCount        = 0;
-                                    data->TransferData.pUserData        = NULL;
-                                    data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                }
-                                else
+                                if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                 {
-                                    pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                    // The event queue is full.  Leave the transfer in this state
+                                    // so that it is reported on a later pass.
+                                    break;
                                 }
                             #endif
+                            pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                            pCurrentEndpoint->status.bfTransferComplete   = 1;
+                            _USB_EndpointStatisticsDone();
                             break;
 
                         default:
@@ -3453,23 +4543,7 @@ void _USB_FindNextToken( void )
                                 ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].dataLength = pCurrentEndpoint->dataCount;
                                 ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].bfDataLengthValid = 1;
                                 #if defined( USB_ENABLE_ISOC_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_TRANSFER;
-                                        data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                        data->TransferData.pUserData        = ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].pBuffer;
-                                        data->TransferData.bErrorCode       = USB_SUCCESS;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
-                                    {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
-                                    }
+                                    _USB_QueueTransferEvent( EVENT_TRANSFER, ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].pBuffer );
                                 #endif
                                 // Move to the next data buffer.
                                 ((ISOCHRONOUS_DATA *)pCurrentEndpoint->pUserData)->currentBufferUSB++;
@@ -3485,22 +4559,7 @@ void _USB_FindNextToken( void )
                                 // interval.
                                 pCurrentEndpoint->transferState = TSTATE_ISOCHRONOUS_READ | TSUBSTATE_ISOCHRONOUS_READ_DATA;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_BUS_ERROR;
-                                        data->TransferData.dataCount        = 0;
-                                        data->TransferData.pUserData        = NULL;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                    }
-                                    else
-                                    {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
-                                    }
+                                    _USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL );
                                 #endif
                                 break;
 
@@ -3544,23 +4603,7 @@ void _USB_FindNextToken( void )
                                 // Update the valid data length for this buffer.
                                 ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].bfDataLengthValid = 0;
                                 #if defined( USB_ENABLE_ISOC_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_TRANSFER;
-                                        data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                        data->TransferData.pUserData        = ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].pBuffer;
-                                        data->TransferData.bErrorCode       = USB_SUCCESS;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
-                                    {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
-                                    }
+                                    _USB_QueueTransferEvent( EVENT_TRANSFER, ((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->buffers[((ISOCHRONOUS_DATA *)(pCurrentEndpoint->pUserData))->currentBufferUSB].pBuffer );
                                 #endif
                                 // Move to the next data buffer.
                                 ((ISOCHRONOUS_DATA *)pCurrentEndpoint->pUserData)->currentBufferUSB++;
@@ -3576,23 +4619,7 @@ void _USB_FindNextToken( void )
                                 // interval.
                                 pCurrentEndpoint->transferState = TSTATE_ISOCHRONOUS_WRITE | TSUBSTATE_ISOCHRONOUS_WRITE_DATA;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_BUS_ERROR;
-                                        data->TransferData.dataCount        = 0;
-                                        data->TransferData.pUserData        = NULL;
-                                        data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
-                                    {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
-                                    }
+                                    _USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL );
                                 #endif
                                 break;
 
@@ -3622,6 +4649,9 @@ void _USB_FindNextToken( void )
     #endif
 
     #ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
+#ifdef ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME
+TryInterrupt:
+#endif
         if (!usbBusInfo.flags.bfInterruptTransfersDone)
         {
             // Look for any interrupt operations.
@@ -3635,6 +4665,15 @@ void _USB_FindNextToken( void )
                             case TSUBSTATE_INTERRUPT_READ_DATA:
                                 if (pCurrentEndpoint->wIntervalCount == 0)
                                 {
+                                    #ifdef ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME
+                                        if (!_USB_ReserveFrameTime())
+                                        {
+                                            // Not enough of the frame is left.  Try again after the next SOF.
+                                            usbBusInfo.flags.bfInterruptTransfersDone = 1;
+                                            break;
+                                        }
+                                    #endif
+
                                     // Reset the interval count for the next packet.
                                     pCurrentEndpoint->wIntervalCount = pCurrentEndpoint->wInterval;
 
@@ -3645,51 +4684,33 @@ void _USB_FindNextToken( void )
                                 break;
 
                             case TSUBSTATE_INTERRUPT_READ_COMPLETE:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_TRANSFER;
-                                        data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                        data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                        data->TransferData.bErrorCode       = USB_SUCCESS;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfInterruptTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             case TSUBSTATE_ERROR:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_BUS_ERROR;
-                                        data->TransferData.dataCount        = 0;
-                                        data->TransferData.pUserData        = NULL;
-                                        data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfInterruptTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             default:
@@ -3704,6 +4725,15 @@ void _USB_FindNextToken( void )
                             case TSUBSTATE_INTERRUPT_WRITE_DATA:
                                 if (pCurrentEndpoint->wIntervalCount == 0)
                                 {
+                                    #ifdef ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME
+                                        if (!_USB_ReserveFrameTime())
+                                        {
+                                            // Not enough of the frame is left.  Try again after the next SOF.
+                                            usbBusInfo.flags.bfInterruptTransfersDone = 1;
+                                            break;
+                                        }
+                                    #endif
+
                                     // Reset the interval count for the next packet.
                                     pCurrentEndpoint->wIntervalCount = pCurrentEndpoint->wInterval;
 
@@ -3714,51 +4744,33 @@ void _USB_FindNextToken( void )
                                 break;
 
                             case TSUBSTATE_INTERRUPT_WRITE_COMPLETE:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_TRANSFER;
-                                        data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                        data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                        data->TransferData.bErrorCode       = USB_SUCCESS;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfInterruptTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             case TSUBSTATE_ERROR:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_BUS_ERROR;
-                                        data->TransferData.dataCount        = 0;
-                                        data->TransferData.pUserData        = NULL;
-                                        data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfInterruptTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             default:
@@ -3779,6 +4791,15 @@ void _USB_FindNextToken( void )
                     pCurrentEndpoint->status.bfTransferComplete   = 1;
                     pCurrentEndpoint->transferState               = TSTATE_IDLE;
                 }
+
+                // We finished a transfer without sending a token.  Look for
+                // another endpoint that is due, unless the frame is full.
+                #ifdef ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME
+                    if (!usbBusInfo.flags.bfInterruptTransfersDone)
+                    {
+                        goto TryInterrupt;
+                    }
+                #endif
             }
 
             // If we've gone through all the endpoints, we do not have any more interrupt transfers.
@@ -3814,51 +4835,33 @@ TryBulk:
                                 break;
 
                             case TSUBSTATE_BULK_READ_COMPLETE:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_TRANSFER;
-                                        data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                        data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                        data->TransferData.bErrorCode       = USB_SUCCESS;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfBulkTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             case TSUBSTATE_ERROR:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_BUS_ERROR;
-                                        data->TransferData.dataCount        = 0;
-                                        data->TransferData.pUserData        = NULL;
-                                        data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfBulkTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             default:
@@ -3877,51 +4880,33 @@ TryBulk:
                                 break;
 
                             case TSUBSTATE_BULK_WRITE_COMPLETE:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_TRANSFER;
-                                        data->TransferData.dataCount        = pCurrentEndpoint->dataCount;
-                                        data->TransferData.pUserData        = pCurrentEndpoint->pUserData;
-                                        data->TransferData.bErrorCode       = USB_SUCCESS;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_TRANSFER, pCurrentEndpoint->pUserData ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfBulkTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             case TSUBSTATE_ERROR:
-                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
-                                pCurrentEndpoint->status.bfTransferComplete   = 1;
                                 #if defined( USB_ENABLE_TRANSFER_EVENT )
-                                    if (StructQueueIsNotFull(&usbEventQueue, USB_EVENT_QUEUE_DEPTH))
-                                    {
-                                        USB_EVENT_DATA *data;
-
-                                        data = StructQueueAdd(&usbEventQueue, USB_EVENT_QUEUE_DEPTH);
-                                        data->event = EVENT_BUS_ERROR;
-                                        data->TransferData.dataCount        = 0;
-                                        data->TransferData.pUserData        = NULL;
-                                        data->TransferData.bErrorCode       = pCurrentEndpoint->bErrorCode;
-                                        data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
-                                        data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
-                                        data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
-                                    }
-                                    else
+                                    if (!_USB_QueueTransferEvent( EVENT_BUS_ERROR, NULL ))
                                     {
-                                        pCurrentEndpoint->bmAttributes.val = USB_EVENT_QUEUE_FULL;
+                                        // The event queue is full.  Leave the transfer in this state
+                                        // so that it is reported on a later pass.
+                                        usbBusInfo.flags.bfBulkTransfersDone = 1;
+                                        break;
                                     }
                                 #endif
+                                pCurrentEndpoint->transferState               = TSTATE_IDLE;
+                                pCurrentEndpoint->status.bfTransferComplete   = 1;
+                                _USB_EndpointStatisticsDone();
                                 break;
 
                             default:
@@ -3950,150 +4935,206 @@ TryBulk:
             #ifdef ALLOW_MULTIPLE_BULK_TRANSACTIONS_PER_FRAME
                 if (usbBusInfo.countBulkTransactions)
                 {
-                    usbBusInfo.lastBulkTransaction = 0;
-                    goto TryBulk;
-
+                    usbBusInfo.lastBulkTransaction = 0;
+                    goto TryBulk;
+
+                }
+            #endif
+
+            // If we've gone through all the endpoints, we do not have any more bulk transfers.
+            usbBusInfo.flags.bfBulkTransfersDone = 1;
+        }
+    #endif
+
+    return;
+}
+
+
+/****************************************************************************
+  Function:
+    BOOL _USB_FindServiceEndpoint( BYTE transferType )
+
+  Description:
+    This function finds an endpoint of the specified transfer type that is
+    ready for servicing.  If it finds one, usbDeviceInfo.pCurrentEndpoint is
+    updated to point to the endpoint information structure.  Only the group
+    of usbSchedule for that transfer type is scanned.
+
+  Precondition:
+    None
+
+  Parameters:
+    BYTE transferType - Endpoint transfer type.  Valid values are:
+                            * USB_TRANSFER_TYPE_CONTROL
+                            * USB_TRANSFER_TYPE_ISOCHRONOUS
+                            * USB_TRANSFER_TYPE_INTERRUPT
+                            * USB_TRANSFER_TYPE_BULK
+
+  Return Values:
+    TRUE    - An endpoint of the indicated transfer type needs to be serviced,
+                and pCurrentEndpoint has been updated to point to the endpoint.
+    FALSE   - No endpoints of the indicated transfer type need to be serviced.
+
+  Remarks:
+    The EP 0 block is retained.
+  ***************************************************************************/
+BOOL _USB_FindServiceEndpoint( BYTE transferType )
+{
+    USB_ENDPOINT_INFO           *pEndpoint;
+    USB_ENDPOINT_INFO           **ppEndpoint;
+    BYTE                        count;
+
+    // Check endpoint 0.
+    if ((usbDeviceInfo.pEndpoint0->bmAttributes.bfTransferType == transferType) &&
+        !usbDeviceInfo.pEndpoint0->status.bfTransferComplete)
+    {
+        pCurrentEndpoint = usbDeviceInfo.pEndpoint0;
+        return TRUE;
+    }
+
+    #if defined( USB_SUPPORT_INTERRUPT_TRANSFERS ) && defined( ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME )
+        if (transferType == USB_TRANSFER_TYPE_INTERRUPT)
+        {
+            return _USB_FindServiceInterruptEndpoint();
+        }
+    #endif
+
+    usbBusInfo.countBulkTransactions = 0;
+    ppEndpoint = &usbSchedule.pEndpoints[usbSchedule.first[transferType]];
+    for (count = usbSchedule.count[transferType]; count != 0; count--)
+    {
+        pEndpoint = *ppEndpoint++;
+
+        switch (transferType)
+        {
+            case USB_TRANSFER_TYPE_CONTROL:
+                if (!pEndpoint->status.bfTransferComplete)
+                {
+                    pCurrentEndpoint = pEndpoint;
+                    return TRUE;
+                }
+                break;
+
+            #ifdef USB_SUPPORT_ISOCHRONOUS_TRANSFERS
+            case USB_TRANSFER_TYPE_ISOCHRONOUS:
+            #endif
+            #ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
+            case USB_TRANSFER_TYPE_INTERRUPT:
+            #endif
+            #if defined( USB_SUPPORT_ISOCHRONOUS_TRANSFERS ) || defined( USB_SUPPORT_INTERRUPT_TRANSFERS )
+                if (pEndpoint->status.bfTransferComplete)
+                {
+                    // The endpoint doesn't need servicing.  If the interval count
+                    // has reached 0 and the user has not initiated another transaction,
+                    // reset the interval count for the next interval.
+                    if (pEndpoint->wIntervalCount == 0)
+                    {
+                        // Reset the interval count for the next packet.
+                        pEndpoint->wIntervalCount = pEndpoint->wInterval;
+                    }
+                }
+                else
+                {
+                    pCurrentEndpoint = pEndpoint;
+                    return TRUE;
                 }
+                break;
             #endif
 
-            // If we've gone through all the endpoints, we do not have any more bulk transfers.
-            usbBusInfo.flags.bfBulkTransfersDone = 1;
+            #ifdef USB_SUPPORT_BULK_TRANSFERS
+            case USB_TRANSFER_TYPE_BULK:
+                #ifdef ALLOW_MULTIPLE_NAKS_PER_FRAME
+                if (!pEndpoint->status.bfTransferComplete)
+                #else
+                if (!pEndpoint->status.bfTransferComplete &&
+                    !pEndpoint->status.bfLastTransferNAKd)
+                #endif
+                {
+                    usbBusInfo.countBulkTransactions ++;
+                    if (usbBusInfo.countBulkTransactions > usbBusInfo.lastBulkTransaction)
+                    {
+                        usbBusInfo.lastBulkTransaction  = usbBusInfo.countBulkTransactions;
+                        pCurrentEndpoint                = pEndpoint;
+                        return TRUE;
+                    }
+                }
+                break;
+            #endif
         }
-    #endif
+    }
 
-    return;
+    // No endpoints with the desired description are ready for servicing.
+    return FALSE;
 }
 
 
+#if defined( USB_SUPPORT_INTERRUPT_TRANSFERS ) && defined( ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME )
 /****************************************************************************
   Function:
-    BOOL _USB_FindServiceEndpoint( BYTE transferType )
+    BOOL _USB_FindServiceInterruptEndpoint( void )
 
   Description:
-    This function finds an endpoint of the specified transfer type that is
-    ready for servicing.  If it finds one, usbDeviceInfo.pCurrentEndpoint is
-    updated to point to the endpoint information structure.
+    This function finds an interrupt endpoint that needs servicing now:
+    either its transfer has finished and must be reported, or its interval
+    has expired.  Pending endpoints that are not due yet are skipped, so
+    they cannot hold up the others.  The scan starts just after the
+    endpoint found last time, so the endpoints are served round-robin.  If
+    it finds one, pCurrentEndpoint is updated to point to the endpoint
+    information structure.
 
   Precondition:
     None
 
   Parameters:
-    BYTE transferType - Endpoint transfer type.  Valid values are:
-                            * USB_TRANSFER_TYPE_CONTROL
-                            * USB_TRANSFER_TYPE_ISOCHRONOUS
-                            * USB_TRANSFER_TYPE_INTERRUPT
-                            * USB_TRANSFER_TYPE_BULK
+    None - None
 
   Return Values:
-    TRUE    - An endpoint of the indicated transfer type needs to be serviced,
-                and pCurrentEndpoint has been updated to point to the endpoint.
-    FALSE   - No endpoints of the indicated transfer type need to be serviced.
+    TRUE    - An interrupt endpoint needs to be serviced, and
+                pCurrentEndpoint has been updated to point to the endpoint.
+    FALSE   - No interrupt endpoints need to be serviced now.
 
   Remarks:
-    The EP 0 block is retained.
+    Called only through _USB_FindServiceEndpoint(), which checks EP0 first.
   ***************************************************************************/
-BOOL _USB_FindServiceEndpoint( BYTE transferType )
+BOOL _USB_FindServiceInterruptEndpoint( void )
 {
     USB_ENDPOINT_INFO           *pEndpoint;
-    USB_INTERFACE_INFO          *pInterface;
-
-    // Check endpoint 0.
-    if ((usbDeviceInfo.pEndpoint0->bmAttributes.bfTransferType == transferType) &&
-        !usbDeviceInfo.pEndpoint0->status.bfTransferComplete)
-    {
-        pCurrentEndpoint = usbDeviceInfo.pEndpoint0;
-        return TRUE;
-    }
-
-    usbBusInfo.countBulkTransactions = 0;
-    pInterface = usbDeviceInfo.pInterfaceList;
-    if (pInterface)
-    {
-        pEndpoint = pInterface->pCurrentSetting->pEndpointList;
-    }
+    BYTE                        count;
+    BYTE                        index;
 
-    while (pInterface)
+    index = usbBusInfo.nextInterruptTransaction;
+    for (count = usbSchedule.count[USB_TRANSFER_TYPE_INTERRUPT]; count != 0; count--)
     {
-        if (pEndpoint != NULL)
+        if (index >= usbSchedule.count[USB_TRANSFER_TYPE_INTERRUPT])
         {
-			if (pEndpoint->bmAttributes.bfTransferType == transferType)
-			{
-				switch (transferType)
-				{
-					case USB_TRANSFER_TYPE_CONTROL:
-						if (!pEndpoint->status.bfTransferComplete)
-						{
-							pCurrentEndpoint = pEndpoint;
-							return TRUE;
-						}
-						break;
-
-					#ifdef USB_SUPPORT_ISOCHRONOUS_TRANSFERS
-					case USB_TRANSFER_TYPE_ISOCHRONOUS:
-					#endif
-					#ifdef USB_SUPPORT_INTERRUPT_TRANSFERS
-					case USB_TRANSFER_TYPE_INTERRUPT:
-					#endif
-					#if defined( USB_SUPPORT_ISOCHRONOUS_TRANSFERS ) || defined( USB_SUPPORT_INTERRUPT_TRANSFERS )
-						if (pEndpoint->status.bfTransferComplete)
-						{
-							// The endpoint doesn't need servicing.  If the interval count
-							// has reached 0 and the user has not initiated another transaction,
-							// reset the interval count for the next interval.
-							if (pEndpoint->wIntervalCount == 0)
-							{
-								// Reset the interval count for the next packet.
-								pEndpoint->wIntervalCount = pEndpoint->wInterval;
-							}
-						}
-						else
-						{
-							pCurrentEndpoint = pEndpoint;
-							return TRUE;
-						}
-						break;
-					#endif
-
-					#ifdef USB_SUPPORT_BULK_TRANSFERS
-					case USB_TRANSFER_TYPE_BULK:
-						#ifdef ALLOW_MULTIPLE_NAKS_PER_FRAME
-						if (!pEndpoint->status.bfTransferComplete)
-						#else
-						if (!pEndpoint->status.bfTransferComplete &&
-							!pEndpoint->status.bfLastTransferNAKd)
-						#endif
-						{
-							usbBusInfo.countBulkTransactions ++;
-							if (usbBusInfo.countBulkTransactions > usbBusInfo.lastBulkTransaction)
-							{
-								usbBusInfo.lastBulkTransaction  = usbBusInfo.countBulkTransactions;
-								pCurrentEndpoint                = pEndpoint;
-								return TRUE;
-							}
-						}
-						break;
-					#endif
-				}
-			}
-
-	        // Go to the next endpoint.
-            pEndpoint = pEndpoint->next;
+            index = 0;
         }
+        pEndpoint = usbSchedule.pEndpoints[usbSchedule.first[USB_TRANSFER_TYPE_INTERRUPT] + index];
+        index ++;
 
-        if (pEndpoint == NULL)
+        if (pEndpoint->status.bfTransferComplete)
         {
-            // Go to the next interface.
-            pInterface = pInterface->next;
-            if (pInterface)
+            // The endpoint doesn't need servicing.  If the interval count
+            // has reached 0 and the user has not initiated another transaction,
+            // reset the interval count for the next interval.
+            if (pEndpoint->wIntervalCount == 0)
             {
-                pEndpoint = pInterface->pCurrentSetting->pEndpointList;
+                pEndpoint->wIntervalCount = pEndpoint->wInterval;
             }
         }
+        else if ((pEndpoint->wIntervalCount == 0) ||
+                 ((pEndpoint->transferState & TSUBSTATE_MASK) != TSUBSTATE_INTERRUPT_READ_DATA))
+        {
+            // TSUBSTATE_INTERRUPT_WRITE_DATA has the same value.
+            usbBusInfo.nextInterruptTransaction = index;
+            pCurrentEndpoint                    = pEndpoint;
+            return TRUE;
+        }
     }
 
-    // No endpoints with the desired description are ready for servicing.
     return FALSE;
 }
+#endif
 
 
 /****************************************************************************
@@ -4123,6 +5164,23 @@ void _USB_FreeConfigMemory( void )
     USB_INTERFACE_SETTING_INFO  *pTempSetting;
     USB_ENDPOINT_INFO           *pTempEndpoint;
 
+    #if defined( USB_HOST_ARENA_SIZE )
+        // The interface lists are the last blocks in the arena, so once they
+        // are freed the arena can go back to where they started.
+        if (usbDeviceInfo.pInterfaceList != NULL)
+        {
+            usbArena.top        = usbArena.configStart;
+            usbArena.pLastBlock = NULL;
+        }
+    #endif
+
+    // Empty the endpoint schedule before the endpoints are freed.
+    usbSchedule.countEndpoints                          = 0;
+    usbSchedule.count[USB_TRANSFER_TYPE_CONTROL]        = 0;
+    usbSchedule.count[USB_TRANSFER_TYPE_ISOCHRONOUS]    = 0;
+    usbSchedule.count[USB_TRANSFER_TYPE_BULK]           = 0;
+    usbSchedule.count[USB_TRANSFER_TYPE_INTERRUPT]      = 0;
+
     while (usbDeviceInfo.pInterfaceList != NULL)
     {
         pTempInterface = usbDeviceInfo.pInterfaceList->next;
@@ -4134,13 +5192,13 @@ void _USB_FreeConfigMemory( void )
             while (usbDeviceInfo.pInterfaceList->pInterfaceSettings->pEndpointList != NULL)
             {
                 pTempEndpoint = usbDeviceInfo.pInterfaceList->pInterfaceSettings->pEndpointList->next;
-                free( (BYTE *)usbDeviceInfo.pInterfaceList->pInterfaceSettings->pEndpointList );
+                USB_FREE( (BYTE *)usbDeviceInfo.pInterfaceList->pInterfaceSettings->pEndpointList );
                 usbDeviceInfo.pInterfaceList->pInterfaceSettings->pEndpointList = pTempEndpoint;
             }
-            free( (BYTE *)usbDeviceInfo.pInterfaceList->pInterfaceSettings );
+            USB_FREE( (BYTE *)usbDeviceInfo.pInterfaceList->pInterfaceSettings );
             usbDeviceInfo.pInterfaceList->pInterfaceSettings = pTempSetting;
         }
-        free( (BYTE *)usbDeviceInfo.pInterfaceList );
+        USB_FREE( (BYTE *)usbDeviceInfo.pInterfaceList );
         usbDeviceInfo.pInterfaceList = pTempInterface;
     }
 
@@ -4155,7 +5213,8 @@ void _USB_FreeConfigMemory( void )
 
   Description:
     This function frees all memory that can be freed.  Only the EP0
-    information block is retained.
+    information block is retained.  If the enumeration arena is used, it is
+    reset.
 
   Precondition:
     None
@@ -4177,8 +5236,8 @@ void _USB_FreeMemory( void )
     while (usbDeviceInfo.pConfigurationDescriptorList != NULL)
     {
         pTemp = (BYTE *)usbDeviceInfo.pConfigurationDescriptorList->next;
-        free( usbDeviceInfo.pConfigurationDescriptorList->descriptor );
-        free( usbDeviceInfo.pConfigurationDescriptorList );
+        USB_FREE( usbDeviceInfo.pConfigurationDescriptorList->descriptor );
+        USB_FREE( usbDeviceInfo.pConfigurationDescriptorList );
         usbDeviceInfo.pConfigurationDescriptorList = (USB_CONFIGURATION *)pTemp;
     }
     if (pDeviceDescriptor != NULL)
@@ -4192,6 +5251,11 @@ void _USB_FreeMemory( void )
 
     _USB_FreeConfigMemory();
 
+    #if defined( USB_HOST_ARENA_SIZE )
+        // Everything allocated for the device has been released, so the
+        // arena can be emptied in one step.
+        _USB_ArenaReset();
+    #endif
 }
 
 
@@ -4238,10 +5302,15 @@ void _USB_InitControlRead( USB_ENDPOINT_INFO *pEndpoint, BYTE *pControlData, WOR
     pEndpoint->dataCount                    = 0;
     pEndpoint->dataCountMax                 = size;
     pEndpoint->countNAKs                    = 0;
+    _USB_StatisticsSubmit( pEndpoint );
 
     pEndpoint->pUserDataSETUP               = pControlData;
     pEndpoint->dataCountMaxSETUP            = controlSize;
     pEndpoint->transferState                = TSTATE_CONTROL_READ;
+    #if defined( USB_ENABLE_CONTROL_READ_STREAM )
+        pEndpoint->streamWindow             = streamWindowSize;
+        pEndpoint->streamConsumed           = 0;
+    #endif
 
     // Set the flag last so all the parameters are set for an interrupt.
     pEndpoint->status.bfTransferComplete    = 0;
@@ -4291,6 +5360,7 @@ void _USB_InitControlWrite( USB_ENDPOINT_INFO *pEndpoint, BYTE *pControlData,
     pEndpoint->dataCount                    = 0;
     pEndpoint->dataCountMax                 = size;
     pEndpoint->countNAKs                    = 0;
+    _USB_StatisticsSubmit( pEndpoint );
 
     pEndpoint->pUserDataSETUP               = pControlData;
     pEndpoint->dataCountMaxSETUP            = controlSize;
@@ -4357,6 +5427,7 @@ void _USB_InitRead( USB_ENDPOINT_INFO *pEndpoint, BYTE *pData, WORD size )
     pEndpoint->dataCount                    = 0;
     pEndpoint->dataCountMax                 = size; // Not used for isochronous.
     pEndpoint->countNAKs                    = 0;
+    _USB_StatisticsSubmit( pEndpoint );
 
     if (pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_INTERRUPT)
     {
@@ -4372,6 +5443,14 @@ void _USB_InitRead( USB_ENDPOINT_INFO *pEndpoint, BYTE *pData, WORD size )
         pEndpoint->transferState            = TSTATE_BULK_READ;
     }
 
+    #if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+        // A BD loaded for an earlier transfer on this endpoint is stale.
+        if (pPrefetchEndpoint == pEndpoint)
+        {
+            pPrefetchEndpoint = NULL;
+        }
+    #endif
+
     // Set the flag last so all the parameters are set for an interrupt.
     pEndpoint->status.bfTransferComplete    = 0;
 }
@@ -4424,6 +5503,7 @@ void _USB_InitWrite( USB_ENDPOINT_INFO *pEndpoint, BYTE *pData, WORD size )
     pEndpoint->dataCount                    = 0;
     pEndpoint->dataCountMax                 = size; // Not used for isochronous.
     pEndpoint->countNAKs                    = 0;
+    _USB_StatisticsSubmit( pEndpoint );
 
     if (pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_INTERRUPT)
     {
@@ -4439,6 +5519,14 @@ void _USB_InitWrite( USB_ENDPOINT_INFO *pEndpoint, BYTE *pData, WORD size )
         pEndpoint->transferState            = TSTATE_BULK_WRITE;
     }
 
+    #if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+        // A BD loaded for an earlier transfer on this endpoint is stale.
+        if (pPrefetchEndpoint == pEndpoint)
+        {
+            pPrefetchEndpoint = NULL;
+        }
+    #endif
+
     // Set the flag last so all the parameters are set for an interrupt.
     pEndpoint->status.bfTransferComplete    = 0;
 }
@@ -4566,6 +5654,11 @@ BOOL _USB_ParseConfigurationDescriptor( void )
     USB_VBUS_POWER_EVENT_DATA   powerRequest;
     BYTE                        *ptr;
 
+    #if defined( USB_HOST_ARENA_SIZE )
+        // Everything allocated from here on belongs to the interface lists.
+        usbArena.configStart = usbArena.top;
+    #endif
+
     // Prime the loops.
     index                   = 0;
     ptr                     = pCurrentConfigurationDescriptor;
@@ -4674,7 +5767,7 @@ BOOL _USB_ParseConfigurationDescriptor( void )
                 if (newInterfaceInfo == NULL)
                 {
                     // This is the first instance of this interface, so create a new node for it.
-                    if ((newInterfaceInfo = (USB_INTERFACE_INFO *)malloc( sizeof(USB_INTERFACE_INFO) )) == NULL)
+                    if ((newInterfaceInfo = (USB_INTERFACE_INFO *)USB_MALLOC( sizeof(USB_INTERFACE_INFO) )) == NULL)
                     {
                         return FALSE;   // Out of memory
                     }
@@ -4690,7 +5783,7 @@ BOOL _USB_ParseConfigurationDescriptor( void )
                 }
 
                 // Create a new setting for this interface, and add it to the list.
-                if ((newSettingInfo = (USB_INTERFACE_SETTING_INFO *)malloc( sizeof(USB_INTERFACE_SETTING_INFO) )) == NULL)
+                if ((newSettingInfo = (USB_INTERFACE_SETTING_INFO *)USB_MALLOC( sizeof(USB_INTERFACE_SETTING_INFO) )) == NULL)
                 {
                     return FALSE;   // Out of memory
                 }
@@ -4723,7 +5816,7 @@ BOOL _USB_ParseConfigurationDescriptor( void )
                     else
                     {
                         // Create an entry for the new endpoint.
-                        if ((newEndpointInfo = (USB_ENDPOINT_INFO *)malloc( sizeof(USB_ENDPOINT_INFO) )) == NULL)
+                        if ((newEndpointInfo = (USB_ENDPOINT_INFO *)USB_MALLOC( sizeof(USB_ENDPOINT_INFO) )) == NULL)
                         {
                             return FALSE;   // Out of memory
                         }
@@ -4738,6 +5831,7 @@ BOOL _USB_ParseConfigurationDescriptor( void )
                         newEndpointInfo->dataCount                  = 0;  // Initialize to 0 since we set bfTransferComplete.
                         newEndpointInfo->transferState              = TSTATE_IDLE;
                         newEndpointInfo->clientDriver               = ClientDriver;
+                        _USB_StatisticsClear( newEndpointInfo );
 
                         // Special setup for isochronous endpoints.
                         if (newEndpointInfo->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS)
@@ -4809,6 +5903,236 @@ BOOL _USB_ParseConfigurationDescriptor( void )
 }
 
 
+#if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+/****************************************************************************
+  Function:
+    void _USB_PrefetchBDT( BYTE token, WORD currentPacketSize )
+
+  Description:
+    This function loads the idle ping-pong BD of the token's direction with
+    the next packet of the bulk transfer on pCurrentEndpoint, straight from
+    the user's buffer.  When the current packet finishes, _USB_SetBDT()
+    finds the BD already loaded and the token can be sent at once.
+
+  Precondition:
+    _USB_SetBDT() has just given the BD for the current packet to the USB
+    module, and has advanced the ping-pong flag to the idle BD.
+
+  Parameters:
+    BYTE token              - Token of the current packet: USB_TOKEN_IN or
+                                USB_TOKEN_OUT
+    WORD currentPacketSize  - Size of the current packet
+
+  Returns:
+    None
+
+  Remarks:
+    Only full packets that do not finish the transfer are followed by a
+    prefetch.  The prefetched packet uses the opposite data toggle, which is
+    the toggle it will need if the current packet succeeds.  If it does not,
+    the toggle or offset will not match and _USB_SetBDT() loads the BD again.
+  ***************************************************************************/
+
+void _USB_PrefetchBDT( BYTE token, WORD currentPacketSize )
+{
+    BDT_ENTRY           *pBDT;
+    DWORD               dataCount;
+    WORD                nextPacketSize;
+
+    if ((token == USB_TOKEN_SETUP) ||
+        (pCurrentEndpoint->bmAttributes.bfTransferType != USB_TRANSFER_TYPE_BULK) ||
+        (currentPacketSize != pCurrentEndpoint->wMaxPacketSize))
+    {
+        return;
+    }
+
+    dataCount = pCurrentEndpoint->dataCount + currentPacketSize;
+    if (dataCount >= pCurrentEndpoint->dataCountMax)
+    {
+        return;
+    }
+    nextPacketSize = pCurrentEndpoint->wMaxPacketSize;
+    if ((pCurrentEndpoint->dataCountMax - dataCount) < nextPacketSize)
+    {
+        nextPacketSize = pCurrentEndpoint->dataCountMax - dataCount;
+    }
+
+    // The ping-pong flag already points to the idle BD.
+    if (token == USB_TOKEN_IN)
+    {
+        pBDT = usbDeviceInfo.flags.bfPingPongIn ? BDT_IN_ODD : BDT_IN;
+    }
+    else
+    {
+        pBDT = usbDeviceInfo.flags.bfPingPongOut ? BDT_OUT_ODD : BDT_OUT;
+    }
+    if (pBDT->STAT.UOWN)
+    {
+        return;
+    }
+
+    #if defined(__C30__)
+        pBDT->ADR       = ConvertToPhysicalAddress((WORD)pCurrentEndpoint->pUserData + (WORD)dataCount);
+    #else
+        pBDT->ADR       = ConvertToPhysicalAddress((DWORD)pCurrentEndpoint->pUserData + dataCount);
+    #endif
+    pBDT->STAT.Val      = 0;
+    pBDT->count         = nextPacketSize;
+    pBDT->STAT.DTS      = !pCurrentEndpoint->status.bfNextDATA01;
+    pBDT->STAT.DTSEN    = pCurrentEndpoint->status.bfUseDTS;
+    pBDT->STAT.UOWN     = 1;
+
+    pPrefetchEndpoint   = (USB_ENDPOINT_INFO *)pCurrentEndpoint;
+    prefetchDataCount   = dataCount;
+    prefetchPacketSize  = nextPacketSize;
+    prefetchDATA01      = !pCurrentEndpoint->status.bfNextDATA01;
+    pPrefetchBDT        = pBDT;
+}
+#endif
+
+
+#if defined( USB_ENABLE_TRANSFER_EVENT )
+/****************************************************************************
+  Function:
+    BOOL _USB_QueueTransferEvent( USB_EVENT event, void *pUserData )
+
+  Description:
+    This function adds a transfer event for pCurrentEndpoint to the event
+    queue, to be passed to the client driver by USBHostTasks().  The slot is
+    filled in before head is advanced, so the tasks loop never sees a
+    partly written event.
+
+  Precondition:
+    Called only from the USB ISR (through _USB_FindNextToken()).
+
+  Parameters:
+    USB_EVENT event - EVENT_TRANSFER or EVENT_BUS_ERROR
+    void *pUserData - Data buffer to report with an EVENT_TRANSFER
+
+  Return Values:
+    TRUE    - The event was queued.
+    FALSE   - The queue is full.
+
+  Remarks:
+    When the queue is full, the caller should leave a control, interrupt
+    or bulk transfer in its completion state so that the event is queued
+    on a later pass, after the tasks loop has made room.  These deferrals
+    are counted as deferred.  Isochronous events cannot wait for the next
+    interval, so they are counted as dropped.  See
+    USBHostEventQueueStatistics().
+  ***************************************************************************/
+
+BOOL _USB_QueueTransferEvent( USB_EVENT event, void *pUserData )
+{
+    USB_EVENT_DATA  *data;
+    BYTE            count;
+
+    count = _USB_EventQueueCount();
+    if (count >= USB_EVENT_QUEUE_DEPTH)
+    {
+        if (pCurrentEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS)
+        {
+            if (usbEventQueue.statistics.dropped != 0xFFFF)
+            {
+                usbEventQueue.statistics.dropped ++;
+            }
+        }
+        else
+        {
+            if (usbEventQueue.statistics.deferred != 0xFFFF)
+            {
+                usbEventQueue.statistics.deferred ++;
+            }
+        }
+        return FALSE;
+    }
+
+    data = _USB_EventQueueSlot( usbEventQueue.head );
+    data->event                         = event;
+    if (event == EVENT_BUS_ERROR)
+    {
+        data->TransferData.dataCount    = 0;
+        data->TransferData.pUserData    = NULL;
+        data->TransferData.bErrorCode   = pCurrentEndpoint->bErrorCode;
+    }
+    else
+    {
+        data->TransferData.dataCount    = pCurrentEndpoint->dataCount;
+        data->TransferData.pUserData    = pUserData;
+        data->TransferData.bErrorCode   = USB_SUCCESS;
+    }
+    data->TransferData.bEndpointAddress = pCurrentEndpoint->bEndpointAddress;
+    data->TransferData.bmAttributes.val = pCurrentEndpoint->bmAttributes.val;
+    data->TransferData.clientDriver     = pCurrentEndpoint->clientDriver;
+
+    // Publish the event only after the slot is complete.
+    _USB_MemoryBarrier();
+    usbEventQueue.head ++;
+
+    if (count >= usbEventQueue.statistics.highWater)
+    {
+        usbEventQueue.statistics.highWater = count + 1;
+    }
+    return TRUE;
+}
+#endif
+
+
+#if defined( USB_SUPPORT_INTERRUPT_TRANSFERS ) && defined( ALLOW_MULTIPLE_INTERRUPT_TRANSACTIONS_PER_FRAME )
+/****************************************************************************
+  Function:
+    BOOL _USB_ReserveFrameTime( void )
+
+  Description:
+    This function reserves bus time in the current frame for one interrupt
+    transaction on pCurrentEndpoint.  The cost of a transaction is its
+    maximum packet size plus the protocol overhead, in full-speed byte
+    times, and eight times that for a low-speed device.  Interrupt
+    transactions may use up to USB_PERIODIC_FRAME_TIME of each frame.  If
+    the transaction does not fit, the round-robin scan is moved back so
+    that this endpoint is the first one tried in the next frame.
+
+  Precondition:
+    pCurrentEndpoint was just returned by _USB_FindServiceInterruptEndpoint().
+
+  Parameters:
+    None - None
+
+  Return Values:
+    TRUE    - The time was reserved, and the token can be sent.
+    FALSE   - There is not enough time left in the frame.
+
+  Remarks:
+    The first interrupt transaction of a frame is always allowed.  The U1SOF
+    threshold still keeps the SIE from starting a token too close to the
+    next SOF.
+  ***************************************************************************/
+
+BOOL _USB_ReserveFrameTime( void )
+{
+    WORD    cost;
+
+    cost = pCurrentEndpoint->wMaxPacketSize + USB_TRANSACTION_OVERHEAD;
+    if (usbDeviceInfo.flags.bfIsLowSpeed)
+    {
+        cost <<= 3;
+    }
+
+    if (usbBusInfo.periodicFrameTime && (usbBusInfo.periodicFrameTime + cost > USB_PERIODIC_FRAME_TIME))
+    {
+        if (usbBusInfo.nextInterruptTransaction)
+        {
+            usbBusInfo.nextInterruptTransaction --;
+        }
+        return FALSE;
+    }
+
+    usbBusInfo.periodicFrameTime += cost;
+    return TRUE;
+}
+#endif
+
+
 /****************************************************************************
   Function:
     void _USB_ResetDATA0( BYTE endpoint )
@@ -4924,6 +6248,20 @@ void _USB_SendToken( BYTE endpoint, BYTE tokenType )
     #endif
 
     U1ADDR = usbDeviceInfo.deviceAddressAndSpeed;
+
+    #if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+        usbCapture.endpoint = endpoint & 0x0F;
+        if (tokenType == USB_TOKEN_IN)
+        {
+            usbCapture.endpoint |= 0x80;
+            _USB_CaptureRecord( USB_CAPTURE_TOKEN, tokenType, 0, NULL, 0 );
+        }
+        else
+        {
+            _USB_CaptureRecord( USB_CAPTURE_TOKEN, tokenType, 0, ConvertToVirtualAddress( pCaptureBDT->ADR ), pCaptureBDT->count );
+        }
+    #endif
+
     U1TOK = (tokenType << 4) | (endpoint & 0x7F);
 
     // Lock out anyone from writing another token until this one has finished.
@@ -4963,12 +6301,14 @@ void _USB_SendToken( BYTE endpoint, BYTE tokenType )
     None
 
   Remarks:
-    None
+    With ALLOW_BULK_PING_PONG_PREFETCH, the BD may already have been loaded
+    by _USB_PrefetchBDT(), in which case only the next packet is prefetched.
   ***************************************************************************/
 
 void _USB_SetBDT( BYTE token )
 {
     WORD                currentPacketSize;
+    DWORD               dataOffset;
     BDT_ENTRY           *pBDT;
 
     if (token == USB_TOKEN_IN)
@@ -5008,6 +6348,28 @@ void _USB_SetBDT( BYTE token )
         #endif
     }
 
+    #if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+        pCaptureBDT = pBDT;
+    #endif
+
+    #if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+        if (pBDT == pPrefetchBDT)
+        {
+            pPrefetchBDT = NULL;
+            if ((pCurrentEndpoint == pPrefetchEndpoint) &&
+                (pCurrentEndpoint->dataCount == prefetchDataCount) &&
+                (pCurrentEndpoint->status.bfNextDATA01 == prefetchDATA01))
+            {
+                // This packet was loaded while the previous one was on the bus.
+                _USB_PrefetchBDT( token, prefetchPacketSize );
+                return;
+            }
+
+            // Take the stale BD back before loading it again.
+            pBDT->STAT.Val = 0;
+        }
+    #endif
+
     // Determine how much data we'll transfer in this packet.
     if (token == USB_TOKEN_SETUP)
     {
@@ -5040,6 +6402,16 @@ void _USB_SetBDT( BYTE token )
         }
     }
 
+    // Offset of the packet in the user's buffer.  A streamed control read
+    // wraps round its window.
+    dataOffset = pCurrentEndpoint->dataCount;
+    #if defined( USB_ENABLE_CONTROL_READ_STREAM )
+        if (pCurrentEndpoint->streamWindow && (pCurrentEndpoint->transferState == (TSTATE_CONTROL_READ | TSUBSTATE_CONTROL_READ_DATA)))
+        {
+            dataOffset %= pCurrentEndpoint->streamWindow;
+        }
+    #endif
+
     // Load up the BDT address.
     if (token == USB_TOKEN_SETUP)
     {
@@ -5058,7 +6430,7 @@ void _USB_SetBDT( BYTE token )
             }
             else
             {
-                pBDT->ADR  = ConvertToPhysicalAddress((WORD)pCurrentEndpoint->pUserData + (WORD)pCurrentEndpoint->dataCount);
+                pBDT->ADR  = ConvertToPhysicalAddress((WORD)pCurrentEndpoint->pUserData + (WORD)dataOffset);
             }
         #elif defined(__PIC32MX__)
             if (pCurrentEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS)
@@ -5067,7 +6439,7 @@ void _USB_SetBDT( BYTE token )
             }
             else
             {
-                pBDT->ADR  = ConvertToPhysicalAddress((DWORD)pCurrentEndpoint->pUserData + (DWORD)pCurrentEndpoint->dataCount);
+                pBDT->ADR  = ConvertToPhysicalAddress((DWORD)pCurrentEndpoint->pUserData + dataOffset);
             }
         #else
             #error Cannot set BDT address.
@@ -5083,6 +6455,10 @@ void _USB_SetBDT( BYTE token )
     // Transfer the BD to the USB OTG module.
     pBDT->STAT.UOWN     = 1;
 
+    #if defined( ALLOW_BULK_PING_PONG_PREFETCH )
+        _USB_PrefetchBDT( token, currentPacketSize );
+    #endif
+
     #ifdef DEBUG_MODE
 //        UART2PutChar('{');
 //        UART2PutHex((pBDT->v[0] >> 24) & 0xff);
@@ -5223,6 +6599,7 @@ void _USB1Interrupt( void )
     {
         // The interrupt is cleared by writing a '1' to it.
         U1OTGIR = USB_INTERRUPT_T1MSECIF;
+        _USB_TelemetryTick();
 
         #ifdef DEBUG_MODE
             UART2PutChar('~');
@@ -5458,6 +6835,17 @@ void _USB1Interrupt( void )
                 #endif
             }
 
+            #if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+                if ((pBDT->STAT.PID == PID_DATA0) || (pBDT->STAT.PID == PID_DATA1))
+                {
+                    _USB_CaptureRecord( USB_CAPTURE_RESULT, pBDT->STAT.PID, 0, ConvertToVirtualAddress( pBDT->ADR ), pBDT->count );
+                }
+                else
+                {
+                    _USB_CaptureRecord( USB_CAPTURE_RESULT, pBDT->STAT.PID, 0, NULL, 0 );
+                }
+            #endif
+
             if (pBDT->STAT.PID == PID_ACK)
             {
                 // We will only get this PID from an OUT or SETUP packet.
@@ -5467,6 +6855,8 @@ void _USB1Interrupt( void )
                 // count when an ACK, DATA0, or DATA1 is received.
                 packetSize                  = pBDT->count;
                 pCurrentEndpoint->dataCount += packetSize;
+                _USB_StatisticsAdd( transactions, 1 );
+                _USB_StatisticsAdd( bytes, packetSize );
 
                 // Set the NAK retries for the next transaction;
                 pCurrentEndpoint->countNAKs = 0;
@@ -5518,6 +6908,8 @@ void _USB1Interrupt( void )
                 // count when an ACK, DATA0, or DATA1 is received.
                 packetSize                  = pBDT->count;
                 pCurrentEndpoint->dataCount += packetSize;
+                _USB_StatisticsAdd( transactions, 1 );
+                _USB_StatisticsAdd( bytes, packetSize );
 
                 // Set the NAK retries for the next transaction;
                 pCurrentEndpoint->countNAKs = 0;
@@ -5525,6 +6917,13 @@ void _USB1Interrupt( void )
                 // Toggle DTS for the next transfer.
                 pCurrentEndpoint->status.bfNextDATA01 ^= 0x01;
 
+                #if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+                    if (packetSize && (pCurrentEndpoint->bmAttributes.bfTransferType != USB_TRANSFER_TYPE_CONTROL))
+                    {
+                        _USB_TelemetryMark( firstData );
+                    }
+                #endif
+
                 // We are doing IN transfers.  See if we've received all the data.
                 // We've received all the data if it's an isochronous transfer, or when we receive a
                 // short packet or we have transferred all the data.
@@ -5551,6 +6950,7 @@ void _USB1Interrupt( void )
                 #endif
 
                 pCurrentEndpoint->countNAKs ++;
+                _USB_StatisticsAdd( naks, 1 );
 
                 switch( pCurrentEndpoint->bmAttributes.bfTransferType )
                 {
@@ -5620,6 +7020,7 @@ void _USB1Interrupt( void )
                 #endif
                 pCurrentEndpoint->status.bfStalled = 1;
                 pCurrentEndpoint->bErrorCode       = USB_ENDPOINT_STALLED;
+                _USB_StatisticsAdd( stalls, 1 );
                 _USB_SetTransferErrorState( pCurrentEndpoint );
             }
             else
@@ -5630,6 +7031,7 @@ void _USB1Interrupt( void )
                 // that the host has received it.  But the data is not actually received, and the application
                 // layer is not informed of the packet.
                 pCurrentEndpoint->status.bfErrorCount++;
+                _USB_StatisticsAdd( errors, 1 );
 
                 if (pCurrentEndpoint->status.bfErrorCount >= USB_TRANSACTION_RETRY_ATTEMPTS)
                 {
@@ -5669,37 +7071,34 @@ void _USB1Interrupt( void )
     if (U1IEbits.SOFIE && U1IRbits.SOFIF)
     {
         USB_ENDPOINT_INFO           *pEndpoint;
-        USB_INTERFACE_INFO          *pInterface;
+        BYTE                        i;
 
         #ifdef DEBUG_MODE
 //            UART2PutChar( '$' );
         #endif
         U1IR = USB_INTERRUPT_SOF; // Clear the interrupt by writing a '1' to the flag.
+        _USB_TelemetryTick();
+        #if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+            usbBusInfo.frameCount ++;
+        #endif
 
-        pInterface = usbDeviceInfo.pInterfaceList;
-        while (pInterface)
+        for (i = 0; i < usbSchedule.countEndpoints; i++)
         {
-            pEndpoint = pInterface->pCurrentSetting->pEndpointList;
-            while (pEndpoint)
+            pEndpoint = usbSchedule.pEndpoints[i];
+
+            // Decrement the interval count of all active interrupt and isochronous endpoints.
+            if ((pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_INTERRUPT) ||
+                (pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS))
             {
-                // Decrement the interval count of all active interrupt and isochronous endpoints.
-                if ((pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_INTERRUPT) ||
-                    (pEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS))
+                if (pEndpoint->wIntervalCount != 0)
                 {
-                    if (pEndpoint->wIntervalCount != 0)
-                    {
-                        pEndpoint->wIntervalCount--;
-                    }
+                    pEndpoint->wIntervalCount--;
                 }
-
-                #ifndef ALLOW_MULTIPLE_NAKS_PER_FRAME
-                    pEndpoint->status.bfLastTransferNAKd = 0;
-                #endif
-
-                pEndpoint = pEndpoint->next;
             }
 
-            pInterface = pInterface->next;
+            #ifndef ALLOW_MULTIPLE_NAKS_PER_FRAME
+                pEndpoint->status.bfLastTransferNAKd = 0;
+            #endif
         }
 
         usbBusInfo.flags.bfControlTransfersDone     = 0;
@@ -5708,6 +7107,7 @@ void _USB1Interrupt( void )
         usbBusInfo.flags.bfBulkTransfersDone        = 0;
         //usbBusInfo.dBytesSentInFrame                = 0;
         usbBusInfo.lastBulkTransaction              = 0;
+        usbBusInfo.periodicFrameTime                = 0;
 
         _USB_FindNextToken();
     }
@@ -5724,6 +7124,10 @@ void _USB1Interrupt( void )
 
         // The previous token has finished, so clear the way for writing a new one.
         usbBusInfo.flags.bfTokenAlreadyWritten = 0;
+        _USB_StatisticsAdd( errors, 1 );
+        #if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+            _USB_CaptureRecord( USB_CAPTURE_RESULT, 0, U1EIR, NULL, 0 );
+        #endif
 
         // If we are doing isochronous transfers, ignore the error.
         if (pCurrentEndpoint->bmAttributes.bfTransferType == USB_TRANSFER_TYPE_ISOCHRONOUS)
@@ -358,18 +358,28 @@ HOLDING state machine values
 #define USB_SOF_THRESHOLD_32                0x2A    // U1SOF - Threshold for a max packet size of 32
 #define USB_SOF_THRESHOLD_64                0x4A    // U1SOF - Threshold for a max packet size of 64
 
+#define USB_PERIODIC_FRAME_TIME             1350    // Full-speed byte times of each frame for interrupt transactions (90% of 1500)
+#define USB_TRANSACTION_OVERHEAD            13      // Protocol overhead of a full-speed interrupt transaction, in byte times
+
 #define USB_1MS_TIMER_FLAG                  0x40
 #ifndef USB_INSERT_TIME
     #define USB_INSERT_TIME                 (250+1) // Insertion delay time (spec minimum is 100 ms)
 #endif
-#define USB_RESET_TIME                      (50+1)  // RESET signaling time - 50ms
-#if defined( __C30__ )
-    #define USB_RESET_RECOVERY_TIME         (10+1)  // RESET recovery time.
-#elif defined( __PIC32MX__ )
-    #define USB_RESET_RECOVERY_TIME         (100+1) // RESET recovery time - Changed to 100 ms from 10ms.  Some devices take longer.
-#else
-    #error Unknown USB_RESET_RECOVERY_TIME
+#ifndef USB_RESET_TIME
+    #define USB_RESET_TIME                  (50+1)  // RESET signaling time - 50ms
+#endif
+#ifndef USB_RESET_RECOVERY_TIME
+    #if defined( __C30__ )
+        #define USB_RESET_RECOVERY_TIME     (10+1)  // RESET recovery time.
+    #elif defined( __PIC32MX__ )
+        #define USB_RESET_RECOVERY_TIME     (100+1) // RESET recovery time - Changed to 100 ms from 10ms.  Some devices take longer.
+    #else
+        #error Unknown USB_RESET_RECOVERY_TIME
+    #endif
 #endif
+#define USB_MIN_INSERT_TIME                 (100+1) // USB 2.0 TATTDB - shortest insertion debounce in a timing profile
+#define USB_MIN_RESET_TIME                  (50+1)  // USB 2.0 TDRSTR (7.1.7.5) - shortest root port RESET signaling in a timing profile
+#define USB_MIN_RESET_RECOVERY_TIME         (10+1)  // USB 2.0 TRSTRCY - shortest RESET recovery in a timing profile
 #define USB_RESUME_TIME                     (20+1)  // RESUME signaling time - 20 ms
 #define USB_RESUME_RECOVERY_TIME            (10+1)  // RESUME recovery time - 10 ms
 
@@ -404,6 +414,11 @@ typedef struct _USB_BUS_INFO
 //    volatile DWORD      dBytesSentInFrame;                  // The number of bytes sent during the current frame. Isochronous use only.
     volatile BYTE       lastBulkTransaction;                // The last bulk transaction sent.
     volatile BYTE       countBulkTransactions;              // The number of active bulk transactions.
+    volatile BYTE       nextInterruptTransaction;           // Where the next round-robin scan of interrupt endpoints starts.
+    volatile WORD       periodicFrameTime;                  // Byte times used by interrupt transactions in the current frame.
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+    volatile WORD       frameCount;                         // Free-running count of SOFs, for transfer latency.
+#endif
 } USB_BUS_INFO;
 
 
@@ -463,10 +478,40 @@ typedef struct _USB_ENDPOINT_INFO
     volatile BYTE               bErrorCode;                     // If bfError is set, this indicates the reason
     volatile WORD               countNAKs;                      // Count of NAK's of current transaction.
     WORD                        timeoutNAKs;                    // Count of NAK's for a timeout, if bfNAKTimeoutEnabled.
+#if defined( USB_ENABLE_CONTROL_READ_STREAM )
+    WORD                        streamWindow;                   // Size of the window a streamed control read passes through, 0 if not streamed.
+    volatile DWORD              streamConsumed;                 // Bytes of the streamed control read the client has read.
+#endif
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+    WORD                        submitFrame;                    // usbBusInfo.frameCount when the transfer was submitted.
+    USB_ENDPOINT_STATISTICS     statistics;                     // Transfer statistics.  See USBHostEndpointStatistics().
+#endif
 
 } USB_ENDPOINT_INFO;
 
 
+// *****************************************************************************
+/* Endpoint Schedule
+
+This structure holds a flat table of the endpoints in the current interface
+settings, grouped by transfer type, so that the token scheduler and the SOF
+ISR do not have to walk the interface and endpoint lists.  Within a transfer
+type, endpoints keep the order of the interface and endpoint lists.  It is
+rebuilt whenever the configuration or an alternate setting changes.
+*/
+#ifndef USB_MAX_SCHEDULED_ENDPOINTS
+    #define USB_MAX_SCHEDULED_ENDPOINTS     8       // Default of 8 endpoints, not counting EP0
+#endif
+
+typedef struct _USB_SCHEDULE
+{
+    USB_ENDPOINT_INFO   *pEndpoints[USB_MAX_SCHEDULED_ENDPOINTS];   // Active endpoints, grouped by transfer type.
+    volatile BYTE       first[4];                                   // Index of the first endpoint of each transfer type.
+    volatile BYTE       count[4];                                   // Number of endpoints of each transfer type.
+    volatile BYTE       countEndpoints;                             // Total number of scheduled endpoints.
+} USB_SCHEDULE;
+
+
 // *****************************************************************************
 /* Interface Setting Information Structure
 
@@ -586,24 +631,118 @@ the client drivers.
 
 This structure defines the queue of USB events that can be generated by the
 ISR that need to be synchronized to the USB event tasks loop (see
-USB_EVENT_DATA, above).  See "struct_queue.h" for usage and operations.
+USB_EVENT_DATA, above).  It is a single producer, single consumer ring: only
+the ISR writes head and only USBHostTasks() writes tail.  Both indices run
+freely and are masked with the depth when used, so the depth must be a power
+of two.  Neither side has to disable interrupts to use the queue.
 */
 #if defined( USB_ENABLE_TRANSFER_EVENT )
     #ifndef USB_EVENT_QUEUE_DEPTH
         #define USB_EVENT_QUEUE_DEPTH   4       // Default depth of 4 events
     #endif
 
+    #if (USB_EVENT_QUEUE_DEPTH < 2) || (USB_EVENT_QUEUE_DEPTH > 128) || (USB_EVENT_QUEUE_DEPTH & (USB_EVENT_QUEUE_DEPTH - 1))
+        #error "USB_EVENT_QUEUE_DEPTH must be a power of two from 2 to 128"
+    #endif
+
     typedef struct _usb_event_queue
     {
-        int             head;
-        int             tail;
-        int             count;
-        USB_EVENT_DATA  buffer[USB_EVENT_QUEUE_DEPTH];
+        volatile BYTE               head;       // Count of events added.  Written only by the ISR.
+        volatile BYTE               tail;       // Count of events removed.  Written only by USBHostTasks().
+        USB_EVENT_QUEUE_STATISTICS  statistics; // Overflow counters.  See USBHostEventQueueStatistics().
+        USB_EVENT_DATA              buffer[USB_EVENT_QUEUE_DEPTH];
 
     } USB_EVENT_QUEUE;
 #endif
 
 
+// *****************************************************************************
+/* Traffic Capture Ring
+
+This structure holds the last USB_CAPTURE_RECORDS transactions on the bus
+(see USB_CAPTURE_RECORD).  Records are only added from the USB ISR, and the
+oldest record is overwritten when the ring is full.
+*/
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+    #if (USB_CAPTURE_RECORDS < 2) || (USB_CAPTURE_RECORDS & (USB_CAPTURE_RECORDS - 1))
+        #error "USB_CAPTURE_RECORDS must be a power of two"
+    #endif
+
+    typedef struct _USB_CAPTURE_RING
+    {
+        volatile DWORD      count;                  // Records made.  The next one goes in record[count % USB_CAPTURE_RECORDS].
+        volatile BOOL       enabled;                // Records are being added.
+        BYTE                endpoint;               // Endpoint and direction of the token in flight.
+        USB_CAPTURE_RECORD  record[USB_CAPTURE_RECORDS];
+    } USB_CAPTURE_RING;
+#endif
+
+
+// *****************************************************************************
+/* Enumeration Memory
+
+Device, configuration, interface and endpoint information for the attached
+device is allocated with USB_MALLOC and released with USB_FREE.  By default
+these map to malloc and free.  If USB_HOST_ARENA_SIZE is defined, they map to
+a static arena of that many bytes instead.  The arena is a bump allocator:
+USB_FREE only gives back the most recent block.  The interface lists are
+given back together when they are freed, and the whole arena is reset when
+the device detaches or its enumeration is retried.  This keeps repeated attach and detach
+cycles from fragmenting the heap.  The application may define USB_MALLOC
+and USB_FREE itself to use some other allocator.
+*/
+#if defined( USB_HOST_ARENA_SIZE )
+    #define USB_ARENA_ALIGN(x)      (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+    typedef struct _USB_ARENA
+    {
+        BYTE            *pLastBlock;    // Most recent block, which can be given back.
+        WORD            top;            // Offset of the first free byte.
+        WORD            configStart;    // Offset where the interface lists start.
+        WORD            highWater;      // Largest value of top since power up.
+    } USB_ARENA;
+
+    #ifndef USB_MALLOC
+        #define USB_MALLOC(size)    _USB_ArenaAlloc( size )
+        #define USB_FREE(ptr)       _USB_ArenaFree( ptr )
+    #endif
+#endif
+
+#ifndef USB_MALLOC
+    #define USB_MALLOC(size)        malloc( size )
+    #define USB_FREE(ptr)           free( ptr )
+#endif
+
+
+// *****************************************************************************
+/* Enumeration Cache
+
+If USB_ENUMERATION_CACHE_ENTRIES is defined, the host keeps the configuration
+descriptor it selected for the last few devices, keyed by the VID, PID and
+bcdDevice of the device descriptor.  When a device with a matching key
+attaches, the cached descriptor is used and the host goes straight from
+SET_ADDRESS to SET_CONFIGURATION without reading the configuration
+descriptors again.  Descriptors longer than USB_ENUMERATION_CACHE_SIZE are
+not cached.  An entry is removed when it is used, and stored again once the
+device is configured, so a device that fails to configure with a cached
+descriptor is enumerated in full on the next attempt.
+*/
+#if defined( USB_ENUMERATION_CACHE_ENTRIES )
+    #ifndef USB_ENUMERATION_CACHE_SIZE
+        #define USB_ENUMERATION_CACHE_SIZE  64      // Largest configuration descriptor that is cached
+    #endif
+
+    typedef struct _USB_ENUMERATION_CACHE_ENTRY
+    {
+        WORD            idVendor;       // Key: vendor ID of the device.
+        WORD            idProduct;      // Key: product ID of the device.
+        WORD            bcdDevice;      // Key: release number of the device.
+        BYTE            configNumber;   // Configuration number of the descriptor, 0 if the entry is empty.
+        BYTE            descriptor[USB_ENUMERATION_CACHE_SIZE]; // The configuration descriptor.
+    } USB_ENUMERATION_CACHE_ENTRY;
+#endif
+
+
 /********************************************************************
  * USB Endpoint Control Registers
  *******************************************************************/
@@ -632,7 +771,37 @@ USB_EVENT_DATA, above).  See "struct_queue.h" for usage and operations.
 #define _USB_SetNextTransferState()     { pCurrentEndpoint->transferState ++; }
 #define _USB_SetPreviousSubSubState()   { usbHostState =  usbHostState - NEXT_SUBSUBSTATE; }
 #define _USB_SetTransferErrorState(x)   { x->transferState = (x->transferState & TSTATE_MASK) | TSUBSTATE_ERROR; }
-#define freez(x)                        { free(x); x = NULL; }
+#define freez(x)                        { USB_FREE(x); x = NULL; }
+
+// The ISR and the tasks loop share the event queue on a single in-order core,
+// so keeping the compiler from moving memory accesses across an index update
+// is enough to order the slot contents against the index.
+#define _USB_MemoryBarrier()            { __asm__ __volatile__ ("" ::: "memory"); }
+
+#if defined( USB_ENABLE_TRANSFER_EVENT )
+    #define _USB_EventQueueCount()      ((BYTE)(usbEventQueue.head - usbEventQueue.tail))
+    #define _USB_EventQueueIsFull()     (_USB_EventQueueCount() >= USB_EVENT_QUEUE_DEPTH)
+    #define _USB_EventQueueSlot(x)      (&usbEventQueue.buffer[(x) & (USB_EVENT_QUEUE_DEPTH - 1)])
+#endif
+
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+    #define _USB_StatisticsAdd(x,n)     { pCurrentEndpoint->statistics.x += (n); }
+    #define _USB_StatisticsClear(p)     { memset( &(p)->statistics, 0, sizeof(USB_ENDPOINT_STATISTICS) ); }
+    #define _USB_StatisticsSubmit(p)    { (p)->submitFrame = usbBusInfo.frameCount; }
+#else
+    #define _USB_EndpointStatisticsDone()
+    #define _USB_StatisticsAdd(x,n)
+    #define _USB_StatisticsClear(p)
+    #define _USB_StatisticsSubmit(p)
+#endif
+
+#if defined( USB_ENABLE_ENUMERATION_TELEMETRY )
+    #define _USB_TelemetryMark(x)       { if (!usbTelemetry.x) usbTelemetry.x = usbTelemetryClock; }
+    #define _USB_TelemetryTick()        { if (usbTelemetryClock != 0xFFFF) usbTelemetryClock++; }
+#else
+    #define _USB_TelemetryMark(x)
+    #define _USB_TelemetryTick()
+#endif
 
 
 //******************************************************************************
@@ -641,13 +810,30 @@ USB_EVENT_DATA, above).  See "struct_queue.h" for usage and operations.
 //******************************************************************************
 //******************************************************************************
 
+#if defined( USB_HOST_ARENA_SIZE )
+void *               _USB_ArenaAlloc( WORD size );
+void                 _USB_ArenaFree( void *ptr );
+void                 _USB_ArenaReset( void );
+#endif
+BOOL                 _USB_BuildSchedule( void );
+#if defined( USB_ENABLE_TRAFFIC_CAPTURE )
+void                 _USB_CaptureRecord( BYTE event, BYTE pid, BYTE error, BYTE *pData, WORD length );
+#endif
 void                 _USB_CheckCommandAndEnumerationAttempts( void );
+#if defined( USB_ENABLE_ENDPOINT_STATISTICS )
+void                 _USB_EndpointStatisticsDone( void );
+#endif
+#if defined( USB_ENUMERATION_CACHE_ENTRIES )
+BOOL                 _USB_EnumerationCacheRestore( void );
+void                 _USB_EnumerationCacheStore( void );
+#endif
 BOOL                 _USB_FindClassDriver( BYTE bClass, BYTE bSubClass, BYTE bProtocol, BYTE *pbClientDrv );
 BOOL                 _USB_FindDeviceLevelClientDriver( void );
 USB_ENDPOINT_INFO *  _USB_FindEndpoint( BYTE endpoint );
 USB_INTERFACE_INFO * _USB_FindInterface ( BYTE bInterface, BYTE bAltSetting );
 void                 _USB_FindNextToken( void );
 BOOL                 _USB_FindServiceEndpoint( BYTE transferType );
+BOOL                 _USB_FindServiceInterruptEndpoint( void );
 void                 _USB_FreeConfigMemory( void );
 void                 _USB_FreeMemory( void );
 void                 _USB_InitControlRead( USB_ENDPOINT_INFO *pEndpoint, BYTE *pControlData, WORD controlSize,
@@ -658,6 +844,11 @@ void                 _USB_InitRead( USB_ENDPOINT_INFO *pEndpoint, BYTE *pData, W
 void                 _USB_InitWrite( USB_ENDPOINT_INFO *pEndpoint, BYTE *pData, WORD size );
 void                 _USB_NotifyClients( BYTE DevAddress, USB_EVENT event, void *data, unsigned int size );
 BOOL                 _USB_ParseConfigurationDescriptor( void );
+void                 _USB_PrefetchBDT( BYTE token, WORD currentPacketSize );
+#if defined( USB_ENABLE_TRANSFER_EVENT )
+BOOL                 _USB_QueueTransferEvent( USB_EVENT event, void *pUserData );
+#endif
+BOOL                 _USB_ReserveFrameTime( void );
 void                 _USB_ResetDATA0( BYTE endpoint );
 void                 _USB_SendToken( BYTE endpoint, BYTE tokenType );
 void                 _USB_SetBDT( BYTE  direction );
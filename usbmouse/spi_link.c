@@ -0,0 +1,680 @@
+/******************************************************************************
+
+    PIC32 to FPGA SPI Link
+
+Sends cursor frames to the VGA FPGA over SPI2 without blocking.  Frames are
+queued in a ring (see "struct_queue.h" for the queue operations) and DMA
+channel 0 copies them into SPI2BUF, one 32-bit cell per SPI2 transmit
+request.  A DMA block covers the run of queued frames that is contiguous in
+the ring, capped at one less than the ring size so that the newest queued
+frame can always be replaced when the ring is full.
+
+ File Name:       spi_link.c
+ Dependencies:    spi_link.h, struct_queue.h
+ Processor:       PIC32MX
+ Compiler:        C32
+
+*******************************************************************************/
+
+#include <string.h>
+#include "GenericTypeDefs.h"
+#include <p32xxxx.h>
+#include "struct_queue.h"
+#include "spi_link.h"
+
+#if (SPI_LINK_QUEUE_DEPTH < 2)
+    #error "SPI_LINK_QUEUE_DEPTH must be at least 2"
+#endif
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Data Structures
+// *****************************************************************************
+// *****************************************************************************
+
+typedef struct _SPI_LINK_QUEUE
+{
+    int                 head;
+    int                 tail;
+    int                 count;
+    SPI_LINK_FRAME      buffer[SPI_LINK_QUEUE_DEPTH];
+} SPI_LINK_QUEUE;
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Global Variables
+// *****************************************************************************
+// *****************************************************************************
+
+static SPI_LINK_QUEUE   spiLinkQueue __attribute__ ((aligned(4)));
+static BYTE             spiLinkInFlight;    // Frames at the tail of the ring owned by the DMA channel
+static SPI_LINK_STATS   spiLinkStats;
+static BYTE             spiLinkSequence;    // Sequence number of the next cursor frame
+static SPI_LINK_SCREEN  spiLinkScreen;      // Video mode the FPGA reported
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Local Prototypes
+// *****************************************************************************
+// *****************************************************************************
+
+static void _SPILinkReadScreen( void );
+static BOOL _SPILinkSendFrame( BYTE sof, DWORD word0, DWORD word1 );
+static BYTE _SPILinkCRC8( BYTE crc, BYTE data );
+static void _SPILinkRetireBlock( void );
+static void _SPILinkStartBlock( void );
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Application Callable Functions
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    void SPILinkInitialize( void )
+
+  Summary:
+    Configures SPI2 and DMA channel 0 for the FPGA link.
+
+  Description:
+    Configures SPI2 as a 32-bit master at SPI_LINK_BRG, reads the video
+    mode from the FPGA, and sets up DMA channel 0 to feed SPI2 from the
+    frame ring on the SPI2 transmit interrupt request.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Waits for up to SPI_LINK_STATUS_TRIES words on the link.
+  ***************************************************************************/
+void SPILinkInitialize( void )
+{
+    StructQueueInit( &spiLinkQueue, SPI_LINK_QUEUE_DEPTH );
+    spiLinkInFlight = 0;
+    spiLinkSequence = 0;
+    memset( &spiLinkStats, 0, sizeof(spiLinkStats) );
+
+    SPI2CONbits.ON      = 0;                // disable SPI to reset any previous state
+    (void)SPI2BUF;                          // read SPI buffer to clear the receive buffer
+    SPI2BRG             = SPI_LINK_BRG;
+    SPI2CONbits.MSTEN   = 1;                // enable master mode
+    SPI2CONbits.CKE     = 1;                // set clock-to-data timing (data centered on rising SCK edge)
+    SPI2CONbits.MODE32  = 1;                // 32 bits per word
+    SPI2CONbits.MSSEN   = 1;                // drive SS2 low for each word, the FPGA resets its bit count on it
+    SPI2CONbits.ON      = 1;
+
+    _SPILinkReadScreen();
+
+    // DMA channel 0: one 32-bit cell into SPI2BUF per SPI2 transmit request.
+    DMACONbits.ON       = 1;
+    DCH0CON             = 0x03;             // Highest priority, disabled until there is a block
+    DCH0ECON            = (_SPI2_TX_IRQ << _DCH0ECON_CHSIRQ_POSITION) | _DCH0ECON_SIRQEN_MASK;
+    DCH0DSA             = KVA_TO_PA( &SPI2BUF );
+    DCH0DSIZ            = sizeof(DWORD);
+    DCH0CSIZ            = sizeof(DWORD);
+    DCH0INTCLR          = 0x00FF00FF;       // Clear the flags, no channel interrupts
+}
+
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkSend( const SPI_LINK_FRAME *frame )
+
+  Summary:
+    Queues a frame for the FPGA.
+
+  Description:
+    Queues a frame for the FPGA and starts the DMA channel if it is idle.
+    If the ring is full, a cursor frame replaces the newest queued frame
+    (which is never part of the DMA block) if that is a cursor frame too;
+    otherwise the frame is refused.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    const SPI_LINK_FRAME *frame - Frame to send
+
+  Return Values:
+    TRUE    - The frame was added to the ring
+    FALSE   - The frame replaced the newest queued frame, or was refused
+
+  Remarks:
+    None
+  ***************************************************************************/
+BOOL SPILinkSend( const SPI_LINK_FRAME *frame )
+{
+    BOOL    queued = TRUE;
+
+    _SPILinkRetireBlock();
+
+    if (StructQueueIsFull( &spiLinkQueue, SPI_LINK_QUEUE_DEPTH ))
+    {
+        if (((frame->word[0] >> 24) == SPI_LINK_SOF_CURSOR) &&
+            ((spiLinkQueue.buffer[spiLinkQueue.head].word[0] >> 24) == SPI_LINK_SOF_CURSOR))
+        {
+            memcpy( &spiLinkQueue.buffer[spiLinkQueue.head], frame, sizeof(SPI_LINK_FRAME) );
+            spiLinkStats.framesReplaced++;
+        }
+        else
+        {
+            spiLinkStats.framesRefused++;
+        }
+        queued = FALSE;
+    }
+    else
+    {
+        memcpy( StructQueueAdd( &spiLinkQueue, SPI_LINK_QUEUE_DEPTH ), frame, sizeof(SPI_LINK_FRAME) );
+        spiLinkStats.framesQueued++;
+    }
+
+    _SPILinkStartBlock();
+
+    return queued;
+}
+
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkSendCursor( WORD x, WORD y, BYTE buttons, BYTE wheel )
+
+  Summary:
+    Queues a cursor frame for the FPGA.
+
+  Description:
+    Packs the cursor position, buttons and wheel into a cursor frame and
+    queues it.  See spi_link.h for the frame layout.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    WORD x          - Cursor column, 0 to 2047
+    WORD y          - Cursor row, 0 to 2047
+    BYTE buttons    - Button bitmap, bit 0 is the first (left) button
+    BYTE wheel      - Running total of wheel movement, modulo 256
+
+  Return Values:
+    TRUE    - The frame was added to the ring
+    FALSE   - The frame replaced the newest queued frame, or was refused
+              because the newest queued frame is not a cursor frame
+
+  Remarks:
+    None
+  ***************************************************************************/
+BOOL SPILinkSendCursor( WORD x, WORD y, BYTE buttons, BYTE wheel )
+{
+    return _SPILinkSendFrame( SPI_LINK_SOF_CURSOR, ((DWORD)buttons << 8) | (DWORD)wheel,
+                              ((DWORD)(x & 0x7FF) << 21) | ((DWORD)(y & 0x7FF) << 10) );
+}
+
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkWriteTile( BYTE column, BYTE row, BYTE character, BYTE color )
+
+  Summary:
+    Queues a write to one tile of the FPGA's text screen.
+
+  Description:
+    Packs the tile address, character and color into a tile write frame and
+    queues it.  See spi_link.h for the frame layout.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    BYTE column     - Tile column, 0 to width / 8 - 1
+    BYTE row        - Tile row, 0 to height / 8 - 1
+    BYTE character  - Character code in the FPGA's charrom.txt, 0 for none
+    BYTE color      - Palette index, 0 to 15
+
+  Return Values:
+    TRUE    - The frame was queued
+    FALSE   - The ring was full; call SPILinkTasks() and try again
+
+  Remarks:
+    None
+  ***************************************************************************/
+BOOL SPILinkWriteTile( BYTE column, BYTE row, BYTE character, BYTE color )
+{
+    return _SPILinkSendFrame( SPI_LINK_SOF_TILE, ((DWORD)(row & 0x7F) << 8) | (DWORD)column,
+                              ((DWORD)(color & 0x0F) << 24) | ((DWORD)character << 16) );
+}
+
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkSetSprite( BYTE sprite, WORD x, WORD y, BYTE pattern,
+                           BYTE color, BOOL enable )
+
+  Summary:
+    Queues new attributes for one of the FPGA's sprites.
+
+  Description:
+    Packs the sprite number, position, pattern, color and enable into a
+    sprite frame and queues it.  See spi_link.h for the frame layout.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    BYTE sprite     - Sprite number, 1 to 15
+    WORD x          - Column of the sprite's left edge
+    WORD y          - Row of the sprite's top edge
+    BYTE pattern    - Pattern in the FPGA's sprites.txt, 0 to 7
+    BYTE color      - Palette index, 0 to 15
+    BOOL enable     - TRUE to show the sprite, FALSE to hide it
+
+  Return Values:
+    TRUE    - The frame was queued
+    FALSE   - The ring was full; call SPILinkTasks() and try again
+
+  Remarks:
+    None
+  ***************************************************************************/
+BOOL SPILinkSetSprite( BYTE sprite, WORD x, WORD y, BYTE pattern, BYTE color, BOOL enable )
+{
+    return _SPILinkSendFrame( SPI_LINK_SOF_SPRITE,
+                              ((DWORD)(sprite & 0x0F) << 12) | ((enable) ? 0x0800 : 0) |
+                              ((DWORD)(pattern & 0x07) << 8) | ((DWORD)(color & 0x0F) << 4),
+                              ((DWORD)(x & 0x7FF) << 21) | ((DWORD)(y & 0x7FF) << 10) );
+}
+
+
+/****************************************************************************
+  Function:
+    void SPILinkTasks( void )
+
+  Summary:
+    Keeps the DMA channel fed.
+
+  Description:
+    Retires the DMA block that has completed, if any, and starts a new block
+    with the frames that have been queued since.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void SPILinkTasks( void )
+{
+    _SPILinkRetireBlock();
+    _SPILinkStartBlock();
+}
+
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkIsIdle( void )
+
+  Summary:
+    Reports whether the link has anything left to send.
+
+  Description:
+    Reports whether every queued frame has been handed to SPI2.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Return Values:
+    TRUE    - Nothing is queued or in DMA
+    FALSE   - Frames are still waiting
+
+  Remarks:
+    None
+  ***************************************************************************/
+BOOL SPILinkIsIdle( void )
+{
+    _SPILinkRetireBlock();
+
+    return StructQueueIsEmpty( &spiLinkQueue, SPI_LINK_QUEUE_DEPTH );
+}
+
+
+/****************************************************************************
+  Function:
+    const SPI_LINK_STATS * SPILinkGetStats( void )
+
+  Summary:
+    Returns the link counters.
+
+  Description:
+    Returns the link counters.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    Pointer to the counters.
+
+  Remarks:
+    None
+  ***************************************************************************/
+const SPI_LINK_STATS * SPILinkGetStats( void )
+{
+    return &spiLinkStats;
+}
+
+
+/****************************************************************************
+  Function:
+    const SPI_LINK_SCREEN * SPILinkGetScreen( void )
+
+  Summary:
+    Returns the FPGA's video mode.
+
+  Description:
+    Returns the video mode and resolution the FPGA reported when the link
+    was initialized, or the SPI_LINK_DEFAULT_WIDTH by
+    SPI_LINK_DEFAULT_HEIGHT default if it did not answer.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    Pointer to the video mode.
+
+  Remarks:
+    None
+  ***************************************************************************/
+const SPI_LINK_SCREEN * SPILinkGetScreen( void )
+{
+    return &spiLinkScreen;
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Internal Functions
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    static void _SPILinkReadScreen( void )
+
+  Summary:
+    Reads the video mode from the FPGA.
+
+  Description:
+    Sends words that are not the start of a frame, which the FPGA's
+    receiver ignores, and reads the status word the FPGA shifts back at
+    the same time.  The mode is taken once two status words in a row agree.
+
+  Precondition:
+    SPI2 is on and DMA channel 0 is not using it.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    Leaves spiLinkScreen at the defaults if no status word is seen in
+    SPI_LINK_STATUS_TRIES words, as with an FPGA build that predates it.
+  ***************************************************************************/
+static void _SPILinkReadScreen( void )
+{
+    DWORD   status;
+    DWORD   previous    = 0;
+    BYTE    tries;
+
+    spiLinkScreen.mode      = 0;
+    spiLinkScreen.width     = SPI_LINK_DEFAULT_WIDTH;
+    spiLinkScreen.height    = SPI_LINK_DEFAULT_HEIGHT;
+    spiLinkScreen.reported  = FALSE;
+
+    for (tries = 0; tries < SPI_LINK_STATUS_TRIES; tries++)
+    {
+        SPI2BUF = 0;
+        while (!SPI2STATbits.SPIRBF)
+        {
+        }
+        status = SPI2BUF;
+
+        if (((status >> 24) == SPI_LINK_STATUS_MARKER) && (status == previous))
+        {
+            spiLinkScreen.mode      = (status >> 22) & 0x03;
+            spiLinkScreen.width     = (status >> 11) & 0x7FF;
+            spiLinkScreen.height    = status & 0x7FF;
+            spiLinkScreen.reported  = TRUE;
+            break;
+        }
+        previous = status;
+    }
+}
+
+
+/****************************************************************************
+  Function:
+    static BOOL _SPILinkSendFrame( BYTE sof, DWORD word0, DWORD word1 )
+
+  Summary:
+    Completes a frame and queues it.
+
+  Description:
+    Puts the start of frame marker and the next sequence number in the top
+    byte of word 0 and the CRC in the bottom byte of word 1, and queues the
+    frame with SPILinkSend().
+
+  Precondition:
+    None
+
+  Parameters:
+    BYTE sof    - Start of frame marker
+    DWORD word0 - Bits 15:0 of word 0
+    DWORD word1 - Bits 31:8 of word 1
+
+  Return Values:
+    TRUE    - The frame was added to the ring
+    FALSE   - The frame replaced the newest queued frame, or was refused
+
+  Remarks:
+    The sequence number is not used up by a refused frame, which the caller
+    sends again, but is by a replaced one, so the FPGA can tell how many
+    cursor frames it missed.
+  ***************************************************************************/
+static BOOL _SPILinkSendFrame( BYTE sof, DWORD word0, DWORD word1 )
+{
+    SPI_LINK_FRAME  frame;
+    DWORD           word;
+    DWORD           replaced;
+    BOOL            queued;
+    BYTE            crc;
+    BYTE            i;
+
+    frame.word[0]   = ((DWORD)sof << 24) | ((DWORD)spiLinkSequence << 16) | (word0 & 0xFFFF);
+    frame.word[1]   = word1 & 0xFFFFFF00;
+
+    // CRC over word 0 and the top three bytes of word 1, in the order they
+    // are shifted out.
+    crc = 0;
+    for (i = 0; i < 7; i++)
+    {
+        word = frame.word[i / 4];
+        crc  = _SPILinkCRC8( crc, (BYTE)(word >> (24 - 8 * (i % 4))) );
+    }
+    frame.word[1] |= crc;
+
+    replaced    = spiLinkStats.framesReplaced;
+    queued      = SPILinkSend( &frame );
+    if (queued || (spiLinkStats.framesReplaced != replaced))
+    {
+        spiLinkSequence++;
+    }
+
+    return queued;
+}
+
+
+/****************************************************************************
+  Function:
+    static BYTE _SPILinkCRC8( BYTE crc, BYTE data )
+
+  Summary:
+    Adds one byte to a CRC-8.
+
+  Description:
+    Runs the eight bits of data, most significant first, through the
+    SPI_LINK_CRC_POLYNOMIAL CRC, the same way the FPGA does as the bits
+    arrive.
+
+  Precondition:
+    None
+
+  Parameters:
+    BYTE crc    - CRC so far
+    BYTE data   - Next byte of the frame
+
+  Returns:
+    The updated CRC.
+
+  Remarks:
+    None
+  ***************************************************************************/
+static BYTE _SPILinkCRC8( BYTE crc, BYTE data )
+{
+    BYTE    bit;
+
+    crc ^= data;
+    for (bit = 0; bit < 8; bit++)
+    {
+        if (crc & 0x80)
+        {
+            crc = (crc << 1) ^ SPI_LINK_CRC_POLYNOMIAL;
+        }
+        else
+        {
+            crc <<= 1;
+        }
+    }
+
+    return crc;
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SPILinkRetireBlock( void )
+
+  Summary:
+    Frees the frames of a completed DMA block.
+
+  Description:
+    If the DMA channel has raised its block complete flag, the frames it
+    was sending are removed from the ring.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+static void _SPILinkRetireBlock( void )
+{
+    if (spiLinkInFlight && (DCH0INT & _DCH0INT_CHBCIF_MASK))
+    {
+        DCH0INTCLR = _DCH0INT_CHBCIF_MASK;
+
+        spiLinkStats.framesSent += spiLinkInFlight;
+        while (spiLinkInFlight)
+        {
+            (void)StructQueueRemove( &spiLinkQueue, SPI_LINK_QUEUE_DEPTH );
+            spiLinkInFlight--;
+        }
+    }
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SPILinkStartBlock( void )
+
+  Summary:
+    Hands the oldest queued frames to the DMA channel.
+
+  Description:
+    If the channel is idle, starts a block with the queued frames that are
+    contiguous in the ring from the oldest one.  The block stops short of
+    the whole ring so the newest frame stays replaceable.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    The SPI2 transmit request is already active when the channel is
+    enabled, so the first cell is forced and the rest follow the requests
+    raised as SPI2 empties.
+  ***************************************************************************/
+static void _SPILinkStartBlock( void )
+{
+    int     first;
+    int     frames;
+
+    if (spiLinkInFlight || StructQueueIsEmpty( &spiLinkQueue, SPI_LINK_QUEUE_DEPTH ))
+    {
+        return;
+    }
+
+    first   = (spiLinkQueue.tail < (SPI_LINK_QUEUE_DEPTH - 1)) ? (spiLinkQueue.tail + 1) : 0;
+    frames  = spiLinkQueue.count;
+    if (frames > (SPI_LINK_QUEUE_DEPTH - first))
+    {
+        frames = SPI_LINK_QUEUE_DEPTH - first;
+    }
+    if (frames > (SPI_LINK_QUEUE_DEPTH - 1))
+    {
+        frames = SPI_LINK_QUEUE_DEPTH - 1;
+    }
+
+    spiLinkInFlight = (BYTE)frames;
+    spiLinkStats.blocks++;
+
+    DCH0SSA     = KVA_TO_PA( &spiLinkQueue.buffer[first] );
+    DCH0SSIZ    = frames * sizeof(SPI_LINK_FRAME);
+    DCH0INTCLR  = _DCH0INT_CHBCIF_MASK;
+    DCH0CONSET  = _DCH0CON_CHEN_MASK;
+    DCH0ECONSET = _DCH0ECON_CFORCE_MASK;
+}
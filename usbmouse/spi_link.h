@@ -0,0 +1,363 @@
+/******************************************************************************
+
+    PIC32 to FPGA SPI Link (Header File)
+
+Summary:
+    Non-blocking, DMA driven transmit path from the mouse application to the
+    VGA FPGA.
+
+Description:
+    Frames handed to SPILinkSend() are copied into a small ring and sent by
+    DMA channel 0, which writes one 32-bit cell into SPI2BUF each time the
+    SPI2 transmit buffer empties.  The CPU only programs the channel at the
+    start of each block, so neither the USB stack nor the application waits
+    on the link.
+
+    Every queued frame is eventually sent, in order.  If the ring is full
+    and both the new frame and the newest queued one are cursor frames, the
+    queued one is replaced, so the most recent cursor position is never the
+    one that is lost.  Any other frame is refused when the ring is full and
+    has to be sent again.
+
+    SPILinkTasks() must be called regularly (once per pass of the main loop
+    is enough) to retire finished DMA blocks and start the next one.
+
+    Every frame is two words, most significant bit first.  The start of
+    frame (SOF) marker gives the frame type:
+
+    Cursor, built by SPILinkSendCursor():
+
+        word 0:  SOF (0xA5)  | sequence   | buttons     | wheel
+                 [31:24]       [23:16]      [15:8]        [7:0]
+        word 1:  x           | y          | 0           | CRC
+                 [31:21]       [20:10]      [9:8]         [7:0]
+
+    Tile write to the text screen of 8 x 8 tiles, built by SPILinkWriteTile():
+
+        word 0:  SOF (0xA6)  | sequence   | 0           | address
+                 [31:24]       [23:16]      [15]          [14:0]
+        word 1:  0           | data       | 0           | CRC
+                 [31:28]       [27:16]      [15:8]        [7:0]
+
+    Sprite attributes, built by SPILinkSetSprite():
+
+        word 0:  SOF (0xA7)  | sequence   | sprite  | enable | pattern | color | 0
+                 [31:24]       [23:16]      [15:12]   [11]     [10:8]    [7:4]   [3:0]
+        word 1:  x           | y          | 0           | CRC
+                 [31:21]       [20:10]      [9:8]         [7:0]
+
+    The tile address is {row[6:0], column[7:0]} and the data is
+    {color[3:0], character[7:0]}; character 0 is transparent.  Sprite 0 is
+    the mouse cursor, which follows the cursor frames, so sprite frames set
+    sprites 1 and up.  The sequence
+    number counts frames of every type.  The CRC is CRC-8 (x^8 + x^2 + x + 1, initial value 0) of the seven bytes
+    before it.  SS2 is driven low for each 32-bit word, so the FPGA can find
+    word boundaries even after a lost or extra SCK edge, and only takes a
+    frame whose start marker and CRC check out.  The wheel byte is a running
+    total rather than a delta so that a replaced frame loses no scrolling.
+
+    The FPGA is built for one of several video modes.  While each word goes
+    out, the FPGA shifts a status word back on SDI2:
+
+        status:  marker (0x5A) | mode       | width       | height
+                 [31:24]         [23:22]      [21:11]       [10:0]
+
+    SPILinkInitialize() reads it before the DMA channel takes over SPI2,
+    and SPILinkGetScreen() returns the result, so the application can keep
+    the cursor on whatever screen the FPGA drives.
+
+ File Name:       spi_link.h
+ Dependencies:    GenericTypeDefs.h
+ Processor:       PIC32MX
+ Compiler:        C32
+
+*******************************************************************************/
+
+#ifndef _SPI_LINK_H_
+#define _SPI_LINK_H_
+
+#include "GenericTypeDefs.h"
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Configuration
+// *****************************************************************************
+// *****************************************************************************
+
+#ifndef SPI_LINK_QUEUE_DEPTH
+    #define SPI_LINK_QUEUE_DEPTH    4       // Frames waiting for or in DMA
+#endif
+
+#ifndef SPI_LINK_BRG
+    #define SPI_LINK_BRG            1       // SCK = PBCLK / (2 * (BRG + 1)), 5MHz at 20MHz
+#endif
+
+#define SPI_LINK_FRAME_WORDS        2       // 32-bit SPI words per frame
+
+#define SPI_LINK_SOF_CURSOR         0xA5    // Start of frame marker for cursor frames
+#define SPI_LINK_SOF_TILE           0xA6    // Start of frame marker for tile writes
+#define SPI_LINK_SOF_SPRITE         0xA7    // Start of frame marker for sprite attributes
+#define SPI_LINK_CRC_POLYNOMIAL     0x07    // CRC-8, x^8 + x^2 + x + 1
+
+#define SPI_LINK_STATUS_MARKER      0x5A    // Top byte of the FPGA's status word
+#define SPI_LINK_STATUS_TRIES       8       // Words sent looking for two matching status words
+#define SPI_LINK_DEFAULT_WIDTH      640     // Screen assumed if the FPGA does not answer
+#define SPI_LINK_DEFAULT_HEIGHT     480
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Data Structures
+// *****************************************************************************
+// *****************************************************************************
+
+// One frame to the FPGA, sent most significant word first.
+typedef struct _SPI_LINK_FRAME
+{
+    DWORD       word[SPI_LINK_FRAME_WORDS];
+} SPI_LINK_FRAME;
+
+// Link counters, for debugging.
+typedef struct _SPI_LINK_STATS
+{
+    DWORD       framesQueued;       // Frames accepted by SPILinkSend()
+    DWORD       framesReplaced;     // Cursor frames overwritten because the ring was full
+    DWORD       framesRefused;      // Other frames turned away because the ring was full
+    DWORD       framesSent;         // Frames the DMA channel has finished with
+    DWORD       blocks;             // DMA blocks started
+} SPI_LINK_STATS;
+
+// Video mode of the FPGA.
+typedef struct _SPI_LINK_SCREEN
+{
+    BYTE        mode;               // 0: 640 x 480, 1: 800 x 600, 2: 1024 x 768, 3: 1280 x 720
+    WORD        width;              // Visible pixels per line
+    WORD        height;             // Visible lines
+    BOOL        reported;           // FALSE if the FPGA did not answer and the defaults are in use
+} SPI_LINK_SCREEN;
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Function Prototypes
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    void SPILinkInitialize( void )
+
+  Description:
+    Configures SPI2 as a 32-bit master at SPI_LINK_BRG, reads the video
+    mode from the FPGA, and sets up DMA channel 0 to feed SPI2 from the
+    frame ring on the SPI2 transmit interrupt request.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    The DMA controller is switched on if it is not on already.  Waits for
+    up to SPI_LINK_STATUS_TRIES words on the link.
+  ***************************************************************************/
+void SPILinkInitialize( void );
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkSend( const SPI_LINK_FRAME *frame )
+
+  Description:
+    Queues a frame for the FPGA and starts the DMA channel if it is idle.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    const SPI_LINK_FRAME *frame - Frame to send
+
+  Return Values:
+    TRUE    - The frame was added to the ring
+    FALSE   - The ring was full; a cursor frame replaced the newest queued
+              cursor frame, any other frame was not queued
+
+  Remarks:
+    Never waits for the link.
+  ***************************************************************************/
+BOOL SPILinkSend( const SPI_LINK_FRAME *frame );
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkSendCursor( WORD x, WORD y, BYTE buttons, BYTE wheel )
+
+  Description:
+    Builds a cursor frame with the next sequence number and its CRC, and
+    queues it with SPILinkSend().
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    WORD x          - Cursor column, 0 to 2047
+    WORD y          - Cursor row, 0 to 2047
+    BYTE buttons    - Button bitmap, bit 0 is the first (left) button
+    BYTE wheel      - Running total of wheel movement, modulo 256
+
+  Return Values:
+    TRUE    - The frame was added to the ring
+    FALSE   - The ring was full and the frame replaced the newest queued
+              frame
+
+  Remarks:
+    Only the low 11 bits of x and y are sent.
+  ***************************************************************************/
+BOOL SPILinkSendCursor( WORD x, WORD y, BYTE buttons, BYTE wheel );
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkWriteTile( BYTE column, BYTE row, BYTE character, BYTE color )
+
+  Description:
+    Builds a tile write frame for one character of the FPGA's text screen
+    and queues it with SPILinkSend().
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    BYTE column     - Tile column, 0 to width / 8 - 1
+    BYTE row        - Tile row, 0 to height / 8 - 1
+    BYTE character  - Character code in the FPGA's charrom.txt, 0 for none
+    BYTE color      - Palette index, 0 to 15
+
+  Return Values:
+    TRUE    - The frame was queued
+    FALSE   - The ring was full; call SPILinkTasks() and try again
+
+  Remarks:
+    The FPGA drops writes outside its screen.
+  ***************************************************************************/
+BOOL SPILinkWriteTile( BYTE column, BYTE row, BYTE character, BYTE color );
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkSetSprite( BYTE sprite, WORD x, WORD y, BYTE pattern,
+                           BYTE color, BOOL enable )
+
+  Description:
+    Builds a sprite attribute frame and queues it with SPILinkSend().
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    BYTE sprite     - Sprite number, 1 to 15 (the FPGA draws 1 to 7 by default)
+    WORD x          - Column of the sprite's left edge
+    WORD y          - Row of the sprite's top edge
+    BYTE pattern    - Pattern in the FPGA's sprites.txt, 0 to 7
+    BYTE color      - Palette index, 0 to 15
+    BOOL enable     - TRUE to show the sprite, FALSE to hide it
+
+  Return Values:
+    TRUE    - The frame was queued
+    FALSE   - The ring was full; call SPILinkTasks() and try again
+
+  Remarks:
+    None
+  ***************************************************************************/
+BOOL SPILinkSetSprite( BYTE sprite, WORD x, WORD y, BYTE pattern, BYTE color, BOOL enable );
+
+/****************************************************************************
+  Function:
+    void SPILinkTasks( void )
+
+  Description:
+    Retires the DMA block that has completed, if any, and starts a new block
+    with the frames that have been queued since.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+void SPILinkTasks( void );
+
+/****************************************************************************
+  Function:
+    BOOL SPILinkIsIdle( void )
+
+  Description:
+    Reports whether every queued frame has been handed to SPI2.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Return Values:
+    TRUE    - Nothing is queued or in DMA
+    FALSE   - Frames are still waiting
+
+  Remarks:
+    The last word may still be shifting out of SPI2 when this returns TRUE.
+  ***************************************************************************/
+BOOL SPILinkIsIdle( void );
+
+/****************************************************************************
+  Function:
+    const SPI_LINK_STATS * SPILinkGetStats( void )
+
+  Description:
+    Returns the link counters.
+
+  Precondition:
+    None
+
+  Parameters:
+    None
+
+  Returns:
+    Pointer to the counters.
+
+  Remarks:
+    None
+  ***************************************************************************/
+const SPI_LINK_STATS * SPILinkGetStats( void );
+
+/****************************************************************************
+  Function:
+    const SPI_LINK_SCREEN * SPILinkGetScreen( void )
+
+  Description:
+    Returns the video mode and resolution the FPGA reported when the link
+    was initialized.
+
+  Precondition:
+    SPILinkInitialize() has been called.
+
+  Parameters:
+    None
+
+  Returns:
+    Pointer to the video mode.
+
+  Remarks:
+    If the FPGA did not answer, the mode is SPI_LINK_DEFAULT_WIDTH by
+    SPI_LINK_DEFAULT_HEIGHT and reported is FALSE.
+  ***************************************************************************/
+const SPI_LINK_SCREEN * SPILinkGetScreen( void );
+
+#endif  // _SPI_LINK_H_
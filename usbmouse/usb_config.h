@@ -49,6 +49,10 @@ DEFENSE THEREOF), OR OTHER SIMILAR COSTS.
     #error No processor header file.
 #endif
 
+#if defined(USB_HOST_SIMULATOR)
+    #include "usb_sim.h"
+#endif
+
 #define _USB_CONFIG_VERSION_MAJOR 1
 #define _USB_CONFIG_VERSION_MINOR 0
 #define _USB_CONFIG_VERSION_DOT   4
@@ -71,20 +75,50 @@ DEFENSE THEREOF), OR OTHER SIMILAR COSTS.
 #define USB_INITIAL_VBUS_CURRENT (100/2)
 #define USB_INSERT_TIME (250+1)
 #define USB_HOST_APP_EVENT_HANDLER USB_ApplicationEventHandler
+#define USB_ENABLE_TRANSFER_EVENT
+#define USB_EVENT_QUEUE_DEPTH 4
+#define USB_HOST_ARENA_SIZE 512
+#define USB_ENUMERATION_CACHE_ENTRIES 2
+#define USB_ENABLE_ENUMERATION_TELEMETRY
+#define USB_ENABLE_ENDPOINT_STATISTICS
+#define USB_ENABLE_TRAFFIC_CAPTURE
+#define USB_ENABLE_CONTROL_READ_STREAM
 
 // Host HID Client Driver Configuration
 
 #define USB_MAX_HID_DEVICES 1
-#define HID_MAX_DATA_FIELD_SIZE 8
+#define HID_MAX_DATA_FIELD_SIZE 16
 #define APPL_COLLECT_PARSED_DATA USB_HID_DataCollectionHandler
+#define USB_HID_ENABLE_REPORT_PIPELINE
+#define USB_HID_PIPELINE_DEPTH 4
+#define USB_HID_PIPELINE_REPORT_SIZE 16
+#define USB_HID_ENABLE_IMPORT_PROGRAM
+#define USB_HID_IMPORT_MAX_FIELDS 8
+#define USB_HID_ENABLE_REPORT_ROUTING
+#define USB_HID_ROUTE_MAX_REPORT_ID 15
+#define USB_HID_MAX_ROUTES 4
+#define USB_HID_ROUTE_MAX_FIELDS 16
+#define USB_HID_STREAM_REPORT_DESCRIPTOR
+#define USB_HID_REPORT_DESCRIPTOR_WINDOW 64
+#define USB_HID_REPORT_CACHE_ENTRIES 2
+#define USB_HID_REPORT_CACHE_SIZE 640
 
 // Helpful Macros
 
-#define USBTasks()                  \
-    {                               \
-        USBHostTasks();             \
-        USBHostHIDTasks();          \
-    }
+#if defined(USB_HOST_SIMULATOR)
+    #define USBTasks()                  \
+        {                               \
+            USBSimTaskTick();           \
+            USBHostTasks();             \
+            USBHostHIDTasks();          \
+        }
+#else
+    #define USBTasks()                  \
+        {                               \
+            USBHostTasks();             \
+            USBHostHIDTasks();          \
+        }
+#endif
 
 #define USBInitialize(x)            \
     {                               \
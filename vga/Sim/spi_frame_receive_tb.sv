@@ -0,0 +1,355 @@
+// spi_frame_receive_tb.sv
+// Self-checking testbench for spi_frame_receive in vga.sv.  Frames are
+// built the same way as _SPILinkSendFrame() in spi_link.c and shifted in
+// one word per cs_b low, as SPI2 does with MSSEN set.  Some frames are sent
+// with a fault: an SCK edge left out, an extra SCK edge, a flipped bit or a
+// whole word lost.
+//
+// Every frame is checked against a word level model of the receiver, taken
+// from the description above spi_frame_receive: which frames are taken and
+// what reaches the cursor, tile and sprite outputs.  The directed tests also
+// check that a frame is taken if and only if it arrives intact, so that the
+// receiver is back in step by the next good frame after any fault.  In the
+// random frames a corrupt frame can pass the 8-bit CRC, about one in 256,
+// and take the word 0 of the good frame after it with it; those are counted
+// and reported, and every good frame lost must be down to one of them.
+//
+// Run from the vga directory with Icarus Verilog:
+//
+//   iverilog -g2012 -s spi_frame_receive_tb -o Sim/spi_frame_receive_tb.vvp \
+//       Sim/spi_frame_receive_tb.sv vga.sv pll_bb.v
+//   vvp Sim/spi_frame_receive_tb.vvp
+//
+// or with Verilator 5:
+//
+//   verilator --binary --timing -Wno-fatal -Wno-lint -Wno-style \
+//       --top-module spi_frame_receive_tb --Mdir Sim/obj_dir_tb \
+//       Sim/spi_frame_receive_tb.sv vga.sv pll_bb.v
+//   Sim/obj_dir_tb/Vspi_frame_receive_tb
+//
+// It ends with PASSED, or with the failed checks and FAILED.
+
+`timescale 1ns/1ps
+
+module spi_frame_receive_tb;
+
+  localparam logic [7:0] SOF_CURSOR = 8'hA5;  // must match spi_link.h
+  localparam logic [7:0] SOF_TILE   = 8'hA6;
+  localparam logic [7:0] SOF_SPRITE = 8'hA7;
+
+  localparam FAULT_NONE  = 0;  // frame sent as is
+  localparam FAULT_DROP  = 1;  // SCK edge of bit position left out
+  localparam FAULT_EXTRA = 2;  // second SCK edge after bit position
+  localparam FAULT_FLIP  = 3;  // bit position inverted
+  localparam FAULT_LOSE  = 4;  // word holding bit position not sent
+
+  localparam RANDOM_FRAMES = 4000;
+
+  logic        sck, sdi, cs_b;
+  logic [10:0] xPos, yPos;
+  logic [7:0]  buttons, wheel, seq;
+  logic        tileWrite, spriteWrite;
+  logic [14:0] tileAddress;
+  logic [11:0] tileData;
+  logic [3:0]  spriteIndex;
+  logic [29:0] spriteAttributes;
+
+  // what the receiver has done, sampled just before each rising sck edge
+  int          framesTaken, tileWrites, spriteWrites;
+  logic [26:0] tileSeen;        // {address, data} of the last tile write
+  logic [33:0] spriteSeen;      // {index, attributes} of the last sprite write
+
+  // what it should have done
+  logic [31:0] modelWord0;
+  logic        modelHaveWord0;
+  int          modelFrames, modelTiles, modelSprites;
+  logic        modelCursorSet;
+  logic [45:0] modelCursor;     // {x, y, buttons, wheel, seq}
+  logic [26:0] modelTile;
+  logic [33:0] modelSprite;
+  logic [63:0] modelLastFrame;
+
+  int          errors, checks;
+  int          randomIntact, randomLost, randomCorruptTaken;
+  logic [7:0]  seqNext;
+  logic [31:0] random;
+
+  spi_frame_receive dut(sck, sdi, cs_b, xPos, yPos, buttons, wheel, seq,
+                        tileWrite, tileAddress, tileData,
+                        spriteWrite, spriteIndex, spriteAttributes);
+
+  // CRC-8 (x^8 + x^2 + x + 1, starting from 0) of the 56 bits before the
+  // CRC, as spi_link.c computes it
+  function automatic logic [7:0] frameCrc(input logic [31:0] word0,
+                                          input logic [23:0] payload1);
+    logic [55:0] frameBits;
+    logic [7:0]  crc;
+    frameBits = {word0, payload1};
+    crc       = 8'h00;
+    for (int i = 55; i >= 0; i--)
+      crc = {crc[6:0], 1'b0} ^ ((crc[7] ^ frameBits[i]) ? 8'h07 : 8'h00);
+    return crc;
+  endfunction
+
+  // The word clocked in when the edge after bit position comes twice: that
+  // bit goes in again and the last bit of the word is pushed out by the
+  // 33rd edge, which cs_b going high then throws away.
+  function automatic logic [31:0] extraEdgeWord(input logic [31:0] word,
+                                                input int          position);
+    logic [31:0] after;
+    after = 32'hFFFFFFFF >> position;
+    return (word & ~after) | ((word >> 1) & after);
+  endfunction
+
+  // xorshift32, so that every simulator sends the same frames
+  function automatic logic [31:0] nextRandom(input logic [31:0] state);
+    state = state ^ (state << 13);
+    state = state ^ (state >> 17);
+    state = state ^ (state << 5);
+    return state;
+  endfunction
+
+  task automatic check(input logic ok, input string what);
+    checks++;
+    if (!ok) begin
+      errors++;
+      $display("FAILED: %s", what);
+    end
+  endtask
+
+  // A word of 32 edges reaches the model of the receiver: with a word 0
+  // held and a good CRC it completes a frame, otherwise it is held as the
+  // next word 0 if it starts with a marker.
+  task automatic modelWord(input logic [31:0] word);
+    if (modelHaveWord0 && (frameCrc(modelWord0, word[31:8]) == word[7:0])) begin
+      modelFrames++;
+      modelLastFrame = {modelWord0, word};
+      case (modelWord0[31:24])
+        SOF_CURSOR: begin
+          modelCursorSet = 1'b1;
+          modelCursor    = {word[31:10], modelWord0[15:0], modelWord0[23:16]};
+        end
+        SOF_TILE: begin
+          modelTiles++;
+          modelTile = {modelWord0[14:0], word[27:16]};
+        end
+        SOF_SPRITE: begin
+          modelSprites++;
+          modelSprite = {modelWord0[15:4], word[31:10]};
+        end
+      endcase
+      modelHaveWord0 = 1'b0;
+    end else begin
+      modelWord0     = word;
+      modelHaveWord0 = (word[31:24] == SOF_CURSOR) | (word[31:24] == SOF_TILE) |
+                       (word[31:24] == SOF_SPRITE);
+    end
+  endtask
+
+  // one rising edge of sck; the write strobes are sampled just before it,
+  // which is where the RAM behind them sees them
+  task automatic sckEdge;
+    if (dut.frameGood) framesTaken++;
+    if (tileWrite) begin
+      tileWrites++;
+      tileSeen = {tileAddress, tileData};
+    end
+    if (spriteWrite) begin
+      spriteWrites++;
+      spriteSeen = {spriteIndex, spriteAttributes};
+    end
+    sck = 1'b1;
+    #5;
+    sck = 1'b0;
+    #5;
+  endtask
+
+  // one word, most significant bit first; position counts bits from 1
+  task automatic sendWord(input logic [31:0] word, input int fault, input int position);
+    if (fault != FAULT_LOSE) begin
+      cs_b = 1'b0;
+      #5;
+      for (int i = 1; i <= 32; i++) begin
+        sdi = word[32 - i] ^ ((fault == FAULT_FLIP) && (i == position));
+        #5;
+        if (!((fault == FAULT_DROP) && (i == position))) sckEdge();
+        if ((fault == FAULT_EXTRA) && (i == position))    sckEdge();
+      end
+      cs_b = 1'b1;
+      #10;
+    end
+
+    // a word with an edge left out never reaches 32 edges
+    case (fault)
+      FAULT_NONE:  modelWord(word);
+      FAULT_EXTRA: modelWord(extraEdgeWord(word, position));
+      FAULT_FLIP:  modelWord(word ^ (32'h1 << (32 - position)));
+      default:     ;
+    endcase
+  endtask
+
+  // Sends a frame, position 1 to 32 in word 0 and 33 to 64 in word 1, and
+  // checks the receiver against the model.  If strict, the frame must also
+  // be taken if and only if it arrives intact.
+  task automatic sendAndCheck(input logic [7:0]  sof,
+                              input logic [15:0] payload0,
+                              input logic [23:0] payload1,
+                              input int          fault,
+                              input int          position,
+                              input logic        strict,
+                              input string       what);
+    logic [31:0] word0, word1;
+    logic        intact, takenAsSent;
+    int          modelFramesBefore;
+
+    word0   = {sof, seqNext, payload0};
+    word1   = {payload1, frameCrc(word0, payload1)};
+    seqNext = seqNext + 8'd1;
+    intact  = (fault == FAULT_NONE) ||
+              ((fault == FAULT_EXTRA) &&
+               (extraEdgeWord((position <= 32) ? word0 : word1,
+                              (position <= 32) ? position : position - 32) ==
+                ((position <= 32) ? word0 : word1)));
+    modelFramesBefore = modelFrames;
+
+    sendWord(word0, (position <= 32) ? fault : FAULT_NONE, position);
+    sendWord(word1, (position >  32) ? fault : FAULT_NONE, position - 32);
+
+    check(framesTaken == modelFrames, $sformatf("%s: %0d frames taken, model %0d",
+                                                what, framesTaken, modelFrames));
+    if (modelCursorSet)
+      check({xPos, yPos, buttons, wheel, seq} == modelCursor,
+            $sformatf("%s: cursor %h, model %h", what,
+                      {xPos, yPos, buttons, wheel, seq}, modelCursor));
+    check(tileWrites == modelTiles, $sformatf("%s: %0d tile writes, model %0d",
+                                              what, tileWrites, modelTiles));
+    if (modelTiles != 0)
+      check(tileSeen == modelTile, $sformatf("%s: tile write %h, model %h",
+                                             what, tileSeen, modelTile));
+    check(spriteWrites == modelSprites, $sformatf("%s: %0d sprite writes, model %0d",
+                                                  what, spriteWrites, modelSprites));
+    if (modelSprites != 0)
+      check(spriteSeen == modelSprite, $sformatf("%s: sprite write %h, model %h",
+                                                 what, spriteSeen, modelSprite));
+
+    takenAsSent = (modelFrames != modelFramesBefore) && (modelLastFrame == {word0, word1});
+    if (strict)
+      check(takenAsSent == intact, $sformatf("%s: frame %0s", what,
+                                             intact ? "not taken" : "taken"));
+    else begin
+      if (intact)                 randomIntact++;
+      if (intact && !takenAsSent) randomLost++;
+      if ((modelFrames != modelFramesBefore) && !takenAsSent) randomCorruptTaken++;
+    end
+  endtask
+
+  initial begin
+    logic [7:0]  sof;
+    logic [15:0] payload0;
+    logic [23:0] payload1;
+    int          fault, position;
+
+    sck                = 1'b0;
+    sdi                = 1'b0;
+    cs_b               = 1'b1;
+    framesTaken        = 0;
+    tileWrites         = 0;
+    spriteWrites       = 0;
+    modelHaveWord0     = 1'b0;
+    modelFrames        = 0;
+    modelTiles         = 0;
+    modelSprites       = 0;
+    modelCursorSet     = 1'b0;
+    errors             = 0;
+    checks             = 0;
+    randomIntact       = 0;
+    randomLost         = 0;
+    randomCorruptTaken = 0;
+    seqNext            = 8'd0;
+    random             = 32'h2545F491;
+    #20;
+
+    // the status poll the PIC sends at start up is not a frame
+    sendWord(32'h00000000, FAULT_NONE, 0);
+    check(framesTaken == 0, "status poll taken as a frame");
+
+    // good frames of each type
+    sendAndCheck(SOF_CURSOR, 16'h01FE, {11'd100, 11'd60, 2'b0}, FAULT_NONE, 0, 1'b1, "cursor");
+    sendAndCheck(SOF_TILE,   16'h0A23, {4'b0, 12'hF55, 8'b0},    FAULT_NONE, 0, 1'b1, "tile write");
+    sendAndCheck(SOF_SPRITE, 16'h19C0, {11'd52, 11'd240, 2'b0}, FAULT_NONE, 0, 1'b1, "sprite");
+
+    // a lost SCK edge spoils its word, wherever it falls, and the next
+    // good frame is taken
+    for (position = 1; position <= 64; position++) begin
+      sendAndCheck(SOF_CURSOR, 16'h0203, {11'd400, 11'd300, 2'b0}, FAULT_DROP, position, 1'b1,
+                   $sformatf("drop %0d", position));
+      sendAndCheck(SOF_CURSOR, 16'h0000, {11'd401, 11'd301, 2'b0}, FAULT_NONE, 0, 1'b1,
+                   $sformatf("after drop %0d", position));
+    end
+
+    // so does an extra edge, unless the bits from there to the end of the
+    // word are all the same; the tile address ends in a run of ones
+    for (position = 1; position <= 64; position++) begin
+      sendAndCheck(SOF_TILE, 16'h1FFF, {4'b0, 12'h0AA, 8'b0}, FAULT_EXTRA, position, 1'b1,
+                   $sformatf("extra %0d", position));
+      sendAndCheck(SOF_CURSOR, 16'h0100, {11'd639, 11'd479, 2'b0}, FAULT_NONE, 0, 1'b1,
+                   $sformatf("after extra %0d", position));
+    end
+
+    // a flipped bit fails the CRC
+    for (position = 1; position <= 64; position++) begin
+      sendAndCheck(SOF_SPRITE, 16'h7F10, {11'd7, 11'd9, 2'b0}, FAULT_FLIP, position, 1'b1,
+                   $sformatf("flip %0d", position));
+      sendAndCheck(SOF_CURSOR, 16'h0001, {11'd5, 11'd6, 2'b0}, FAULT_NONE, 0, 1'b1,
+                   $sformatf("after flip %0d", position));
+    end
+
+    // a lost word 0 leaves word 1 to be tried as a word 0, a lost word 1
+    // leaves word 0 waiting for the next frame
+    sendAndCheck(SOF_CURSOR, 16'h0000, {11'd1, 11'd2, 2'b0},   FAULT_LOSE, 1,  1'b1, "lose word 0");
+    sendAndCheck(SOF_CURSOR, 16'h0000, {11'd3, 11'd4, 2'b0},   FAULT_NONE, 0,  1'b1, "after lose word 0");
+    sendAndCheck(SOF_TILE,   16'h0001, {4'b0, 12'h123, 8'b0},  FAULT_LOSE, 33, 1'b1, "lose word 1");
+    sendAndCheck(SOF_TILE,   16'h0002, {4'b0, 12'h456, 8'b0},  FAULT_NONE, 0,  1'b1, "after lose word 1");
+
+    // a word 1 with a start of frame marker in its top byte
+    sendAndCheck(SOF_CURSOR, 16'h0000, {8'hA5, 16'h0000},      FAULT_LOSE, 1,  1'b1, "marker in word 1");
+    sendAndCheck(SOF_CURSOR, 16'h0000, {11'd10, 11'd20, 2'b0}, FAULT_NONE, 0,  1'b1, "after marker in word 1");
+
+    // random frames, half of them with a fault
+    for (int n = 0; n < RANDOM_FRAMES; n++) begin
+      random = nextRandom(random);
+      case (random % 3)
+        0:       sof = SOF_CURSOR;
+        1:       sof = SOF_TILE;
+        default: sof = SOF_SPRITE;
+      endcase
+      random   = nextRandom(random);
+      payload0 = random[15:0];
+      payload1 = {random[31:16], random[7:0]};
+      if (sof == SOF_TILE) begin
+        payload0[15]    = 1'b0;
+        payload1[23:20] = 4'b0;
+        payload1[7:0]   = 8'b0;
+      end else begin
+        payload1[1:0]   = 2'b0;
+        if (sof == SOF_SPRITE) payload0[3:0] = 4'b0;
+      end
+      random   = nextRandom(random);
+      fault    = (random % 10 < 5) ? FAULT_NONE : (random % 10) - 4;
+      if (fault > FAULT_LOSE) fault = FAULT_EXTRA;
+      random   = nextRandom(random);
+      position = random % 64 + 1;
+      sendAndCheck(sof, payload0, payload1, fault, position, 1'b0,
+                   $sformatf("random frame %0d", n));
+    end
+    check(randomLost <= randomCorruptTaken, "good frames lost without a corrupt frame passing the CRC");
+
+    $display("%0d random frames: %0d intact, %0d of those lost, %0d corrupt frames passed the CRC",
+             RANDOM_FRAMES, randomIntact, randomLost, randomCorruptTaken);
+    $display("%0d checks, %0d frames taken, %0d tile writes, %0d sprite writes",
+             checks, framesTaken, tileWrites, spriteWrites);
+    if (errors == 0) $display("PASSED");
+    else             $display("FAILED: %0d of %0d checks", errors, checks);
+    $finish;
+  end
+endmodule
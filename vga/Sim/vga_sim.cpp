@@ -0,0 +1,500 @@
+/******************************************************************************
+
+    VGA Simulator
+
+Clocks vgaController and videoGen from vga.sv (through vga_sim_top.sv) for
+whole frames under Verilator, drives the SPI pins from a scripted cursor
+trace, and writes each frame out as a PPM image.  When the run ends it
+prints the simulation speed in frames per second, so RTL changes can be
+benchmarked as well as checked for geometry and timing regressions by
+comparing the images.
+
+Build and run from the vga directory (the ROM files are read from the current
+directory):
+
+    verilator -O3 --cc --exe --build -Wno-fatal -Wno-lint -Wno-style \
+        --top-module vga_sim_top --Mdir Sim/obj_dir -o vga_sim \
+        Sim/vga_sim_top.sv vga.sv Sim/vga_sim.cpp
+
+Add -GMODE=1, 2 or 3 to build for 800 x 600, 1024 x 768 or 1280 x 720
+instead of 640 x 480.  The harness reads the resolution back from the
+FPGA's status word, as the PIC does.
+
+    Sim/obj_dir/vga_sim [trace [frames [prefix]]]
+
+trace is a cursor trace file (default Sim/cursor.trace, "-" for none),
+frames the number of whole frames to run (default 4) and prefix, if given,
+the start of the PPM file names (prefix0000.ppm, prefix0001.ppm, ...).
+
+Each line of the trace is "frame x y [buttons [wheel [drop]]]",
+"text frame column row color string" or
+"sprite frame index x y pattern color enable"; # starts a comment.  The
+cursor frame, tile write frames (one per character of the string) or
+sprite frame are sent over SPI as spi_link.c would send them, at the start
+of the vertical blanking before the given frame.  If drop is 1 to 64, that SCK edge of the cursor frame is
+left out, to check that the receiver throws the frame away and picks up
+the next one.  Lines must be in frame order.  Frames end after their
+last visible pixel, and the trace lines for the next frame are sent then.
+
+ File Name:       vga_sim.cpp
+ Dependencies:    Verilator, vga_sim_top.sv, vga.sv
+ Processor:       Host simulator
+ Compiler:        GCC
+
+*******************************************************************************/
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "verilated.h"
+#include "Vvga_sim_top.h"
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Constants
+// *****************************************************************************
+// *****************************************************************************
+
+#define VGA_SIM_MAX_WIDTH       1280
+#define VGA_SIM_MAX_HEIGHT      768
+#define VGA_SIM_STATUS_MARKER   0x5A        // Top byte of the FPGA's status word
+#define VGA_SIM_STATUS_TRIES    8           // Must match SPI_LINK_STATUS_TRIES in spi_link.h
+
+#define VGA_SIM_SOF_CURSOR      0xA5        // Must match SPI_LINK_SOF_CURSOR in spi_link.h
+#define VGA_SIM_SOF_TILE        0xA6        // Must match SPI_LINK_SOF_TILE in spi_link.h
+#define VGA_SIM_SOF_SPRITE      0xA7        // Must match SPI_LINK_SOF_SPRITE in spi_link.h
+#define VGA_SIM_CRC_POLYNOMIAL  0x07        // Must match SPI_LINK_CRC_POLYNOMIAL in spi_link.h
+
+#define VGA_SIM_MAX_TRACE       4096
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Data Structures
+// *****************************************************************************
+// *****************************************************************************
+
+// One line of the cursor trace.  For a text line x, y and buttons hold the
+// column, row and color.
+typedef struct _VGA_SIM_CURSOR
+{
+    unsigned int    frame;
+    unsigned int    x;
+    unsigned int    y;
+    unsigned int    buttons;
+    unsigned int    wheel;
+    unsigned int    drop;       // SCK edge (1 to 64) to leave out, 0 for none
+    char            text[64];   // Empty for a cursor or sprite line
+    bool            sprite;
+    unsigned int    index;      // Sprite line only
+    unsigned int    pattern;
+    unsigned int    color;
+    unsigned int    enable;
+} VGA_SIM_CURSOR;
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Global Variables
+// *****************************************************************************
+// *****************************************************************************
+
+static Vvga_sim_top     *vga;
+static VGA_SIM_CURSOR   simTrace[VGA_SIM_MAX_TRACE];
+static unsigned int     simTraceLength;
+static unsigned char    simFrame[VGA_SIM_MAX_HEIGHT][VGA_SIM_MAX_WIDTH][3];
+static unsigned int     simWidth;
+static unsigned int     simHeight;
+static unsigned int     simSequence;
+
+// Real frame rate of each video mode, for the speed report
+static const double     simRefreshHz[4] = { 59.94, 60.32, 60.00, 60.03 };
+
+
+// Older Verilator runtimes call this for $time; nothing here uses it.
+double sc_time_stamp( void )
+{
+    return 0;
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Local Functions
+// *****************************************************************************
+// *****************************************************************************
+
+/****************************************************************************
+  Function:
+    static void _SimLoadTrace( const char *name )
+
+  Description:
+    Reads a cursor trace file into simTrace.
+
+  Precondition:
+    None
+
+  Parameters:
+    const char *name    - File name, or "-" for no trace
+
+  Returns:
+    None
+
+  Remarks:
+    Exits if the file cannot be opened.
+  ***************************************************************************/
+static void _SimLoadTrace( const char *name )
+{
+    FILE            *file;
+    char            line[256];
+    VGA_SIM_CURSOR  entry;
+    int             fields;
+
+    if (!strcmp( name, "-" ))
+    {
+        return;
+    }
+    if ((file = fopen( name, "r" )) == NULL)
+    {
+        fprintf( stderr, "vga_sim: cannot open trace %s\n", name );
+        exit( 2 );
+    }
+
+    while (fgets( line, sizeof(line), file ) && (simTraceLength < VGA_SIM_MAX_TRACE))
+    {
+        if (strchr( line, '#' ))
+        {
+            *strchr( line, '#' ) = 0;
+        }
+        memset( &entry, 0, sizeof(entry) );
+        if (sscanf( line, " text %u %u %u %u %63[^\r\n]", &entry.frame, &entry.x, &entry.y,
+                    &entry.buttons, entry.text ) == 5)
+        {
+            simTrace[simTraceLength++] = entry;
+            continue;
+        }
+        if (sscanf( line, " sprite %u %u %u %u %u %u %u", &entry.frame, &entry.index, &entry.x,
+                    &entry.y, &entry.pattern, &entry.color, &entry.enable ) == 7)
+        {
+            entry.sprite = true;
+            simTrace[simTraceLength++] = entry;
+            continue;
+        }
+        fields = sscanf( line, "%u %u %u %u %u %u", &entry.frame, &entry.x, &entry.y,
+                         &entry.buttons, &entry.wheel, &entry.drop );
+        if (fields >= 3)
+        {
+            simTrace[simTraceLength++] = entry;
+        }
+    }
+    fclose( file );
+}
+
+
+/****************************************************************************
+  Function:
+    static unsigned int _SimSpiWord( unsigned int word, unsigned int drop )
+
+  Description:
+    Shifts one 32-bit word into the FPGA, most significant bit first, with
+    cs_b low for the word and high afterwards, as SPI2 does with MSSEN set,
+    and samples sdo on each rising SCK edge as SPI2 does.
+
+  Precondition:
+    None
+
+  Parameters:
+    unsigned int word   - Word to send
+    unsigned int drop   - SCK edge (1 to 32) to leave out, 0 for none
+
+  Returns:
+    The word shifted out of the FPGA.
+
+  Remarks:
+    The SPI clock is unrelated to the pixel clock, so the word is sent
+    between two pixel clocks.
+  ***************************************************************************/
+static unsigned int _SimSpiWord( unsigned int word, unsigned int drop )
+{
+    int             bit;
+    unsigned int    received = 0;
+
+    vga->cs_b = 0;
+    vga->eval();
+    for (bit = 31; bit >= 0; bit--)
+    {
+        vga->sdi = (word >> bit) & 1;
+        vga->sck = 0;
+        vga->eval();
+        if ((unsigned int)(32 - bit) != drop)
+        {
+            received = (received << 1) | (vga->sdo & 1);
+            vga->sck = 1;
+            vga->eval();
+        }
+    }
+    vga->sck  = 0;
+    vga->cs_b = 1;
+    vga->eval();
+
+    return received;
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimSendFrame( unsigned int sof, unsigned int word0,
+                               unsigned int word1, unsigned int drop )
+
+  Description:
+    Builds a frame the same way as _SPILinkSendFrame() in spi_link.c and
+    sends it.
+
+  Precondition:
+    None
+
+  Parameters:
+    unsigned int sof    - Start of frame marker
+    unsigned int word0  - Bits 15:0 of word 0
+    unsigned int word1  - Bits 31:8 of word 1
+    unsigned int drop   - SCK edge (1 to 64) to leave out, 0 for none
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+static void _SimSendFrame( unsigned int sof, unsigned int word0, unsigned int word1, unsigned int drop )
+{
+    unsigned int    word[2];
+    unsigned char   crc;
+    int             i;
+    int             bit;
+
+    word[0] = (sof << 24) | ((simSequence++ & 0xFF) << 16) | (word0 & 0xFFFF);
+    word[1] = word1 & 0xFFFFFF00;
+
+    crc = 0;
+    for (i = 0; i < 7; i++)
+    {
+        crc ^= (unsigned char)(word[i / 4] >> (24 - 8 * (i % 4)));
+        for (bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? ((crc << 1) ^ VGA_SIM_CRC_POLYNOMIAL) : (crc << 1);
+        }
+    }
+    word[1] |= crc;
+
+    (void)_SimSpiWord( word[0], (drop <= 32) ? drop : 0 );
+    (void)_SimSpiWord( word[1], (drop > 32) ? drop - 32 : 0 );
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimSendTraceLine( const VGA_SIM_CURSOR *line )
+
+  Description:
+    Sends the cursor frame, tile write frames or sprite frame for one line
+    of the trace.
+
+  Precondition:
+    None
+
+  Parameters:
+    const VGA_SIM_CURSOR *line  - Trace line
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+static void _SimSendTraceLine( const VGA_SIM_CURSOR *line )
+{
+    unsigned int    i;
+
+    if (line->sprite)
+    {
+        _SimSendFrame( VGA_SIM_SOF_SPRITE, ((line->index & 0x0F) << 12) | (line->enable ? 0x0800 : 0) |
+                       ((line->pattern & 0x07) << 8) | ((line->color & 0x0F) << 4),
+                       ((line->x & 0x7FF) << 21) | ((line->y & 0x7FF) << 10), 0 );
+        return;
+    }
+    if (!line->text[0])
+    {
+        _SimSendFrame( VGA_SIM_SOF_CURSOR, ((line->buttons & 0xFF) << 8) | (line->wheel & 0xFF),
+                       ((line->x & 0x7FF) << 21) | ((line->y & 0x7FF) << 10), line->drop );
+        return;
+    }
+
+    for (i = 0; line->text[i]; i++)
+    {
+        _SimSendFrame( VGA_SIM_SOF_TILE, ((line->y & 0x7F) << 8) | ((line->x + i) & 0xFF),
+                       ((line->buttons & 0x0F) << 24) | ((unsigned char)line->text[i] << 16), 0 );
+    }
+}
+
+
+/****************************************************************************
+  Function:
+    static void _SimWriteFrame( const char *prefix, unsigned int frame )
+
+  Description:
+    Writes the captured frame as a binary PPM.
+
+  Precondition:
+    None
+
+  Parameters:
+    const char *prefix  - Start of the file name
+    unsigned int frame  - Frame number
+
+  Returns:
+    None
+
+  Remarks:
+    None
+  ***************************************************************************/
+static void _SimWriteFrame( const char *prefix, unsigned int frame )
+{
+    FILE            *file;
+    char            name[512];
+    unsigned int    row;
+
+    snprintf( name, sizeof(name), "%s%04u.ppm", prefix, frame );
+    if ((file = fopen( name, "wb" )) == NULL)
+    {
+        fprintf( stderr, "vga_sim: cannot write %s\n", name );
+        return;
+    }
+    fprintf( file, "P6\n%u %u\n255\n", simWidth, simHeight );
+    for (row = 0; row < simHeight; row++)
+    {
+        fwrite( simFrame[row], 3, simWidth, file );
+    }
+    fclose( file );
+}
+
+
+// *****************************************************************************
+// *****************************************************************************
+// Section: Main
+// *****************************************************************************
+// *****************************************************************************
+
+int main( int argc, char **argv )
+{
+    const char      *traceName  = (argc > 1) ? argv[1] : "Sim/cursor.trace";
+    unsigned int    frames      = (argc > 2) ? (unsigned int)atoi( argv[2] ) : 4;
+    const char      *prefix     = (argc > 3) ? argv[3] : NULL;
+    unsigned int    frame       = 0;
+    unsigned int    nextCursor  = 0;
+    unsigned long   pixelClocks = 0;
+    unsigned long   framePixels = 0;
+    bool            started     = false;
+    unsigned int    status;
+    unsigned int    previous;
+    unsigned int    tries;
+    unsigned int    mode;
+    double          seconds;
+
+    Verilated::commandArgs( argc, argv );
+    _SimLoadTrace( traceName );
+
+    vga         = new Vvga_sim_top;
+    vga->vgaclk = 0;
+    vga->sck    = 0;
+    vga->sdi    = 0;
+    vga->cs_b   = 1;
+    vga->eval();
+
+    // Ask for the resolution the same way _SPILinkReadScreen() does: the
+    // words sent are not the start of a frame, so the receiver ignores
+    // them, and the mode is taken once two status words in a row agree.
+    // The first word after power up can be 0, as the status is only loaded
+    // when cs_b goes high.
+    previous    = 0;
+    for (tries = 0; tries < VGA_SIM_STATUS_TRIES; tries++)
+    {
+        status = _SimSpiWord( 0, 0 );
+        if (((status >> 24) == VGA_SIM_STATUS_MARKER) && (status == previous))
+        {
+            break;
+        }
+        previous = status;
+    }
+    mode        = (status >> 22) & 0x03;
+    simWidth    = (status >> 11) & 0x7FF;
+    simHeight   = status & 0x7FF;
+    if ((tries == VGA_SIM_STATUS_TRIES) || (simWidth > VGA_SIM_MAX_WIDTH) ||
+        (simHeight > VGA_SIM_MAX_HEIGHT))
+    {
+        fprintf( stderr, "vga_sim: bad status word %08X\n", status );
+        return 1;
+    }
+    printf( "mode %u: %u x %u\n", mode, simWidth, simHeight );
+
+    auto start = std::chrono::steady_clock::now();
+
+    while (frame < frames)
+    {
+        vga->vgaclk = 1;
+        vga->eval();
+        vga->vgaclk = 0;
+        vga->eval();
+        pixelClocks++;
+
+        if ((vga->x >= simWidth) || (vga->y >= simHeight))
+        {
+            continue;
+        }
+        if (started)
+        {
+            simFrame[vga->y][vga->x][0] = vga->r;
+            simFrame[vga->y][vga->x][1] = vga->g;
+            simFrame[vga->y][vga->x][2] = vga->b;
+            framePixels++;
+        }
+
+        // A frame ends with its last visible pixel; the cursor for the
+        // next one is sent then, in the vertical blanking.
+        if ((vga->x == simWidth - 1) && (vga->y == simHeight - 1))
+        {
+            if (started)
+            {
+                if (framePixels != simWidth * simHeight)
+                {
+                    printf( "frame %u: %lu active pixels, expected %u\n", frame, framePixels,
+                            simWidth * simHeight );
+                }
+                if (prefix)
+                {
+                    _SimWriteFrame( prefix, frame );
+                }
+                frame++;
+            }
+            started     = true;
+            framePixels = 0;
+
+            while ((nextCursor < simTraceLength) && (simTrace[nextCursor].frame <= frame))
+            {
+                _SimSendTraceLine( &simTrace[nextCursor++] );
+            }
+        }
+    }
+
+    seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+    printf( "%u frames, %lu pixel clocks in %.3f s\n", frames, pixelClocks, seconds );
+    printf( "%.2f frames/s (%.4fx real time at %.2f Hz)\n", frames / seconds,
+            frames / seconds / simRefreshHz[mode], simRefreshHz[mode] );
+
+    vga->final();
+    delete vga;
+
+    return 0;
+}
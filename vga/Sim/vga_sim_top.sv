@@ -0,0 +1,43 @@
+// vga_sim_top.sv
+// Simulation top level for the Verilator harness in vga_sim.cpp.
+// Wraps vga, with the pixel clock coming straight from the harness through
+// the stand-in PLL below, and brings the beam position out so frames can be
+// captured pixel for pixel.  x and y are delayed to line up with r, g and b,
+// which come out VIDEO_LATENCY + 1 clocks after the controller's x and y.
+
+module vga_sim_top #(parameter MODE = 0)  // video mode, as for vga
+                   (input  logic        vgaclk, sdi, sck, cs_b,
+                    output tri          sdo,
+                    output logic        hsync, vsync, sync_b,
+                    output logic [10:0] x, y,
+                    output logic [7:0]  r, g, b);
+
+  localparam VIDEO_LATENCY = 3;  // must match vga
+
+  logic        pixelClock;
+  logic [10:0] xDelay[VIDEO_LATENCY:0], yDelay[VIDEO_LATENCY:0];
+
+  vga #(.MODE(MODE)) dut(vgaclk, sdi, sck, cs_b, pixelClock, sdo, hsync, vsync, sync_b, r, g, b);
+
+  always_ff @(posedge vgaclk) begin
+    xDelay[0] <= dut.x;
+    yDelay[0] <= dut.y;
+    for (int i = 1; i <= VIDEO_LATENCY; i++) begin
+      xDelay[i] <= xDelay[i-1];
+      yDelay[i] <= yDelay[i-1];
+    end
+  end
+
+  assign x = xDelay[VIDEO_LATENCY];
+  assign y = yDelay[VIDEO_LATENCY];
+endmodule
+
+// Stand-in for the altpll megafunction in pll.v: the pixel clock is the
+// harness's clock whatever the mode.
+module pll #(parameter MULTIPLY_BY = 1, DIVIDE_BY = 1)
+            (input  logic areset, inclk0,
+             output logic c0, locked);
+
+  assign c0     = inclk0;
+  assign locked = 1'b1;
+endmodule
@@ -42,6 +42,12 @@ module pll (
 	c0,
 	locked);
 
+	// Pixel clock = 40 MHz * MULTIPLY_BY / DIVIDE_BY, set by vga for its
+	// video mode.  These two parameters were added by hand; put them back
+	// if the file is regenerated.
+	parameter MULTIPLY_BY = 1007;
+	parameter DIVIDE_BY   = 1600;
+
 	input	  areset;
 	input	  inclk0;
 	output	  c0;
@@ -103,9 +109,9 @@ module pll (
 				.vcounderrange ());
 	defparam
 		altpll_component.bandwidth_type = "AUTO",
-		altpll_component.clk0_divide_by = 1600,
+		altpll_component.clk0_divide_by = DIVIDE_BY,
 		altpll_component.clk0_duty_cycle = 50,
-		altpll_component.clk0_multiply_by = 1007,
+		altpll_component.clk0_multiply_by = MULTIPLY_BY,
 		altpll_component.clk0_phase_shift = "0",
 		altpll_component.compensate_clock = "CLK0",
 		altpll_component.inclk0_input_frequency = 25000,
@@ -37,6 +37,9 @@ module pll (
 	c0,
 	locked);
 
+	parameter MULTIPLY_BY = 1007;
+	parameter DIVIDE_BY   = 1600;
+
 	input	  areset;
 	input	  inclk0;
 	output	  c0;
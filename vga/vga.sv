@@ -2,105 +2,178 @@
 // 20 October 2011 Karl_Wang & David_Harris@hmc.edu
 // VGA driver with character generator
 
-module vga(input  logic       clk, sdi, sck,
-			  output logic       vgaclk,						// 25 MHz VGA clock
+// MODE picks the video mode at build time, from the table below; the PIC
+// reads the resolution back over SPI (see spiStatusSend).
+module vga #(parameter MODE = 0)  // 0: 640x480, 1: 800x600, 2: 1024x768, 3: 1280x720
+           (input  logic       clk, sdi, sck, cs_b,
+			  output logic       vgaclk,						// pixel clock
+			  output tri         sdo,							// status back to the PIC
 			  output logic       hsync, vsync, sync_b,	// to monitor & DAC
 			  output logic [7:0] r, g, b);					// to video DAC
  
-  logic [9:0] x, y;
-  logic [7:0] r_int, g_int, b_int;
+  // Mode table, all at 60 Hz (VESA DMT and CEA-861 timings).  The pixel
+  // clock is made from the 40 MHz clk by the PLL:
+  //
+  //   mode  resolution  pixel clock          horizontal    vertical     sync
+  //                                          front/sync/back             polarity
+  //   0     640 x 480   25.175 (1007/1600)   16/96/48      10/2/33      -/-
+  //   1     800 x 600   40.000 (1/1)         40/128/88     1/4/23       +/+
+  //   2     1024 x 768  65.000 (13/8)        24/136/160    3/6/29       -/-
+  //   3     1280 x 720  74.286 (13/7)        110/40/220    5/5/20       +/+
+  //
+  // 1280 x 720 wants 74.25 MHz; 13/7 is the nearest ratio the PLL makes
+  // with a legal VCO, 0.05% fast, which monitors accept.
+  localparam PLL_MULTIPLY  = (MODE == 1) ? 1 : (MODE == 2) ? 13 : (MODE == 3) ? 13 : 1007;
+  localparam PLL_DIVIDE    = (MODE == 1) ? 1 : (MODE == 2) ? 8  : (MODE == 3) ? 7  : 1600;
+  localparam WIDTH         = (MODE == 1) ? 800  : (MODE == 2) ? 1024 : (MODE == 3) ? 1280 : 640;
+  localparam HFRONT        = (MODE == 1) ? 40   : (MODE == 2) ? 24   : (MODE == 3) ? 110  : 16;
+  localparam HSYNC         = (MODE == 1) ? 128  : (MODE == 2) ? 136  : (MODE == 3) ? 40   : 96;
+  localparam HBACK         = (MODE == 1) ? 88   : (MODE == 2) ? 160  : (MODE == 3) ? 220  : 48;
+  localparam HEIGHT        = (MODE == 1) ? 600  : (MODE == 2) ? 768  : (MODE == 3) ? 720  : 480;
+  localparam VFRONT        = (MODE == 1) ? 1    : (MODE == 2) ? 3    : (MODE == 3) ? 5    : 10;
+  localparam VSYNC         = (MODE == 1) ? 4    : (MODE == 2) ? 6    : (MODE == 3) ? 5    : 2;
+  localparam VBACK         = (MODE == 1) ? 23   : (MODE == 2) ? 29   : (MODE == 3) ? 20   : 33;
+  localparam SYNC_POSITIVE = (MODE == 1) | (MODE == 3);
+
+  localparam VIDEO_LATENCY = 3;  // clocks from x and y to r_int, g_int and b_int
+
+  logic [10:0] x, y;
+  logic [7:0]  r_int, g_int, b_int;
 	
-  // Use a PLL to create the 25.175 MHz VGA pixel clock 
-  // 25.175 Mhz clk period = 39.772 ns
-  // Screen is 800 clocks wide by 525 tall, but only 640 x 480 used for display
-  // HSync = 1/(39.772 ns * 800) = 31.470 KHz
-  // Vsync = 31.474 KHz / 525 = 59.94 Hz (~60 Hz refresh rate)
-  pll	vgapll(.inclk0(clk),	.c0(vgaclk)); 
-  
-  pll	pll_inst (
-	.areset ( areset_sig ),
-	.inclk0 ( inclk0_sig ),
-	.c0 ( c0_sig ),
-	.locked ( locked_sig )
-  );
-
-  // generate monitor timing signals
-  vgaController vgaCont(vgaclk, hsync, vsync, sync_b,  
+  pll	#(.MULTIPLY_BY(PLL_MULTIPLY), .DIVIDE_BY(PLL_DIVIDE))
+      vgapll(.inclk0(clk),	.c0(vgaclk)); 
+
+  // generate monitor timing signals; x and y run LATENCY clocks ahead of
+  // the beam so that videoGen's pipelined pixel lands on the right spot
+  vgaController #(.WIDTH(WIDTH), .HFRONT(HFRONT), .HSYNC(HSYNC), .HBACK(HBACK),
+                  .HEIGHT(HEIGHT), .VFRONT(VFRONT), .VSYNC(VSYNC), .VBACK(VBACK),
+                  .SYNC_POSITIVE(SYNC_POSITIVE), .LATENCY(VIDEO_LATENCY))
+                vgaCont(vgaclk, hsync, vsync, sync_b,
                         r_int, g_int, b_int, r, g, b, x, y);
 	
   // user-defined module to determine pixel color
-  videoGen videoGen(x, y, sdi, sck, r_int, g_int, b_int);
+  videoGen #(.MODE(MODE), .WIDTH(WIDTH), .HEIGHT(HEIGHT))
+           videoGen(vgaclk, x, y, sdi, sck, cs_b, sdo, r_int, g_int, b_int);
 endmodule
 
-module vgaController #(parameter HMAX   = 10'd800,
-                                 VMAX   = 10'd525, 
-											HSTART = 10'd152,
-											WIDTH  = 10'd640,
-											VSTART = 10'd37,
-											HEIGHT = 10'd480)
-						  (input  logic       vgaclk, 
-                     output logic       hsync, vsync, sync_b,
-							input  logic [7:0] r_int, g_int, b_int,
-							output logic [7:0] r, g, b,
-							output logic [9:0] x, y);
-
-  logic [9:0] hcnt, vcnt;
-  logic       oldhsync;
-  logic       valid;
+// Counts out the frame and drives the monitor.  Each line starts with the
+// sync pulse, then the back porch, the WIDTH visible pixels and the front
+// porch, and the frame the same way in lines.  The counters, syncs and
+// pixel outputs are all registered.  x and y are LATENCY pixels ahead of
+// the pixel being sent, so a video generator that takes LATENCY clocks from
+// x and y to r_int, g_int and b_int lines up with the syncs.  LATENCY must
+// be less than HSYNC + HBACK so that y has moved to the next row before its
+// first pixel is fetched.
+module vgaController #(parameter WIDTH         = 640,
+                                 HFRONT        = 16,
+                                 HSYNC         = 96,
+                                 HBACK         = 48,
+                                 HEIGHT        = 480,
+                                 VFRONT        = 10,
+                                 VSYNC         = 2,
+                                 VBACK         = 33,
+                                 SYNC_POSITIVE = 0,   // 1 if the syncs are active high
+                                 LATENCY       = 0)
+						  (input  logic        vgaclk, 
+                     output logic        hsync, vsync, sync_b,
+							input  logic [7:0]  r_int, g_int, b_int,
+							output logic [7:0]  r, g, b,
+							output logic [10:0] x, y);
+
+  localparam HSTART = HSYNC + HBACK;
+  localparam HTOTAL = HSTART + WIDTH + HFRONT;
+  localparam VSTART = VSYNC + VBACK;
+  localparam VTOTAL = VSTART + HEIGHT + VFRONT;
+
+  logic [10:0] hcnt, vcnt;
+  logic        hsyncNow, vsyncNow, valid;
   
-  // counters for horizontal and vertical positions
-  always @(posedge vgaclk) begin
-    if (hcnt >= HMAX) hcnt = 0;
-    else hcnt++;
-	 if (hsync & ~oldhsync) begin // start of hsync; advance to next row
-	   if (vcnt >= VMAX) vcnt = 0;
-      else vcnt++;
+  // counters for horizontal and vertical positions; the row advances at
+  // the end of each line
+  always_ff @(posedge vgaclk)
+    if (hcnt == HTOTAL - 1) begin
+      hcnt <= 11'd0;
+      vcnt <= (vcnt == VTOTAL - 1) ? 11'd0 : vcnt + 11'd1;
     end
-    oldhsync = hsync;
-  end
+    else hcnt <= hcnt + 11'd1;
   
-  // compute sync signals (active low)
-  assign hsync = ~(hcnt >= 10'd8 & hcnt < 10'd104); // horizontal sync
-  assign vsync = ~(vcnt >= 2 & vcnt < 4); // vertical sync
-  assign sync_b = hsync | vsync;
+  // sync pulses for the current count
+  assign hsyncNow = (hcnt < HSYNC);
+  assign vsyncNow = (vcnt < VSYNC);
 
-  // determine x and y positions
-  assign x = hcnt - HSTART;
+  // determine x and y positions of the pixel to fetch
+  assign x = hcnt + LATENCY - HSTART;
   assign y = vcnt - VSTART;
   
   // force outputs to black when outside the legal display area
   assign valid = (hcnt >= HSTART & hcnt < HSTART+WIDTH &
                   vcnt >= VSTART & vcnt < VSTART+HEIGHT);
-  assign {r,g,b} = valid ? {r_int,g_int,b_int} : 24'b0;
+
+  // sync_b to the DAC stays active low whatever the monitor's polarity
+  always_ff @(posedge vgaclk) begin
+    hsync   <= SYNC_POSITIVE ? hsyncNow : ~hsyncNow;
+    vsync   <= SYNC_POSITIVE ? vsyncNow : ~vsyncNow;
+    sync_b  <= ~(hsyncNow & vsyncNow);
+    {r,g,b} <= valid ? {r_int,g_int,b_int} : 24'b0;
+  end
 endmodule
 
-module videoGen(input  logic [9:0] x, y,
-					 input  logic sdi, sck,
+// Pixel pipeline: x and y go in on stage 0, the text, sprite and keyboard
+// layers each come out on stage 2, and the layer on top is registered into
+// r_int, g_int and b_int, three clocks after x and y (VIDEO_LATENCY in vga).
+// The keyboard gets as many keys as fit across the screen.
+module videoGen #(parameter MODE   = 0,
+                            WIDTH  = 640,
+                            HEIGHT = 480)
+					(input  logic vgaclk,
+					 input  logic [10:0] x, y,
+					 input  logic sdi, sck, cs_b,
+					 output tri   sdo,
            		 output logic [7:0] r_int, g_int, b_int);
 	
+  localparam WHITE_KEYS = (WIDTH - 2 * 20) / 27; // keyLookup's LEFT margin on both sides, PITCH per key
+
   logic whiteKey, blackKey, whitePressedKey, blackPressedKey;
-  logic inCursorRect, pixel;
 
-  logic [9:0] xPos, yPos; //For tracking mouse
+  logic [10:0] xPos, yPos; //For tracking mouse
+  logic [7:0] buttons, wheel, seq; //Rest of the cursor frame (bit 0 of buttons is the left button)
   
-  logic [31:0] out; //Stores feedback from the SPI connection
+  logic        tileWrite; //Text screen writes from the PIC
+  logic [14:0] tileAddress;
+  logic [11:0] tileData;
+  logic        textPixel;
+  logic [23:0] textColor;
   
-  assign xPos = out[25:16]; //Because x was sent first
-  assign yPos = out[9:0]; //Because y was sent second  
+  logic        spriteWrite; //Sprite attribute writes from the PIC
+  logic [3:0]  spriteIndex;
+  logic [29:0] spriteAttributes;
+  logic        spritePixel;
+  logic [23:0] spriteColor;
  
-  spi_slave_receive_only mySPI(sck, sdi, out);
+  spi_frame_receive mySPI(sck, sdi, cs_b, xPos, yPos, buttons, wheel, seq, tileWrite, tileAddress, tileData,
+                          spriteWrite, spriteIndex, spriteAttributes);
+  spiStatusSend #(.MODE(MODE), .WIDTH(WIDTH), .HEIGHT(HEIGHT)) myStatus(sck, cs_b, sdo);
+  
+  textLayer #(.COLUMNS(WIDTH / 8), .ROWS(HEIGHT / 8))
+            myText(vgaclk, x, y, sck, tileWrite, tileAddress, tileData, textPixel, textColor);
   
-  rectGen cursorRect(x, y, xPos, yPos, xPos + 10'd12, yPos + 10'd8, inCursorRect);
-  chargenrom2 myCursor(x-xPos, y-yPos, inCursorRect, pixel); 
+  //Sprite 0 is the mouse cursor
+  spriteEngine #(.WIDTH(WIDTH))
+               mySprites(vgaclk, x, y, xPos, yPos, sck, spriteWrite, spriteIndex, spriteAttributes,
+                         spritePixel, spriteColor);
 
-  keyboard myBoard(x, y, xPos, yPos, whiteKey, blackKey, whitePressedKey, blackPressedKey);
+  keyboard #(.WHITE_KEYS(WHITE_KEYS), .SCREEN_HEIGHT(HEIGHT))
+           myBoard(vgaclk, x, y, xPos, yPos, whiteKey, blackKey, whitePressedKey, blackPressedKey);
   
-  always_comb begin
-		if(inCursorRect & pixel) begin
-			{r_int, g_int, b_int} = {{8{1'b0}}, {8{pixel}}, {8{1'b0}}};
+  always_ff @(posedge vgaclk) begin
+		if(spritePixel) begin
+			{r_int, g_int, b_int} <= spriteColor;
+		end
+		else if(textPixel) begin
+			{r_int, g_int, b_int} <= textColor;
 		end
 		else begin
-			{r_int, g_int, b_int} = {{8{(whiteKey  & ~blackKey) | blackPressedKey}}, {8{~blackKey & ~whitePressedKey}}, {8{~blackKey & ~whitePressedKey}}};
+			{r_int, g_int, b_int} <= {{8{(whiteKey  & ~blackKey) | blackPressedKey}}, {8{~blackKey & ~whitePressedKey}}, {8{~blackKey & ~whitePressedKey}}};
 		end
   end
   
@@ -126,94 +199,276 @@ module videoGen(input  logic [9:0] x, y,
   end*/
 endmodule
 
-module keyboard(input logic [9:0] x, y, xMouse, yMouse,
+// COLUMNS x ROWS text screen of 8 x 8 tiles in block RAM, drawn over the
+// keyboard.  Each tile is {color[3:0], character[7:0]}; the glyphs are the
+// 6 x 8 ones in charrom.txt, which has GLYPHS of them.  Characters from
+// GLYPHS up, 128 to 255 included, have no glyph and are transparent, as is
+// character 0.  Tiles are written from the SPI side on sck, and writes
+// outside the screen are dropped.  The tile and glyph reads are registered,
+// so the pixel for x and y comes out two clocks later.
+module textLayer #(parameter COLUMNS = 80,
+                             ROWS    = 60,
+                             GLYPHS  = 94)   // characters in charrom.txt
+                  (input  logic        vgaclk,
+                   input  logic [10:0] x, y,
+                   input  logic        wclk, we,
+                   input  logic [14:0] waddr,    // {row[6:0], column[7:0]}
+                   input  logic [11:0] wdata,
+                   output logic        pixel,
+                   output logic [23:0] color);
+
+  logic [11:0] tiles[COLUMNS*ROWS-1:0];  // row by row
+  logic [6:0]  wrow;
+  logic [7:0]  wcolumn;
+  logic [5:0]  glyphs[1023:0]; // 8 lines per character
+  logic [11:0] tile;
+  logic [5:0]  line;
+  logic [2:0]  xoff1, xoff2, yoff1;
+  logic [3:0]  color2;
+  logic        hasGlyph2;
+
+  initial
+    $readmemb("charrom.txt", glyphs);
+
+  assign {wrow, wcolumn} = waddr;
+
+  always_ff @(posedge wclk)
+    if (we & (wrow < ROWS) & (wcolumn < COLUMNS)) tiles[wrow * COLUMNS + wcolumn] <= wdata;
+
+  always_ff @(posedge vgaclk) begin
+    // stage 1: tile
+    tile      <= tiles[y[10:3] * COLUMNS + x[10:3]];
+    xoff1     <= x[2:0];
+    yoff1     <= y[2:0];
+    // stage 2: line of the glyph
+    line      <= glyphs[{tile[6:0], yoff1}];
+    xoff2     <= xoff1;
+    color2    <= tile[11:8];
+    hasGlyph2 <= (tile[7:0] < GLYPHS);
+  end
+
+  // glyphs are 6 pixels wide, most significant bit on the left
+  assign pixel = hasGlyph2 & (xoff2 < 3'd6) & line[3'd5 - xoff2];
+
+  palette textPalette(color2, color);
+endmodule
+
+// Sprite unit: up to SPRITES 16 x 16 single color sprites from the patterns
+// in sprites.txt.  Sprite 0 is the mouse cursor (pattern 0 at the cursor
+// position); the others are set over SPI.  While one line is displayed from
+// one line buffer, the next line is drawn into the other: each sprite's
+// attributes are read in turn, and if the sprite covers that line its row
+// of the pattern is written into the buffer, one pixel per clock and only
+// where the pattern is set.  Sprites are drawn from the last to sprite 0,
+// so lower numbered sprites are in front.  A sprite on the line takes 19
+// clocks and one off it 2, well inside the shortest (800 clock) line.  The displayed
+// buffer is read at x, with the pixel coming out two clocks later, and
+// cleared one pixel behind the read.
+module spriteEngine #(parameter SPRITES = 8,
+                                WIDTH   = 640)
+                     (input  logic        vgaclk,
+                      input  logic [10:0] x, y,
+                      input  logic [10:0] xCursor, yCursor,
+                      input  logic        wclk, we,
+                      input  logic [3:0]  windex,
+                      input  logic [29:0] wattributes,  // {enable, pattern[2:0], color[3:0], x[10:0], y[10:0]}
+                      output logic        pixel,
+                      output logic [23:0] color);
+
+  typedef enum logic [2:0] {IDLE, FETCH, EVALUATE, LOAD, DRAW} statetype;
+  statetype    state;
+
+  logic [29:0] attributes[15:0];
+  logic [15:0] patterns[127:0];
+  logic [4:0]  buffer0[2047:0], buffer1[2047:0]; // {opaque, color[3:0]} for lines with y[0] = 0 and 1
+
+  logic [29:0] attributeRead, attribute;
+  logic [15:0] patternLine, bits;
+  logic [3:0]  sprite, column, spriteColor, shownColor;
+  logic [10:0] xPrev, yPrev, drawY, drawX, row;
+  logic [11:0] drawAt;
+  logic [6:0]  patternAddress;
+  logic [4:0]  read0, read1, data0, data1;
+  logic [10:0] address0, address1;
+  logic        drawWrite, write0, write1, shownLine;
+
+  initial
+    $readmemb("sprites.txt", patterns);
+
+  // attributes come in on the SPI clock
+  always_ff @(posedge wclk)
+    if (we) attributes[windex] <= wattributes;
+
+  always_ff @(posedge vgaclk) begin
+    attributeRead <= attributes[sprite];
+    patternLine   <= patterns[patternAddress];
+  end
+
+  assign attribute      = (sprite == 4'd0) ? {1'b1, 3'd0, 4'hA, xCursor, yCursor} : attributeRead;
+  assign row            = drawY - attribute[10:0];
+  assign patternAddress = {attribute[28:26], row[3:0]};
+  assign drawAt         = {1'b0, drawX} + column;
+  assign drawWrite      = (state == DRAW) & bits[4'd15 - column] & (drawAt < WIDTH);
+
+  // draw the line after the one being displayed
+  always_ff @(posedge vgaclk) begin
+    yPrev <= y;
+    case (state)
+      IDLE:     if (y != yPrev) begin
+                  drawY  <= y + 11'd1;
+                  sprite <= SPRITES - 1;
+                  state  <= FETCH;
+                end
+      FETCH:    state <= EVALUATE;     // attributes are read on this edge
+      EVALUATE: if (attribute[29] & (row < 11'd16)) begin
+                  drawX       <= attribute[21:11];
+                  spriteColor <= attribute[25:22];
+                  state       <= LOAD; // pattern line is read on this edge
+                end else if (sprite == 4'd0) state <= IDLE;
+                else begin
+                  sprite <= sprite - 4'd1;
+                  state  <= FETCH;
+                end
+      LOAD:     begin
+                  bits   <= patternLine;
+                  column <= 4'd0;
+                  state  <= DRAW;
+                end
+      DRAW:     begin
+                  column <= column + 4'd1;
+                  if (column == 4'd15) begin
+                    if (sprite == 4'd0) state <= IDLE;
+                    else begin
+                      sprite <= sprite - 4'd1;
+                      state  <= FETCH;
+                    end
+                  end
+                end
+    endcase
+  end
+
+  // each buffer is drawn into while it holds the next line, and cleared
+  // behind the beam while it is displayed
+  assign write0   = y[0] ? drawWrite : (xPrev < WIDTH);
+  assign address0 = y[0] ? drawAt[10:0] : xPrev;
+  assign data0    = y[0] ? {1'b1, spriteColor} : 5'b0;
+  assign write1   = y[0] ? (xPrev < WIDTH) : drawWrite;
+  assign address1 = y[0] ? xPrev : drawAt[10:0];
+  assign data1    = y[0] ? 5'b0 : {1'b1, spriteColor};
+
+  always_ff @(posedge vgaclk) begin
+    if (write0) buffer0[address0] <= data0;
+    if (write1) buffer1[address1] <= data1;
+    xPrev <= x;
+    read0 <= buffer0[x];
+    read1 <= buffer1[x];
+    shownLine <= y[0];
+    {pixel, shownColor} <= shownLine ? read1 : read0;
+  end
+
+  palette spritePalette(shownColor, color);
+endmodule
+
+// 16 color palette shared by the text and sprite layers
+module palette(input  logic [3:0]  index,
+               output logic [23:0] color);
+
+  always_comb
+    case (index)
+      4'h0: color = 24'h000000;  4'h1: color = 24'h0000AA;
+      4'h2: color = 24'h00AA00;  4'h3: color = 24'h00AAAA;
+      4'h4: color = 24'hAA0000;  4'h5: color = 24'hAA00AA;
+      4'h6: color = 24'hAA5500;  4'h7: color = 24'hAAAAAA;
+      4'h8: color = 24'h555555;  4'h9: color = 24'h5555FF;
+      4'hA: color = 24'h55FF55;  4'hB: color = 24'h55FFFF;
+      4'hC: color = 24'hFF5555;  4'hD: color = 24'hFF55FF;
+      4'hE: color = 24'hFFFF55;  default: color = 24'hFFFFFF;
+    endcase
+endmodule
+
+// Piano keyboard starting at middle C.  The keys under the beam are looked up
+// every pixel and come out two clocks after x and y; the keys under the mouse
+// only change once per frame, so they are looked up during vertical blanking
+// and held.
+module keyboard #(parameter WHITE_KEYS    = 22,
+                            SCREEN_HEIGHT = 480)
+					(input logic vgaclk,
+					input logic [10:0] x, y, xMouse, yMouse,
 					output logic isWhite, isBlack, whiteIsRed, blackIsRed);
 	
-	logic [9:0]startX, startXB, startY, width, widthB, nextW, height, heightB;
-	logic latentBlack; // Says that a black key is pressed somewhere (not necessarily at (x,y))
+	logic [6:0] whiteKey, blackKey, mouseWhiteKey, mouseBlackKey, nextMouseWhiteKey, nextMouseBlackKey;
+	logic mouseWhite, mouseBlack, nextMouseWhite, nextMouseBlack;
 	
-	assign startX = 10'd20;	
-	assign startY = 10'd175;
-	assign width = 10'd25;
-	assign nextW = 10'd27;
-	assign height = 10'd150;
+	keyLookup #(.WHITE_KEYS(WHITE_KEYS)) beamKey(vgaclk, x, y, isWhite, isBlack, whiteKey, blackKey);
+	keyLookup #(.WHITE_KEYS(WHITE_KEYS)) mouseKey(vgaclk, xMouse, yMouse, nextMouseWhite, nextMouseBlack, nextMouseWhiteKey, nextMouseBlackKey);
 	
-	assign startXB = 10'd38;
-	assign widthB = 10'd16;
-	assign heightB = 10'd70;
-	
-	logic inMiddleC, inMiddleD, inMiddleE, inMiddleF, inMiddleG, inNextA, inNextB, inNextC, inNextD, inNextE, inNextF, inNextG;
-	logic inThirdA, inThirdB, inThirdC, inThirdD, inThirdE, inThirdF, inThirdG, inLastA, inLastB, inLastC;
-	logic tinMiddleC, tinMiddleD, tinMiddleE, tinMiddleF, tinMiddleG, tinNextA, tinNextB, tinNextC, tinNextD, tinNextE, tinNextF, tinNextG;
-	logic tinThirdA, tinThirdB, tinThirdC, tinThirdD, tinThirdE, tinThirdF, tinThirdG, tinLastA, tinLastB, tinLastC;
-	logic isMiddleC, isMiddleD, isMiddleE, isMiddleF, isMiddleG, isNextA, isNextB, isNextC, isNextD, isNextE, isNextF, isNextG;
-	logic isThirdA, isThirdB, isThirdC, isThirdD, isThirdE, isThirdF, isThirdG, isLastA, isLastB, isLastC;
-	
-	logic inMiddleCS, inMiddleDS, inMiddleFS, inMiddleGS, inNextAS, inNextCS, inNextDS, inNextFS, inNextGS;
-	logic inThirdAS, inThirdCS, inThirdDS, inThirdFS, inThirdGS, inLastAS, inLastCS;
-	logic tinMiddleCS, tinMiddleDS, tinMiddleFS, tinMiddleGS, tinNextAS, tinNextCS, tinNextDS, tinNextFS, tinNextGS;
-	logic tinThirdAS, tinThirdCS, tinThirdDS, tinThirdFS, tinThirdGS, tinLastAS, tinLastCS;
-	logic isMiddleCS, isMiddleDS, isMiddleFS, isMiddleGS, isNextAS, isNextCS, isNextDS, isNextFS, isNextGS;
-	logic isThirdAS, isThirdCS, isThirdDS, isThirdFS, isThirdGS, isLastAS, isLastCS;
-	
-	//Create all 22 white keys
-	rectGenPlus middleC(x, y, xMouse, yMouse, 	startX ,						startY, startX + width, 					startY + height, inMiddleC, tinMiddleC, isMiddleC);
-	rectGenPlus middleD(x, y, xMouse, yMouse, 	startX + 10'd1*nextW, 	startY, startX + 10'd1*nextW + width, 	startY + 10'd1*height, inMiddleD, tinMiddleD, isMiddleD);
-	rectGenPlus middleE(x, y, xMouse, yMouse,  startX + 10'd2*nextW, 	startY, startX + 10'd2*nextW + width, 	startY + 10'd1*height, inMiddleE, tinMiddleE, isMiddleE);
-	rectGenPlus middleF(x, y, xMouse, yMouse,  startX + 10'd3*nextW, 	startY, startX + 10'd3*nextW + width, 	startY + 10'd1*height, inMiddleF, tinMiddleF, isMiddleF);
-	rectGenPlus middleG(x, y, xMouse, yMouse,  startX + 10'd4*nextW, 	startY, startX + 10'd4*nextW + width, 	startY + 10'd1*height, inMiddleG, tinMiddleG, isMiddleG);
-	rectGenPlus nextA(x, y, xMouse, yMouse,  	startX + 10'd5*nextW, 	startY, startX + 10'd5*nextW + width, 	startY + 10'd1*height, inNextA, tinNextA, isNextA);
-	rectGenPlus nextB(x, y, xMouse, yMouse,  	startX + 10'd6*nextW, 	startY, startX + 10'd6*nextW + width, 	startY + 10'd1*height, inNextB, tinNextB, isNextB);
-	rectGenPlus nextC(x, y, xMouse, yMouse,  	startX + 10'd7*nextW, 	startY, startX + 10'd7*nextW + width, 	startY + 10'd1*height, inNextC, tinNextC, isNextC);
-	rectGenPlus nextD(x, y, xMouse, yMouse,  	startX + 10'd8*nextW, 	startY, startX + 10'd8*nextW + width, 	startY + 10'd1*height, inNextD, tinNextD, isNextD);
-	rectGenPlus nextE(x, y, xMouse, yMouse,  	startX + 10'd9*nextW, 	startY, startX + 10'd9*nextW + width, 	startY + 10'd1*height, inNextE, tinNextE, isNextE);
-	rectGenPlus nextF(x, y, xMouse, yMouse,  	startX + 10'd10*nextW, 	startY, startX + 10'd10*nextW + width, startY + 10'd1*height, inNextF, tinNextF, isNextF);
-	rectGenPlus nextG(x, y, xMouse, yMouse,  	startX + 10'd11*nextW, 	startY, startX + 10'd11*nextW + width, startY + 10'd1*height, inNextG, tinNextG, isNextG);
-	rectGenPlus thirdA(x, y, xMouse, yMouse,  	startX + 10'd12*nextW,	startY, startX + 10'd12*nextW + width, startY + 10'd1*height, inThirdA, tinThirdA, isThirdA);
-	rectGenPlus thirdB(x, y, xMouse, yMouse,  	startX + 10'd13*nextW, 	startY, startX + 10'd13*nextW + width, startY + 10'd1*height, inThirdB, tinThirdB, isThirdB);
-	rectGenPlus thirdC(x, y, xMouse, yMouse,  	startX + 10'd14*nextW, 	startY, startX + 10'd14*nextW + width, startY + 10'd1*height, inThirdC, tinThirdC, isThirdC);
-	rectGenPlus thirdD(x, y, xMouse, yMouse,  	startX + 10'd15*nextW, 	startY, startX + 10'd15*nextW + width, startY + 10'd1*height, inThirdD, tinThirdD, isThirdD);
-	rectGenPlus thirdE(x, y, xMouse, yMouse,  	startX + 10'd16*nextW, 	startY, startX + 10'd16*nextW + width, startY + 10'd1*height, inThirdE, tinThirdE, isThirdE);
-	rectGenPlus thirdF(x, y, xMouse, yMouse,  	startX + 10'd17*nextW, 	startY, startX + 10'd17*nextW + width, startY + 10'd1*height, inThirdF, tinThirdF, isThirdF);
-	rectGenPlus thirdG(x, y, xMouse, yMouse,  	startX + 10'd18*nextW, 	startY, startX + 10'd18*nextW + width, startY + 10'd1*height, inThirdG, tinThirdG, isThirdG);
-	rectGenPlus lastA(x, y, xMouse, yMouse, 	startX + 10'd19*nextW, 	startY, startX + 10'd19*nextW + width, startY + 10'd1*height, inLastA, tinLastA, isLastA);
-	rectGenPlus lastB(x, y, xMouse, yMouse,  	startX + 10'd20*nextW, 	startY, startX + 10'd20*nextW + width, startY + 10'd1*height, inLastB, tinLastB, isLastB);
-	rectGenPlus lastC(x, y, xMouse, yMouse,  	startX + 10'd21*nextW, 	startY, startX + 10'd21*nextW + width, startY + 10'd1*height, inLastC, tinLastC, isLastC);
-
-	//Now 16 Black keys
-	rectGenPlus middleCS(x, y, xMouse, yMouse, 	startXB,						startY, startXB + widthB, 						startY + heightB, 		inMiddleCS, tinMiddleCS, isMiddleCS);
-	rectGenPlus middleDS(x, y, xMouse, yMouse, 	startXB + 10'd1*nextW, 	startY, startXB + 10'd1*nextW + widthB, 	startY + 10'd1*heightB, inMiddleDS, tinMiddleDS, isMiddleDS);
-	rectGenPlus middleFS(x, y, xMouse, yMouse,  	startXB + 10'd3*nextW, 	startY, startXB + 10'd3*nextW + widthB, 	startY + 10'd1*heightB, inMiddleFS, tinMiddleFS, isMiddleFS);
-	rectGenPlus middleGS(x, y, xMouse, yMouse,  	startXB + 10'd4*nextW, 	startY, startXB + 10'd4*nextW + widthB, 	startY + 10'd1*heightB, inMiddleGS, tinMiddleGS, isMiddleGS);
-	rectGenPlus nextAS(x, y, xMouse, yMouse,  		startXB + 10'd5*nextW, 	startY, startXB + 10'd5*nextW + widthB, 	startY + 10'd1*heightB, inNextAS, 	tinNextAS, isNextAS);
-	rectGenPlus nextCS(x, y, xMouse, yMouse,  		startXB + 10'd7*nextW, 	startY, startXB + 10'd7*nextW + widthB, 	startY + 10'd1*heightB, inNextCS, 	tinNextCS, isNextCS);
-	rectGenPlus nextDS(x, y, xMouse, yMouse,  		startXB + 10'd8*nextW, 	startY, startXB + 10'd8*nextW + widthB, 	startY + 10'd1*heightB, inNextDS, 	tinNextDS, isNextDS);
-	rectGenPlus nextFS(x, y, xMouse, yMouse,  		startXB + 10'd10*nextW, startY, startXB + 10'd10*nextW + widthB, 	startY + 10'd1*heightB, inNextFS, 	tinNextFS, isNextFS);
-	rectGenPlus nextGS(x, y, xMouse, yMouse,  		startXB + 10'd11*nextW, startY, startXB + 10'd11*nextW + widthB, 	startY + 10'd1*heightB, inNextGS, 	tinNextGS, isNextGS);
-	rectGenPlus thirdAS(x, y, xMouse, yMouse,  	startXB + 10'd12*nextW,	startY, startXB + 10'd12*nextW + widthB, 	startY + 10'd1*heightB, inThirdAS, 	tinThirdAS, isThirdAS);
-	rectGenPlus thirdCS(x, y, xMouse, yMouse,  	startXB + 10'd14*nextW, startY, startXB + 10'd14*nextW + widthB, 	startY + 10'd1*heightB, inThirdCS, 	tinThirdCS, isThirdCS);
-	rectGenPlus thirdDS(x, y, xMouse, yMouse,  	startXB + 10'd15*nextW, startY, startXB + 10'd15*nextW + widthB, 	startY + 10'd1*heightB, inThirdDS, 	tinThirdDS, isThirdDS);
-	rectGenPlus thirdFS(x, y, xMouse, yMouse,  	startXB + 10'd17*nextW, startY, startXB + 10'd17*nextW + widthB, 	startY + 10'd1*heightB, inThirdFS, 	tinThirdFS, isThirdFS);
-	rectGenPlus thirdGS(x, y, xMouse, yMouse,  	startXB + 10'd18*nextW, startY, startXB + 10'd18*nextW + widthB, 	startY + 10'd1*heightB, inThirdGS, 	tinThirdGS, isThirdGS);
-	rectGenPlus lastAS(x, y, xMouse, yMouse, 		startXB + 10'd19*nextW, startY, startXB + 10'd19*nextW + widthB, 	startY + 10'd1*heightB, inLastAS, 	tinLastAS, isLastAS);
-	rectGenPlus lastCS(x, y, xMouse, yMouse,  		startXB + 10'd21*nextW, startY, startXB + 10'd21*nextW + widthB, 	startY + 10'd1*heightB, inLastCS, 	tinLastCS, isLastCS);
-	
-	assign isWhite = inMiddleC | inMiddleD | inMiddleE | inMiddleF | inMiddleG | inNextA | inNextB | inNextC | inNextD | inNextE | inNextF | inNextG | inThirdA | inThirdB | inThirdC | inThirdD | inThirdE | inThirdF | inThirdG | inLastA | inLastB | inLastC;
-	assign isBlack = inMiddleCS | inMiddleDS | inMiddleFS | inMiddleGS | inNextAS | inNextCS | inNextDS | inNextFS | inNextGS | inThirdAS | inThirdCS | inThirdDS | inThirdFS | inThirdGS | inLastAS | inLastCS;
-	
-	assign latentBlack = tinMiddleCS | tinMiddleDS | tinMiddleFS | tinMiddleGS | tinNextAS | tinNextCS | tinNextDS | tinNextFS | tinNextGS | tinThirdAS | tinThirdCS | tinThirdDS | tinThirdFS | tinThirdGS | tinLastAS | tinLastCS;
+	always_ff @(posedge vgaclk)
+		if (y == SCREEN_HEIGHT) begin
+			{mouseWhite, mouseBlack} <= {nextMouseWhite, nextMouseBlack};
+			{mouseWhiteKey, mouseBlackKey} <= {nextMouseWhiteKey, nextMouseBlackKey};
+		end
 	
-	assign blackIsRed = isMiddleCS | isMiddleDS | isMiddleFS | isMiddleGS | isNextAS | isNextCS | isNextDS | isNextFS | isNextGS | isThirdAS | isThirdCS | isThirdDS | isThirdFS | isThirdGS | isLastAS | isLastCS;
-	assign whiteIsRed = ~latentBlack & (isMiddleC | isMiddleD | isMiddleE | isMiddleF | isMiddleG | isNextA | isNextB | isNextC | isNextD | isNextE | isNextF | isNextG | isThirdA | isThirdB | isThirdC | isThirdD | isThirdE | isThirdF | isThirdG | isLastA | isLastB | isLastC);
+	// A black key under the mouse wins over the white key it overlaps
+	assign blackIsRed = isBlack & mouseBlack & (blackKey == mouseBlackKey);
+	assign whiteIsRed = isWhite & mouseWhite & ~mouseBlack & (whiteKey == mouseWhiteKey);
 endmodule
-	
-module rectGenPlus(input logic[9:0] x, y, xtarget, ytarget, left, top, right, bot,
-				output logic inrect, targetInRect, withTarget);
-				
-	assign targetInRect = (xtarget >= left & xtarget < right & ytarget >= top & ytarget < bot);
-	assign inrect = (x >= left & x < right & y >= top & y < bot);
-	assign withTarget = targetInRect & inrect;
 
+// Finds the piano key under a point.  The white key index is the offset from
+// LEFT divided by PITCH, done as a multiply by the reciprocal, and BLACK_AFTER
+// says which notes of the octave have a black key to their right.  Black key
+// k starts BLACK_OFFSET into white key k and may overhang into white key k+1,
+// so a point can belong to the black key of its own white key or the one
+// before.  Keys are numbered by the white key they belong to.  The divide is
+// registered, then the key tests, so the result comes out two clocks after
+// the point goes in.
+module keyLookup #(parameter WHITE_KEYS   = 22,
+                             FIRST_NOTE   = 0,       // 0 for C, 1 for D, ... 6 for B
+                             LEFT         = 20,
+                             TOP          = 175,
+                             PITCH        = 27,
+                             WIDTH        = 25,
+                             HEIGHT       = 150,
+                             BLACK_OFFSET = 18,
+                             BLACK_WIDTH  = 16,
+                             BLACK_HEIGHT = 70)
+                  (input  logic        clk,
+                   input  logic [10:0] x, y,
+                   output logic        white, black,
+                   output logic [6:0]  whiteKey, blackKey);
+
+  localparam RECIPROCAL       = (2**16 + PITCH - 1) / PITCH; // exact for x offsets below 2048
+  localparam [6:0] BLACK_AFTER = 7'b0111011;                  // bit n set if note n has a black key after it (C = bit 0)
+
+  logic [10:0] dxIn, dx, offset;
+  logic [31:0] product;
+  logic [6:0]  index;
+  logic        inKeyboard, inWhite, inBlack, blackRight, blackLeft;
+
+  assign dxIn    = x - LEFT;
+  assign product = dxIn * RECIPROCAL;
+
+  // stage 1: key index and which rows the point is in
+  always_ff @(posedge clk) begin
+    dx         <= dxIn;
+    index      <= product[22:16];
+    inKeyboard <= (x >= LEFT) & (y >= TOP);
+    inWhite    <= (y < TOP + HEIGHT);
+    inBlack    <= (y < TOP + BLACK_HEIGHT);
+  end
+
+  // stage 2: position within the key and the key tests
+  assign offset     = dx - index * PITCH;
+  assign blackRight = BLACK_AFTER[(index + FIRST_NOTE) % 7] & (index < WHITE_KEYS) &
+                      (offset >= BLACK_OFFSET) & (offset < BLACK_OFFSET + BLACK_WIDTH);
+  assign blackLeft  = BLACK_AFTER[(index + FIRST_NOTE + 6) % 7] & (index >= 1) & (index <= WHITE_KEYS) &
+                      (offset + PITCH < BLACK_OFFSET + BLACK_WIDTH);
+
+  always_ff @(posedge clk) begin
+    white    <= inKeyboard & inWhite & (index < WHITE_KEYS) & (offset < WIDTH);
+    black    <= inKeyboard & inBlack & (blackRight | blackLeft);
+    whiteKey <= index;
+    blackKey <= blackRight ? index : index - 7'd1;
+  end
 endmodule
 
 module rectGen(input logic[9:0] x, y, left, top, right, bot,
@@ -223,30 +478,6 @@ module rectGen(input logic[9:0] x, y, left, top, right, bot,
 
 endmodule
 
-module chargenrom2(input  logic [9:0] xoff, yoff,
-						input logic validPoint,
-						output logic       pixel);
-						
-  logic [11:0] charrom2[7:0]; // character generator ROM
-  logic [11:0] line;            // a line read from the ROM
-  // initialize ROM with characters from text file 
-  initial 
-	 $readmemb("charrom2.txt", charrom2);
-  always_comb begin
-	  if (validPoint)
-	  begin
-		  // index into ROM to find line of character
-		  line = {charrom2[yoff]}; 
-		  // reverse order of bits
-		  pixel = line[10'd11-xoff];
-	  end else begin
-		line = 7'b0;
-		pixel = 1'b0;
-	  end
-  end
-endmodule
-
-
 module chargenrom(input  logic [7:0] ch,
                   input  logic [2:0] xoff, yoff,
 						output logic       pixel);
@@ -264,20 +495,105 @@ module chargenrom(input  logic [7:0] ch,
   assign pixel = line[3'd7-xoff];
 endmodule
 
-// If the slave only need to received data from the master
-// Slave reduces to a simple shift register given by following HDL: 
-module spi_slave_receive_only(input logic sck, //from master
-							input logic sdi, //from master 
-							output logic[31:0] q); // data received
-  logic [4:0] counter;
-  logic [31:0] shiftRegister;
-  
+// Receives the two word frames sent by spi_link.c on the PIC, most
+// significant bit first.  The start of frame marker gives the frame type:
+//   cursor      word 0: 8'hA5, seq[7:0], buttons[7:0], wheel[7:0]
+//               word 1: x[10:0], y[10:0], 2'b0, crc[7:0]
+//   tile write  word 0: 8'hA6, seq[7:0], 1'b0, address[14:0]
+//               word 1: 4'b0, data[11:0], 8'b0, crc[7:0]
+//   sprite      word 0: 8'hA7, seq[7:0], index[3:0], enable, pattern[2:0], color[3:0], 4'b0
+//               word 1: x[10:0], y[10:0], 2'b0, crc[7:0]
+// crc is CRC-8 (x^8 + x^2 + x + 1, starting from 0) of the 56 bits before it,
+// so running the whole frame through the CRC leaves 0.  The PIC drives cs_b
+// high between words, which resets the bit count, so a lost or extra SCK edge
+// only spoils the word it lands in.  A frame is taken only if it starts with
+// the marker and its CRC checks; a word that fails as word 1 is tried again as
+// word 0, so the receiver is back in step by the next frame.  tileWrite and
+// spriteWrite are only high for the sck edge that completes a good frame of
+// their type, which is the edge the RAM behind them has to be written on.
+module spi_frame_receive(input  logic        sck, sdi, cs_b,
+                         output logic [10:0] xPos, yPos,
+                         output logic [7:0]  buttons, wheel, seq,
+                         output logic        tileWrite,
+                         output logic [14:0] tileAddress,
+                         output logic [11:0] tileData,
+                         output logic        spriteWrite,
+                         output logic [3:0]  spriteIndex,
+                         output logic [29:0] spriteAttributes);
+  logic [4:0]  bitCount;
+  logic [31:0] shiftRegister, word, word0;
+  logic [7:0]  crcWord, crcFrame, crcWord0, nextCrcWord, nextCrcFrame;
+  logic        haveWord0, frameGood;
+
+  // one bit of CRC-8, most significant bit first
+  function automatic logic [7:0] crc8(input logic [7:0] crc, input logic d);
+    crc8 = {crc[6:0], 1'b0} ^ ((crc[7] ^ d) ? 8'h07 : 8'h00);
+  endfunction
+
+  // bit position in the current word, held at 0 while cs_b is high
+  always_ff @(posedge sck, posedge cs_b)
+    if (cs_b) bitCount <= 5'b0;
+    else      bitCount <= bitCount + 5'b1;
+
+  assign word = {shiftRegister[30:0], sdi}; // including the bit on this edge
+
+  // crcWord covers this word alone (in case it is a word 0); crcFrame
+  // carries on from the CRC of the word 0 being held
+  assign nextCrcWord  = crc8((bitCount == 5'b0) ? 8'h00 : crcWord, sdi);
+  assign nextCrcFrame = crc8((bitCount == 5'b0) ? crcWord0 : crcFrame, sdi);
+
+  assign frameGood   = (bitCount == 5'd31) & haveWord0 & (nextCrcFrame == 8'h00);
+  assign tileWrite   = frameGood & (word0[31:24] == 8'hA6);
+  assign tileAddress = word0[14:0];
+  assign tileData    = word[27:16];
+
+  assign spriteWrite      = frameGood & (word0[31:24] == 8'hA7);
+  assign spriteIndex      = word0[15:12];
+  assign spriteAttributes = {word0[11:4], word[31:10]};
+
   always_ff @(posedge sck) begin
-	 counter <= counter + 5'b1;
-    if (counter == 5'b0)
-		q <= shiftRegister;
-	 else begin
-      shiftRegister <={shiftRegister[30:0], sdi}; //shift register
-	 end
+    shiftRegister <= word;
+    crcWord       <= nextCrcWord;
+    crcFrame      <= nextCrcFrame;
+    if (bitCount == 5'd31) begin
+      if (frameGood) begin
+        if (word0[31:24] == 8'hA5) begin
+          {seq, buttons, wheel} <= word0[23:0];
+          {xPos, yPos}          <= word[31:10];
+        end
+        haveWord0 <= 1'b0;
+      end else begin
+        word0     <= word;
+        crcWord0  <= nextCrcWord;
+        haveWord0 <= (word[31:24] == 8'hA5) | (word[31:24] == 8'hA6) | (word[31:24] == 8'hA7);
+      end
+    end
   end
 endmodule
+
+// Tells the PIC which video mode this build runs.  SPI is full duplex, so
+// while the PIC shifts a word in on sdi the FPGA shifts this status word out
+// on sdo, most significant bit first:
+//   8'h5A, mode[1:0], width[10:0], height[10:0]
+// The PIC samples on the rising edge of sck, so each bit is put out on the
+// falling edge before it, and the first one as soon as cs_b goes low.  sdo
+// floats while cs_b is high.
+module spiStatusSend #(parameter MODE   = 0,
+                                 WIDTH  = 640,
+                                 HEIGHT = 480)
+                      (input  logic sck, cs_b,
+                       output tri   sdo);
+
+  localparam logic [1:0]  MODE_BITS   = MODE;
+  localparam logic [10:0] WIDTH_BITS  = WIDTH;
+  localparam logic [10:0] HEIGHT_BITS = HEIGHT;
+  localparam logic [31:0] STATUS      = {8'h5A, MODE_BITS, WIDTH_BITS, HEIGHT_BITS};
+
+  logic [31:0] shiftRegister;
+
+  always_ff @(negedge sck, posedge cs_b)
+    if (cs_b) shiftRegister <= STATUS;
+    else      shiftRegister <= {shiftRegister[30:0], 1'b0};
+
+  assign sdo = cs_b ? 1'bz : shiftRegister[31];
+endmodule